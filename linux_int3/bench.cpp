@@ -0,0 +1,209 @@
+#include "trap/LinuxAccessTracer.h"
+#include "trap/LinuxCodeArena.h"
+#include "trap/LinuxProbes.h"
+#include "trap/LinuxTracepoints.h"
+#include <atomic>
+#include <csignal>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Throughput of the trap mechanisms, as seen by the traced threads.
+
+static constexpr int kAccessesPerThread = 100000;
+
+static double Seconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Each thread increments a counter on its own page, or all of them on the first page with `shared`. Returns the
+// seconds it took.
+static double RunAccesses(char *pages, size_t page_size, int threads, bool shared) {
+  std::vector<std::thread> workers;
+  const auto start = std::chrono::steady_clock::now();
+  for (int t = 0; t < threads; t++) {
+    volatile uint64_t *counter =
+        reinterpret_cast<volatile uint64_t *>(pages + (shared ? 0 : t * page_size) + t * sizeof(uint64_t));
+    workers.emplace_back([counter] {
+      for (int i = 0; i < kAccessesPerThread; i++) *counter = *counter + 1;
+    });
+  }
+  for (std::thread &worker : workers) worker.join();
+  return Seconds(start);
+}
+
+struct AccessModeCase {
+  LinuxAccessTracer::AccessMode mode;
+  const char *name;
+};
+
+static void BenchAccessTracer() {
+  const size_t page_size = ::sysconf(_SC_PAGESIZE);
+  const int max_threads = 4;
+  char *pages = static_cast<char *>(
+      ::mmap(NULL, page_size * max_threads, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (pages == MAP_FAILED) ::abort();
+
+  std::printf("access tracer, %d increments per thread\n", kAccessesPerThread);
+  const double untraced = kAccessesPerThread / RunAccesses(pages, page_size, 1, false);
+  std::printf("  untraced, 1 thread: %.0f increments/sec\n", untraced);
+  // An increment is a read and a write, two traced accesses with eAccessAll.
+  LinuxAccessTracer tracer(1 << 18, 64, 64);
+  for (AccessModeCase mode : {AccessModeCase{LinuxAccessTracer::eAccessAll, "all"},
+                              AccessModeCase{LinuxAccessTracer::eAccessWrite, "writes"}}) {
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+      for (bool shared : {false, true}) {
+        if (shared && threads == 1) continue;
+        tracer.Track(pages, page_size * max_threads, mode.mode);
+        const LinuxAccessTracer::Statistics before = tracer.GetStatistics();
+        const double seconds = RunAccesses(pages, page_size, threads, shared);
+        tracer.Untrack(pages, page_size * max_threads);
+        const LinuxAccessTracer::Statistics after = tracer.GetStatistics();
+        const size_t drained = tracer.Drain([](const LinuxAccessTracer::Access &) {});
+        const uint64_t traced = after.accesses + after.dropped - before.accesses - before.dropped;
+        std::printf("  %s, %d thread%s%s: %.0f accesses/sec, %zu recorded, %llu dropped\n", mode.name, threads,
+                    threads > 1 ? "s" : "", shared ? " on one page" : "", traced / seconds, drained,
+                    static_cast<unsigned long long>(after.dropped - before.dropped));
+      }
+    }
+  }
+  ::munmap(pages, page_size * max_threads);
+}
+
+// Probe sites: the first instruction of each is 5 bytes long, the tracepoint's jmp replaces exactly it.
+extern "C" uint64_t BenchTracedFunction(uint64_t x);
+extern "C" uint64_t BenchTrappedFunction(uint64_t x);
+asm(".text\n"
+    ".globl BenchTracedFunction\n"
+    ".type BenchTracedFunction, @function\n"
+    "BenchTracedFunction:\n"
+    "  mov $1, %eax\n"
+    "  add %rdi, %rax\n"
+    "  ret\n"
+    ".globl BenchTrappedFunction\n"
+    ".type BenchTrappedFunction, @function\n"
+    "BenchTrappedFunction:\n"
+    "  int3\n"
+    "  mov $1, %eax\n"
+    "  add %rdi, %rax\n"
+    "  ret\n");
+
+static constexpr int kCallsPerThread = 1000000;
+
+static std::atomic<uint64_t> s_trap_hits{0};
+
+// Calls `function` on `threads` threads; returns the nanoseconds per call, as seen by one thread.
+static double RunCalls(uint64_t (*function)(uint64_t), int threads, int calls) {
+  std::vector<std::thread> workers;
+  const auto start = std::chrono::steady_clock::now();
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([function, calls] {
+      uint64_t sum = 0;
+      for (int i = 0; i < calls; i++) sum += function(i);
+      if (sum == 0) ::abort();
+    });
+  }
+  for (std::thread &worker : workers) worker.join();
+  return Seconds(start) * 1e9 / calls;
+}
+
+static void BenchTracepoints() {
+  std::printf("tracepoints, %d calls per thread\n", kCallsPerThread);
+  std::printf("  untraced: %.1f ns/call\n", RunCalls(BenchTracedFunction, 1, kCallsPerThread));
+
+  // What a hit costs when it is an INT3 and a signal handler, the debugger-less lower bound of a breakpoint.
+  struct sigaction action = {}, old_action;
+  action.sa_handler = [](int) { s_trap_hits.fetch_add(1, std::memory_order_relaxed); };
+  sigemptyset(&action.sa_mask);
+  ::sigaction(SIGTRAP, &action, &old_action);
+  std::printf("  int3 and SIGTRAP handler: %.1f ns/call\n",
+              RunCalls(BenchTrappedFunction, 1, kCallsPerThread / 10));
+  ::sigaction(SIGTRAP, &old_action, NULL);
+
+  LinuxTracepoints tracepoints(1 << 20);
+  tracepoints.Set(reinterpret_cast<const void *>(BenchTracedFunction));
+  for (int threads = 1; threads <= 4; threads *= 2) {
+    const double ns = RunCalls(BenchTracedFunction, threads, kCallsPerThread);
+    const size_t drained = tracepoints.Drain([](const LinuxTracepoints::Event &) {});
+    std::printf("  traced, %d thread%s: %.1f ns/call, %zu events, %llu lost\n", threads, threads > 1 ? "s" : "", ns,
+                drained, static_cast<unsigned long long>(tracepoints.GetStatistics().lost));
+  }
+}
+
+__attribute__((noinline)) static uint64_t BenchProbedFunction(uint64_t x) {
+  LINUX_PROBE("bench");
+  return x + 1;
+}
+
+static void BenchProbes() {
+  std::printf("probes, %d calls per thread\n", kCallsPerThread);
+  LinuxProbes probes(1 << 14);
+  std::printf("  disabled: %.1f ns/call\n", RunCalls(BenchProbedFunction, 1, kCallsPerThread));
+  probes.Enable("bench");
+  for (int threads = 1; threads <= 4; threads *= 2) {
+    const double ns = RunCalls(BenchProbedFunction, threads, kCallsPerThread / 10);
+    const size_t drained = probes.Drain([](const LinuxProbes::Hit &) {});
+    const LinuxProbes::Statistics stats = probes.GetStatistics();
+    std::printf("  enabled, %d thread%s: %.1f ns/hit, %llu hits, %zu recorded, %llu dropped\n", threads,
+                threads > 1 ? "s" : "", ns, static_cast<unsigned long long>(stats.hits), drained,
+                static_cast<unsigned long long>(stats.dropped));
+  }
+}
+
+static constexpr int kStubs = 4096;
+
+static void BenchCodeArena() {
+  std::printf("code arena, %d stubs\n", kStubs);
+  LinuxCodeArena arena;
+  std::vector<LinuxCodeArena::Stub> stubs(kStubs);
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kStubs; i++) {
+    stubs[i] = arena.Allocate(6, 0, i);
+    // mov $i, %eax; ret
+    const uint8_t code[6] = {0xb8, static_cast<uint8_t>(i), static_cast<uint8_t>(i >> 8), 0, 0, 0xc3};
+    std::memcpy(stubs[i].writable, code, sizeof(code));
+  }
+  const double allocate = Seconds(start);
+  start = std::chrono::steady_clock::now();
+  arena.Publish();
+  const double publish = Seconds(start);
+
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kStubs; i++) {
+    if (reinterpret_cast<int (*)()>(stubs[i].code)() != i) ::abort();
+  }
+  const double call = Seconds(start);
+  start = std::chrono::steady_clock::now();
+  for (int round = 0; round < 100; round++) {
+    for (int i = 0; i < kStubs; i++) {
+      if (arena.Find(stubs[i].code + 5).tag != static_cast<uint32_t>(i)) ::abort();
+    }
+  }
+  const double find = Seconds(start) / 100;
+
+  start = std::chrono::steady_clock::now();
+  for (const LinuxCodeArena::Stub &stub : stubs) arena.Free(stub.code);
+  for (int i = 0; i < kStubs; i++) stubs[i] = arena.Allocate(6, 0, i);
+  arena.Publish();
+  const double recycle = Seconds(start);
+
+  const LinuxCodeArena::Statistics &stats = arena.GetStatistics();
+  std::printf("  allocate and write: %.1f ns/stub, publish: %.1f us/batch, first call: %.1f ns/stub\n",
+              allocate * 1e9 / kStubs, publish * 1e6, call * 1e9 / kStubs);
+  std::printf("  find: %.1f ns, free and reallocate: %.1f ns/stub, %llu chunks, %llu reused\n", find * 1e9 / kStubs,
+              recycle * 1e9 / kStubs, static_cast<unsigned long long>(stats.chunks),
+              static_cast<unsigned long long>(stats.reused));
+}
+
+int main() {
+  BenchAccessTracer();
+  BenchTracepoints();
+  BenchProbes();
+  BenchCodeArena();
+  return 0;
+}
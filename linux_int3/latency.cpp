@@ -0,0 +1,312 @@
+#include "trap/LinuxProbes.h"
+#include "trap/LinuxTracepoints.h"
+#include "trap/LinuxTrapSupport.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <functional>
+#include <linux/userfaultfd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/ucontext.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Round-trip latency of the trap mechanisms a probe can be built on, from the trapping instruction back to the code
+// behind it, as seen by the trapping thread: every trap is timed on its own and the percentiles are over all threads.
+// Traps/s is the throughput of all threads together. With more threads than CPUs the latency includes waiting for
+// one.
+
+static constexpr int kSignalTraps = 20000; // Per thread, for the in-process mechanisms
+static constexpr int kSlowTraps = 5000;    // Per thread, for ptrace and userfaultfd
+static constexpr int kFaultPages = 256;    // Pages a thread faults in before they are dropped again
+static constexpr greg_t kTrapFlag = 0x100; // EFLAGS.TF
+
+// Trap sites. Each takes the address to load in rdi; the ud2 and the load are 2 bytes, the handler skips them.
+extern "C" void LatencyReturn(const void *addr);
+extern "C" void LatencyInt3(const void *addr);
+extern "C" void LatencyUd2(const void *addr);
+extern "C" void LatencyLoad(const void *addr);
+extern "C" void LatencyStep(const void *addr);
+extern "C" void LatencyTraced(const void *addr);
+asm(".text\n"
+    ".globl LatencyReturn\n"
+    ".type LatencyReturn, @function\n"
+    "LatencyReturn:\n"
+    "  ret\n"
+    ".globl LatencyInt3\n"
+    ".type LatencyInt3, @function\n"
+    "LatencyInt3:\n"
+    "  int3\n"
+    "  ret\n"
+    ".globl LatencyUd2\n"
+    ".type LatencyUd2, @function\n"
+    "LatencyUd2:\n"
+    "  ud2\n"
+    "  ret\n"
+    ".globl LatencyLoad\n"
+    ".type LatencyLoad, @function\n"
+    "LatencyLoad:\n"
+    "  movl (%rdi), %eax\n"
+    "  ret\n"
+    ".globl LatencyStep\n"
+    ".type LatencyStep, @function\n"
+    "LatencyStep:\n"
+    "  pushfq\n"
+    "  orq $0x100, (%rsp)\n"
+    "  popfq\n"
+    "  nop\n" // Traps after it
+    "  ret\n"
+    ".globl LatencyTraced\n"
+    ".type LatencyTraced, @function\n"
+    "LatencyTraced:\n"
+    "  mov $1, %eax\n" // 5 bytes, the tracepoint's jmp replaces exactly it
+    "  ret\n");
+
+__attribute__((noinline)) static void LatencyProbed(const void *) { LINUX_PROBE("latency"); }
+
+static uint64_t NowNs() {
+  struct timespec now;
+  ::clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// Times `count` calls of `function`.
+static void TimeCalls(void (*function)(const void *), const void *addr, uint64_t *samples, int count) {
+  for (int i = 0; i < count; i++) {
+    const uint64_t start = NowNs();
+    function(addr);
+    samples[i] = NowNs() - start;
+  }
+}
+
+typedef std::function<void(int thread, uint64_t *samples, int count)> Body;
+
+// Runs `body` on `threads` threads, each filling its `count` samples; returns the wall time in seconds.
+static double RunThreads(int threads, int count, const Body &body, uint64_t *samples) {
+  std::vector<std::thread> workers;
+  const uint64_t start = NowNs();
+  for (int t = 0; t < threads; t++) workers.emplace_back(body, t, samples + size_t(t) * count, count);
+  for (std::thread &worker : workers) worker.join();
+  return (NowNs() - start) / 1e9;
+}
+
+static void Report(const char *mechanism, int threads, uint64_t *samples, size_t count, double seconds) {
+  std::sort(samples, samples + count);
+  auto percentile = [samples, count](double q) {
+    return static_cast<unsigned long long>(samples[std::min(count - 1, static_cast<size_t>(q * count))]);
+  };
+  std::printf("%-12s %7d %10.0f %9llu %9llu %9llu %9llu\n", mechanism, threads, count / seconds, percentile(0.5),
+              percentile(0.99), percentile(0.999), static_cast<unsigned long long>(samples[count - 1]));
+}
+
+static void Measure(const char *mechanism, int count, const Body &body) {
+  for (int threads = 1; threads <= 4; threads *= 2) {
+    std::vector<uint64_t> samples(size_t(threads) * count);
+    const double seconds = RunThreads(threads, count, body, samples.data());
+    Report(mechanism, threads, samples.data(), samples.size(), seconds);
+  }
+}
+
+// Returns from the traps of the in-process mechanisms: behind the INT3 already, over the ud2 or the load, or with the
+// trap flag cleared after the single step.
+static void SkipHandler(int signal, siginfo_t *, void *context) {
+  greg_t *gregs = static_cast<ucontext_t *>(context)->uc_mcontext.gregs;
+  const uintptr_t rip = gregs[REG_RIP];
+  if (signal == SIGTRAP) {
+    gregs[REG_EFL] &= ~kTrapFlag;
+  } else if (rip == reinterpret_cast<uintptr_t>(LatencyUd2) || rip == reinterpret_cast<uintptr_t>(LatencyLoad)) {
+    gregs[REG_RIP] += 2;
+  } else {
+    // Not ours: fault again with the default action.
+    ::signal(signal, SIG_DFL);
+  }
+}
+
+static void MeasureSignals() {
+  struct sigaction action = {}, old_trap, old_ill, old_segv;
+  action.sa_flags = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  action.sa_sigaction = SkipHandler;
+  ::sigaction(SIGTRAP, &action, &old_trap);
+  ::sigaction(SIGILL, &action, &old_ill);
+  ::sigaction(SIGSEGV, &action, &old_segv);
+  void *guard = ::mmap(NULL, ::sysconf(_SC_PAGESIZE), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  Measure("none", kSignalTraps, [](int, uint64_t *samples, int count) {
+    TimeCalls(LatencyReturn, nullptr, samples, count);
+  });
+  Measure("int3", kSignalTraps, [](int, uint64_t *samples, int count) {
+    TimeCalls(LatencyInt3, nullptr, samples, count);
+  });
+  Measure("ud2", kSignalTraps, [](int, uint64_t *samples, int count) {
+    TimeCalls(LatencyUd2, nullptr, samples, count);
+  });
+  if (guard != MAP_FAILED) {
+    Measure("guard page", kSignalTraps, [guard](int, uint64_t *samples, int count) {
+      TimeCalls(LatencyLoad, guard, samples, count);
+    });
+    ::munmap(guard, ::sysconf(_SC_PAGESIZE));
+  }
+  Measure("trap flag", kSignalTraps, [](int, uint64_t *samples, int count) {
+    TimeCalls(LatencyStep, nullptr, samples, count);
+  });
+
+  ::sigaction(SIGTRAP, &old_trap, NULL);
+  ::sigaction(SIGILL, &old_ill, NULL);
+  ::sigaction(SIGSEGV, &old_segv, NULL);
+}
+
+// What the probe libraries add on top of the raw mechanisms.
+static void MeasureProbes() {
+  try {
+    LinuxProbes probes;
+    probes.Enable("latency");
+    Measure("probe", kSignalTraps, [](int, uint64_t *samples, int count) {
+      TimeCalls(LatencyProbed, nullptr, samples, count);
+    });
+  } catch (const std::runtime_error &error) {
+    std::printf("%-12s unavailable: %s\n", "probe", error.what());
+  }
+  try {
+    LinuxTracepoints tracepoints(1 << 16);
+    tracepoints.Set(reinterpret_cast<const void *>(LatencyTraced));
+    Measure("tracepoint", kSignalTraps, [](int, uint64_t *samples, int count) {
+      TimeCalls(LatencyTraced, nullptr, samples, count);
+    });
+  } catch (const std::runtime_error &error) {
+    std::printf("%-12s unavailable: %s\n", "tracepoint", error.what());
+  }
+}
+
+// Each thread writes to the pages of its own region, which are dropped again every kFaultPages writes, outside of
+// the timing. Without a userfaultfd the kernel fills them with zeroes itself.
+static void TimePageFaults(char *regions, size_t page_size, int thread, uint64_t *samples, int count) {
+  char *region = regions + size_t(thread) * kFaultPages * page_size;
+  for (int i = 0; i < count; i++) {
+    const int page = i % kFaultPages;
+    if (page == 0) ::madvise(region, kFaultPages * page_size, MADV_DONTNEED);
+    const uint64_t start = NowNs();
+    *reinterpret_cast<volatile char *>(region + page * page_size) = 1;
+    samples[i] = NowNs() - start;
+  }
+}
+
+static void MeasureUserfaultfd() {
+  const size_t page_size = ::sysconf(_SC_PAGESIZE);
+  const size_t size = 4 * kFaultPages * page_size;
+  char *regions =
+      static_cast<char *>(::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (regions == MAP_FAILED) return;
+  Measure("page fault", kSlowTraps, [regions, page_size](int thread, uint64_t *samples, int count) {
+    TimePageFaults(regions, page_size, thread, samples, count);
+  });
+
+  // Missing-page faults resolved with a zero page by one handler thread, the minimal userfaultfd round trip.
+  int uffd = ::syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+  if (uffd < 0 && errno == EINVAL) uffd = ::syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+  struct uffdio_api api = {};
+  api.api = UFFD_API;
+  struct uffdio_register region = {};
+  region.range.start = reinterpret_cast<uintptr_t>(regions);
+  region.range.len = size;
+  region.mode = UFFDIO_REGISTER_MODE_MISSING;
+  if (uffd < 0 || ::ioctl(uffd, UFFDIO_API, &api) != 0 || ::ioctl(uffd, UFFDIO_REGISTER, &region) != 0) {
+    std::printf("%-12s unavailable: %s\n", "userfaultfd", ::strerror(errno));
+    if (uffd >= 0) ::close(uffd);
+    ::munmap(regions, size);
+    return;
+  }
+  const int stop_fd = ::eventfd(0, EFD_CLOEXEC);
+  std::thread handler([uffd, stop_fd, page_size] {
+    struct pollfd fds[2] = {{uffd, POLLIN, 0}, {stop_fd, POLLIN, 0}};
+    for (;;) {
+      if (::poll(fds, 2, -1) < 0 && errno != EINTR) return;
+      if (fds[1].revents != 0) return;
+      struct uffd_msg message;
+      while (::read(uffd, &message, sizeof(message)) == sizeof(message)) {
+        if (message.event != UFFD_EVENT_PAGEFAULT) continue;
+        struct uffdio_zeropage zero = {};
+        zero.range.start = message.arg.pagefault.address & ~static_cast<uint64_t>(page_size - 1);
+        zero.range.len = page_size;
+        // EEXIST: another thread's fault on the page was resolved already.
+        ::ioctl(uffd, UFFDIO_ZEROPAGE, &zero);
+      }
+    }
+  });
+  Measure("userfaultfd", kSlowTraps, [regions, page_size](int thread, uint64_t *samples, int count) {
+    TimePageFaults(regions, page_size, thread, samples, count);
+  });
+  const uint64_t one = 1;
+  if (::write(stop_fd, &one, sizeof(one)) != sizeof(one)) std::printf("userfaultfd handler does not stop\n");
+  handler.join();
+  ::close(stop_fd);
+  ::close(uffd);
+  ::munmap(regions, size);
+}
+
+// A forked child traps on INT3 and the parent, its tracer, resumes every thread from its SIGTRAP stop with
+// PTRACE_CONT: the round trip of a breakpoint that a debugger only counts.
+static void MeasurePtrace() {
+  for (int threads = 1; threads <= 4; threads *= 2) {
+    const size_t count = size_t(threads) * kSlowTraps;
+    const size_t size = sizeof(double) + count * sizeof(uint64_t);
+    void *shared = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) return;
+    double *seconds = static_cast<double *>(shared);
+    uint64_t *samples = reinterpret_cast<uint64_t *>(seconds + 1);
+    const pid_t pid = ::fork();
+    if (pid == 0) {
+      ::ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+      ::raise(SIGSTOP);
+      *seconds = RunThreads(threads, kSlowTraps, [](int, uint64_t *thread_samples, int thread_count) {
+        TimeCalls(LatencyInt3, nullptr, thread_samples, thread_count);
+      }, samples);
+      ::_exit(0);
+    }
+    int status = 0;
+    bool exited = pid < 0 || ::waitpid(pid, &status, 0) != pid || !WIFSTOPPED(status);
+    if (!exited) {
+      ::ptrace(PTRACE_SETOPTIONS, pid, NULL, PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+      ::ptrace(PTRACE_CONT, pid, NULL, NULL);
+    }
+    while (!exited) {
+      const pid_t tid = ::waitpid(-1, &status, __WALL);
+      if (tid < 0) break;
+      if (WIFEXITED(status) || WIFSIGNALED(status)) {
+        exited = tid == pid;
+        continue;
+      }
+      // Breakpoints, clone events and the SIGSTOP new threads start with are swallowed, anything else delivered.
+      const int signal = WSTOPSIG(status);
+      const bool swallow = signal == SIGTRAP || signal == SIGSTOP;
+      ::ptrace(PTRACE_CONT, tid, NULL, swallow ? 0 : signal);
+    }
+    if (pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+      Report("ptrace", threads, samples, count, *seconds);
+    } else {
+      std::printf("%-12s %7d unavailable\n", "ptrace", threads);
+    }
+    ::munmap(shared, size);
+  }
+}
+
+int main() {
+  std::printf("%-12s %7s %10s %9s %9s %9s %9s\n", "mechanism", "threads", "traps/s", "p50 ns", "p99 ns", "p999 ns",
+              "max ns");
+  MeasureSignals();
+  MeasureProbes();
+  MeasureUserfaultfd();
+  MeasurePtrace();
+  return 0;
+}
@@ -1,9 +1,13 @@
+#include "trap/LinuxCodeArena.h"
+#include "trap/LinuxProbes.h"
+#include "trap/LinuxWriteWatch.h"
 #include <array>
 #include <atomic>
 #include <csignal>
 #include <cstring>
-#include <fcntl.h>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -13,7 +17,7 @@
 
 using Int3Func = void (*)();
 
-constexpr std::array<uint8_t, 1> INT3{0xCC};
+constexpr std::array<uint8_t, 2> INT3{0xCC, 0xC3}; // int3; ret
 Int3Func int3 = [] {
   asm("INT3");
   std::cout << "hhhh\n";
@@ -32,11 +36,20 @@ void initSingalHandler() {
   if (ret == -1) { throw std::runtime_error(strerror(errno)); }
 }
 
+// Written through the arena's writable view, run from its executable one; no page is both.
 void initIn3() {
-  int fd = open("/dev/zero", O_RDWR);
-  int3 = reinterpret_cast<Int3Func>(mmap(NULL, INT3.size(), PROT_READ | PROT_WRITE | PROT_EXEC, MAP_SHARED, fd, 0));
-  if (int3 == MAP_FAILED) { throw std::runtime_error(strerror(errno)); }
-  std::memcpy(reinterpret_cast<void *>(int3), INT3.data(), INT3.size());
+  static LinuxCodeArena codeArena;
+  LinuxCodeArena::Stub stub = codeArena.Allocate(INT3.size());
+  std::memcpy(stub.writable, INT3.data(), INT3.size());
+  codeArena.Publish();
+  int3 = reinterpret_cast<Int3Func>(stub.code);
+}
+
+// Work counters on a page of their own, so only writes to them fault.
+std::array<int, 4> *initProgress() {
+  void *page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (page == MAP_FAILED) { throw std::runtime_error(strerror(errno)); }
+  return new (page) std::array<int, 4>{};
 }
 
 int main() {
@@ -44,15 +57,33 @@ int main() {
   std::cout << "INT3 addr " << reinterpret_cast<uint64_t>(int3) << "\n";
 
   initSingalHandler();
+  // The data equivalent of the INT3 trap: writes to `progress` are reported on the watch's handler thread.
+  std::array<int, 4> *progress = initProgress();
+  // Optional: without userfaultfd write protection the demo runs on without it.
+  std::unique_ptr<LinuxWriteWatch> writeWatch;
+  try {
+    writeWatch = std::make_unique<LinuxWriteWatch>([](const LinuxWriteWatch::Event &event) {
+      std::cout << "Thread " << event.tid << " wrote " << event.addr << " (watch " << event.watch_id << ")\n";
+    });
+    writeWatch->Watch(progress, sizeof(*progress));
+  } catch (const std::runtime_error &error) {
+    std::cout << "write watch unavailable: " << error.what() << "\n";
+    writeWatch.reset();
+  }
+  // Counted in the probes' SIGTRAP handler, the int3() traps above go on to ours.
+  LinuxProbes probes;
+  probes.Enable("work");
   std::thread int3Thread([] {
     std::this_thread::sleep_for(std::chrono::milliseconds(1000));
     std::cout << "Thread " << std::this_thread::get_id() << " throw int3\n";
     int3();
   });
 
-  std::thread workThread([] {
+  std::thread workThread([progress] {
     for (int i = 0; i < 20; i++) {
+      LINUX_PROBE("work");
       std::cout << "Thread " << std::this_thread::get_id() << " is working\n";
+      (*progress)[i % progress->size()]++;
       std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
   });
@@ -63,4 +94,6 @@ int main() {
 
   if (int3Thread.joinable()) { int3Thread.join(); }
   if (workThread.joinable()) { workThread.join(); }
+  if (writeWatch) { std::cout << "write faults " << writeWatch->GetStatistics().faults << "\n"; }
+  std::cout << "work probe hits " << probes.GetStatistics().hits << "\n";
 }
\ No newline at end of file
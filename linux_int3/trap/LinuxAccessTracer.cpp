@@ -0,0 +1,247 @@
+#include "LinuxAccessTracer.h"
+#include "LinuxTrapSupport.h"
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+#include <sys/syscall.h>
+#include <sys/ucontext.h>
+#include <unistd.h>
+
+static constexpr greg_t kTrapFlag = 0x100;      // EFLAGS.TF
+static constexpr greg_t kPageFaultWrite = 0x2; // Page fault error code: the access was a write
+// Pages a thread can have open at once: an instruction may touch two pages, or four for a string move.
+static constexpr size_t kMaxOpenPages = 4;
+
+std::atomic<LinuxAccessTracer *> LinuxAccessTracer::s_tracer{nullptr};
+std::atomic<uint64_t> LinuxAccessTracer::s_generation{0};
+
+// What a thread has going on with the tracer, read and written by its own signal handlers only. Initial-exec TLS
+// needs no allocation on first use, unlike the general dynamic model.
+struct TracerThreadState {
+  uint64_t generation;
+  size_t buffer;     // Index of the thread's buffer
+  bool has_buffer;
+  bool no_buffer;    // Every buffer was taken
+  size_t open_count; // Pages opened for the instruction being stepped
+  size_t open_pages[kMaxOpenPages];
+};
+static thread_local TracerThreadState t_state __attribute__((tls_model("initial-exec")));
+
+static TracerThreadState &ThreadState(uint64_t generation) {
+  if (t_state.generation != generation) t_state = TracerThreadState{generation, 0, false, false, 0, {}};
+  return t_state;
+}
+
+LinuxAccessTracer::LinuxAccessTracer(size_t records_per_thread, size_t max_threads, size_t max_pages)
+    : m_page_size(::sysconf(_SC_PAGESIZE)), m_records_per_thread(records_per_thread), m_max_threads(max_threads),
+      m_max_pages(max_pages), m_generation(++s_generation) {
+  m_table_size = 1;
+  while (m_table_size < 2 * max_pages) m_table_size *= 2;
+  m_pages.reset(new Page[m_table_size]);
+  m_buffers.reset(new ThreadBuffer[max_threads]);
+  m_records.reset(new Access[max_threads * records_per_thread]);
+  for (size_t i = 0; i < max_threads; i++) m_buffers[i].records = m_records.get() + i * records_per_thread;
+
+  LinuxAccessTracer *expected = nullptr;
+  if (!s_tracer.compare_exchange_strong(expected, this)) throw std::runtime_error("an access tracer exists already");
+  struct sigaction action = {};
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  action.sa_sigaction = SegvHandler;
+  bool ok = ::sigaction(SIGSEGV, &action, &m_old_segv) == 0;
+  action.sa_sigaction = TrapHandler;
+  ok = ok && ::sigaction(SIGTRAP, &action, &m_old_trap) == 0;
+  if (!ok) {
+    std::runtime_error error = ErrnoError("sigaction");
+    ::sigaction(SIGSEGV, &m_old_segv, NULL);
+    s_tracer = nullptr;
+    throw error;
+  }
+}
+
+LinuxAccessTracer::~LinuxAccessTracer() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < m_table_size; i++) {
+      Page &entry = m_pages[i];
+      if (entry.addr == 0 || !entry.traced) continue;
+      entry.traced = false;
+      ::mprotect(reinterpret_cast<void *>(entry.addr.load()), m_page_size, entry.prot);
+    }
+  }
+  ::sigaction(SIGSEGV, &m_old_segv, NULL);
+  ::sigaction(SIGTRAP, &m_old_trap, NULL);
+  s_tracer = nullptr;
+}
+
+LinuxAccessTracer::Page *LinuxAccessTracer::FindPage(uintptr_t page) const {
+  const size_t mask = m_table_size - 1;
+  for (size_t i = ((page / m_page_size) * 0x9E3779B97F4A7C15ull) >> 20 & mask, probes = 0; probes < m_table_size;
+       i = (i + 1) & mask, probes++) {
+    const uintptr_t addr = m_pages[i].addr.load(std::memory_order_acquire);
+    if (addr == page) return &m_pages[i];
+    if (addr == 0) return nullptr;
+  }
+  return nullptr;
+}
+
+LinuxAccessTracer::Page *LinuxAccessTracer::InsertPage(uintptr_t page) {
+  Page *entry = FindPage(page);
+  if (entry != nullptr) return entry;
+  if (m_page_count == m_max_pages) return nullptr;
+  const size_t mask = m_table_size - 1;
+  size_t i = ((page / m_page_size) * 0x9E3779B97F4A7C15ull) >> 20 & mask;
+  while (m_pages[i].addr.load(std::memory_order_relaxed) != 0) i = (i + 1) & mask;
+  m_page_count++;
+  m_pages[i].addr.store(page, std::memory_order_release);
+  return &m_pages[i];
+}
+
+void LinuxAccessTracer::Track(const void *addr, size_t size, AccessMode mode, int prot) {
+  const uintptr_t page_mask = ~static_cast<uintptr_t>(m_page_size - 1);
+  const uintptr_t start = reinterpret_cast<uintptr_t>(addr) & page_mask;
+  const uintptr_t end = (reinterpret_cast<uintptr_t>(addr) + size + m_page_size - 1) & page_mask;
+  const int traced_prot = mode == eAccessAll ? PROT_NONE : prot & ~PROT_WRITE;
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (uintptr_t page = start; page < end; page += m_page_size) {
+    Page *entry = InsertPage(page);
+    if (entry == nullptr) {
+      errno = ENOSPC;
+      throw ErrnoError("track");
+    }
+    entry->prot = prot;
+    entry->traced_prot = traced_prot;
+    entry->traced.store(true, std::memory_order_release);
+  }
+  if (::mprotect(reinterpret_cast<void *>(start), end - start, traced_prot) != 0) throw ErrnoError("mprotect");
+}
+
+void LinuxAccessTracer::Untrack(const void *addr, size_t size) {
+  const uintptr_t page_mask = ~static_cast<uintptr_t>(m_page_size - 1);
+  const uintptr_t start = reinterpret_cast<uintptr_t>(addr) & page_mask;
+  const uintptr_t end = (reinterpret_cast<uintptr_t>(addr) + size + m_page_size - 1) & page_mask;
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (uintptr_t page = start; page < end; page += m_page_size) {
+    Page *entry = FindPage(page);
+    if (entry == nullptr || !entry->traced) continue;
+    // A thread stepping through the page sees this at its trap and leaves the page alone.
+    entry->traced.store(false, std::memory_order_release);
+    ::mprotect(reinterpret_cast<void *>(page), m_page_size, entry->prot);
+  }
+}
+
+LinuxAccessTracer::ThreadBuffer *LinuxAccessTracer::CurrentBuffer() {
+  TracerThreadState &state = ThreadState(m_generation);
+  if (state.has_buffer) return &m_buffers[state.buffer];
+  if (state.no_buffer) return nullptr;
+  size_t index = m_buffer_count.load(std::memory_order_relaxed);
+  do {
+    if (index == m_max_threads) {
+      state.no_buffer = true;
+      return nullptr;
+    }
+  } while (!m_buffer_count.compare_exchange_weak(index, index + 1));
+  m_buffers[index].tid = static_cast<pid_t>(::syscall(SYS_gettid));
+  state.buffer = index;
+  state.has_buffer = true;
+  return &m_buffers[index];
+}
+
+bool LinuxAccessTracer::HandleFault(siginfo_t *info, ucontext_t *context) {
+  if (info->si_code != SEGV_ACCERR) return false;
+  const uintptr_t addr = reinterpret_cast<uintptr_t>(info->si_addr);
+  const uintptr_t page = addr & ~static_cast<uintptr_t>(m_page_size - 1);
+  Page *entry = FindPage(page);
+  if (entry == nullptr || !entry->traced.load(std::memory_order_acquire)) return false;
+  TracerThreadState &state = ThreadState(m_generation);
+  const size_t page_index = entry - m_pages.get();
+  for (size_t i = 0; i < state.open_count; i++) {
+    if (state.open_pages[i] != page_index) continue;
+    // Closed by another thread before our instruction got through: open it again, the access is recorded.
+    ::mprotect(reinterpret_cast<void *>(page), m_page_size, entry->prot);
+    return true;
+  }
+  if (state.open_count == kMaxOpenPages) return false;
+
+  ThreadBuffer *buffer = CurrentBuffer();
+  if (buffer == nullptr) {
+    m_dropped.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    const uint64_t head = buffer->head.load(std::memory_order_relaxed);
+    if (head - buffer->tail.load(std::memory_order_acquire) == m_records_per_thread) {
+      buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      struct timespec now;
+      ::clock_gettime(CLOCK_MONOTONIC, &now);
+      Access &access = buffer->records[head % m_records_per_thread];
+      access.addr = addr;
+      access.rip = context->uc_mcontext.gregs[REG_RIP];
+      access.time_ns = static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+      access.tid = buffer->tid;
+      access.write = (context->uc_mcontext.gregs[REG_ERR] & kPageFaultWrite) != 0;
+      buffer->head.store(head + 1, std::memory_order_release);
+    }
+  }
+
+  entry->open_count.fetch_add(1, std::memory_order_acq_rel);
+  ::mprotect(reinterpret_cast<void *>(page), m_page_size, entry->prot);
+  state.open_pages[state.open_count++] = page_index;
+  context->uc_mcontext.gregs[REG_EFL] |= kTrapFlag;
+  return true;
+}
+
+bool LinuxAccessTracer::HandleTrap(ucontext_t *context) {
+  TracerThreadState &state = ThreadState(m_generation);
+  if (state.open_count == 0) return false;
+  for (size_t i = 0; i < state.open_count; i++) {
+    Page &entry = m_pages[state.open_pages[i]];
+    // The last thread out closes the page, unless it was untracked meanwhile.
+    if (entry.open_count.fetch_sub(1, std::memory_order_acq_rel) == 1 &&
+        entry.traced.load(std::memory_order_acquire)) {
+      ::mprotect(reinterpret_cast<void *>(entry.addr.load(std::memory_order_relaxed)), m_page_size,
+                 entry.traced_prot);
+    }
+  }
+  state.open_count = 0;
+  context->uc_mcontext.gregs[REG_EFL] &= ~kTrapFlag;
+  return true;
+}
+
+void LinuxAccessTracer::SegvHandler(int signal, siginfo_t *info, void *context) {
+  LinuxAccessTracer *tracer = s_tracer.load(std::memory_order_acquire);
+  if (tracer == nullptr || tracer->HandleFault(info, static_cast<ucontext_t *>(context))) return;
+  ForwardSignal(signal, tracer->m_old_segv, info, context);
+}
+
+void LinuxAccessTracer::TrapHandler(int signal, siginfo_t *info, void *context) {
+  LinuxAccessTracer *tracer = s_tracer.load(std::memory_order_acquire);
+  if (tracer == nullptr || tracer->HandleTrap(static_cast<ucontext_t *>(context))) return;
+  ForwardSignal(signal, tracer->m_old_trap, info, context);
+}
+
+size_t LinuxAccessTracer::Drain(const std::function<void(const Access &access)> &consumer) {
+  size_t count = 0;
+  const size_t buffer_count = m_buffer_count.load(std::memory_order_acquire);
+  for (size_t i = 0; i < buffer_count; i++) {
+    ThreadBuffer &buffer = m_buffers[i];
+    const uint64_t tail = buffer.tail.load(std::memory_order_relaxed);
+    const uint64_t head = buffer.head.load(std::memory_order_acquire);
+    for (uint64_t k = tail; k < head; k++) consumer(buffer.records[k % m_records_per_thread]);
+    buffer.tail.store(head, std::memory_order_release);
+    count += head - tail;
+  }
+  return count;
+}
+
+LinuxAccessTracer::Statistics LinuxAccessTracer::GetStatistics() const {
+  Statistics stats;
+  stats.dropped = m_dropped.load(std::memory_order_relaxed);
+  stats.threads = static_cast<uint32_t>(m_buffer_count.load(std::memory_order_acquire));
+  for (size_t i = 0; i < stats.threads; i++) {
+    stats.accesses += m_buffers[i].head.load(std::memory_order_acquire);
+    stats.dropped += m_buffers[i].dropped.load(std::memory_order_relaxed);
+  }
+  return stats;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+// In-process data access tracer on guard pages, no debugger process and no kernel module: the traced pages are
+// mprotect()ed, an access raises SIGSEGV, the handler records it (address, RIP, thread, read or write), opens the
+// page and sets the trap flag in the interrupted context. The faulting instruction then runs once and the SIGTRAP
+// that follows closes the page again. Each traced access costs two signals, so this is for finding hot objects and
+// access patterns, not for tracing everything.
+//
+// Records go to per-thread ring buffers allocated up front, written lock-free from the signal handler and read by
+// Drain(). While one thread has a page open for its single instruction, accesses of other threads to that page go
+// unseen; accesses made by the kernel (a read() into a traced buffer) fail with EFAULT instead of being traced.
+//
+// The tracer owns SIGSEGV and SIGTRAP while it exists and hands faults and traps that are not its own to the
+// handlers installed before it, so only one tracer may exist at a time.
+class LinuxAccessTracer {
+public:
+  enum AccessMode {
+    eAccessAll,   // Reads and writes, the pages are made PROT_NONE
+    eAccessWrite, // Writes only, the pages are made read-only
+  };
+
+  struct Access {
+    uintptr_t addr;   // Address of the fault
+    uintptr_t rip;    // Instruction that accessed it
+    uint64_t time_ns; // CLOCK_MONOTONIC
+    pid_t tid;
+    bool write;
+  };
+
+  struct Statistics {
+    uint64_t accesses = 0; // Recorded
+    uint64_t dropped = 0;  // Lost to full buffers, or to threads beyond `max_threads`
+    uint32_t threads = 0;  // Threads that have a buffer
+  };
+
+  // Installs the signal handlers; throws std::runtime_error when another tracer exists or sigaction fails.
+  // `max_pages` bounds the pages traced at once, `max_threads` the threads ever recorded.
+  explicit LinuxAccessTracer(size_t records_per_thread = 1 << 16, size_t max_threads = 64, size_t max_pages = 4096);
+  ~LinuxAccessTracer();
+  LinuxAccessTracer(const LinuxAccessTracer &) = delete;
+  LinuxAccessTracer &operator=(const LinuxAccessTracer &) = delete;
+
+  // Traces the pages holding [addr, addr + size), whose protection outside of tracing is `prot`. Throws
+  // std::runtime_error when mprotect fails or too many pages are traced.
+  void Track(const void *addr, size_t size, AccessMode mode, int prot = PROT_READ | PROT_WRITE);
+  // Gives the pages back their `prot` of Track().
+  void Untrack(const void *addr, size_t size);
+
+  // Consumes the accesses recorded so far, thread by thread in recording order. One consumer at a time.
+  size_t Drain(const std::function<void(const Access &access)> &consumer);
+  Statistics GetStatistics() const;
+
+private:
+  struct Page {
+    std::atomic<uintptr_t> addr{0}; // 0 while the slot is free
+    std::atomic<bool> traced{false};
+    std::atomic<int> open_count{0}; // Threads between their fault and their trap
+    int traced_prot = PROT_NONE;
+    int prot = PROT_NONE;
+  };
+
+  struct ThreadBuffer {
+    std::atomic<uint64_t> head{0}; // Written by the owning thread
+    std::atomic<uint64_t> tail{0}; // Written by Drain()
+    std::atomic<uint64_t> dropped{0};
+    pid_t tid = 0;
+    Access *records = nullptr;
+  };
+
+  Page *FindPage(uintptr_t page) const;
+  Page *InsertPage(uintptr_t page);
+  ThreadBuffer *CurrentBuffer();
+  bool HandleFault(siginfo_t *info, ucontext_t *context);
+  bool HandleTrap(ucontext_t *context);
+  static void SegvHandler(int signal, siginfo_t *info, void *context);
+  static void TrapHandler(int signal, siginfo_t *info, void *context);
+
+  static std::atomic<LinuxAccessTracer *> s_tracer;
+  static std::atomic<uint64_t> s_generation; // Tells a thread's cached buffer of an older tracer from ours
+
+  size_t m_page_size;
+  size_t m_records_per_thread;
+  size_t m_max_threads;
+  size_t m_max_pages;
+  uint64_t m_generation;
+  size_t m_table_size;
+  std::unique_ptr<Page[]> m_pages; // Open addressing on the page address, a slot stays with its page for good
+  size_t m_page_count = 0;
+  std::mutex m_mutex;              // Serializes Track()/Untrack(), never taken by the signal handlers
+  std::unique_ptr<ThreadBuffer[]> m_buffers;
+  std::unique_ptr<Access[]> m_records;
+  std::atomic<size_t> m_buffer_count{0};
+  std::atomic<uint64_t> m_dropped{0}; // Accesses of threads that found no buffer left
+  struct sigaction m_old_segv = {};
+  struct sigaction m_old_trap = {};
+};
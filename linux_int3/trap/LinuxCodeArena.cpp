@@ -0,0 +1,206 @@
+#include "LinuxCodeArena.h"
+#include "LinuxTrapSupport.h"
+#include <cerrno>
+#include <cstring>
+#include <linux/membarrier.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Whether `code` is within +-1GB of `near`, so that a rel32 reaches from anywhere in a chunk at `code` to code
+// around `near`.
+static bool IsNear(uintptr_t code, uintptr_t near) {
+  if (near == 0) return true;
+  const int64_t distance = static_cast<int64_t>(code - near);
+  return distance > -(int64_t(1) << 30) && distance < (int64_t(1) << 30);
+}
+
+LinuxCodeArena::LinuxCodeArena(size_t chunk_size, size_t max_chunks)
+    : m_chunk_size(chunk_size), m_max_chunks(max_chunks) {
+  const size_t page_size = ::sysconf(_SC_PAGESIZE);
+  if (chunk_size < page_size || (chunk_size & (chunk_size - 1)) != 0) {
+    throw std::runtime_error("code arena chunk size is not a power of two of pages");
+  }
+  while ((size_t(1) << m_chunk_shift) < chunk_size) m_chunk_shift++;
+  size_t table_size = 1;
+  while (table_size < 2 * max_chunks) table_size *= 2;
+  m_table_mask = table_size - 1;
+  m_table.reset(new Entry[table_size]);
+  m_free.resize(m_chunk_shift + 1);
+
+  m_fd = ::memfd_create("linux-code-arena", MFD_CLOEXEC);
+  if (m_fd < 0) throw ErrnoError("memfd_create");
+  // Without it Publish() relies on the other cores not running stale code of a reused slot.
+  m_sync_core = ::syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_SYNC_CORE, 0, 0) == 0;
+}
+
+LinuxCodeArena::~LinuxCodeArena() {
+  for (const std::unique_ptr<Chunk> &chunk : m_chunks) {
+    ::munmap(reinterpret_cast<void *>(chunk->code), m_chunk_size);
+    ::munmap(chunk->writable, m_chunk_size);
+  }
+  ::close(m_fd);
+}
+
+LinuxCodeArena::Stub LinuxCodeArena::Allocate(size_t size, uintptr_t near, uint32_t tag) {
+  if (size > m_chunk_size) throw std::runtime_error("code arena stub larger than a chunk");
+  unsigned slot_shift = kMinSlotShift;
+  while ((size_t(1) << slot_shift) < size) slot_shift++;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Chunk *chunk = nullptr;
+  size_t slot = 0;
+  // The most recently freed slot first, then the newest chunk with room, then a new chunk.
+  std::vector<uintptr_t> &free = m_free[slot_shift];
+  for (size_t i = free.size(); i-- > 0;) {
+    if (!IsNear(free[i], near)) continue;
+    chunk = FindChunk(free[i]);
+    slot = (free[i] - chunk->code) >> slot_shift;
+    free.erase(free.begin() + i);
+    m_stats.reused++;
+    break;
+  }
+  for (size_t i = m_chunks.size(); chunk == nullptr && i-- > 0;) {
+    Chunk &candidate = *m_chunks[i];
+    if (candidate.slot_shift == slot_shift && candidate.used < (m_chunk_size >> slot_shift) &&
+        IsNear(candidate.code, near)) {
+      chunk = &candidate;
+      slot = chunk->used++;
+    }
+  }
+  if (chunk == nullptr) {
+    chunk = MapChunk(slot_shift, near);
+    slot = chunk->used++;
+  }
+
+  const Stub stub = MakeStub(*chunk, slot, tag);
+  // Leftovers of a freed stub trap rather than run.
+  ::memset(stub.writable, 0xcc, stub.size);
+  chunk->slots[slot].store(uint64_t(tag) << 1 | 1, std::memory_order_release);
+  m_pending++;
+  m_stats.allocated++;
+  m_stats.stubs++;
+  return stub;
+}
+
+void LinuxCodeArena::Free(uintptr_t code) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Chunk *chunk = FindChunk(code);
+  if (chunk == nullptr || (code - chunk->code) & ((uintptr_t(1) << chunk->slot_shift) - 1)) return;
+  std::atomic<uint64_t> &state = chunk->slots[(code - chunk->code) >> chunk->slot_shift];
+  if ((state.load(std::memory_order_relaxed) & 1) == 0) return;
+  state.store(0, std::memory_order_release);
+  m_free[chunk->slot_shift].push_back(code);
+  m_stats.stubs--;
+}
+
+void LinuxCodeArena::Publish() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_pending == 0) return;
+  std::atomic_thread_fence(std::memory_order_release);
+  if (m_sync_core) ::syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE, 0, 0);
+  m_stats.published += m_pending;
+  m_stats.batches++;
+  m_pending = 0;
+}
+
+LinuxCodeArena::Stub LinuxCodeArena::Find(uintptr_t addr) const {
+  const Chunk *chunk = FindChunk(addr);
+  if (chunk == nullptr) return Stub();
+  const size_t slot = (addr - chunk->code) >> chunk->slot_shift;
+  const uint64_t state = chunk->slots[slot].load(std::memory_order_acquire);
+  if ((state & 1) == 0) return Stub();
+  return MakeStub(*chunk, slot, static_cast<uint32_t>(state >> 1));
+}
+
+LinuxCodeArena::Chunk *LinuxCodeArena::FindChunk(uintptr_t addr) const {
+  const uintptr_t code = addr & ~static_cast<uintptr_t>(m_chunk_size - 1);
+  for (size_t i = Hash(code), probes = 0; probes <= m_table_mask; i = (i + 1) & m_table_mask, probes++) {
+    const uintptr_t entry = m_table[i].code.load(std::memory_order_acquire);
+    if (entry == code) return m_table[i].chunk.load(std::memory_order_relaxed);
+    if (entry == 0) return nullptr;
+  }
+  return nullptr;
+}
+
+LinuxCodeArena::Stub LinuxCodeArena::MakeStub(const Chunk &chunk, size_t slot, uint32_t tag) const {
+  Stub stub;
+  stub.code = chunk.code + (slot << chunk.slot_shift);
+  stub.writable = chunk.writable + (slot << chunk.slot_shift);
+  stub.size = size_t(1) << chunk.slot_shift;
+  stub.tag = tag;
+  return stub;
+}
+
+LinuxCodeArena::Chunk *LinuxCodeArena::MapChunk(unsigned slot_shift, uintptr_t near) {
+  if (m_chunks.size() >= m_max_chunks) throw std::runtime_error("code arena full");
+  const off_t offset = m_file_size;
+  if (::ftruncate(m_fd, offset + m_chunk_size) != 0) throw ErrnoError("ftruncate");
+  const uintptr_t code = MapCode(offset, near);
+  void *writable = MAP_FAILED;
+  if (code != 0) writable = ::mmap(NULL, m_chunk_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, offset);
+  if (writable == MAP_FAILED) {
+    std::runtime_error error = code == 0 && near != 0 ? std::runtime_error("no room for code near the address")
+                                                      : ErrnoError("mmap");
+    if (code != 0) ::munmap(reinterpret_cast<void *>(code), m_chunk_size);
+    ::ftruncate(m_fd, offset);
+    throw error;
+  }
+  m_file_size += m_chunk_size;
+  ::memset(writable, 0xcc, m_chunk_size);
+
+  std::unique_ptr<Chunk> chunk(new Chunk);
+  chunk->code = code;
+  chunk->writable = static_cast<uint8_t *>(writable);
+  chunk->slot_shift = slot_shift;
+  chunk->used = 0;
+  chunk->slots.reset(new std::atomic<uint64_t>[m_chunk_size >> slot_shift]());
+  size_t i = Hash(code);
+  while (m_table[i].code.load(std::memory_order_relaxed) != 0) i = (i + 1) & m_table_mask;
+  m_table[i].chunk.store(chunk.get(), std::memory_order_relaxed);
+  m_table[i].code.store(code, std::memory_order_release);
+  m_chunks.push_back(std::move(chunk));
+  m_stats.chunks++;
+  return m_chunks.back().get();
+}
+
+uintptr_t LinuxCodeArena::MapCode(off_t offset, uintptr_t near) {
+  const uintptr_t align_mask = m_chunk_size - 1;
+  if (near == 0) {
+    // Anywhere, aligned: reserve twice the size and keep the aligned middle.
+    void *reserved = ::mmap(NULL, 2 * m_chunk_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED) return 0;
+    const uintptr_t start = reinterpret_cast<uintptr_t>(reserved);
+    const uintptr_t code = (start + align_mask) & ~align_mask;
+    if (::mmap(reinterpret_cast<void *>(code), m_chunk_size, PROT_READ | PROT_EXEC, MAP_SHARED | MAP_FIXED, m_fd,
+               offset) == MAP_FAILED) {
+      ::munmap(reserved, 2 * m_chunk_size);
+      return 0;
+    }
+    if (code > start) ::munmap(reserved, code - start);
+    if (code + m_chunk_size < start + 2 * m_chunk_size) {
+      ::munmap(reinterpret_cast<void *>(code + m_chunk_size), start + m_chunk_size - code);
+    }
+    return code;
+  }
+  // Probe free space at growing distances on both sides; MAP_FIXED_NOREPLACE fails on anything mapped.
+  const uintptr_t base = near & ~align_mask;
+  for (uintptr_t distance = 1 << 20; distance < (uintptr_t(1) << 30); distance *= 4) {
+    for (int side = 0; side < 2; side++) {
+      if (side == 0 && distance > base) continue;
+      const uintptr_t hint = side == 0 ? base - distance : base + distance;
+      void *code = ::mmap(reinterpret_cast<void *>(hint), m_chunk_size, PROT_READ | PROT_EXEC,
+                          MAP_SHARED | MAP_FIXED_NOREPLACE, m_fd, offset);
+      if (code == MAP_FAILED) continue;
+      // An old kernel may have taken the flag for a hint, see LinuxMmap.h.
+      if ((reinterpret_cast<uintptr_t>(code) & align_mask) != 0 || !IsNear(reinterpret_cast<uintptr_t>(code), near)) {
+        ::munmap(code, m_chunk_size);
+        continue;
+      }
+      return reinterpret_cast<uintptr_t>(code);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sys/types.h>
+#include <vector>
+
+// Executable memory for code generated at run time (trampolines, stubs), never writable and executable at once: the
+// arena is a memfd mapped twice, read-execute where the code runs and read-write at an unrelated address where it is
+// written. Nothing is mprotect()ed, so generating code costs no system call beyond the occasional new chunk.
+//
+// Memory comes in chunks aligned to their size, each cut into slots of one power-of-two size class: a stub is
+// allocated by bumping the chunk of its class or by taking a freed slot, and the stub owning a code address is found
+// with one hash lookup for the chunk and a shift for the slot. Chunks can be asked for within +-1GB of an address,
+// so that rel32 jumps and RIP-relative operands reach between the stub and that code.
+//
+// Stubs written since the last Publish() must not run before it: it orders the writes of the batch before the caller
+// links the stubs in and serializes the instruction stream of every thread (membarrier SYNC_CORE) once for all of
+// them, which matters when a freed slot is rewritten while other threads may have its old code prefetched.
+class LinuxCodeArena {
+public:
+  struct Stub {
+    uintptr_t code = 0;          // Executable address, 0 when there is no stub
+    uint8_t *writable = nullptr; // The same bytes in the writable view
+    size_t size = 0;             // Of the slot, at least the size asked for
+    uint32_t tag = 0;            // The caller's, given to Allocate()
+  };
+
+  struct Statistics {
+    uint64_t chunks = 0;    // Mapped
+    uint64_t stubs = 0;     // Allocated and not freed
+    uint64_t allocated = 0; // Allocations
+    uint64_t reused = 0;    // Allocations that took a freed slot
+    uint64_t published = 0; // Stubs published
+    uint64_t batches = 0;   // Publish() calls that had stubs to publish
+  };
+
+  // Creates the memfd, chunks are mapped as needed; throws std::runtime_error when memfd_create fails.
+  // `chunk_size` is a power of two and a multiple of the page size, `max_chunks` bounds the lookup table.
+  explicit LinuxCodeArena(size_t chunk_size = 1 << 16, size_t max_chunks = 4096);
+  ~LinuxCodeArena();
+  LinuxCodeArena(const LinuxCodeArena &) = delete;
+  LinuxCodeArena &operator=(const LinuxCodeArena &) = delete;
+
+  // Allocates a stub of at least `size` bytes, within +-1GB of `near` unless it is 0. Throws std::runtime_error when
+  // `size` is larger than a chunk, or no chunk can be mapped (near `near`).
+  Stub Allocate(size_t size, uintptr_t near = 0, uint32_t tag = 0);
+  // Gives the slot of the stub at `code` back to its size class. No thread may run it or jump to it any more.
+  void Free(uintptr_t code);
+  // Makes the stubs allocated since the last call safe to run on every thread.
+  void Publish();
+
+  // The stub whose slot holds `addr`; lock-free and async-signal-safe, for signal handlers and unwinders.
+  Stub Find(uintptr_t addr) const;
+
+  int Fd() const { return m_fd; }
+  const Statistics &GetStatistics() const { return m_stats; }
+
+private:
+  static constexpr unsigned kMinSlotShift = 4;
+
+  struct Chunk {
+    uintptr_t code;
+    uint8_t *writable;
+    unsigned slot_shift;
+    size_t used; // Slots handed out by the bump allocator
+    // Per slot: tag << 1 | allocated, read by Find().
+    std::unique_ptr<std::atomic<uint64_t>[]> slots;
+  };
+  // Chunk base -> chunk, open addressing; entries are never removed.
+  struct Entry {
+    std::atomic<uintptr_t> code{0};
+    std::atomic<Chunk *> chunk{nullptr};
+  };
+
+  Chunk *MapChunk(unsigned slot_shift, uintptr_t near);
+  uintptr_t MapCode(off_t offset, uintptr_t near);
+  Chunk *FindChunk(uintptr_t addr) const;
+  Stub MakeStub(const Chunk &chunk, size_t slot, uint32_t tag) const;
+  size_t Hash(uintptr_t code) const { return (code >> m_chunk_shift) * 0x9E3779B97F4A7C15ull >> 32 & m_table_mask; }
+
+  size_t m_chunk_size;
+  unsigned m_chunk_shift = 0;
+  size_t m_max_chunks;
+  size_t m_table_mask;
+  std::unique_ptr<Entry[]> m_table;
+  int m_fd = -1;
+  off_t m_file_size = 0;
+  bool m_sync_core = false;
+  std::mutex m_mutex; // Serializes Allocate(), Free() and Publish(), never taken by Find()
+  std::vector<std::unique_ptr<Chunk>> m_chunks;
+  std::vector<std::vector<uintptr_t>> m_free; // By slot shift: freed stubs
+  uint64_t m_pending = 0;                     // Allocated since the last Publish()
+  Statistics m_stats;
+};
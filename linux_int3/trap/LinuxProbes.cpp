@@ -0,0 +1,276 @@
+#include "LinuxProbes.h"
+#include "LinuxTrapSupport.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/ucontext.h>
+#include <unistd.h>
+
+static constexpr uint8_t kNop = 0x90;
+static constexpr uint8_t kInt3 = 0xcc;
+
+// Bounds of the linux_probes section, defined by the linker when there is at least one LINUX_PROBE().
+extern "C" const LinuxProbes::Site __start_linux_probes[] __attribute__((weak));
+extern "C" const LinuxProbes::Site __stop_linux_probes[] __attribute__((weak));
+
+std::atomic<LinuxProbes *> LinuxProbes::s_probes{nullptr};
+std::atomic<uint64_t> LinuxProbes::s_generation{0};
+
+// The thread's buffer, read and written by its own signal handler only. Initial-exec TLS needs no allocation on
+// first use, unlike the general dynamic model.
+struct ProbesThreadState {
+  uint64_t generation;
+  size_t buffer;
+  bool has_buffer;
+  bool no_buffer; // Every buffer was taken
+};
+static thread_local ProbesThreadState t_state __attribute__((tls_model("initial-exec")));
+
+LinuxProbes::LinuxProbes(size_t hits_per_thread, size_t max_threads)
+    : m_page_size(::sysconf(_SC_PAGESIZE)), m_hits_per_thread(hits_per_thread), m_max_threads(max_threads),
+      m_generation(++s_generation) {
+  if (__start_linux_probes != nullptr) m_sites.assign(__start_linux_probes, __stop_linux_probes);
+  std::sort(m_sites.begin(), m_sites.end(), [](const Site &a, const Site &b) { return a.addr < b.addr; });
+  m_enabled.assign(m_sites.size(), 0);
+  BuildTable();
+
+  m_buffers.reset(new ThreadBuffer[max_threads]);
+  m_records.reset(new Hit[max_threads * hits_per_thread]);
+  m_counters.reset(new std::atomic<uint64_t>[max_threads * m_sites.size()]());
+  for (size_t i = 0; i < max_threads; i++) {
+    m_buffers[i].records = m_records.get() + i * hits_per_thread;
+    m_buffers[i].counters = m_counters.get() + i * m_sites.size();
+  }
+
+  LinuxProbes *expected = nullptr;
+  if (!s_probes.compare_exchange_strong(expected, this)) throw std::runtime_error("probes exist already");
+  struct sigaction action = {};
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  action.sa_sigaction = TrapHandler;
+  if (::sigaction(SIGTRAP, &action, &m_old_trap) != 0) {
+    std::runtime_error error = ErrnoError("sigaction");
+    s_probes = nullptr;
+    throw error;
+  }
+}
+
+LinuxProbes::~LinuxProbes() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<uint32_t> enabled;
+    for (uint32_t probe = 0; probe < m_sites.size(); probe++) {
+      if (m_enabled[probe]) enabled.push_back(probe);
+    }
+    try {
+      Patch(enabled, false);
+    } catch (const std::runtime_error &) {
+      // Sites left as INT3s trap into the handler installed before ours.
+    }
+  }
+  ::sigaction(SIGTRAP, &m_old_trap, NULL);
+  s_probes = nullptr;
+}
+
+// Two-level perfect hashing (Fredman, Komlos, Szemeredi): the first level spreads the sites over as many buckets, the
+// second gives each bucket of b sites 2b^2 slots and a multiplier that maps them without collision. Both levels are
+// multiply-shift hashes with random odd multipliers, retried until they fit; each try succeeds with probability > 1/2.
+void LinuxProbes::BuildTable() {
+  const size_t count = m_sites.size();
+  unsigned bits = 1;
+  while ((size_t(1) << bits) < count) bits++;
+  m_bucket_shift = 64 - bits;
+  m_buckets.assign(size_t(1) << bits, Bucket());
+  m_slots.clear();
+  if (count == 0) return;
+
+  uint64_t state = 0;
+  auto random = [&state] {
+    // splitmix64, odd for multiply-shift.
+    uint64_t z = state += 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return (z ^ (z >> 31)) | 1;
+  };
+  std::vector<std::vector<uint32_t>> members;
+  for (;;) {
+    m_seed = random();
+    members.assign(m_buckets.size(), {});
+    for (uint32_t probe = 0; probe < count; probe++) {
+      members[m_sites[probe].addr * m_seed >> m_bucket_shift].push_back(probe);
+    }
+    size_t squares = 0;
+    for (const std::vector<uint32_t> &bucket : members) squares += bucket.size() * bucket.size();
+    if (squares <= 4 * count) break;
+  }
+
+  std::vector<bool> taken;
+  for (size_t b = 0; b < members.size(); b++) {
+    if (members[b].empty()) continue;
+    unsigned slot_bits = 1;
+    while ((size_t(1) << slot_bits) < 2 * members[b].size() * members[b].size()) slot_bits++;
+    Bucket &bucket = m_buckets[b];
+    bucket.offset = static_cast<uint32_t>(m_slots.size());
+    bucket.shift = static_cast<uint8_t>(64 - slot_bits);
+    for (bool collision = true; collision;) {
+      bucket.multiplier = random();
+      taken.assign(size_t(1) << slot_bits, false);
+      collision = false;
+      for (uint32_t probe : members[b]) {
+        const size_t slot = m_sites[probe].addr * bucket.multiplier >> bucket.shift;
+        collision = collision || taken[slot];
+        taken[slot] = true;
+      }
+    }
+    m_slots.resize(m_slots.size() + (size_t(1) << slot_bits));
+    for (uint32_t probe : members[b]) {
+      Slot &slot = m_slots[bucket.offset + (m_sites[probe].addr * bucket.multiplier >> bucket.shift)];
+      slot.addr = m_sites[probe].addr;
+      slot.probe = probe;
+    }
+  }
+}
+
+std::vector<uint32_t> LinuxProbes::Find(const char *name) const {
+  std::vector<uint32_t> probes;
+  for (uint32_t probe = 0; probe < m_sites.size(); probe++) {
+    if (::strcmp(m_sites[probe].name, name) == 0) probes.push_back(probe);
+  }
+  return probes;
+}
+
+void LinuxProbes::Enable(uint32_t probe, bool enable) {
+  if (probe >= m_sites.size()) throw std::runtime_error("no such probe");
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Patch({probe}, enable);
+}
+
+size_t LinuxProbes::Enable(const char *name, bool enable) {
+  const std::vector<uint32_t> probes = Find(name);
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Patch(probes, enable);
+  return probes.size();
+}
+
+void LinuxProbes::Patch(std::vector<uint32_t> probes, bool enable) {
+  probes.erase(std::remove_if(probes.begin(), probes.end(),
+                              [this, enable](uint32_t probe) { return m_enabled[probe] == enable; }),
+               probes.end());
+  const uintptr_t page_mask = ~static_cast<uintptr_t>(m_page_size - 1);
+  LinuxVMRegionIndex index;
+  if (!probes.empty()) index.Refresh(::getpid());
+  for (size_t i = 0, end; i < probes.size(); i = end) {
+    const uintptr_t page = m_sites[probes[i]].addr & page_mask;
+    end = i + 1;
+    while (end < probes.size() && (m_sites[probes[end]].addr & page_mask) == page) end++;
+    void *start = reinterpret_cast<void *>(page);
+    // Put back to exactly what it was afterwards.
+    const int protection = Protection(index, page);
+    if (protection < 0) throw std::runtime_error("probe site is not mapped");
+    const bool writable = (protection & PROT_WRITE) != 0;
+    if (!writable && ::mprotect(start, m_page_size, protection | PROT_WRITE) != 0) throw ErrnoError("mprotect");
+    // One byte, so a thread sees either the nop or the INT3.
+    for (size_t k = i; k < end; k++) {
+      __atomic_store_n(reinterpret_cast<uint8_t *>(m_sites[probes[k]].addr), enable ? kInt3 : kNop,
+                       __ATOMIC_RELEASE);
+      m_enabled[probes[k]] = enable;
+      if (enable) {
+        m_enabled_count++;
+      } else {
+        m_enabled_count--;
+      }
+    }
+    if (!writable && ::mprotect(start, m_page_size, protection) != 0) throw ErrnoError("mprotect");
+  }
+}
+
+LinuxProbes::ThreadBuffer *LinuxProbes::CurrentBuffer() {
+  if (t_state.generation != m_generation) t_state = ProbesThreadState{m_generation, 0, false, false};
+  if (t_state.has_buffer) return &m_buffers[t_state.buffer];
+  if (t_state.no_buffer) return nullptr;
+  size_t index = m_buffer_count.load(std::memory_order_relaxed);
+  do {
+    if (index == m_max_threads) {
+      t_state.no_buffer = true;
+      return nullptr;
+    }
+  } while (!m_buffer_count.compare_exchange_weak(index, index + 1));
+  m_buffers[index].tid = static_cast<pid_t>(::syscall(SYS_gettid));
+  t_state.buffer = index;
+  t_state.has_buffer = true;
+  return &m_buffers[index];
+}
+
+bool LinuxProbes::HandleHit(uintptr_t site) {
+  const int64_t probe = Lookup(site);
+  if (probe < 0) return false;
+  ThreadBuffer *buffer = CurrentBuffer();
+  if (buffer == nullptr) {
+    m_dropped.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  // Only this thread writes its counters: no locked instruction.
+  std::atomic<uint64_t> &counter = buffer->counters[probe];
+  counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  if (m_hits_per_thread == 0) return true;
+  const uint64_t head = buffer->head.load(std::memory_order_relaxed);
+  if (head - buffer->tail.load(std::memory_order_acquire) == m_hits_per_thread) {
+    buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  Hit &hit = buffer->records[head % m_hits_per_thread];
+  hit.tsc = __builtin_ia32_rdtsc();
+  hit.probe = static_cast<uint32_t>(probe);
+  hit.tid = buffer->tid;
+  buffer->head.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+void LinuxProbes::TrapHandler(int signal, siginfo_t *info, void *context) {
+  LinuxProbes *probes = s_probes.load(std::memory_order_acquire);
+  if (probes == nullptr) return;
+  // A hit on a site disabled meanwhile is still ours; either way the thread goes on behind the INT3, where the nop
+  // was.
+  const greg_t *gregs = static_cast<ucontext_t *>(context)->uc_mcontext.gregs;
+  if (info->si_code == SI_KERNEL && probes->HandleHit(gregs[REG_RIP] - 1)) return;
+  ForwardSignal(signal, probes->m_old_trap, info, context);
+}
+
+uint64_t LinuxProbes::Hits(uint32_t probe) const {
+  uint64_t hits = 0;
+  const size_t buffer_count = m_buffer_count.load(std::memory_order_acquire);
+  for (size_t i = 0; i < buffer_count; i++) hits += m_buffers[i].counters[probe].load(std::memory_order_relaxed);
+  return hits;
+}
+
+size_t LinuxProbes::Drain(const std::function<void(const Hit &hit)> &consumer) {
+  size_t count = 0;
+  const size_t buffer_count = m_buffer_count.load(std::memory_order_acquire);
+  for (size_t i = 0; i < buffer_count && m_hits_per_thread != 0; i++) {
+    ThreadBuffer &buffer = m_buffers[i];
+    const uint64_t tail = buffer.tail.load(std::memory_order_relaxed);
+    const uint64_t head = buffer.head.load(std::memory_order_acquire);
+    for (uint64_t k = tail; k < head; k++) consumer(buffer.records[k % m_hits_per_thread]);
+    buffer.tail.store(head, std::memory_order_release);
+    count += head - tail;
+  }
+  return count;
+}
+
+LinuxProbes::Statistics LinuxProbes::GetStatistics() const {
+  Statistics stats;
+  stats.dropped = m_dropped.load(std::memory_order_relaxed);
+  stats.threads = static_cast<uint32_t>(m_buffer_count.load(std::memory_order_acquire));
+  for (size_t i = 0; i < stats.threads; i++) {
+    for (size_t probe = 0; probe < m_sites.size(); probe++) {
+      stats.hits += m_buffers[i].counters[probe].load(std::memory_order_relaxed);
+    }
+    stats.dropped += m_buffers[i].dropped.load(std::memory_order_relaxed);
+  }
+  stats.enabled = m_enabled_count;
+  return stats;
+}
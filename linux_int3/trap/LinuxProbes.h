@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sys/types.h>
+#include <vector>
+
+// A probe site compiled into the code: a one-byte nop, listed with its name in the linux_probes section. Disabled it
+// costs the nop; LinuxProbes::Enable() turns it into an INT3 and every pass through it into a hit. `name` is a string
+// literal, and sites may share a name.
+#define LINUX_PROBE(name)                                                                                             \
+  asm volatile("990: nop\n"                                                                                           \
+               ".pushsection linux_probe_names, \"a\"\n"                                                              \
+               "991: .asciz \"" name "\"\n"                                                                           \
+               ".popsection\n"                                                                                        \
+               ".pushsection linux_probes, \"aw\"\n"                                                                  \
+               ".balign 8\n"                                                                                          \
+               ".quad 990b, 991b\n"                                                                                   \
+               ".popsection\n")
+
+// In-process probes on the LINUX_PROBE() sites of the executable. An enabled site is an INT3: the SIGTRAP handler
+// finds the probe by the trapping address in a perfect hash table (two multiplications and two loads, no probing),
+// bumps the thread's counter of the probe and appends {probe, thread, tsc} to the thread's ring, and returns behind
+// the INT3, where the nop was. Nothing in the handler takes a lock, allocates or makes a system call.
+//
+// Counters and rings are per thread and allocated up front, written by their thread only and read by Hits() and
+// Drain(); hits of threads beyond `max_threads` are counted as dropped. A hit on a full ring is counted, but not
+// recorded.
+//
+// The probes own SIGTRAP while they exist and hand the traps that are not theirs to the handler installed before, so
+// only one LinuxProbes may exist at a time. The sites are those of the module that links this library, probes in
+// shared libraries are not seen.
+class LinuxProbes {
+public:
+  // Layout of the linux_probes section, see LINUX_PROBE().
+  struct Site {
+    uintptr_t addr;
+    const char *name;
+  };
+
+  struct Hit {
+    uint64_t tsc;
+    uint32_t probe;
+    pid_t tid;
+  };
+
+  struct Statistics {
+    uint64_t hits = 0;    // Counted
+    uint64_t dropped = 0; // Of threads beyond `max_threads`, or not recorded on a full ring
+    uint32_t threads = 0; // Threads that have counters
+    size_t enabled = 0;   // Probes enabled
+  };
+
+  // Collects the sites, builds the hash table and installs the SIGTRAP handler; throws std::runtime_error when
+  // another LinuxProbes exists or sigaction fails. No probe is enabled.
+  explicit LinuxProbes(size_t hits_per_thread = 1 << 14, size_t max_threads = 64);
+  ~LinuxProbes();
+  LinuxProbes(const LinuxProbes &) = delete;
+  LinuxProbes &operator=(const LinuxProbes &) = delete;
+
+  // Probes are numbered by address, from 0 to Count() - 1.
+  size_t Count() const { return m_sites.size(); }
+  const Site &GetSite(uint32_t probe) const { return m_sites[probe]; }
+  // Probes whose site is named `name`.
+  std::vector<uint32_t> Find(const char *name) const;
+
+  // Turns the sites into INT3s or back into nops; throws std::runtime_error when the code cannot be made writable.
+  void Enable(uint32_t probe, bool enable = true);
+  // Every site named `name`, with one pair of mprotect() calls per page; returns the number of sites.
+  size_t Enable(const char *name, bool enable = true);
+
+  // Hits of `probe` so far, over all threads.
+  uint64_t Hits(uint32_t probe) const;
+  // Consumes the hits recorded so far, thread by thread in recording order. One consumer at a time.
+  size_t Drain(const std::function<void(const Hit &hit)> &consumer);
+  Statistics GetStatistics() const;
+
+private:
+  struct Bucket {
+    uint64_t multiplier = 0;
+    uint32_t offset = 0;
+    uint8_t shift = 0; // 64 - log2 of the slots of the bucket, 0 for an empty bucket
+  };
+  struct Slot {
+    uintptr_t addr = 0;
+    uint32_t probe = 0;
+  };
+
+  struct ThreadBuffer {
+    std::atomic<uint64_t> head{0}; // Written by the owning thread
+    std::atomic<uint64_t> tail{0}; // Written by Drain()
+    std::atomic<uint64_t> dropped{0};
+    pid_t tid = 0;
+    Hit *records = nullptr;
+    std::atomic<uint64_t> *counters = nullptr; // One per probe
+  };
+
+  void BuildTable();
+  // Probe at `addr`, -1 when there is none.
+  int64_t Lookup(uintptr_t addr) const {
+    const Bucket &bucket = m_buckets[addr * m_seed >> m_bucket_shift];
+    if (bucket.shift == 0) return -1;
+    const Slot &slot = m_slots[bucket.offset + (addr * bucket.multiplier >> bucket.shift)];
+    return slot.addr == addr ? slot.probe : -1;
+  }
+  // `probes` in ascending order, that is by address.
+  void Patch(std::vector<uint32_t> probes, bool enable);
+  ThreadBuffer *CurrentBuffer();
+  bool HandleHit(uintptr_t site);
+  static void TrapHandler(int signal, siginfo_t *info, void *context);
+
+  static std::atomic<LinuxProbes *> s_probes;
+  static std::atomic<uint64_t> s_generation; // Tells a thread's cached buffer of older probes from ours
+
+  size_t m_page_size;
+  size_t m_hits_per_thread;
+  size_t m_max_threads;
+  uint64_t m_generation;
+  std::vector<Site> m_sites;
+  std::vector<uint8_t> m_enabled;
+  uint64_t m_seed = 0;
+  unsigned m_bucket_shift = 0;
+  std::vector<Bucket> m_buckets;
+  std::vector<Slot> m_slots;
+  std::mutex m_mutex; // Serializes Enable(), never taken by the signal handler
+  std::unique_ptr<ThreadBuffer[]> m_buffers;
+  std::unique_ptr<Hit[]> m_records;
+  std::unique_ptr<std::atomic<uint64_t>[]> m_counters;
+  std::atomic<size_t> m_buffer_count{0};
+  std::atomic<uint64_t> m_dropped{0}; // Hits of threads that found no buffer left
+  size_t m_enabled_count = 0;
+  struct sigaction m_old_trap = {};
+};
@@ -0,0 +1,373 @@
+#include "LinuxTracepoints.h"
+#include "LinuxTrapSupport.h"
+#include "lldb/LinuxInstruction.h"
+#include <cerrno>
+#include <cstring>
+#include <linux/membarrier.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/ucontext.h>
+#include <unistd.h>
+#include <vector>
+
+static_assert(sizeof(LinuxTracepoints::Event) == 32, "the trampolines index the ring with a shift by 5");
+static_assert(sizeof(LinuxTracepoints::RingHeader) == 64, "the trampolines expect the events 64 bytes in");
+
+std::atomic<LinuxTracepoints *> LinuxTracepoints::s_tracepoints{nullptr};
+
+// Whether a rel32 at `from` reaches `to`.
+static bool InReach(uintptr_t from, uintptr_t to) {
+  const int64_t distance = static_cast<int64_t>(to - from);
+  return distance >= INT32_MIN && distance <= INT32_MAX;
+}
+
+static void Put32(std::vector<uint8_t> &code, uint32_t value) {
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+  code.insert(code.end(), bytes, bytes + sizeof(value));
+}
+
+static void Put64(std::vector<uint8_t> &code, uint64_t value) {
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+  code.insert(code.end(), bytes, bytes + sizeof(value));
+}
+
+// Appends the branch `opcode` with a rel32 to `target`, for code that will sit at `base`.
+static void PutBranch(std::vector<uint8_t> &code, uintptr_t base, std::initializer_list<uint8_t> opcode,
+                      uintptr_t target) {
+  code.insert(code.end(), opcode);
+  const uintptr_t end = base + code.size() + sizeof(uint32_t);
+  if (!InReach(end, target)) throw std::runtime_error("tracepoint branch out of reach");
+  Put32(code, static_cast<uint32_t>(target - end));
+}
+
+// Saves what it clobbers and appends {sequence, id, tsc, rdi} to the ring at `ring`. The stack pointer moves past
+// the red zone first, the traced code may keep data there.
+static void PutRecord(std::vector<uint8_t> &code, uintptr_t ring, uint32_t id) {
+  code.insert(code.end(), {0x48, 0x8d, 0x64, 0x24, 0x80,       // lea -0x80(%rsp), %rsp
+                           0x9c, 0x50, 0x51, 0x52, 0x56,       // pushfq; push %rax, %rcx, %rdx, %rsi
+                           0x48, 0xbe});                       // movabs $ring, %rsi
+  Put64(code, ring);
+  code.insert(code.end(), {0xb8, 0x01, 0x00, 0x00, 0x00,       // mov $1, %eax
+                           0xf0, 0x48, 0x0f, 0xc1, 0x06,       // lock xadd %rax, (%rsi): reserve
+                           0x48, 0x89, 0xc1,                   // mov %rax, %rcx
+                           0x48, 0x23, 0x4e, 0x08,             // and 0x8(%rsi), %rcx: & mask
+                           0x48, 0xc1, 0xe1, 0x05,             // shl $5, %rcx
+                           0x48, 0x8d, 0x4c, 0x0e, 0x40,       // lea 0x40(%rsi, %rcx), %rcx
+                           0x48, 0xc7, 0x01, 0x00, 0x00, 0x00, 0x00, // movq $0, (%rcx): being written
+                           0x48, 0xc7, 0x41, 0x08});           // movq $id, 0x8(%rcx)
+  Put32(code, id);
+  code.insert(code.end(), {0x48, 0x89, 0x79, 0x18,             // mov %rdi, 0x18(%rcx)
+                           0x48, 0x89, 0xc6,                   // mov %rax, %rsi
+                           0x0f, 0x31,                         // rdtsc
+                           0x48, 0xc1, 0xe2, 0x20,             // shl $32, %rdx
+                           0x48, 0x09, 0xd0,                   // or %rdx, %rax
+                           0x48, 0x89, 0x41, 0x10,             // mov %rax, 0x10(%rcx)
+                           0x48, 0x8d, 0x46, 0x01,             // lea 0x1(%rsi), %rax
+                           0x48, 0x89, 0x01,                   // mov %rax, (%rcx): publish
+                           0x5e, 0x5a, 0x59, 0x58, 0x9d,       // pop %rsi, %rdx, %rcx, %rax; popfq
+                           0x48, 0x8d, 0xa4, 0x24, 0x80, 0x00, 0x00, 0x00}); // lea 0x80(%rsp), %rsp
+}
+
+LinuxTracepoints::LinuxTracepoints(size_t ring_events, size_t max_tracepoints)
+    : m_page_size(::sysconf(_SC_PAGESIZE)), m_max_tracepoints(max_tracepoints) {
+  if (ring_events == 0 || (ring_events & (ring_events - 1)) != 0) {
+    throw std::runtime_error("tracepoint ring size is not a power of two");
+  }
+  m_bridge_table_size = 1;
+  while (m_bridge_table_size < 2 * max_tracepoints) m_bridge_table_size *= 2;
+  m_bridges.reset(new Bridge[m_bridge_table_size]);
+
+  m_ring_fd = ::memfd_create("linux-tracepoints", MFD_CLOEXEC);
+  if (m_ring_fd < 0) throw ErrnoError("memfd_create");
+  m_ring_size = sizeof(RingHeader) + ring_events * sizeof(Event);
+  void *ring = MAP_FAILED;
+  if (::ftruncate(m_ring_fd, m_ring_size) == 0) {
+    ring = ::mmap(NULL, m_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_ring_fd, 0);
+  }
+  if (ring == MAP_FAILED) {
+    std::runtime_error error = ErrnoError("tracepoint ring");
+    ::close(m_ring_fd);
+    throw error;
+  }
+  m_ring = static_cast<RingHeader *>(ring);
+  m_ring->mask = ring_events - 1;
+  // Without it the patching threads rely on the other cores refetching the code soon enough.
+  m_sync_core = ::syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_SYNC_CORE, 0, 0) == 0;
+
+  LinuxTracepoints *expected = nullptr;
+  bool ok = s_tracepoints.compare_exchange_strong(expected, this);
+  if (ok) {
+    struct sigaction action = {};
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    action.sa_sigaction = TrapHandler;
+    ok = ::sigaction(SIGTRAP, &action, &m_old_trap) == 0;
+    if (!ok) s_tracepoints = nullptr;
+  }
+  if (!ok) {
+    std::runtime_error error = expected != nullptr ? std::runtime_error("tracepoints exist already")
+                                                   : ErrnoError("sigaction");
+    ::munmap(m_ring, m_ring_size);
+    ::close(m_ring_fd);
+    throw error;
+  }
+}
+
+LinuxTracepoints::~LinuxTracepoints() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &entry : m_tracepoints) {
+      if (entry.second.inserted) Patch(entry.first, entry.second.code, kJumpSize);
+    }
+  }
+  ::sigaction(SIGTRAP, &m_old_trap, NULL);
+  s_tracepoints = nullptr;
+  ::munmap(m_ring, m_ring_size);
+  ::close(m_ring_fd);
+}
+
+// Length of the whole instructions a jump of `size` bytes at `site` displaces.
+static uint8_t DisplacedLength(uintptr_t site, size_t size) {
+  size_t covered = 0;
+  while (covered < size) {
+    LinuxInstruction insn;
+    if (!DecodeInstruction(reinterpret_cast<const uint8_t *>(site + covered), 15, &insn)) {
+      throw std::runtime_error("tracepoint site does not decode");
+    }
+    covered += insn.length;
+  }
+  return static_cast<uint8_t>(covered);
+}
+
+uint32_t LinuxTracepoints::Set(const void *site_addr) {
+  const uintptr_t site = reinterpret_cast<uintptr_t>(site_addr);
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto pos = m_tracepoints.find(site);
+  if (pos != m_tracepoints.end() && pos->second.inserted) return pos->second.id;
+
+  const bool reuse = pos != m_tracepoints.end() && ::memcmp(pos->second.code, site_addr, pos->second.length) == 0;
+  const uint8_t length = reuse ? pos->second.length : DisplacedLength(site, kJumpSize);
+  // Inserted neighbours must not share a byte with the displaced instructions. Checked before a trampoline is built,
+  // which would have nowhere to go.
+  auto next = m_tracepoints.upper_bound(site);
+  if (next != m_tracepoints.end() && next->second.inserted && next->first < site + length) {
+    throw std::runtime_error("tracepoint overlaps the next one");
+  }
+  auto prev = m_tracepoints.lower_bound(site);
+  if (prev != m_tracepoints.begin() && (--prev)->second.inserted && prev->first + prev->second.length > site) {
+    throw std::runtime_error("tracepoint overlaps the previous one");
+  }
+
+  Tracepoint tracepoint;
+  if (reuse) {
+    tracepoint = pos->second;
+    m_stats.reused++;
+  } else {
+    // The code changed under a cached trampoline: the old one stays, a thread may still be in it.
+    tracepoint.id = pos != m_tracepoints.end() ? pos->second.id : m_next_id;
+    tracepoint.trampoline = BuildTrampoline(site, tracepoint.id, tracepoint.length);
+    ::memcpy(tracepoint.code, site_addr, tracepoint.length);
+    m_arena.Publish();
+    m_stats.trampolines++;
+  }
+
+  SetBridge(site, tracepoint.trampoline);
+  uint8_t jump[kJumpSize] = {0xe9};
+  const uint32_t rel = static_cast<uint32_t>(tracepoint.trampoline - (site + kJumpSize));
+  ::memcpy(jump + 1, &rel, sizeof(rel));
+  if (!Patch(site, jump, kJumpSize)) throw ErrnoError("mprotect");
+
+  tracepoint.inserted = true;
+  m_tracepoints[site] = tracepoint;
+  m_sites[tracepoint.id] = site;
+  if (tracepoint.id == m_next_id) m_next_id++;
+  m_stats.set++;
+  return tracepoint.id;
+}
+
+void LinuxTracepoints::Remove(uint32_t id) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto pos = m_sites.find(id);
+  if (pos == m_sites.end()) return;
+  Tracepoint &tracepoint = m_tracepoints[pos->second];
+  if (!tracepoint.inserted) return;
+  if (!Patch(pos->second, tracepoint.code, kJumpSize)) throw ErrnoError("mprotect");
+  tracepoint.inserted = false;
+  m_stats.removed++;
+}
+
+uintptr_t LinuxTracepoints::BuildTrampoline(uintptr_t site, uint32_t id, uint8_t &length) {
+  // Within +-1GB, so that the jmp and every rel32 of the displaced code reach.
+  const LinuxCodeArena::Stub stub = m_arena.Allocate(kTrampolineSize, site, id);
+  try {
+    WriteTrampoline(site, id, stub, length);
+  } catch (...) {
+    m_arena.Free(stub.code);
+    throw;
+  }
+  return stub.code;
+}
+
+void LinuxTracepoints::WriteTrampoline(uintptr_t site, uint32_t id, const LinuxCodeArena::Stub &stub,
+                                       uint8_t &length) {
+  const uintptr_t trampoline = stub.code;
+  std::vector<uint8_t> code;
+  code.reserve(kTrampolineSize);
+  PutRecord(code, reinterpret_cast<uintptr_t>(m_ring), id);
+
+  std::vector<uintptr_t> targets;
+  size_t covered = 0;
+  bool falls_through = true;
+  while (covered < kJumpSize) {
+    if (!falls_through) throw std::runtime_error("tracepoint site leaves the function within 5 bytes");
+    const uint8_t *insn_code = reinterpret_cast<const uint8_t *>(site + covered);
+    LinuxInstruction insn;
+    if (!DecodeInstruction(insn_code, 15, &insn)) throw std::runtime_error("tracepoint site does not decode");
+    const uintptr_t next = site + covered + insn.length;
+    const uintptr_t target = next + insn.branch_offset;
+    switch (insn.flow) {
+    case LinuxInstruction::eFlowNone:
+    case LinuxInstruction::eFlowIndirectJump:
+    case LinuxInstruction::eFlowReturn: {
+      const size_t start = code.size();
+      code.insert(code.end(), insn_code, insn_code + insn.length);
+      if (insn.rip_relative) {
+        int32_t disp;
+        ::memcpy(&disp, insn_code + insn.disp_offset, sizeof(disp));
+        const uintptr_t operand = next + disp;
+        if (!InReach(trampoline + code.size(), operand)) throw std::runtime_error("tracepoint operand out of reach");
+        disp = static_cast<int32_t>(operand - (trampoline + code.size()));
+        ::memcpy(&code[start + insn.disp_offset], &disp, sizeof(disp));
+      }
+      falls_through = insn.flow == LinuxInstruction::eFlowNone;
+      break;
+    }
+    case LinuxInstruction::eFlowJump:
+      PutBranch(code, trampoline, {0xe9}, target);
+      targets.push_back(target);
+      falls_through = false;
+      break;
+    case LinuxInstruction::eFlowConditionalJump:
+      PutBranch(code, trampoline, {0x0f, static_cast<uint8_t>(0x80 | insn.condition)}, target);
+      targets.push_back(target);
+      break;
+    default:
+      throw std::runtime_error("tracepoint site displaces a call, loop, syscall or trap");
+    }
+    covered += insn.length;
+  }
+  for (uintptr_t target : targets) {
+    if (target > site && target < site + covered) throw std::runtime_error("tracepoint site jumps into itself");
+  }
+  if (falls_through) PutBranch(code, trampoline, {0xe9}, site + covered);
+  if (code.size() > kTrampolineSize) throw std::runtime_error("tracepoint trampoline too large");
+
+  ::memcpy(stub.writable, code.data(), code.size());
+  length = static_cast<uint8_t>(covered);
+}
+
+bool LinuxTracepoints::Patch(uintptr_t site, const uint8_t *code, size_t size) {
+  const uintptr_t page_mask = ~static_cast<uintptr_t>(m_page_size - 1);
+  // The code may straddle two pages, each of which goes back to the protection it had.
+  LinuxVMRegionIndex index;
+  index.Refresh(::getpid());
+  std::vector<std::pair<uintptr_t, int>> pages;
+  for (uintptr_t page = site & page_mask; page < site + size; page += m_page_size) {
+    const int protection = Protection(index, page);
+    if (protection < 0) {
+      errno = EFAULT;
+      return false;
+    }
+    if (protection & PROT_WRITE) continue;
+    if (::mprotect(reinterpret_cast<void *>(page), m_page_size, protection | PROT_WRITE) != 0) return false;
+    pages.emplace_back(page, protection);
+  }
+  uint8_t *bytes = reinterpret_cast<uint8_t *>(site);
+  // A thread reaching the site meanwhile traps on the INT3, TrapHandler() sends it to the trampoline.
+  __atomic_store_n(bytes, 0xcc, __ATOMIC_RELEASE);
+  SyncCore();
+  for (size_t i = 1; i < size; i++) __atomic_store_n(bytes + i, code[i], __ATOMIC_RELAXED);
+  SyncCore();
+  __atomic_store_n(bytes, code[0], __ATOMIC_RELEASE);
+  SyncCore();
+  bool success = true;
+  for (const auto &page : pages) {
+    if (::mprotect(reinterpret_cast<void *>(page.first), m_page_size, page.second) != 0) success = false;
+  }
+  return success;
+}
+
+void LinuxTracepoints::SyncCore() {
+  if (m_sync_core) ::syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE, 0, 0);
+}
+
+void LinuxTracepoints::SetBridge(uintptr_t site, uintptr_t trampoline) {
+  const size_t mask = m_bridge_table_size - 1;
+  size_t i = (site * 0x9E3779B97F4A7C15ull) >> 32 & mask;
+  for (size_t probes = 0; probes < m_max_tracepoints; i = (i + 1) & mask, probes++) {
+    const uintptr_t entry = m_bridges[i].site.load(std::memory_order_relaxed);
+    if (entry != site && entry != 0) continue;
+    m_bridges[i].trampoline.store(trampoline, std::memory_order_release);
+    m_bridges[i].site.store(site, std::memory_order_release);
+    return;
+  }
+  throw std::runtime_error("too many tracepoint sites");
+}
+
+uintptr_t LinuxTracepoints::FindBridge(uintptr_t site) const {
+  const size_t mask = m_bridge_table_size - 1;
+  for (size_t i = (site * 0x9E3779B97F4A7C15ull) >> 32 & mask, probes = 0; probes < m_bridge_table_size;
+       i = (i + 1) & mask, probes++) {
+    const uintptr_t entry = m_bridges[i].site.load(std::memory_order_acquire);
+    if (entry == site) return m_bridges[i].trampoline.load(std::memory_order_acquire);
+    if (entry == 0) return 0;
+  }
+  return 0;
+}
+
+void LinuxTracepoints::TrapHandler(int signal, siginfo_t *info, void *context) {
+  LinuxTracepoints *tracepoints = s_tracepoints.load(std::memory_order_acquire);
+  if (tracepoints == nullptr) return;
+  greg_t *gregs = static_cast<ucontext_t *>(context)->uc_mcontext.gregs;
+  if (info->si_code == SI_KERNEL) {
+    const uintptr_t trampoline = tracepoints->FindBridge(gregs[REG_RIP] - 1);
+    if (trampoline != 0) {
+      gregs[REG_RIP] = trampoline;
+      return;
+    }
+  }
+  ForwardSignal(signal, tracepoints->m_old_trap, info, context);
+}
+
+size_t LinuxTracepoints::Drain(const std::function<void(const Event &event)> &consumer) {
+  Event *events = reinterpret_cast<Event *>(m_ring + 1);
+  const uint64_t capacity = m_ring->mask + 1;
+  const uint64_t head = m_ring->head.load(std::memory_order_acquire);
+  if (head - m_tail > capacity) {
+    m_stats.lost += head - capacity - m_tail;
+    m_tail = head - capacity;
+  }
+  size_t count = 0;
+  for (; m_tail < head; m_tail++) {
+    Event &slot = events[m_tail & m_ring->mask];
+    const uint64_t sequence = __atomic_load_n(&slot.sequence, __ATOMIC_ACQUIRE);
+    // Reserved but not written yet: read it next time.
+    if (sequence < m_tail + 1) break;
+    Event event;
+    event.sequence = sequence;
+    event.id = __atomic_load_n(&slot.id, __ATOMIC_RELAXED);
+    event.tsc = __atomic_load_n(&slot.tsc, __ATOMIC_RELAXED);
+    event.arg = __atomic_load_n(&slot.arg, __ATOMIC_RELAXED);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // Overwritten by a producer a lap ahead, before or while we read it.
+    if (sequence != m_tail + 1 || __atomic_load_n(&slot.sequence, __ATOMIC_RELAXED) != sequence) {
+      m_stats.lost++;
+      continue;
+    }
+    consumer(event);
+    count++;
+  }
+  return count;
+}
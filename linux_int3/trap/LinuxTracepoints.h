@@ -0,0 +1,128 @@
+#pragma once
+
+#include "LinuxCodeArena.h"
+#include <atomic>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+
+// Fast tracepoints, the logging-only alternative to INT3: the instructions at a probe site are overwritten with a
+// 5-byte `jmp` into a trampoline that saves the registers it uses, appends an event to a ring buffer, runs the
+// displaced instructions relocated and jumps back behind them. A hit costs a few dozen instructions instead of a
+// signal, and nothing stops while tracepoints are set or hit.
+//
+// The jmp is written while other threads run, as the kernel patches its text: an INT3 goes to the first byte, then
+// the rest of the jmp, then its first byte, each followed by a core serialization of every thread (membarrier), and
+// the SIGTRAP handler sends a thread that hits the INT3 meanwhile to the trampoline. The site must start at an
+// instruction, and no code may jump into the patched bytes behind it; a thread that is suspended between two of the
+// displaced instructions while the jmp is written resumes in the middle of it, so sites whose first instruction is
+// 5 bytes or longer are the safe ones.
+//
+// Displaced instructions with RIP-relative operands are rebased and relative jumps re-encoded with a rel32; calls,
+// loops, syscalls and traps are refused. The trampolines live in a LinuxCodeArena, within reach of the sites (+-1GB),
+// and are cached: removing a tracepoint restores the code but keeps its trampoline, as a thread may still be running
+// it, and setting it again reuses it.
+//
+// The ring lives in a memfd, so another process (a debugger) can map RingFd() and read the events as they come.
+// Producers reserve a slot with one atomic add and overwrite the oldest events when the reader falls behind; the
+// reader tells a complete event by its sequence number and counts the overwritten ones as lost.
+//
+// The tracepoints own SIGTRAP while they exist and hand the traps that are not theirs to the handler installed
+// before, so only one LinuxTracepoints may exist at a time, and no thread may be inside a trampoline when it is
+// destroyed.
+class LinuxTracepoints {
+public:
+  // Layout shared with the trampolines and the readers of RingFd(): the header, then `mask + 1` events.
+  struct Event {
+    uint64_t sequence; // Reservation number + 1, 0 while the event is written
+    uint64_t id;       // Tracepoint that was hit
+    uint64_t tsc;      // rdtsc at the hit
+    uint64_t arg;      // rdi at the hit, the first argument at a function entry
+  };
+  struct RingHeader {
+    std::atomic<uint64_t> head; // Events reserved so far
+    uint64_t mask;              // Events in the ring - 1
+    uint64_t reserved[6];
+  };
+
+  struct Statistics {
+    uint64_t set = 0;         // Tracepoints inserted
+    uint64_t removed = 0;     // Tracepoints removed
+    uint64_t trampolines = 0; // Trampolines built
+    uint64_t reused = 0;      // Insertions that found their trampoline cached
+    uint64_t lost = 0;        // Events overwritten before Drain() read them
+  };
+
+  // Maps the ring of `ring_events` (a power of two) events and installs the SIGTRAP handler; throws
+  // std::runtime_error when another LinuxTracepoints exists or a system call fails.
+  explicit LinuxTracepoints(size_t ring_events = 1 << 16, size_t max_tracepoints = 4096);
+  ~LinuxTracepoints();
+  LinuxTracepoints(const LinuxTracepoints &) = delete;
+  LinuxTracepoints &operator=(const LinuxTracepoints &) = delete;
+
+  // Patches the code at `site` and returns the tracepoint ID, the same ID when the site was traced before. Throws
+  // std::runtime_error when the displaced instructions cannot be relocated, the site overlaps another tracepoint, no
+  // trampoline fits within reach or the code cannot be made writable.
+  uint32_t Set(const void *site);
+  // Restores the code of the tracepoint `id`.
+  void Remove(uint32_t id);
+
+  // Consumes the events written since the last call, in reservation order. One consumer at a time.
+  size_t Drain(const std::function<void(const Event &event)> &consumer);
+  int RingFd() const { return m_ring_fd; }
+  const RingHeader *Ring() const { return m_ring; }
+  const Statistics &GetStatistics() const { return m_stats; }
+
+private:
+  static constexpr size_t kJumpSize = 5;
+  static constexpr size_t kTrampolineSize = 256;
+
+  struct Tracepoint {
+    uint32_t id;
+    uintptr_t trampoline;
+    uint8_t length; // Of the displaced instructions
+    uint8_t code[16];
+    bool inserted;
+  };
+  // Site -> trampoline for the SIGTRAP handler, entries are never removed.
+  struct Bridge {
+    std::atomic<uintptr_t> site{0};
+    std::atomic<uintptr_t> trampoline{0};
+  };
+
+  // Allocates and writes the trampoline for the code at `site`, returns its address and the length of the displaced
+  // instructions.
+  uintptr_t BuildTrampoline(uintptr_t site, uint32_t id, uint8_t &length);
+  // Writes the trampoline into `stub` through its writable view.
+  void WriteTrampoline(uintptr_t site, uint32_t id, const LinuxCodeArena::Stub &stub, uint8_t &length);
+  // Writes `size` bytes over the code at `site`, first byte last, bridged by an INT3. False with errno set when the
+  // code cannot be made writable.
+  bool Patch(uintptr_t site, const uint8_t *code, size_t size);
+  void SyncCore();
+  void SetBridge(uintptr_t site, uintptr_t trampoline);
+  uintptr_t FindBridge(uintptr_t site) const;
+  static void TrapHandler(int signal, siginfo_t *info, void *context);
+
+  static std::atomic<LinuxTracepoints *> s_tracepoints;
+
+  size_t m_page_size;
+  bool m_sync_core = false;
+  int m_ring_fd = -1;
+  RingHeader *m_ring = nullptr;
+  size_t m_ring_size = 0;
+  uint64_t m_tail = 0; // Next event Drain() reads
+  size_t m_max_tracepoints;
+  size_t m_bridge_table_size;
+  std::unique_ptr<Bridge[]> m_bridges; // Open addressing on the site
+  std::mutex m_mutex;                  // Serializes Set()/Remove(), never taken by the signal handler
+  std::map<uintptr_t, Tracepoint> m_tracepoints; // Site -> tracepoint, removed ones stay as the trampoline cache
+  std::map<uint32_t, uintptr_t> m_sites;         // ID -> site
+  LinuxCodeArena m_arena;
+  uint32_t m_next_id = 1;
+  Statistics m_stats;
+  struct sigaction m_old_trap = {};
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "lldb/LinuxMmap.h"
+#include "lldb/LinuxVMRegion.h"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+
+// Helpers shared by the in-process trap mechanisms; not part of their interface.
+
+#ifndef UFFD_USER_MODE_ONLY
+#define UFFD_USER_MODE_ONLY 1
+#endif
+
+// `what` failed with the current errno.
+inline std::runtime_error ErrnoError(const char *what) {
+  return std::runtime_error(std::string(what) + ": " + ::strerror(errno));
+}
+
+// PROT_* of the region of `index` holding `addr`, -1 when nothing is mapped there. Code is patched with the page made
+// writable and put back to exactly this afterwards, so RWX (JIT) pages stay writable.
+inline int Protection(const LinuxVMRegionIndex &index, uintptr_t addr) {
+  const LinuxVMRegion *region = index.FindRegion(addr);
+  if (region == NULL) return -1;
+  return ((region->permissions & eMemoryPermissionsReadable) ? PROT_READ : 0) |
+         ((region->permissions & eMemoryPermissionsWritable) ? PROT_WRITE : 0) |
+         ((region->permissions & eMemoryPermissionsExecutable) ? PROT_EXEC : 0);
+}
+
+// Passes a signal our handler does not claim on to the handler installed before it, `action`.
+inline void ForwardSignal(int signal, const struct sigaction &action, siginfo_t *info, void *context) {
+  if (action.sa_flags & SA_SIGINFO) {
+    if (action.sa_sigaction != nullptr) action.sa_sigaction(signal, info, context);
+    return;
+  }
+  if (action.sa_handler == SIG_IGN) return;
+  if (action.sa_handler != SIG_DFL) {
+    action.sa_handler(signal);
+    return;
+  }
+  // Let the default action happen as if we were not there: it is delivered once this handler returns.
+  struct sigaction default_action = {};
+  default_action.sa_handler = SIG_DFL;
+  ::sigaction(signal, &default_action, NULL);
+  ::raise(signal);
+}
@@ -0,0 +1,253 @@
+#include "LinuxWriteWatch.h"
+#include "LinuxTrapSupport.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/userfaultfd.h>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static uint64_t MonotonicNanoseconds() {
+  struct timespec now;
+  ::clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+static int OpenUserfaultfd() {
+  // User mode only is what vm.unprivileged_userfaultfd=0 still allows (5.11), and all a watch on our own writes needs.
+  int fd = static_cast<int>(::syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY));
+  if (fd < 0 && errno == EINVAL) fd = static_cast<int>(::syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK));
+  if (fd >= 0 || errno != EPERM) return fd;
+  // Without vm.unprivileged_userfaultfd, /dev/userfaultfd hands out descriptors to whoever may open it.
+  int device = ::open("/dev/userfaultfd", O_RDWR | O_CLOEXEC);
+  if (device < 0) {
+    errno = EPERM;
+    return -1;
+  }
+  fd = ::ioctl(device, USERFAULTFD_IOC_NEW, O_CLOEXEC | O_NONBLOCK);
+  ::close(device);
+  return fd;
+}
+
+// Calls `range` for every run of consecutive pages in the sorted `pages`.
+template <typename Function>
+static void ForEachRun(const std::vector<uintptr_t> &pages, size_t page_size, Function range) {
+  for (size_t i = 0; i < pages.size();) {
+    size_t j = i + 1;
+    while (j < pages.size() && pages[j] == pages[j - 1] + page_size) j++;
+    range(pages[i], (j - i) * page_size);
+    i = j;
+  }
+}
+
+LinuxWriteWatch::LinuxWriteWatch(Handler handler, uint64_t rearm_ns)
+    : m_handler(std::move(handler)), m_rearm_ns(rearm_ns), m_page_size(::sysconf(_SC_PAGESIZE)) {
+  // A userfaultfd takes a single UFFDIO_API, so the supported features are asked on a throwaway one.
+  int probe = OpenUserfaultfd();
+  if (probe < 0) throw ErrnoError("userfaultfd");
+  struct uffdio_api api = {UFFD_API, 0, 0};
+  int ret = ::ioctl(probe, UFFDIO_API, &api);
+  ::close(probe);
+  if (ret < 0) throw ErrnoError("UFFDIO_API");
+  if ((api.features & UFFD_FEATURE_PAGEFAULT_FLAG_WP) == 0) {
+    throw std::runtime_error("userfaultfd write protection is not supported");
+  }
+  const uint64_t features = api.features & (UFFD_FEATURE_PAGEFAULT_FLAG_WP | UFFD_FEATURE_THREAD_ID |
+                                            UFFD_FEATURE_EXACT_ADDRESS | UFFD_FEATURE_WP_HUGETLBFS_SHMEM);
+  m_uffd = OpenUserfaultfd();
+  if (m_uffd < 0) throw ErrnoError("userfaultfd");
+  api = {UFFD_API, features, 0};
+  m_stop_fd = ::eventfd(0, EFD_CLOEXEC);
+  if (::ioctl(m_uffd, UFFDIO_API, &api) < 0 || m_stop_fd < 0) {
+    std::runtime_error error = ErrnoError(m_stop_fd < 0 ? "eventfd" : "UFFDIO_API");
+    ::close(m_uffd);
+    if (m_stop_fd >= 0) ::close(m_stop_fd);
+    throw error;
+  }
+  m_exact_addresses = (features & UFFD_FEATURE_EXACT_ADDRESS) != 0;
+  m_open_pages.reserve(kMaxOpenPages);
+  m_faults.reserve(kMaxFaults);
+  m_events.reserve(kMaxEvents);
+  m_thread = std::thread(&LinuxWriteWatch::Run, this);
+}
+
+LinuxWriteWatch::~LinuxWriteWatch() {
+  // Unwatch everything before stopping the handler thread: it frees its own state on exit, maybe on a watched page.
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto &page : m_pages) {
+      struct uffdio_range range = {page.first, m_page_size};
+      ::ioctl(m_uffd, UFFDIO_UNREGISTER, &range);
+    }
+  }
+  uint64_t one = 1;
+  if (::write(m_stop_fd, &one, sizeof(one)) == sizeof(one)) m_thread.join();
+  else m_thread.detach();
+  ::close(m_uffd);
+  ::close(m_stop_fd);
+}
+
+uint32_t LinuxWriteWatch::Watch(const void *addr, size_t size) {
+  if (size == 0) throw std::runtime_error("empty watch");
+  const uintptr_t start = reinterpret_cast<uintptr_t>(addr);
+  const uintptr_t end = start + size;
+  const uintptr_t page_mask = ~static_cast<uintptr_t>(m_page_size - 1);
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::vector<uintptr_t> new_pages;
+  for (uintptr_t page = start & page_mask; page < end; page += m_page_size) {
+    if (m_pages.count(page) == 0) new_pages.push_back(page);
+  }
+  std::vector<std::pair<uintptr_t, size_t>> registered;
+  bool ok = true;
+  ForEachRun(new_pages, m_page_size, [&](uintptr_t run, size_t run_size) {
+    if (!ok) return;
+    // Before 6.4, protection only sticks to pages that are populated.
+    ::madvise(reinterpret_cast<void *>(run), run_size, MADV_POPULATE_WRITE);
+    struct uffdio_register reg = {{run, run_size}, UFFDIO_REGISTER_MODE_WP, 0};
+    struct uffdio_writeprotect wp = {{run, run_size}, UFFDIO_WRITEPROTECT_MODE_WP};
+    ok = ::ioctl(m_uffd, UFFDIO_REGISTER, &reg) == 0;
+    if (ok) registered.emplace_back(run, run_size);
+    ok = ok && ::ioctl(m_uffd, UFFDIO_WRITEPROTECT, &wp) == 0;
+  });
+  if (!ok) {
+    std::runtime_error error = ErrnoError("watch");
+    for (const auto &run : registered) {
+      struct uffdio_range range = {run.first, run.second};
+      ::ioctl(m_uffd, UFFDIO_UNREGISTER, &range);
+    }
+    throw error;
+  }
+  const uint32_t watch_id = m_next_id++;
+  m_objects[watch_id] = {start, end};
+  for (uintptr_t page = start & page_mask; page < end; page += m_page_size) m_pages[page].push_back(watch_id);
+  return watch_id;
+}
+
+void LinuxWriteWatch::Unwatch(uint32_t watch_id) {
+  const uintptr_t page_mask = ~static_cast<uintptr_t>(m_page_size - 1);
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto pos = m_objects.find(watch_id);
+  if (pos == m_objects.end()) return;
+  std::vector<uintptr_t> free_pages;
+  for (uintptr_t page = pos->second.start & page_mask; page < pos->second.end; page += m_page_size) {
+    std::vector<uint32_t> &ids = m_pages[page];
+    ids.erase(std::remove(ids.begin(), ids.end(), watch_id), ids.end());
+    if (!ids.empty()) continue;
+    m_pages.erase(page);
+    free_pages.push_back(page);
+  }
+  m_objects.erase(pos);
+  // Unregistering lifts the protection and wakes a writer blocked on the range.
+  ForEachRun(free_pages, m_page_size, [this](uintptr_t run, size_t run_size) {
+    struct uffdio_range range = {run, run_size};
+    if (::ioctl(m_uffd, UFFDIO_UNREGISTER, &range) < 0) throw ErrnoError("UFFDIO_UNREGISTER");
+  });
+}
+
+void LinuxWriteWatch::Protect(uintptr_t page, bool protect) {
+  // Lifting the protection wakes the writers blocked on the page. Fails harmlessly on a page unwatched meanwhile.
+  struct uffdio_writeprotect wp = {{page, m_page_size}, protect ? UFFDIO_WRITEPROTECT_MODE_WP : 0};
+  ::ioctl(m_uffd, UFFDIO_WRITEPROTECT, &wp);
+}
+
+void LinuxWriteWatch::HandleFault(uintptr_t addr, pid_t tid, uint64_t time_ns) {
+  m_stats.faults++;
+  const uintptr_t page = addr & ~static_cast<uintptr_t>(m_page_size - 1);
+  // Lift the protection before anything else: the writer may be holding m_mutex.
+  Protect(page, false);
+  if (m_open_pages.size() == kMaxOpenPages) {
+    Protect(m_open_pages.front().second, true);
+    m_open_pages.erase(m_open_pages.begin());
+    m_stats.rearms++;
+  }
+  m_open_pages.emplace_back(time_ns + m_rearm_ns, page);
+  if (m_faults.size() == kMaxFaults) {
+    m_stats.dropped++;
+    return;
+  }
+  m_faults.push_back({addr, tid, time_ns});
+}
+
+void LinuxWriteWatch::DispatchFaults() {
+  // The lock holder may be a writer whose fault is not read yet, so never wait for it.
+  std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+  if (!lock.owns_lock()) return;
+  m_events.clear();
+  size_t dispatched = 0;
+  for (; dispatched < m_faults.size(); dispatched++) {
+    const Fault &fault = m_faults[dispatched];
+    const uintptr_t page = fault.addr & ~static_cast<uintptr_t>(m_page_size - 1);
+    const size_t first_event = m_events.size();
+    auto pos = m_pages.find(page);
+    if (pos != m_pages.end()) {
+      // Leave the fault for the next round when its events do not fit, unless it is the first one.
+      if (first_event != 0 && first_event + pos->second.size() > kMaxEvents) break;
+      for (uint32_t watch_id : pos->second) {
+        const Object &object = m_objects.find(watch_id)->second;
+        // Without exact addresses all we know is the page.
+        const bool inside = m_exact_addresses ? (fault.addr >= object.start && fault.addr < object.end)
+                                              : (object.start < page + m_page_size && object.end > page);
+        if (inside && m_events.size() < kMaxEvents) {
+          m_events.push_back({fault.addr, watch_id, fault.tid, fault.time_ns});
+        }
+      }
+    }
+    if (m_events.size() == first_event) m_stats.stray_faults++;
+  }
+  lock.unlock();
+  m_faults.erase(m_faults.begin(), m_faults.begin() + dispatched);
+  for (const Event &event : m_events) {
+    m_handler(event);
+    m_stats.events++;
+  }
+}
+
+void LinuxWriteWatch::Run() {
+  struct pollfd fds[2] = {{m_uffd, POLLIN, 0}, {m_stop_fd, POLLIN, 0}};
+  struct uffd_msg messages[kMessageBatch];
+  for (;;) {
+    struct timespec timeout;
+    struct timespec *timeout_ptr = NULL;
+    if (!m_faults.empty() || !m_open_pages.empty()) {
+      const uint64_t now = MonotonicNanoseconds();
+      uint64_t wait_ns = UINT64_MAX;
+      if (!m_open_pages.empty()) wait_ns = m_open_pages.front().first > now ? m_open_pages.front().first - now : 0;
+      if (!m_faults.empty()) wait_ns = std::min(wait_ns, kRetryNs);
+      timeout = {static_cast<time_t>(wait_ns / 1000000000), static_cast<long>(wait_ns % 1000000000)};
+      timeout_ptr = &timeout;
+    }
+    if (::ppoll(fds, 2, timeout_ptr, NULL) < 0 && errno != EINTR) break;
+    if (fds[1].revents != 0) break;
+
+    // Faults are always read and their pages opened, even with no room left to report them: the writer may be the
+    // one holding the lock.
+    const ssize_t bytes_read = ::read(m_uffd, messages, sizeof(messages));
+    const uint64_t now = MonotonicNanoseconds();
+    for (ssize_t i = 0; i < bytes_read / static_cast<ssize_t>(sizeof(uffd_msg)); i++) {
+      const uffd_msg &message = messages[i];
+      if (message.event != UFFD_EVENT_PAGEFAULT || (message.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP) == 0) {
+        continue;
+      }
+      HandleFault(message.arg.pagefault.address, static_cast<pid_t>(message.arg.pagefault.feat.ptid), now);
+    }
+    if (!m_faults.empty()) DispatchFaults();
+
+    // Deadlines are in fault order, the expired ones are a prefix.
+    const uint64_t rearm_time = MonotonicNanoseconds();
+    size_t expired = 0;
+    while (expired < m_open_pages.size() && m_open_pages[expired].first <= rearm_time) {
+      Protect(m_open_pages[expired].second, true);
+      expired++;
+    }
+    m_open_pages.erase(m_open_pages.begin(), m_open_pages.begin() + expired);
+    m_stats.rearms += expired;
+  }
+}
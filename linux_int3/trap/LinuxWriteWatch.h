@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// In-process write watch on userfaultfd write protection, the data counterpart of trapping code with INT3: the pages
+// holding the watched objects are write protected, and a write to them blocks the writing thread and queues a fault
+// message instead of raising a signal. A handler thread reads the messages, lifts the protection of the one page that
+// faulted so the writer continues, and hands the write to the Handler. Cost is paid per write that faults, not per
+// watched byte, so hundreds of objects can be watched where the debug registers hold four.
+//
+// Writing needs the page unprotected, so the page is protected again `rearm_ns` after the fault (the writer has
+// normally retried by then): further writes to the same page inside that window are folded into the first event,
+// and a writer that had not retried yet faults once more and is reported twice. Only writes that fall inside a
+// watched object are reported; other writes to a watched page cost a fault and are counted as stray.
+//
+// Private anonymous memory works on any kernel with userfaultfd write protection (5.7), shmem and hugetlbfs need
+// 5.19. Where the kernel has it (5.11), the userfaultfd only handles faults from user mode: a write the kernel makes
+// to a watched page on the process's behalf, e.g. read(2) into a watched buffer, is not reported but fails with
+// EFAULT. The Handler runs on the handler thread and must not write to watched memory, the thread would block on
+// itself. For the same reason the handler thread works in buffers allocated up front, and lifts the protection
+// before it takes the lock Watch()/Unwatch() hold while they allocate: any malloc may touch a watched heap page.
+class LinuxWriteWatch {
+public:
+  struct Event {
+    uintptr_t addr;    // Written address, rounded down to the page on kernels without exact addresses (5.18)
+    uint32_t watch_id; // The watched object it falls in
+    pid_t tid;         // The writing thread
+    uint64_t time_ns;  // CLOCK_MONOTONIC when the fault was read
+  };
+  typedef std::function<void(const Event &event)> Handler;
+
+  struct Statistics {
+    std::atomic<uint64_t> faults{0};       // Write faults read from the userfaultfd
+    std::atomic<uint64_t> events{0};       // Handler calls
+    std::atomic<uint64_t> stray_faults{0}; // Faults on watched pages outside every watched object
+    std::atomic<uint64_t> rearms{0};       // Pages protected again after a fault
+    std::atomic<uint64_t> dropped{0};      // Faults not reported: Watch()/Unwatch() held the lock too long
+  };
+
+  // Opens the userfaultfd and starts the handler thread; throws std::runtime_error when userfaultfd or its write
+  // protection is not available (unprivileged use before 5.11 needs vm.unprivileged_userfaultfd=1 or /dev/userfaultfd
+  // access).
+  explicit LinuxWriteWatch(Handler handler, uint64_t rearm_ns = 100000);
+  ~LinuxWriteWatch();
+  LinuxWriteWatch(const LinuxWriteWatch &) = delete;
+  LinuxWriteWatch &operator=(const LinuxWriteWatch &) = delete;
+
+  // Watches writes to [addr, addr + size) and returns the watch ID. Objects may share pages and overlap.
+  uint32_t Watch(const void *addr, size_t size);
+  void Unwatch(uint32_t watch_id);
+  bool ExactAddresses() const { return m_exact_addresses; }
+  const Statistics &GetStatistics() const { return m_stats; }
+
+private:
+  struct Object {
+    uintptr_t start;
+    uintptr_t end;
+  };
+
+  struct Fault {
+    uintptr_t addr;
+    pid_t tid;
+    uint64_t time_ns;
+  };
+
+  static constexpr size_t kMessageBatch = 64;
+  static constexpr size_t kMaxFaults = 256;      // Faults read but not dispatched yet
+  static constexpr size_t kMaxEvents = 1024;     // Events of one dispatch
+  static constexpr size_t kMaxOpenPages = 1024;  // Beyond that the oldest page is protected early
+  static constexpr uint64_t kRetryNs = 50000;    // Poll interval while the lock is busy
+
+  void Run();
+  void HandleFault(uintptr_t addr, pid_t tid, uint64_t time_ns);
+  void DispatchFaults();
+  void Protect(uintptr_t page, bool protect);
+
+  Handler m_handler;
+  uint64_t m_rearm_ns;
+  size_t m_page_size;
+  int m_uffd = -1;
+  int m_stop_fd = -1;
+  bool m_exact_addresses = false;
+  std::mutex m_mutex; // Guards the maps below, shared by Watch()/Unwatch() and the handler thread
+  std::map<uint32_t, Object> m_objects;
+  std::unordered_map<uintptr_t, std::vector<uint32_t>> m_pages; // Watched page -> objects on it
+  uint32_t m_next_id = 1;
+  // Handler thread only
+  std::vector<std::pair<uint64_t, uintptr_t>> m_open_pages; // (rearm deadline, page)
+  std::vector<Fault> m_faults;
+  std::vector<Event> m_events;
+  Statistics m_stats;
+  std::thread m_thread;
+};
@@ -0,0 +1,112 @@
+#include "lldb/LinuxInstruction.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <dlfcn.h>
+#include <elf.h>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// Throughput of the instruction decoder over the .text sections of real binaries: the executable itself and the C
+// library by default, or the ELF files given on the command line. Code is decoded linearly from the start of the
+// section; a byte that does not decode (padding, data in code) is skipped.
+
+static constexpr int kRounds = 5;
+
+// Reads the .text section of the 64-bit ELF file at `path`; empty when there is none.
+static std::vector<uint8_t> ReadText(const char *path) {
+  std::ifstream file(path, std::ios::binary);
+  std::vector<uint8_t> image((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  if (image.size() < sizeof(Elf64_Ehdr) || ::memcmp(image.data(), ELFMAG, SELFMAG) != 0 ||
+      image[EI_CLASS] != ELFCLASS64) {
+    return {};
+  }
+  const Elf64_Ehdr *header = reinterpret_cast<const Elf64_Ehdr *>(image.data());
+  if (header->e_shoff + header->e_shnum * sizeof(Elf64_Shdr) > image.size() ||
+      header->e_shstrndx >= header->e_shnum) {
+    return {};
+  }
+  const Elf64_Shdr *sections = reinterpret_cast<const Elf64_Shdr *>(image.data() + header->e_shoff);
+  const Elf64_Shdr &names = sections[header->e_shstrndx];
+  for (size_t i = 0; i < header->e_shnum; i++) {
+    const Elf64_Shdr &section = sections[i];
+    if (section.sh_type != SHT_PROGBITS || section.sh_name >= names.sh_size ||
+        section.sh_offset + section.sh_size > image.size()) {
+      continue;
+    }
+    const char *name = reinterpret_cast<const char *>(image.data() + names.sh_offset + section.sh_name);
+    if (::strcmp(name, ".text") != 0) continue;
+    return std::vector<uint8_t>(image.begin() + section.sh_offset, image.begin() + section.sh_offset + section.sh_size);
+  }
+  return {};
+}
+
+struct DecodeCounts {
+  uint64_t instructions = 0;
+  uint64_t invalid = 0; // Bytes skipped
+  uint64_t rip_relative = 0;
+  uint64_t branches = 0; // Relative jumps, calls and loops
+};
+
+static DecodeCounts DecodeText(const std::vector<uint8_t> &text) {
+  DecodeCounts counts;
+  LinuxInstruction insn;
+  for (size_t pos = 0; pos < text.size();) {
+    if (!DecodeInstruction(text.data() + pos, text.size() - pos, &insn)) {
+      counts.invalid++;
+      pos++;
+      continue;
+    }
+    counts.instructions++;
+    counts.rip_relative += insn.rip_relative;
+    switch (insn.flow) {
+    case LinuxInstruction::eFlowJump:
+    case LinuxInstruction::eFlowConditionalJump:
+    case LinuxInstruction::eFlowCall:
+    case LinuxInstruction::eFlowLoop:
+      counts.branches++;
+      break;
+    default:
+      break;
+    }
+    pos += insn.length;
+  }
+  return counts;
+}
+
+static void BenchDecoder(const char *path) {
+  const std::vector<uint8_t> text = ReadText(path);
+  if (text.empty()) {
+    std::printf("%s: no .text section\n", path);
+    return;
+  }
+  DecodeCounts counts;
+  double best = 0;
+  for (int round = 0; round < kRounds; round++) {
+    const auto start = std::chrono::steady_clock::now();
+    counts = DecodeText(text);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (round == 0 || seconds < best) best = seconds;
+  }
+  std::printf("%s: %.1f MB of .text, %.0f MB/s, %.0f M instructions/s\n", path, text.size() / 1e6,
+              text.size() / best / 1e6, counts.instructions / best / 1e6);
+  std::printf("  %llu instructions, %llu RIP-relative, %llu relative branches, %llu bytes skipped\n",
+              static_cast<unsigned long long>(counts.instructions),
+              static_cast<unsigned long long>(counts.rip_relative), static_cast<unsigned long long>(counts.branches),
+              static_cast<unsigned long long>(counts.invalid));
+}
+
+int main(int argc, const char *argv[]) {
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) BenchDecoder(argv[i]);
+    return 0;
+  }
+  BenchDecoder("/proc/self/exe");
+  Dl_info libc;
+  if (::dladdr(reinterpret_cast<void *>(&::printf), &libc) != 0 && libc.dli_fname != nullptr) {
+    BenchDecoder(libc.dli_fname);
+  }
+  return 0;
+}
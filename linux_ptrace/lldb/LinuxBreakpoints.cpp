@@ -0,0 +1,209 @@
+#include "LinuxBreakpoints.h"
+#include <algorithm>
+#include <cerrno>
+
+static constexpr uint8_t kInt3 = 0xcc;
+
+LinuxBreakpoints::LinuxBreakpoints(LinuxVMMemory &vm_memory, Writer writer)
+    : m_vm_memory(vm_memory), m_writer(std::move(writer)) {
+  if (!m_writer) {
+    m_writer = [&vm_memory](nub_process_t pid, DNBMemoryRequest *requests, nub_size_t request_count) {
+      return vm_memory.WriteBatch(pid, requests, request_count);
+    };
+  }
+}
+
+bool LinuxBreakpoints::Patch(nub_process_t pid, const std::vector<nub_addr_t> &addrs, bool insert,
+                             std::vector<bool> &written) {
+  written.assign(addrs.size(), false);
+  if (addrs.empty()) return true;
+  const nub_size_t page_size = m_vm_memory.PageSize();
+
+  // One range per page, from its first to its last site. `first_site` is the index of the first site of each.
+  std::vector<DNBMemoryRequest> requests;
+  std::vector<size_t> first_site;
+  nub_size_t buffer_size = 0;
+  for (size_t i = 0; i < addrs.size(); i++) {
+    const nub_addr_t page = addrs[i] - addrs[i] % page_size;
+    if (requests.empty() || requests.back().addr - requests.back().addr % page_size != page) {
+      requests.push_back({addrs[i], 0, NULL, 0});
+      first_site.push_back(i);
+    }
+    buffer_size -= requests.back().size;
+    requests.back().size = addrs[i] + 1 - requests.back().addr;
+    buffer_size += requests.back().size;
+  }
+  first_site.push_back(addrs.size());
+  std::vector<uint8_t> buffer(buffer_size);
+  nub_size_t offset = 0;
+  for (DNBMemoryRequest &request : requests) {
+    request.data = buffer.data() + offset;
+    offset += request.size;
+  }
+
+  m_vm_memory.ReadBatch(pid, requests.data(), requests.size());
+  if (m_vm_memory.GetError().Fail()) {
+    m_err = m_vm_memory.GetError();
+    return false;
+  }
+  for (size_t r = 0; r < requests.size(); r++) {
+    DNBMemoryRequest &request = requests[r];
+    // Only what could be read is written back.
+    request.size = request.bytes_transferred;
+    uint8_t *data = static_cast<uint8_t *>(request.data);
+    for (size_t i = first_site[r]; i < first_site[r + 1] && addrs[i] < request.addr + request.size; i++) {
+      Breakpoint &site = m_sites[addrs[i]];
+      uint8_t &byte = data[addrs[i] - request.addr];
+      if (insert && !site.inserted) site.saved_opcode = byte;
+      byte = insert ? kInt3 : site.saved_opcode;
+    }
+  }
+  requests.erase(std::remove_if(requests.begin(), requests.end(),
+                                [](const DNBMemoryRequest &request) { return request.size == 0; }),
+                 requests.end());
+  m_writer(pid, requests.data(), requests.size());
+  m_stats.ranges_written += requests.size();
+
+  bool ok = true;
+  size_t r = 0;
+  for (size_t i = 0; i < addrs.size(); i++) {
+    while (r < requests.size() && requests[r].addr + requests[r].size <= addrs[i]) r++;
+    if (r < requests.size() && requests[r].addr <= addrs[i] && addrs[i] < requests[r].addr +
+        requests[r].bytes_transferred) {
+      m_sites[addrs[i]].inserted = insert;
+      written[i] = true;
+      m_stats.sites_written++;
+    } else {
+      ok = false;
+    }
+  }
+  if (!ok && m_err.Success()) m_err.SetError(EFAULT, DNBError::POSIX);
+  return ok;
+}
+
+bool LinuxBreakpoints::Set(nub_process_t pid, const std::vector<nub_addr_t> &addrs, std::vector<nub_break_t> &ids) {
+  m_err.Clear();
+  std::vector<nub_addr_t> new_addrs;
+  for (nub_addr_t addr : addrs) {
+    if (m_sites.count(addr) == 0) new_addrs.push_back(addr);
+  }
+  std::sort(new_addrs.begin(), new_addrs.end());
+  new_addrs.erase(std::unique(new_addrs.begin(), new_addrs.end()), new_addrs.end());
+  for (nub_addr_t addr : new_addrs) m_sites[addr] = Breakpoint{INVALID_NUB_BREAK_ID, addr, 0, false, 0};
+
+  std::vector<bool> written;
+  const bool ok = Patch(pid, new_addrs, true, written);
+  for (size_t i = 0; i < new_addrs.size(); i++) {
+    if (!written[i]) {
+      m_sites.erase(new_addrs[i]);
+      continue;
+    }
+    Breakpoint &site = m_sites[new_addrs[i]];
+    site.id = m_next_id++;
+    m_ids[site.id] = site.addr;
+  }
+  ids.resize(addrs.size());
+  for (size_t i = 0; i < addrs.size(); i++) {
+    auto pos = m_sites.find(addrs[i]);
+    ids[i] = pos != m_sites.end() ? pos->second.id : INVALID_NUB_BREAK_ID;
+  }
+  return ok;
+}
+
+nub_break_t LinuxBreakpoints::Set(nub_process_t pid, nub_addr_t addr) {
+  std::vector<nub_break_t> ids;
+  Set(pid, std::vector<nub_addr_t>{addr}, ids);
+  return ids[0];
+}
+
+bool LinuxBreakpoints::Remove(nub_process_t pid, const std::vector<nub_break_t> &ids) {
+  m_err.Clear();
+  std::vector<nub_addr_t> addrs;
+  for (nub_break_t id : ids) {
+    auto pos = m_ids.find(id);
+    if (pos == m_ids.end()) {
+      m_err.SetError(ENOENT, DNBError::POSIX);
+      continue;
+    }
+    // A lifted site has its original byte in place already.
+    if (m_sites[pos->second].inserted) {
+      addrs.push_back(pos->second);
+    } else {
+      m_sites.erase(pos->second);
+      m_ids.erase(pos);
+    }
+  }
+  std::sort(addrs.begin(), addrs.end());
+  addrs.erase(std::unique(addrs.begin(), addrs.end()), addrs.end());
+
+  std::vector<bool> written;
+  bool ok = Patch(pid, addrs, false, written) && m_err.Success();
+  for (size_t i = 0; i < addrs.size(); i++) {
+    if (!written[i]) continue;
+    m_ids.erase(m_sites[addrs[i]].id);
+    m_sites.erase(addrs[i]);
+  }
+  return ok;
+}
+
+bool LinuxBreakpoints::RemoveAll(nub_process_t pid) {
+  std::vector<nub_break_t> ids;
+  ids.reserve(m_ids.size());
+  for (const auto &site : m_sites) ids.push_back(site.second.id);
+  return Remove(pid, ids);
+}
+
+bool LinuxBreakpoints::Lift(nub_process_t pid, nub_addr_t addr) {
+  m_err.Clear();
+  auto pos = m_sites.find(addr);
+  if (pos == m_sites.end() || !pos->second.inserted) return true;
+  std::vector<bool> written;
+  return Patch(pid, std::vector<nub_addr_t>{addr}, false, written);
+}
+
+bool LinuxBreakpoints::Reinsert(nub_process_t pid, nub_addr_t addr) {
+  m_err.Clear();
+  auto pos = m_sites.find(addr);
+  if (pos == m_sites.end() || pos->second.inserted) return true;
+  std::vector<bool> written;
+  return Patch(pid, std::vector<nub_addr_t>{addr}, true, written);
+}
+
+const LinuxBreakpoints::Breakpoint *LinuxBreakpoints::Find(nub_break_t id) const {
+  auto pos = m_ids.find(id);
+  return pos != m_ids.end() ? &m_sites.at(pos->second) : NULL;
+}
+
+const LinuxBreakpoints::Breakpoint *LinuxBreakpoints::FindByAddress(nub_addr_t addr) const {
+  auto pos = m_sites.find(addr);
+  return pos != m_sites.end() ? &pos->second : NULL;
+}
+
+const LinuxBreakpoints::Breakpoint *LinuxBreakpoints::Hit(nub_addr_t pc) {
+  auto pos = m_sites.find(pc - 1);
+  if (pos == m_sites.end() || !pos->second.inserted) return NULL;
+  pos->second.hit_count++;
+  m_stats.hits++;
+  return &pos->second;
+}
+
+bool LinuxBreakpoints::Overlaps(nub_addr_t addr, nub_size_t size) const {
+  auto pos = m_sites.lower_bound(addr);
+  return pos != m_sites.end() && pos->first - addr < size;
+}
+
+void LinuxBreakpoints::MaskRead(nub_addr_t addr, void *data, nub_size_t size) const {
+  uint8_t *bytes = static_cast<uint8_t *>(data);
+  for (auto pos = m_sites.lower_bound(addr); pos != m_sites.end() && pos->first - addr < size; ++pos) {
+    if (pos->second.inserted) bytes[pos->first - addr] = pos->second.saved_opcode;
+  }
+}
+
+void LinuxBreakpoints::PatchWrite(nub_addr_t addr, void *data, nub_size_t size) {
+  uint8_t *bytes = static_cast<uint8_t *>(data);
+  for (auto pos = m_sites.lower_bound(addr); pos != m_sites.end() && pos->first - addr < size; ++pos) {
+    // A lifted site is written through, its byte in the process is the original one.
+    pos->second.saved_opcode = bytes[pos->first - addr];
+    if (pos->second.inserted) bytes[pos->first - addr] = kInt3;
+  }
+}
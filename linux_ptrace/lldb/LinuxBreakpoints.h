@@ -0,0 +1,85 @@
+#pragma once
+
+#include "DNBDefs.h"
+#include "DNBError.h"
+#include "LinuxVMMemory.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+// Software breakpoints: an INT3 (0xcc) over the first byte of the instruction, the original byte kept in a table.
+// Sites are inserted and removed in batches grouped by page: the span of each page from its first to its last site
+// is read, patched and written back as one range, and all ranges go through one batch read and one batch write, so
+// ten thousand function entries cost a write per page instead of a write per site.
+//
+// The table is also what keeps the breakpoints invisible: MaskRead() puts the original bytes back into anything read
+// from the process and PatchWrite() keeps the INT3s in place when a write covers a site, taking the written bytes as
+// the new original ones.
+class LinuxBreakpoints {
+public:
+  struct Breakpoint {
+    nub_break_t id;
+    nub_addr_t addr;
+    uint8_t saved_opcode; // The byte under the INT3
+    bool inserted;        // False while lifted for stepping over it
+    uint32_t hit_count;
+  };
+
+  struct Statistics {
+    uint64_t sites_written = 0;  // Sites inserted or removed
+    uint64_t ranges_written = 0; // Page spans written for them
+    uint64_t hits = 0;
+  };
+
+  // Writes one batch of ranges to the process and fills in their `bytes_transferred`, see LinuxVMMemory::WriteBatch.
+  typedef std::function<nub_size_t(nub_process_t pid, DNBMemoryRequest *requests, nub_size_t request_count)> Writer;
+
+  // Code is read through `vm_memory` and written through `writer`, which defaults to `vm_memory` as well. The
+  // process passes its own writer to keep its caches in step.
+  explicit LinuxBreakpoints(LinuxVMMemory &vm_memory, Writer writer = Writer());
+
+  // Sets a breakpoint at each of `addrs` in the stopped process; `ids` gets its ID, or INVALID_NUB_BREAK_ID where
+  // the code could not be read or written. An address that has a breakpoint already keeps it and its ID. Returns
+  // false and sets the error when any address failed.
+  bool Set(nub_process_t pid, const std::vector<nub_addr_t> &addrs, std::vector<nub_break_t> &ids);
+  nub_break_t Set(nub_process_t pid, nub_addr_t addr);
+  bool Remove(nub_process_t pid, const std::vector<nub_break_t> &ids);
+  // Takes every INT3 out of the code, which must happen before detaching: a trap nobody waits for kills the process.
+  bool RemoveAll(nub_process_t pid);
+  // Puts back the original byte of the site at `addr` so a thread can step over it, and the INT3 after the step.
+  bool Lift(nub_process_t pid, nub_addr_t addr);
+  bool Reinsert(nub_process_t pid, nub_addr_t addr);
+
+  const Breakpoint *Find(nub_break_t id) const;
+  const Breakpoint *FindByAddress(nub_addr_t addr) const;
+  size_t Count() const { return m_ids.size(); }
+  // For a thread that trapped on an INT3 and stopped at `pc`, right behind it: the breakpoint it hit, counted, or
+  // NULL when the INT3 is not ours. The thread's pc is then to be rewound to the breakpoint address.
+  const Breakpoint *Hit(nub_addr_t pc);
+
+  bool Overlaps(nub_addr_t addr, nub_size_t size) const;
+  // Replaces the INT3s in `data`, read from [addr, addr + size), by the original bytes.
+  void MaskRead(nub_addr_t addr, void *data, nub_size_t size) const;
+  // For `data` about to be written to [addr, addr + size): keeps its bytes at the sites as the original ones and
+  // puts INT3s in their place.
+  void PatchWrite(nub_addr_t addr, void *data, nub_size_t size);
+
+  const Statistics &GetStatistics() const { return m_stats; }
+  const DNBError &GetError() const { return m_err; }
+
+private:
+  // Writes INT3s (`insert`) or the original bytes over the sites at `addrs`, sorted and unique, one range per page.
+  // Sets `written` for the sites that made it.
+  bool Patch(nub_process_t pid, const std::vector<nub_addr_t> &addrs, bool insert, std::vector<bool> &written);
+
+  LinuxVMMemory &m_vm_memory;
+  Writer m_writer;
+  std::map<nub_addr_t, Breakpoint> m_sites;
+  std::unordered_map<nub_break_t, nub_addr_t> m_ids;
+  nub_break_t m_next_id = 1;
+  Statistics m_stats;
+  DNBError m_err;
+};
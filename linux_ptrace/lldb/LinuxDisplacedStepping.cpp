@@ -0,0 +1,187 @@
+#include "LinuxDisplacedStepping.h"
+#include "LinuxMmap.h"
+#include "LinuxProcess.h"
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// jmp qword ptr [rip + 0], followed by the 8 byte target.
+static const uint8_t kJumpBack[6] = {0xff, 0x25, 0x00, 0x00, 0x00, 0x00};
+static constexpr nub_size_t kJumpBackSize = sizeof(kJumpBack) + sizeof(uint64_t);
+
+// Whether a copy at `slot` can still reach what a rel32 of the instruction at `addr` reached.
+static bool InReach(nub_addr_t slot, nub_addr_t addr) {
+  const int64_t distance = static_cast<int64_t>(slot - addr);
+  return distance > INT32_MIN / 2 && distance < INT32_MAX / 2;
+}
+
+static bool IsStringOperation(const LinuxInstruction &insn) {
+  return insn.opcode_map == 0 && ((insn.opcode >= 0x6c && insn.opcode <= 0x6f) ||
+                                  (insn.opcode >= 0xa4 && insn.opcode <= 0xa7) ||
+                                  (insn.opcode >= 0xaa && insn.opcode <= 0xaf));
+}
+
+bool LinuxDisplacedStepping::Prepare(pid_t tid, nub_addr_t addr, const uint8_t *code, size_t code_size,
+                                     user_regs_struct &gpr) {
+  m_err.Clear();
+  LinuxInstruction insn;
+  if (!DecodeInstruction(code, code_size, &insn)) {
+    m_stats.refused++;
+    return false;
+  }
+  const nub_addr_t next = addr + insn.length;
+  const nub_addr_t target = next + insn.branch_offset;
+  switch (insn.flow) {
+  case LinuxInstruction::eFlowJump:
+    gpr.rip = target;
+    m_stats.emulated++;
+    return true;
+  case LinuxInstruction::eFlowConditionalJump:
+    gpr.rip = ConditionHolds(insn.condition, gpr.eflags) ? target : next;
+    m_stats.emulated++;
+    return true;
+  case LinuxInstruction::eFlowCall: {
+    const uint64_t return_addr = next;
+    if (m_process.WriteMemory(gpr.rsp - sizeof(return_addr), sizeof(return_addr), &return_addr) !=
+        sizeof(return_addr)) {
+      m_stats.refused++;
+      return false;
+    }
+    gpr.rsp -= sizeof(return_addr);
+    gpr.rip = target;
+    m_stats.emulated++;
+    return true;
+  }
+  case LinuxInstruction::eFlowSystem:
+    // Of those only syscall runs the same from anywhere.
+    if (insn.opcode_map != 1 || insn.opcode != 0x05) break;
+    [[fallthrough]];
+  case LinuxInstruction::eFlowNone:
+  case LinuxInstruction::eFlowIndirectJump:
+  case LinuxInstruction::eFlowReturn: {
+    // A rep string operation interrupted half way would restart from the copy's start, which reads as a new hit.
+    if (insn.rep && IsStringOperation(insn)) break;
+    const nub_addr_t slot = PrepareSlot(tid, addr, code, insn);
+    if (slot == INVALID_NUB_ADDRESS) break;
+    gpr.rip = slot;
+    m_stats.displaced++;
+    return true;
+  }
+  default:
+    break;
+  }
+  m_stats.refused++;
+  return false;
+}
+
+nub_addr_t LinuxDisplacedStepping::PrepareSlot(pid_t tid, nub_addr_t addr, const uint8_t *code,
+                                               const LinuxInstruction &insn) {
+  auto pos = m_slots.find(addr);
+  if (pos != m_slots.end() && pos->second.length == insn.length &&
+      ::memcmp(pos->second.code, code, insn.length) == 0) {
+    return pos->second.addr;
+  }
+  // The code under the breakpoint changed: no thread is inside a copy while the process is stopped, so it is
+  // rewritten in place.
+  const nub_addr_t slot = pos != m_slots.end() ? pos->second.addr : AllocateSlot(tid, addr);
+  if (slot == INVALID_NUB_ADDRESS) return INVALID_NUB_ADDRESS;
+
+  uint8_t copy[kSlotSize];
+  ::memcpy(copy, code, insn.length);
+  if (insn.rip_relative) {
+    int32_t disp;
+    ::memcpy(&disp, copy + insn.disp_offset, sizeof(disp));
+    const int64_t rebased = disp + static_cast<int64_t>(addr - slot);
+    if (rebased < INT32_MIN || rebased > INT32_MAX) return INVALID_NUB_ADDRESS;
+    disp = static_cast<int32_t>(rebased);
+    ::memcpy(copy + insn.disp_offset, &disp, sizeof(disp));
+  }
+  const uint64_t next = addr + insn.length;
+  ::memcpy(copy + insn.length, kJumpBack, sizeof(kJumpBack));
+  ::memcpy(copy + insn.length + sizeof(kJumpBack), &next, sizeof(next));
+  const nub_size_t copy_size = insn.length + kJumpBackSize;
+  if (m_process.WriteMemory(slot, copy_size, copy) != copy_size) {
+    m_err.SetError(EFAULT, DNBError::POSIX);
+    return INVALID_NUB_ADDRESS;
+  }
+
+  Slot &entry = m_slots[addr];
+  entry.addr = slot;
+  entry.length = insn.length;
+  ::memcpy(entry.code, code, insn.length);
+  m_owners[slot] = addr;
+  m_stats.slots++;
+  return slot;
+}
+
+nub_addr_t LinuxDisplacedStepping::AllocateSlot(pid_t tid, nub_addr_t addr) {
+  Area *area = NULL;
+  for (Area &candidate : m_areas) {
+    if (candidate.used < kAreaSize && InReach(candidate.start, addr)) {
+      area = &candidate;
+      break;
+    }
+  }
+  if (area == NULL) {
+    if (!MapArea(tid, addr)) return INVALID_NUB_ADDRESS;
+    area = &m_areas.back();
+  }
+  const nub_addr_t slot = area->start + area->used;
+  area->used += kSlotSize;
+  return slot;
+}
+
+bool LinuxDisplacedStepping::MapArea(pid_t tid, nub_addr_t near_addr) {
+  // Probe free space at growing distances on both sides of the code; MAP_FIXED_NOREPLACE fails on anything mapped.
+  const nub_addr_t base = near_addr & ~static_cast<nub_addr_t>(kAreaSize - 1);
+  for (nub_addr_t distance = 1 << 20; distance <= (1ull << 30); distance *= 4) {
+    for (int side = 0; side < 2; side++) {
+      const nub_addr_t hint = side == 0 ? base - distance : base + distance;
+      if (side == 0 && distance > base) continue;
+      uint64_t result = 0;
+      if (!m_process.InjectSyscall(tid, SYS_mmap,
+                                   {hint, kAreaSize, PROT_READ | PROT_EXEC,
+                                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, static_cast<uint64_t>(-1), 0},
+                                   &result)) {
+        m_err.SetErrorToErrno();
+        return false;
+      }
+      if (static_cast<int64_t>(result) < 0 && static_cast<int64_t>(result) > -4096) continue;
+      // An old kernel may have taken the flag for a hint, see LinuxMmap.h.
+      if (result != hint && !InReach(result, near_addr)) {
+        m_process.InjectSyscall(tid, SYS_munmap, {result, kAreaSize}, NULL);
+        continue;
+      }
+      m_areas.push_back({result, 0});
+      m_stats.areas++;
+      return true;
+    }
+  }
+  m_err.SetError(ENOMEM, DNBError::POSIX);
+  return false;
+}
+
+bool LinuxDisplacedStepping::Relocate(nub_addr_t &pc) const {
+  auto pos = m_owners.upper_bound(pc);
+  if (pos == m_owners.begin()) return false;
+  --pos;
+  const Slot &slot = m_slots.at(pos->second);
+  if (pc == slot.addr) {
+    pc = pos->second;
+  } else if (pc == slot.addr + slot.length) {
+    pc = pos->second + slot.length;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void LinuxDisplacedStepping::Clear(pid_t tid) {
+  if (tid != INVALID_NUB_PROCESS) {
+    for (const Area &area : m_areas) m_process.InjectSyscall(tid, SYS_munmap, {area.start, kAreaSize}, NULL);
+  }
+  m_areas.clear();
+  m_slots.clear();
+  m_owners.clear();
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "DNBDefs.h"
+#include "DNBError.h"
+#include "LinuxInstruction.h"
+#include <cstdint>
+#include <map>
+#include <sys/types.h>
+#include <sys/user.h>
+#include <vector>
+
+class LinuxProcess;
+
+// Continues threads past software breakpoints without taking the INT3 out: the instruction under the breakpoint is
+// executed out of line, from a copy in a scratch area mapped into the tracee, followed by an absolute jump back
+// behind the original. RIP-relative operands of the copy are rebased; the scratch areas are placed within reach of
+// the code (+-2GB) for that. Relative jumps, conditional jumps and calls are not copied but emulated on the
+// registers. Threads then resume together at full speed, none of them can slip past a lifted breakpoint, and no
+// extra stop is taken per hit.
+//
+// Instructions that cannot run elsewhere (indirect calls, loops on rcx, traps, rep string operations that may be
+// interrupted half way) are refused, the caller steps them in place. A syscall runs from the copy, so one that blocks
+// does not hold up the resume; interrupted by a stop, it restarts through the breakpoint once the thread is relocated.
+class LinuxDisplacedStepping {
+public:
+  struct Statistics {
+    uint64_t displaced = 0; // Resumes from a copy
+    uint64_t emulated = 0;  // Branches carried out on the registers
+    uint64_t refused = 0;   // Left to stepping in place
+    uint64_t slots = 0;     // Copies prepared
+    uint64_t areas = 0;     // Scratch areas mapped
+  };
+
+  explicit LinuxDisplacedStepping(LinuxProcess &process) : m_process(process) {}
+
+  // For the stopped thread `tid` with registers `gpr`, sitting on the breakpoint at `addr` whose original code starts
+  // with `code`: arranges for the instruction to run when the thread resumes, changing `gpr` (and the stack for an
+  // emulated call). Returns false when the instruction has to be stepped in place instead; `gpr` is then untouched.
+  bool Prepare(pid_t tid, nub_addr_t addr, const uint8_t *code, size_t code_size, user_regs_struct &gpr);
+  // For a thread that stopped inside a copy: moves its pc back to where it is in the original code, the breakpoint
+  // address when the copy did not run yet, or behind the instruction when it did. False when `pc` is not in a copy.
+  bool Relocate(nub_addr_t &pc) const;
+  // Unmaps the scratch areas through `tid`; for detaching, when no thread can be in a copy.
+  void Clear(pid_t tid);
+  // Whether any copy exists, that is whether a thread can be found inside one.
+  bool IsActive() const { return !m_areas.empty(); }
+
+  const Statistics &GetStatistics() const { return m_stats; }
+  const DNBError &GetError() const { return m_err; }
+
+private:
+  static constexpr nub_size_t kSlotSize = 32;  // An instruction of up to 15 bytes and a 14 byte jump back
+  static constexpr nub_size_t kAreaSize = 1 << 16;
+
+  struct Area {
+    nub_addr_t start;
+    nub_size_t used;
+  };
+  struct Slot {
+    nub_addr_t addr;      // Of the copy
+    uint8_t length;       // Of the instruction
+    uint8_t code[15];     // Original instruction the copy was made from
+  };
+
+  // Copies the instruction into a slot near `addr`; INVALID_NUB_ADDRESS when no area is in reach.
+  nub_addr_t PrepareSlot(pid_t tid, nub_addr_t addr, const uint8_t *code, const LinuxInstruction &insn);
+  nub_addr_t AllocateSlot(pid_t tid, nub_addr_t addr);
+  bool MapArea(pid_t tid, nub_addr_t near_addr);
+
+  LinuxProcess &m_process;
+  std::vector<Area> m_areas;
+  std::map<nub_addr_t, Slot> m_slots;        // Breakpoint address -> its copy
+  std::map<nub_addr_t, nub_addr_t> m_owners; // Copy address -> breakpoint address
+  Statistics m_stats;
+  DNBError m_err;
+};
@@ -0,0 +1,183 @@
+#include "LinuxFilePages.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+LinuxFilePages::LinuxFilePages(LinuxVMMemory &vm_memory)
+    : m_vm_memory(vm_memory), m_page_size(vm_memory.PageSize()) {}
+
+LinuxFilePages::~LinuxFilePages() { Clear(); }
+
+void LinuxFilePages::Invalidate() {
+  m_verdicts.clear();
+  m_owned_pages.clear();
+  m_pending_pages.clear();
+  m_patches.clear();
+  m_last_page = INVALID_NUB_ADDRESS;
+  m_last_data = NULL;
+}
+
+void LinuxFilePages::Clear() {
+  Invalidate();
+  for (auto &file : m_files) {
+    if (file.second.data != NULL) ::munmap(const_cast<uint8_t *>(file.second.data), file.second.size);
+  }
+  m_files.clear();
+  m_pid = INVALID_NUB_PROCESS;
+  m_generation = UINT64_MAX;
+}
+
+void LinuxFilePages::Sync(nub_process_t pid) {
+  if (pid != m_pid) {
+    Clear();
+    m_pid = pid;
+  }
+  LinuxVMRegionIndex &index = m_vm_memory.RegionIndex();
+  if (index.IsStale(pid)) index.Refresh(pid);
+  // A changed layout may have remapped or reprotected any page, patches are checked again as pages are resolved.
+  if (index.Generation() != m_generation) {
+    m_verdicts.clear();
+    m_last_page = INVALID_NUB_ADDRESS;
+    m_generation = index.Generation();
+  }
+}
+
+const LinuxFilePages::MappedFile &LinuxFilePages::MapFile(nub_process_t pid, const LinuxVMRegion &region) {
+  const std::pair<uint32_t, uint64_t> key(region.dev, region.inode);
+  auto it = m_files.find(key);
+  if (it != m_files.end()) return it->second;
+
+  // map_files reaches the very file that is mapped, even when its path was replaced or deleted since. It needs
+  // CAP_SYS_ADMIN on older kernels, the path is the fallback and the stat check below catches a different file.
+  MappedFile file = {NULL, 0};
+  char path[64];
+  ::snprintf(path, sizeof(path), "/proc/%d/map_files/%llx-%llx", pid, static_cast<unsigned long long>(region.start),
+             static_cast<unsigned long long>(region.end));
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) fd = ::open(m_vm_memory.RegionIndex().GetName(region).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd >= 0) {
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && st.st_ino == region.inode &&
+        ((major(st.st_dev) << 20) | minor(st.st_dev)) == region.dev) {
+      void *data = ::mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        file = {static_cast<const uint8_t *>(data), static_cast<nub_size_t>(st.st_size)};
+        m_stats.files_mapped++;
+      }
+    }
+    ::close(fd);
+  }
+  return m_files.emplace(key, file).first->second;
+}
+
+const uint8_t *LinuxFilePages::Resolve(nub_process_t pid, nub_addr_t page_addr) {
+  if (page_addr == m_last_page) return m_last_data;
+  auto it = m_verdicts.find(page_addr);
+  if (it == m_verdicts.end()) {
+    // Resolve a run of pages with one pagemap read, code is mostly read sequentially.
+    const LinuxVMRegion *region = m_vm_memory.RegionIndex().FindRegion(page_addr);
+    const MappedFile *file = NULL;
+    LinuxPageStates states;
+    if (region != NULL && region->kind == LinuxVMRegion::eKindFile &&
+        (region->permissions & (eMemoryPermissionsReadable | eMemoryPermissionsWritable)) ==
+            eMemoryPermissionsReadable) {
+      file = &MapFile(pid, *region);
+      const nub_addr_t end = std::min<nub_addr_t>(region->end, page_addr + kResolvePages * m_page_size);
+      if (file->data == NULL || !m_vm_memory.PageMap().Query(pid, page_addr, end - page_addr, states)) file = NULL;
+    }
+    if (file == NULL) {
+      m_verdicts[page_addr] = {NULL};
+      m_stats.pages_resolved++;
+      m_stats.pages_refused++;
+    } else {
+      for (nub_size_t i = 0; i < states.page_count; i++) {
+        const nub_addr_t page = states.PageAddress(i);
+        if (m_verdicts.count(page)) continue;
+        // A present page that is not a page cache page, or a swapped one, is an anonymous copy.
+        const bool copied = LinuxPageStates::Test(states.present, i) ? !LinuxPageStates::Test(states.file, i)
+                                                                     : LinuxPageStates::Test(states.swapped, i);
+        const bool owned = m_owned_pages.count(page) != 0;
+        if (owned && !copied) {
+          // Back to a page of the file (it was remapped): our bytes went with the old copy.
+          m_owned_pages.erase(page);
+          m_patches.erase(m_patches.lower_bound(page), m_patches.lower_bound(page + m_page_size));
+        }
+        const uint64_t offset = region->offset + (page - region->start);
+        const bool served = offset < file->size && (!copied || owned);
+        m_verdicts[page] = {served ? file->data + offset : NULL};
+        m_stats.pages_resolved++;
+        if (!served) m_stats.pages_refused++;
+      }
+    }
+    it = m_verdicts.find(page_addr);
+  }
+  m_last_page = page_addr;
+  m_last_data = it->second.data;
+  return m_last_data;
+}
+
+void LinuxFilePages::ApplyPatches(nub_addr_t address, uint8_t *data, nub_size_t data_count) const {
+  for (auto it = m_patches.lower_bound(address); it != m_patches.end() && it->first < address + data_count; ++it) {
+    data[it->first - address] = it->second;
+  }
+}
+
+nub_size_t LinuxFilePages::Read(nub_process_t pid, nub_addr_t address, void *data, nub_size_t data_count) {
+  if (data == NULL || data_count == 0) return 0;
+  Sync(pid);
+  uint8_t *out = static_cast<uint8_t *>(data);
+  nub_size_t bytes_served = 0;
+  while (bytes_served < data_count) {
+    const nub_addr_t addr = address + bytes_served;
+    const nub_addr_t page_addr = addr & ~static_cast<nub_addr_t>(m_page_size - 1);
+    const uint8_t *page_data = Resolve(pid, page_addr);
+    if (page_data == NULL) break;
+    const nub_size_t size = std::min<nub_size_t>(data_count - bytes_served, page_addr + m_page_size - addr);
+    ::memcpy(out + bytes_served, page_data + (addr - page_addr), size);
+    bytes_served += size;
+  }
+  if (bytes_served != 0 && !m_patches.empty()) ApplyPatches(address, out, bytes_served);
+  m_stats.bytes_served += bytes_served;
+  return bytes_served;
+}
+
+void LinuxFilePages::WillWrite(nub_process_t pid, const DNBMemoryRequest *requests, nub_size_t request_count) {
+  m_pending_pages.clear();
+  Sync(pid);
+  const nub_addr_t page_mask = ~static_cast<nub_addr_t>(m_page_size - 1);
+  for (nub_size_t i = 0; i < request_count; i++) {
+    const nub_addr_t end = requests[i].addr + requests[i].size;
+    for (nub_addr_t page = requests[i].addr & page_mask; page < end; page += m_page_size) {
+      if (Resolve(pid, page) != NULL) m_pending_pages.emplace_back(i, page);
+    }
+  }
+}
+
+void LinuxFilePages::DidWrite(const DNBMemoryRequest *requests, nub_size_t request_count) {
+  for (const auto &pending : m_pending_pages) {
+    if (pending.first >= request_count) break;
+    const DNBMemoryRequest &request = requests[pending.first];
+    const nub_addr_t page = pending.second;
+    const nub_addr_t address = request.addr;
+    const uint8_t *bytes = static_cast<const uint8_t *>(request.data);
+    const nub_addr_t start = std::max(page, address);
+    const nub_addr_t end = std::min<nub_addr_t>(page + m_page_size, address + request.bytes_transferred);
+    if (start >= end) continue;
+    m_owned_pages.insert(page);
+    const uint8_t *file_data = m_verdicts[page].data;
+    for (nub_addr_t addr = start; addr < end; addr++) {
+      const uint8_t byte = bytes[addr - address];
+      if (byte == file_data[addr - page]) {
+        m_patches.erase(addr);
+      } else {
+        m_patches[addr] = byte;
+      }
+    }
+  }
+  m_pending_pages.clear();
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "DNBDefs.h"
+#include "LinuxVMMemory.h"
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Serves reads of read-only file mappings (text, rodata of the executable and its libraries) from our own mmap of
+// the backing file, so disassembly and unwinding do not cost a syscall per read. A page is served from the file
+// only while its content provably is the file's:
+//  - the region is a non-writable private or shared mapping of a regular file, known from the region index,
+//  - the pagemap shows the page as a page cache page, or as not yet faulted in, so it was never copied on write;
+//    pages copied by relocation, by mprotect + write or by anyone's ptrace writes fall back to the process,
+//  - except for pages whose only copy was caused by our own writes through WillWrite()/DidWrite(): those bytes
+//    (breakpoints, mostly) are kept as patches and laid over the file content.
+// Verdicts are cached per page until the region index generation changes, so the steady state costs a hash lookup.
+// They only hold for one stop: a running process can copy any page on write and restore the layout, so the owner
+// calls Invalidate() whenever the process ran.
+class LinuxFilePages {
+public:
+  struct Statistics {
+    uint64_t bytes_served = 0;  // Read from the mapped files
+    uint64_t pages_resolved = 0; // Pages whose verdict had to be looked up
+    uint64_t pages_refused = 0;  // Of those, the ones left to the process
+    uint64_t files_mapped = 0;
+  };
+
+  explicit LinuxFilePages(LinuxVMMemory &vm_memory);
+  ~LinuxFilePages();
+  LinuxFilePages(const LinuxFilePages &) = delete;
+  LinuxFilePages &operator=(const LinuxFilePages &) = delete;
+
+  // Copies the longest prefix of [address, address + data_count) that can be served from files and returns its
+  // length, 0 when the first page has to be read from the process.
+  nub_size_t Read(nub_process_t pid, nub_addr_t address, void *data, nub_size_t data_count);
+  // Bracket every write to the process: WillWrite() records which pages of the requests are still file pages before
+  // the write copies them, DidWrite() keeps the bytes that landed on those pages (the `bytes_transferred` of each
+  // request) as patches.
+  void WillWrite(nub_process_t pid, const DNBMemoryRequest *requests, nub_size_t request_count);
+  void DidWrite(const DNBMemoryRequest *requests, nub_size_t request_count);
+  // For memory written behind WriteMemory(), and after the process ran: forgets every verdict and patch, pages
+  // copied by then are left to the process.
+  void Invalidate();
+  // Invalidate() and unmaps the files, e.g. when detaching.
+  void Clear();
+
+  const Statistics &GetStatistics() const { return m_stats; }
+
+private:
+  // Pages resolved by one pagemap query, ahead of the page asked for.
+  static constexpr nub_size_t kResolvePages = 64;
+
+  struct MappedFile {
+    const uint8_t *data; // NULL when the file could not be opened or is not the one mapped
+    nub_size_t size;
+  };
+  struct Verdict {
+    const uint8_t *data; // The page in the mapped file, NULL when the page must be read from the process
+  };
+
+  void Sync(nub_process_t pid);
+  const uint8_t *Resolve(nub_process_t pid, nub_addr_t page_addr);
+  const MappedFile &MapFile(nub_process_t pid, const LinuxVMRegion &region);
+  void ApplyPatches(nub_addr_t address, uint8_t *data, nub_size_t data_count) const;
+
+  LinuxVMMemory &m_vm_memory;
+  nub_size_t m_page_size;
+  nub_process_t m_pid = INVALID_NUB_PROCESS;
+  uint64_t m_generation = UINT64_MAX;
+  std::map<std::pair<uint32_t, uint64_t>, MappedFile> m_files; // (dev, inode) -> mapping
+  std::unordered_map<nub_addr_t, Verdict> m_verdicts;
+  std::unordered_set<nub_addr_t> m_owned_pages;   // Copied on write by our own writes only
+  std::vector<std::pair<nub_size_t, nub_addr_t>> m_pending_pages; // (request, file page) of the write in flight
+  std::map<nub_addr_t, uint8_t> m_patches;        // Bytes we wrote that differ from the file
+  nub_addr_t m_last_page = INVALID_NUB_ADDRESS;   // One entry cache in front of m_verdicts
+  const uint8_t *m_last_data = NULL;
+  Statistics m_stats;
+};
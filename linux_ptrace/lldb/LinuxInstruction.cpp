@@ -0,0 +1,304 @@
+#include "LinuxInstruction.h"
+#include <array>
+#include <cstring>
+
+static constexpr size_t kMaxInstructionLength = 15;
+
+// Everything about an opcode that does not depend on the bytes after it fits in one table entry: whether a ModRM
+// byte follows, the kind of immediate and the control flow. Entries are built at compile time, decoding is a handful
+// of table lookups per instruction.
+enum : uint8_t {
+  kModRM = 1 << 0,
+  kInvalid = 1 << 1,
+  kEscape = 1 << 2,   // 0f, VEX or EVEX: the opcode is in another map
+  kRelative = 1 << 3, // The immediate is a branch offset
+  kGroup3 = 1 << 4,   // The immediate is there for /0 and /1 only
+};
+
+enum Immediate : uint8_t {
+  eImmNone,
+  eImm8,
+  eImm16,
+  eImm32,
+  eImmZ,      // 16 with an operand size prefix, 32 otherwise
+  eImmV,      // 64 with REX.W, else like eImmZ (mov r, imm)
+  eImmEnter,  // imm16, imm8
+  eImmMoffs,  // 32 with an address size prefix, 64 otherwise
+  eImmCount,
+};
+
+// Immediate sizes by kind and by operand size prefix (bit 0), REX.W (bit 1) and address size prefix (bit 2).
+static constexpr std::array<std::array<uint8_t, 8>, eImmCount> kImmediateSizes = [] {
+  std::array<std::array<uint8_t, 8>, eImmCount> sizes{};
+  for (int variant = 0; variant < 8; variant++) {
+    const bool operand_size = variant & 1, rex_w = variant & 2, address_size = variant & 4;
+    const uint8_t z = operand_size && !rex_w ? 2 : 4;
+    sizes[eImm8][variant] = 1;
+    sizes[eImm16][variant] = 2;
+    sizes[eImm32][variant] = 4;
+    sizes[eImmZ][variant] = z;
+    sizes[eImmV][variant] = rex_w ? 8 : z;
+    sizes[eImmEnter][variant] = 3;
+    sizes[eImmMoffs][variant] = address_size ? 4 : 8;
+  }
+  return sizes;
+}();
+
+// What follows a ModRM byte: whether it addresses memory, the size of the displacement, whether a SIB byte comes
+// first and whether the operand is RIP-relative.
+enum : uint8_t {
+  kModRMDispMask = 0x0f,
+  kModRMSib = 1 << 4,
+  kModRMRipRelative = 1 << 5,
+  kModRMMemory = 1 << 6,
+};
+
+static constexpr std::array<uint8_t, 256> kModRMInfo = [] {
+  std::array<uint8_t, 256> table{};
+  for (int modrm = 0; modrm < 0xc0; modrm++) {
+    const int mod = modrm >> 6, rm = modrm & 7;
+    uint8_t info = kModRMMemory | (mod == 1 ? 1 : mod == 2 ? 4 : 0);
+    if (rm == 4) info |= kModRMSib;
+    // [eip + disp32] with an address size prefix, still relative to the instruction.
+    if (mod == 0 && rm == 5) info = kModRMMemory | kModRMRipRelative | 4;
+    table[modrm] = info;
+  }
+  return table;
+}();
+
+// Flows that depend on the ModRM byte, resolved after it is read.
+static constexpr uint8_t kFlowGroup5 = 15; // ff: call r/m for /2 /3, jmp r/m for /4 /5
+static constexpr uint8_t kFlowXbegin = 14; // c7 f8
+
+struct OpcodeInfo {
+  uint8_t flags;
+  Immediate immediate;
+  uint8_t flow;
+  uint8_t condition;
+};
+
+typedef std::array<OpcodeInfo, 256> OpcodeTable;
+
+// Prefix bytes of the one-byte map, resolved by one lookup per byte.
+enum : uint8_t {
+  kPrefixNone,
+  kPrefixLegacy, // Segment overrides and lock
+  kPrefixOperandSize,
+  kPrefixAddressSize,
+  kPrefixRep,
+  kPrefixRex,
+};
+
+static constexpr std::array<uint8_t, 256> kPrefixes = [] {
+  std::array<uint8_t, 256> table{};
+  for (uint8_t byte : {0x26, 0x2e, 0x36, 0x3e, 0x64, 0x65, 0xf0}) table[byte] = kPrefixLegacy;
+  table[0x66] = kPrefixOperandSize;
+  table[0x67] = kPrefixAddressSize;
+  table[0xf2] = kPrefixRep;
+  table[0xf3] = kPrefixRep;
+  for (int byte = 0x40; byte <= 0x4f; byte++) table[byte] = kPrefixRex;
+  return table;
+}();
+
+static constexpr OpcodeTable kOneByte = [] {
+  OpcodeTable table{};
+  for (int op = 0; op < 0x40; op++) {
+    // The eight ALU operations: r/m,r and r,r/m in both sizes, then al,imm8 and eax,immz.
+    if ((op & 0x07) < 0x04) table[op].flags = kModRM;
+    if ((op & 0x07) == 0x04) table[op].immediate = eImm8;
+    if ((op & 0x07) == 0x05) table[op].immediate = eImmZ;
+  }
+  for (int op : {0x63, 0x69, 0x6b, 0xc0, 0xc1, 0xc6, 0xc7, 0xd0, 0xd1, 0xd2, 0xd3, 0xfe, 0xff}) {
+    table[op].flags = kModRM;
+  }
+  for (int op = 0x80; op <= 0x8f; op++) table[op].flags = kModRM;
+  for (int op = 0xd8; op <= 0xdf; op++) table[op].flags = kModRM;
+  for (int op : {0x06, 0x07, 0x0e, 0x16, 0x17, 0x1e, 0x1f, 0x27, 0x2f, 0x37, 0x3f, 0x60, 0x61, 0x82, 0x9a, 0xce,
+                 0xd4, 0xd5, 0xd6, 0xea}) {
+    table[op].flags = kInvalid;
+  }
+  for (int op : {0x0f, 0x62, 0xc4, 0xc5}) table[op].flags = kEscape;
+
+  for (int op : {0x6a, 0x6b, 0x80, 0x83, 0xa8, 0xc0, 0xc1, 0xc6, 0xcd, 0xe4, 0xe5, 0xe6, 0xe7}) {
+    table[op].immediate = eImm8;
+  }
+  for (int op : {0x68, 0x69, 0x81, 0xa9, 0xc7}) table[op].immediate = eImmZ;
+  for (int op = 0xb0; op <= 0xb7; op++) table[op].immediate = eImm8;
+  for (int op = 0xb8; op <= 0xbf; op++) table[op].immediate = eImmV;
+  for (int op = 0xa0; op <= 0xa3; op++) table[op].immediate = eImmMoffs;
+  table[0xc2].immediate = eImm16;
+  table[0xca].immediate = eImm16;
+  table[0xc8].immediate = eImmEnter;
+  table[0xf6] = {kModRM | kGroup3, eImm8, 0, 0};
+  table[0xf7] = {kModRM | kGroup3, eImmZ, 0, 0};
+
+  for (int op = 0x70; op <= 0x7f; op++) {
+    table[op] = {kRelative, eImm8, LinuxInstruction::eFlowConditionalJump, static_cast<uint8_t>(op & 0x0f)};
+  }
+  for (int op = 0xe0; op <= 0xe3; op++) table[op] = {kRelative, eImm8, LinuxInstruction::eFlowLoop, 0};
+  table[0xeb] = {kRelative, eImm8, LinuxInstruction::eFlowJump, 0};
+  table[0xe9] = {kRelative, eImm32, LinuxInstruction::eFlowJump, 0};
+  table[0xe8] = {kRelative, eImm32, LinuxInstruction::eFlowCall, 0};
+  for (int op : {0xc2, 0xc3, 0xca, 0xcb, 0xcf}) table[op].flow = LinuxInstruction::eFlowReturn;
+  for (int op : {0xcc, 0xcd, 0xf1, 0xf4}) table[op].flow = LinuxInstruction::eFlowSystem;
+  table[0xff].flow = kFlowGroup5;
+  table[0xc7].flow = kFlowXbegin;
+  return table;
+}();
+
+static constexpr OpcodeTable kTwoByte = [] {
+  OpcodeTable table{};
+  for (int op = 0; op < 256; op++) table[op].flags = kModRM;
+  for (int op : {0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0e, 0x30, 0x31, 0x32, 0x33, 0x34, 0x35,
+                 0x36, 0x37, 0x77, 0xa0, 0xa1, 0xa2, 0xa8, 0xa9, 0xaa}) {
+    table[op].flags = 0;
+  }
+  for (int op = 0xc8; op <= 0xcf; op++) table[op].flags = 0;
+  // 0f 0f is 3DNow!, whose opcode is an imm8 suffix.
+  for (int op : {0x0f, 0x70, 0x71, 0x72, 0x73, 0xa4, 0xac, 0xba, 0xc2, 0xc4, 0xc5, 0xc6}) {
+    table[op].immediate = eImm8;
+  }
+  for (int op = 0x80; op <= 0x8f; op++) {
+    table[op] = {kRelative, eImm32, LinuxInstruction::eFlowConditionalJump, static_cast<uint8_t>(op & 0x0f)};
+  }
+  for (int op : {0x05, 0x07, 0x0b, 0x34, 0x35, 0xb9, 0xff}) table[op].flow = LinuxInstruction::eFlowSystem;
+  return table;
+}();
+
+// VEX and EVEX maps 1-3 and 5-6, and the legacy 0f38 and 0f3a maps: every opcode has a ModRM byte, except
+// vzeroupper/vzeroall.
+static constexpr std::array<OpcodeTable, 7> kVexMaps = [] {
+  std::array<OpcodeTable, 7> maps{};
+  for (size_t map = 0; map < maps.size(); map++) {
+    for (int op = 0; op < 256; op++) maps[map][op].flags = map == 0 || map == 4 ? kInvalid : kModRM;
+  }
+  maps[1][0x77].flags = 0;
+  for (int op : {0x70, 0x71, 0x72, 0x73, 0xc2, 0xc4, 0xc5, 0xc6}) maps[1][op].immediate = eImm8;
+  for (int op = 0; op < 256; op++) maps[3][op].immediate = eImm8;
+  return maps;
+}();
+
+// Reads the ModRM byte at `pos` and skips the SIB and displacement behind it.
+static inline bool DecodeModRM(const uint8_t *code, size_t size, size_t &pos, LinuxInstruction *insn) {
+  if (pos >= size) return false;
+  const uint8_t modrm = code[pos++];
+  const uint8_t info = kModRMInfo[modrm];
+  insn->has_modrm = true;
+  insn->modrm = modrm;
+  uint8_t disp_size = info & kModRMDispMask;
+  if (info & kModRMSib) {
+    if (pos >= size) return false;
+    // No base register: disp32 even with mod 0.
+    if (modrm < 0x40 && (code[pos] & 7) == 5) disp_size = 4;
+    pos++;
+  }
+  insn->rip_relative = (info & kModRMRipRelative) != 0;
+  insn->disp_offset = (info & kModRMMemory) ? static_cast<uint8_t>(pos) : 0;
+  insn->disp_size = disp_size;
+  pos += disp_size;
+  return pos <= size;
+}
+
+bool DecodeInstruction(const uint8_t *code, size_t size, LinuxInstruction *insn) {
+  ::memset(insn, 0, sizeof(*insn));
+  if (size > kMaxInstructionLength) size = kMaxInstructionLength;
+  size_t pos = 0;
+  bool operand_size = false, address_size = false;
+  uint8_t rex = 0;
+  // Legacy prefixes in any order; a REX prefix counts only right before the opcode.
+  for (; pos < size; pos++) {
+    const uint8_t prefix = kPrefixes[code[pos]];
+    if (prefix == kPrefixNone) break;
+    if (prefix == kPrefixRex) {
+      rex = code[pos];
+      continue;
+    }
+    rex = 0;
+    operand_size |= prefix == kPrefixOperandSize;
+    address_size |= prefix == kPrefixAddressSize;
+    insn->rep |= prefix == kPrefixRep;
+  }
+  if (pos >= size) return false;
+  const bool rex_w = (rex & 0x08) != 0;
+
+  uint8_t op = code[pos++];
+  const OpcodeInfo *info = &kOneByte[op];
+  if (info->flags & kEscape) {
+    if (op == 0x0f) {
+      if (pos >= size) return false;
+      op = code[pos++];
+      if (op == 0x38 || op == 0x3a) {
+        if (pos >= size) return false;
+        insn->opcode_map = op == 0x38 ? 2 : 3;
+        op = code[pos++];
+        info = &kVexMaps[insn->opcode_map][op];
+      } else {
+        insn->opcode_map = 1;
+        info = &kTwoByte[op];
+      }
+    } else {
+      // VEX and EVEX take the place of REX and the 0f escapes, the map comes from their payload.
+      if (rex != 0) return false;
+      const size_t payload = op == 0xc5 ? 1 : op == 0xc4 ? 2 : 3;
+      if (pos + payload >= size) return false;
+      const uint8_t map = op == 0xc5 ? 1 : code[pos] & (op == 0xc4 ? 0x1f : 0x07);
+      if (map >= kVexMaps.size() || (op == 0xc4 && map > 3)) return false;
+      pos += payload;
+      op = code[pos++];
+      insn->opcode_map = map;
+      info = &kVexMaps[map][op];
+    }
+  }
+  if (info->flags & kInvalid) return false;
+  insn->opcode = op;
+  if ((info->flags & kModRM) && !DecodeModRM(code, size, pos, insn)) return false;
+
+  const uint8_t reg = (insn->modrm >> 3) & 7;
+  uint8_t imm_size = kImmediateSizes[info->immediate][operand_size | rex_w << 1 | address_size << 2];
+  if ((info->flags & kGroup3) && reg >= 2) imm_size = 0;
+
+  uint8_t flow = info->flow;
+  if (flow == kFlowGroup5) {
+    flow = reg == 2 || reg == 3   ? LinuxInstruction::eFlowIndirectCall
+           : reg == 4 || reg == 5 ? LinuxInstruction::eFlowIndirectJump
+                                  : LinuxInstruction::eFlowNone;
+  } else if (flow == kFlowXbegin) {
+    flow = insn->modrm == 0xf8 ? LinuxInstruction::eFlowSystem : LinuxInstruction::eFlowNone;
+  }
+  insn->flow = static_cast<LinuxInstruction::Flow>(flow);
+  insn->condition = info->condition;
+
+  insn->imm_offset = static_cast<uint8_t>(pos);
+  insn->imm_size = imm_size;
+  pos += imm_size;
+  if (pos > size) return false;
+  insn->length = static_cast<uint8_t>(pos);
+  if (info->flags & kRelative) {
+    if (imm_size == 1) {
+      insn->branch_offset = static_cast<int8_t>(code[insn->imm_offset]);
+    } else {
+      int32_t offset;
+      ::memcpy(&offset, code + insn->imm_offset, sizeof(offset));
+      insn->branch_offset = offset;
+    }
+  }
+  return true;
+}
+
+bool ConditionHolds(uint8_t condition, uint64_t eflags) {
+  const bool cf = eflags & (1 << 0), pf = eflags & (1 << 2), zf = eflags & (1 << 6), sf = eflags & (1 << 7),
+             of = eflags & (1 << 11);
+  bool holds = false;
+  switch (condition >> 1) {
+  case 0: holds = of; break;
+  case 1: holds = cf; break;
+  case 2: holds = zf; break;
+  case 3: holds = cf || zf; break;
+  case 4: holds = sf; break;
+  case 5: holds = pf; break;
+  case 6: holds = sf != of; break;
+  case 7: holds = zf || sf != of; break;
+  }
+  // Odd conditions are the negations.
+  return (condition & 1) ? !holds : holds;
+}
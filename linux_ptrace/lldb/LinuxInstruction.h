@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// What the debugger needs to know about one x86-64 instruction to move it elsewhere: its length, where its memory
+// displacement and immediate sit, whether it addresses memory relative to RIP, and how it changes the control flow.
+// Operands are not decoded beyond that.
+struct LinuxInstruction {
+  enum Flow {
+    eFlowNone,            // Falls through to the next instruction
+    eFlowJump,            // jmp rel8/rel32
+    eFlowConditionalJump, // jcc rel8/rel32, `condition` is the low nibble of the opcode
+    eFlowCall,            // call rel32
+    eFlowLoop,            // loop/loope/loopne/jrcxz rel8
+    eFlowIndirectJump,    // jmp r/m
+    eFlowIndirectCall,    // call r/m, far call
+    eFlowReturn,          // ret, retf, iret
+    eFlowSystem,          // Traps or enters the kernel (int3, int, syscall, ud2, hlt...), or xbegin
+  };
+
+  uint8_t length;
+  uint8_t opcode_map; // 0 one-byte, 1 0f, 2 0f38, 3 0f3a, 5-6 EVEX maps
+  uint8_t opcode;
+  bool has_modrm;
+  uint8_t modrm;
+  uint8_t disp_offset; // Displacement of the memory operand, disp_size 0 when there is none
+  uint8_t disp_size;
+  uint8_t imm_offset; // Immediate, or the offset of a relative branch
+  uint8_t imm_size;
+  bool rip_relative; // The memory operand is [rip + disp32]
+  bool rep;          // Has an f2/f3 prefix
+  Flow flow;
+  int64_t branch_offset; // Target of a relative branch, from the end of the instruction
+  uint8_t condition;
+};
+
+// Decodes the instruction at the start of `code`. Returns false when it is invalid in 64-bit mode, does not fit in
+// `size` bytes, or uses an encoding not known here.
+bool DecodeInstruction(const uint8_t *code, size_t size, LinuxInstruction *insn);
+// Whether a conditional jump with `condition` is taken under the status flags in `eflags`.
+bool ConditionHolds(uint8_t condition, uint64_t eflags);
@@ -0,0 +1,570 @@
+#include "LinuxMemoryScanner.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// A query prepared for the window kernels. A window is 64 bytes at `p` and its mask has bit j set when a value
+// starting at p + j matches. Values that are not aligned to their own size are covered by repeating the compare
+// with the loads shifted by each allowed offset within an element.
+struct ScanMatcher {
+  const LinuxScanQuery *query;
+  LinuxScanQuery::Type type;
+  nub_size_t element;
+  nub_size_t shifts[8];
+  nub_size_t shift_count;
+  uint64_t lanes;  // First byte of each element of a window
+  uint64_t filter; // Window positions that satisfy the alignment, windows start 64 byte aligned
+  uint64_t integer;
+  float float_value;
+  float float_tolerance;
+  double double_value;
+  double double_tolerance;
+  nub_size_t first_anchor; // Pattern bytes compared (under their masks) to find candidates, which are then verified
+  nub_size_t last_anchor;
+  uint8_t first_mask;
+  uint8_t last_mask;
+  bool verify;
+
+  explicit ScanMatcher(const LinuxScanQuery &q)
+      : query(&q), type(q.type), element(q.size), shift_count(1), lanes(~0ULL), filter(0), integer(q.integer),
+        float_value(static_cast<float>(q.value)), float_tolerance(static_cast<float>(q.tolerance)),
+        double_value(q.value), double_tolerance(q.tolerance), first_anchor(0), last_anchor(0), first_mask(0),
+        last_mask(0), verify(false) {
+    shifts[0] = 0;
+    for (nub_size_t j = 0; j < 64; j += q.alignment) filter |= 1ULL << j;
+    if (type == LinuxScanQuery::eTypeBytes) {
+      verify = true;
+      auto mask = [&q](nub_size_t i) -> uint8_t { return q.mask.empty() ? 0xff : q.mask[i]; };
+      first_anchor = last_anchor = q.size;
+      for (nub_size_t i = 0; i < q.size; i++) {
+        if (mask(i) == 0) continue;
+        if (first_anchor == q.size) first_anchor = i;
+        last_anchor = i;
+      }
+      if (first_anchor < q.size) {
+        first_mask = mask(first_anchor);
+        last_mask = mask(last_anchor);
+      }
+      return;
+    }
+    lanes = 0;
+    for (nub_size_t j = 0; j < 64; j += element) lanes |= 1ULL << j;
+    if (q.alignment < element) {
+      shift_count = 0;
+      for (nub_size_t shift = 0; shift < element; shift += q.alignment) shifts[shift_count++] = shift;
+      filter = ~0ULL;
+    }
+  }
+  // A pattern that masks out every byte matches everywhere, there is nothing for the vector kernels to look for.
+  bool Vectorizable() const { return type != LinuxScanQuery::eTypeBytes || first_anchor < query->size; }
+};
+
+// Matches `window_count` consecutive windows starting at `p`, which holds the bytes at `addr`, and appends the hits.
+typedef void (*SpanKernel)(const ScanMatcher &m, const uint8_t *p, nub_addr_t addr, nub_size_t window_count,
+                           std::vector<nub_addr_t> &hits);
+
+static inline void AppendHits(const ScanMatcher &m, uint64_t mask, const uint8_t *p, nub_addr_t addr,
+                              std::vector<nub_addr_t> &hits) {
+  for (mask &= m.filter; mask != 0; mask &= mask - 1) {
+    const int offset = __builtin_ctzll(mask);
+    if (m.verify && !m.query->Matches(p + offset)) continue;
+    hits.push_back(addr + offset);
+  }
+}
+
+// Bit i of `bits` becomes bit i * stride.
+static inline uint64_t SpreadBits(uint32_t bits, int stride) {
+  uint64_t spread = 0;
+  for (; bits != 0; bits &= bits - 1) spread |= 1ULL << (__builtin_ctz(bits) * stride);
+  return spread;
+}
+
+#if defined(__x86_64__)
+static inline __m128i LoadSSE2(const uint8_t *q) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(q)); }
+
+static inline uint64_t MoveMaskSSE2(__m128i a, __m128i b, __m128i c, __m128i d) {
+  return static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(a))) |
+         static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(b))) << 16 |
+         static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(c))) << 32 |
+         static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(d))) << 48;
+}
+
+template <nub_size_t kElement> static inline __m128i CompareSSE2(__m128i value, __m128i needle) {
+  switch (kElement) {
+  case 1:
+    return _mm_cmpeq_epi8(value, needle);
+  case 2:
+    return _mm_cmpeq_epi16(value, needle);
+  case 4:
+    return _mm_cmpeq_epi32(value, needle);
+  default: {
+    // SSE2 has no 64-bit compare: both 32-bit halves have to be equal.
+    __m128i equal = _mm_cmpeq_epi32(value, needle);
+    return _mm_and_si128(equal, _mm_shuffle_epi32(equal, _MM_SHUFFLE(2, 3, 0, 1)));
+  }
+  }
+}
+
+template <nub_size_t kElement> static inline __m128i BroadcastSSE2(uint64_t integer) {
+  switch (kElement) {
+  case 1:
+    return _mm_set1_epi8(static_cast<char>(integer));
+  case 2:
+    return _mm_set1_epi16(static_cast<short>(integer));
+  case 4:
+    return _mm_set1_epi32(static_cast<int>(integer));
+  default:
+    return _mm_set1_epi64x(static_cast<long long>(integer));
+  }
+}
+
+template <nub_size_t kElement>
+static void IntegerSpanSSE2(const ScanMatcher &m, const uint8_t *p, nub_addr_t addr, nub_size_t window_count,
+                            std::vector<nub_addr_t> &hits) {
+  const __m128i needle = BroadcastSSE2<kElement>(m.integer);
+  for (nub_size_t window = 0; window < window_count; window++, p += 64, addr += 64) {
+    uint64_t mask = 0;
+    for (nub_size_t i = 0; i < m.shift_count; i++) {
+      const uint8_t *q = p + m.shifts[i];
+      uint64_t equal = MoveMaskSSE2(CompareSSE2<kElement>(LoadSSE2(q), needle),
+                                    CompareSSE2<kElement>(LoadSSE2(q + 16), needle),
+                                    CompareSSE2<kElement>(LoadSSE2(q + 32), needle),
+                                    CompareSSE2<kElement>(LoadSSE2(q + 48), needle));
+      mask |= (equal & m.lanes) << m.shifts[i];
+    }
+    if (mask != 0) AppendHits(m, mask, p, addr, hits);
+  }
+}
+
+static void FloatSpanSSE2(const ScanMatcher &m, const uint8_t *p, nub_addr_t addr, nub_size_t window_count,
+                          std::vector<nub_addr_t> &hits) {
+  const __m128 needle = _mm_set1_ps(m.float_value);
+  const __m128 tolerance = _mm_set1_ps(m.float_tolerance);
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  for (nub_size_t window = 0; window < window_count; window++, p += 64, addr += 64) {
+    uint64_t mask = 0;
+    for (nub_size_t i = 0; i < m.shift_count; i++) {
+      for (int part = 0; part < 4; part++) {
+        __m128 value = _mm_loadu_ps(reinterpret_cast<const float *>(p + m.shifts[i] + part * 16));
+        __m128 distance = _mm_andnot_ps(sign, _mm_sub_ps(value, needle));
+        uint32_t bits = _mm_movemask_ps(_mm_cmple_ps(distance, tolerance));
+        if (bits != 0) mask |= SpreadBits(bits, 4) << (part * 16 + m.shifts[i]);
+      }
+    }
+    if (mask != 0) AppendHits(m, mask, p, addr, hits);
+  }
+}
+
+static void DoubleSpanSSE2(const ScanMatcher &m, const uint8_t *p, nub_addr_t addr, nub_size_t window_count,
+                           std::vector<nub_addr_t> &hits) {
+  const __m128d needle = _mm_set1_pd(m.double_value);
+  const __m128d tolerance = _mm_set1_pd(m.double_tolerance);
+  const __m128d sign = _mm_set1_pd(-0.0);
+  for (nub_size_t window = 0; window < window_count; window++, p += 64, addr += 64) {
+    uint64_t mask = 0;
+    for (nub_size_t i = 0; i < m.shift_count; i++) {
+      for (int part = 0; part < 4; part++) {
+        __m128d value = _mm_loadu_pd(reinterpret_cast<const double *>(p + m.shifts[i] + part * 16));
+        __m128d distance = _mm_andnot_pd(sign, _mm_sub_pd(value, needle));
+        uint32_t bits = _mm_movemask_pd(_mm_cmple_pd(distance, tolerance));
+        if (bits != 0) mask |= SpreadBits(bits, 8) << (part * 16 + m.shifts[i]);
+      }
+    }
+    if (mask != 0) AppendHits(m, mask, p, addr, hits);
+  }
+}
+
+// Candidates are the positions where both anchor bytes match, AppendHits() verifies the rest of the pattern.
+static void BytesSpanSSE2(const ScanMatcher &m, const uint8_t *p, nub_addr_t addr, nub_size_t window_count,
+                          std::vector<nub_addr_t> &hits) {
+  const __m128i first = _mm_set1_epi8(static_cast<char>(m.query->bytes[m.first_anchor] & m.first_mask));
+  const __m128i last = _mm_set1_epi8(static_cast<char>(m.query->bytes[m.last_anchor] & m.last_mask));
+  const __m128i first_mask = _mm_set1_epi8(static_cast<char>(m.first_mask));
+  const __m128i last_mask = _mm_set1_epi8(static_cast<char>(m.last_mask));
+  for (nub_size_t window = 0; window < window_count; window++, p += 64, addr += 64) {
+    const uint8_t *a = p + m.first_anchor;
+    const uint8_t *b = p + m.last_anchor;
+    __m128i parts[4];
+    for (int part = 0; part < 4; part++) {
+      parts[part] = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(LoadSSE2(a + part * 16), first_mask), first),
+                                  _mm_cmpeq_epi8(_mm_and_si128(LoadSSE2(b + part * 16), last_mask), last));
+    }
+    uint64_t mask = MoveMaskSSE2(parts[0], parts[1], parts[2], parts[3]);
+    if (mask != 0) AppendHits(m, mask, p, addr, hits);
+  }
+}
+
+__attribute__((target("avx2"))) static inline __m256i LoadAVX2(const uint8_t *q) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(q));
+}
+
+__attribute__((target("avx2"))) static inline uint64_t MoveMaskAVX2(__m256i low, __m256i high) {
+  return static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(low))) |
+         static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(high))) << 32;
+}
+
+template <nub_size_t kElement> __attribute__((target("avx2"))) static inline __m256i CompareAVX2(__m256i value,
+                                                                                                __m256i needle) {
+  switch (kElement) {
+  case 1:
+    return _mm256_cmpeq_epi8(value, needle);
+  case 2:
+    return _mm256_cmpeq_epi16(value, needle);
+  case 4:
+    return _mm256_cmpeq_epi32(value, needle);
+  default:
+    return _mm256_cmpeq_epi64(value, needle);
+  }
+}
+
+template <nub_size_t kElement> __attribute__((target("avx2"))) static inline __m256i BroadcastAVX2(uint64_t integer) {
+  switch (kElement) {
+  case 1:
+    return _mm256_set1_epi8(static_cast<char>(integer));
+  case 2:
+    return _mm256_set1_epi16(static_cast<short>(integer));
+  case 4:
+    return _mm256_set1_epi32(static_cast<int>(integer));
+  default:
+    return _mm256_set1_epi64x(static_cast<long long>(integer));
+  }
+}
+
+template <nub_size_t kElement>
+__attribute__((target("avx2"))) static void IntegerSpanAVX2(const ScanMatcher &m, const uint8_t *p, nub_addr_t addr,
+                                                            nub_size_t window_count, std::vector<nub_addr_t> &hits) {
+  const __m256i needle = BroadcastAVX2<kElement>(m.integer);
+  for (nub_size_t window = 0; window < window_count; window++, p += 64, addr += 64) {
+    uint64_t mask = 0;
+    for (nub_size_t i = 0; i < m.shift_count; i++) {
+      const uint8_t *q = p + m.shifts[i];
+      uint64_t equal = MoveMaskAVX2(CompareAVX2<kElement>(LoadAVX2(q), needle),
+                                    CompareAVX2<kElement>(LoadAVX2(q + 32), needle));
+      mask |= (equal & m.lanes) << m.shifts[i];
+    }
+    if (mask != 0) AppendHits(m, mask, p, addr, hits);
+  }
+}
+
+__attribute__((target("avx2"))) static void FloatSpanAVX2(const ScanMatcher &m, const uint8_t *p, nub_addr_t addr,
+                                                          nub_size_t window_count, std::vector<nub_addr_t> &hits) {
+  const __m256 needle = _mm256_set1_ps(m.float_value);
+  const __m256 tolerance = _mm256_set1_ps(m.float_tolerance);
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  for (nub_size_t window = 0; window < window_count; window++, p += 64, addr += 64) {
+    uint64_t mask = 0;
+    for (nub_size_t i = 0; i < m.shift_count; i++) {
+      for (int part = 0; part < 2; part++) {
+        __m256 value = _mm256_loadu_ps(reinterpret_cast<const float *>(p + m.shifts[i] + part * 32));
+        __m256 distance = _mm256_andnot_ps(sign, _mm256_sub_ps(value, needle));
+        uint32_t bits = _mm256_movemask_ps(_mm256_cmp_ps(distance, tolerance, _CMP_LE_OQ));
+        if (bits != 0) mask |= SpreadBits(bits, 4) << (part * 32 + m.shifts[i]);
+      }
+    }
+    if (mask != 0) AppendHits(m, mask, p, addr, hits);
+  }
+}
+
+__attribute__((target("avx2"))) static void DoubleSpanAVX2(const ScanMatcher &m, const uint8_t *p, nub_addr_t addr,
+                                                           nub_size_t window_count, std::vector<nub_addr_t> &hits) {
+  const __m256d needle = _mm256_set1_pd(m.double_value);
+  const __m256d tolerance = _mm256_set1_pd(m.double_tolerance);
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  for (nub_size_t window = 0; window < window_count; window++, p += 64, addr += 64) {
+    uint64_t mask = 0;
+    for (nub_size_t i = 0; i < m.shift_count; i++) {
+      for (int part = 0; part < 2; part++) {
+        __m256d value = _mm256_loadu_pd(reinterpret_cast<const double *>(p + m.shifts[i] + part * 32));
+        __m256d distance = _mm256_andnot_pd(sign, _mm256_sub_pd(value, needle));
+        uint32_t bits = _mm256_movemask_pd(_mm256_cmp_pd(distance, tolerance, _CMP_LE_OQ));
+        if (bits != 0) mask |= SpreadBits(bits, 8) << (part * 32 + m.shifts[i]);
+      }
+    }
+    if (mask != 0) AppendHits(m, mask, p, addr, hits);
+  }
+}
+
+__attribute__((target("avx2"))) static inline __m256i AnchorsAVX2(const uint8_t *a, const uint8_t *b, __m256i first,
+                                                                 __m256i first_mask, __m256i last, __m256i last_mask) {
+  return _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(LoadAVX2(a), first_mask), first),
+                          _mm256_cmpeq_epi8(_mm256_and_si256(LoadAVX2(b), last_mask), last));
+}
+
+__attribute__((target("avx2"))) static void BytesSpanAVX2(const ScanMatcher &m, const uint8_t *p, nub_addr_t addr,
+                                                          nub_size_t window_count, std::vector<nub_addr_t> &hits) {
+  const __m256i first = _mm256_set1_epi8(static_cast<char>(m.query->bytes[m.first_anchor] & m.first_mask));
+  const __m256i last = _mm256_set1_epi8(static_cast<char>(m.query->bytes[m.last_anchor] & m.last_mask));
+  const __m256i first_mask = _mm256_set1_epi8(static_cast<char>(m.first_mask));
+  const __m256i last_mask = _mm256_set1_epi8(static_cast<char>(m.last_mask));
+  for (nub_size_t window = 0; window < window_count; window++, p += 64, addr += 64) {
+    const uint8_t *a = p + m.first_anchor;
+    const uint8_t *b = p + m.last_anchor;
+    uint64_t mask = MoveMaskAVX2(AnchorsAVX2(a, b, first, first_mask, last, last_mask),
+                                 AnchorsAVX2(a + 32, b + 32, first, first_mask, last, last_mask));
+    if (mask != 0) AppendHits(m, mask, p, addr, hits);
+  }
+}
+#endif
+
+// NULL when there is no vector kernel for the query on this machine, everything is then matched by the scalar loop.
+static SpanKernel SelectKernel(const ScanMatcher &m) {
+#if defined(__x86_64__)
+  if (!m.Vectorizable()) return NULL;
+  const bool avx2 = __builtin_cpu_supports("avx2");
+  switch (m.type) {
+  case LinuxScanQuery::eTypeInteger:
+    switch (m.element) {
+    case 1:
+      return avx2 ? IntegerSpanAVX2<1> : IntegerSpanSSE2<1>;
+    case 2:
+      return avx2 ? IntegerSpanAVX2<2> : IntegerSpanSSE2<2>;
+    case 4:
+      return avx2 ? IntegerSpanAVX2<4> : IntegerSpanSSE2<4>;
+    default:
+      return avx2 ? IntegerSpanAVX2<8> : IntegerSpanSSE2<8>;
+    }
+  case LinuxScanQuery::eTypeFloat:
+    return avx2 ? FloatSpanAVX2 : FloatSpanSSE2;
+  case LinuxScanQuery::eTypeDouble:
+    return avx2 ? DoubleSpanAVX2 : DoubleSpanSSE2;
+  case LinuxScanQuery::eTypeBytes:
+    return avx2 ? BytesSpanAVX2 : BytesSpanSSE2;
+  }
+#endif
+  return NULL;
+}
+
+static inline nub_addr_t AlignUp(nub_addr_t addr, nub_size_t alignment) {
+  return (addr + alignment - 1) & ~static_cast<nub_addr_t>(alignment - 1);
+}
+
+// Appends the matches of one block, in address order. `data` holds the bytes at `data_addr`; only the readable
+// extents are looked at and only values starting in [start, end) are reported.
+static void ScanBlock(const ScanMatcher &m, SpanKernel kernel, const uint8_t *data, nub_addr_t data_addr,
+                      const std::vector<DNBMemoryExtent> &extents, nub_addr_t start, nub_addr_t end,
+                      std::vector<nub_addr_t> &hits) {
+  const LinuxScanQuery &query = *m.query;
+  auto scalar = [&](nub_addr_t from, nub_addr_t to) {
+    for (nub_addr_t addr = AlignUp(from, query.alignment); addr < to; addr += query.alignment) {
+      if (query.Matches(data + (addr - data_addr))) hits.push_back(addr);
+    }
+  };
+  for (const DNBMemoryExtent &extent : extents) {
+    if (!extent.readable || extent.size < query.size) continue;
+    nub_addr_t addr = std::max(extent.addr, start);
+    const nub_addr_t limit = std::min(end, extent.addr + extent.size - query.size + 1);
+    if (addr >= limit) continue;
+    if (kernel != NULL) {
+      // Windows start 64 byte aligned, which is what the alignment filter of the kernels assumes.
+      const nub_addr_t first_window = AlignUp(addr, 64);
+      if (first_window + 64 <= limit) {
+        scalar(addr, first_window);
+        const nub_size_t window_count = (limit - first_window) / 64;
+        kernel(m, data + (first_window - data_addr), first_window, window_count, hits);
+        addr = first_window + window_count * 64;
+      }
+    }
+    scalar(addr, limit);
+  }
+}
+
+LinuxScanQuery LinuxScanQuery::Integer(uint64_t value, nub_size_t size) {
+  LinuxScanQuery query;
+  query.type = eTypeInteger;
+  query.size = query.alignment = size;
+  query.integer = value;
+  return query;
+}
+
+LinuxScanQuery LinuxScanQuery::Float(float value, float tolerance) {
+  LinuxScanQuery query;
+  query.type = eTypeFloat;
+  query.size = query.alignment = sizeof(float);
+  query.value = value;
+  query.tolerance = tolerance;
+  return query;
+}
+
+LinuxScanQuery LinuxScanQuery::Double(double value, double tolerance) {
+  LinuxScanQuery query;
+  query.type = eTypeDouble;
+  query.size = query.alignment = sizeof(double);
+  query.value = value;
+  query.tolerance = tolerance;
+  return query;
+}
+
+LinuxScanQuery LinuxScanQuery::Bytes(const std::vector<uint8_t> &bytes, const std::vector<uint8_t> &mask) {
+  LinuxScanQuery query;
+  query.type = eTypeBytes;
+  query.size = bytes.size();
+  query.alignment = 1;
+  query.bytes = bytes;
+  query.mask = mask;
+  return query;
+}
+
+bool LinuxScanQuery::IsValid() const {
+  // Window masks repeat every 64 bytes, so that is the largest alignment they can express.
+  if (alignment == 0 || alignment > 64 || (alignment & (alignment - 1)) != 0) return false;
+  switch (type) {
+  case eTypeInteger:
+    return size == 1 || size == 2 || size == 4 || size == 8;
+  case eTypeFloat:
+    return size == sizeof(float);
+  case eTypeDouble:
+    return size == sizeof(double);
+  case eTypeBytes:
+    return size > 0 && bytes.size() == size && (mask.empty() || mask.size() == size);
+  }
+  return false;
+}
+
+bool LinuxScanQuery::Matches(const uint8_t *data) const {
+  switch (type) {
+  case eTypeInteger: {
+    uint64_t value = 0;
+    std::memcpy(&value, data, size);
+    return size == 8 ? value == integer : value == (integer & ((1ULL << (size * 8)) - 1));
+  }
+  case eTypeFloat: {
+    float value;
+    std::memcpy(&value, data, sizeof(value));
+    return std::fabs(value - static_cast<float>(this->value)) <= static_cast<float>(tolerance);
+  }
+  case eTypeDouble: {
+    double value;
+    std::memcpy(&value, data, sizeof(value));
+    return std::fabs(value - this->value) <= tolerance;
+  }
+  case eTypeBytes:
+    for (nub_size_t i = 0; i < size; i++) {
+      const uint8_t byte_mask = mask.empty() ? 0xff : mask[i];
+      if ((data[i] & byte_mask) != (bytes[i] & byte_mask)) return false;
+    }
+    return true;
+  }
+  return false;
+}
+
+LinuxMemoryScanner::LinuxMemoryScanner(LinuxVMMemory &vm_memory, unsigned thread_count)
+    : m_vm_memory(vm_memory),
+      m_thread_count(thread_count != 0 ? thread_count : std::max(1u, std::thread::hardware_concurrency())),
+      m_err(0) {}
+
+const char *LinuxMemoryScanner::KernelName() {
+#if defined(__x86_64__)
+  return __builtin_cpu_supports("avx2") ? "avx2" : "sse2";
+#else
+  return "scalar";
+#endif
+}
+
+bool LinuxMemoryScanner::Scan(nub_process_t pid, const LinuxScanQuery &query, std::vector<nub_addr_t> &hits) {
+  hits.clear();
+  std::mutex mutex;
+  std::vector<std::pair<size_t, std::vector<nub_addr_t>>> block_hits;
+  bool success = Scan(pid, query, [&](size_t block, std::vector<nub_addr_t> &found, const uint8_t *, nub_addr_t) {
+    std::lock_guard<std::mutex> lock(mutex);
+    block_hits.emplace_back(block, std::move(found));
+  });
+  // Blocks are numbered in address order, so concatenating their hits in that order keeps the array sorted.
+  std::sort(block_hits.begin(), block_hits.end(),
+            [](const auto &a, const auto &b) { return a.first < b.first; });
+  hits.reserve(m_stats.hits);
+  for (const auto &block : block_hits) hits.insert(hits.end(), block.second.begin(), block.second.end());
+  return success;
+}
+
+bool LinuxMemoryScanner::Scan(nub_process_t pid, const LinuxScanQuery &query, const HitSink &sink) {
+  m_err.Clear();
+  m_stats = Statistics{};
+  if (!query.IsValid()) {
+    m_err.SetError(EINVAL, DNBError::POSIX);
+    return false;
+  }
+  const ScanMatcher matcher(query);
+  const SpanKernel kernel = SelectKernel(matcher);
+  std::atomic<uint64_t> hit_count(0);
+  auto visitor = [&](size_t block, const uint8_t *data, nub_addr_t data_addr,
+                     const std::vector<DNBMemoryExtent> &extents, nub_addr_t start, nub_addr_t end) {
+    std::vector<nub_addr_t> block_hits;
+    ScanBlock(matcher, kernel, data, data_addr, extents, start, end, block_hits);
+    if (block_hits.empty()) return;
+    hit_count += block_hits.size();
+    sink(block, block_hits, data, data_addr);
+  };
+  if (!ReadBlocks(pid, query.size - 1, visitor)) return false;
+  m_stats.hits = hit_count;
+  return true;
+}
+
+bool LinuxMemoryScanner::ReadBlocks(nub_process_t pid, nub_size_t overlap, const BlockVisitor &visitor) {
+  auto start_time = std::chrono::steady_clock::now();
+  m_err.Clear();
+  m_stats = Statistics{};
+  LinuxVMRegionIndex &index = m_vm_memory.RegionIndex();
+  if (index.IsStale(pid) && !index.Refresh(pid) && index.GetError().Fail()) {
+    m_err = index.GetError();
+    return false;
+  }
+
+  std::vector<Block> blocks;
+  for (const LinuxVMRegion &region : index.Regions()) {
+    if ((region.permissions & m_permissions) != m_permissions) continue;
+    if (region.kind == LinuxVMRegion::eKindVVar || region.kind == LinuxVMRegion::eKindVSyscall) continue;
+    const nub_addr_t start = std::max(region.start, m_start);
+    const nub_addr_t end = std::min(region.end, m_end);
+    if (start >= end) continue;
+    m_stats.regions++;
+    // Blocks end on multiples of the block size, so a page never straddles two of them.
+    for (nub_addr_t block = start, block_end; block < end; block = block_end) {
+      block_end = std::min<nub_addr_t>((block & ~static_cast<nub_addr_t>(kBlockSize - 1)) + kBlockSize, end);
+      blocks.push_back({block, block_end, std::min<nub_addr_t>(block_end + overlap, region.end),
+                        region.kind == LinuxVMRegion::eKindFile});
+    }
+  }
+
+  std::atomic<size_t> next_block(0);
+  std::atomic<uint64_t> bytes_scanned(0);
+  auto worker = [&]() {
+    // Transfers keep per instance state (error, cached fds), so every worker reads through its own instance.
+    LinuxVMMemory reader;
+    const nub_size_t page_size = reader.PageSize();
+    std::vector<uint8_t> buffer(kBlockSize + page_size + overlap);
+    std::vector<DNBMemoryExtent> extents;
+    for (size_t i = next_block++; i < blocks.size(); i = next_block++) {
+      const Block &block = blocks[i];
+      // Read from the page boundary, so that the data is 64 byte aligned along with the addresses.
+      const nub_addr_t read_start = block.start & ~(static_cast<nub_addr_t>(page_size) - 1);
+      const nub_size_t read_size = block.read_end - read_start;
+      // Untouched pages of a file mapping read as the file, untouched anonymous pages are zero and skipped.
+      nub_size_t bytes_read = block.file_backed
+                                  ? reader.ReadLarge(pid, read_start, buffer.data(), read_size, extents)
+                                  : reader.ReadResident(pid, read_start, buffer.data(), read_size, extents);
+      bytes_scanned += bytes_read;
+      visitor(i, buffer.data(), read_start, extents, block.start, block.end);
+    }
+  };
+  const size_t thread_count = std::min<size_t>(m_thread_count, blocks.size());
+  if (thread_count <= 1) {
+    worker();
+  } else {
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < thread_count; i++) workers.emplace_back(worker);
+    for (std::thread &thread : workers) thread.join();
+  }
+
+  m_stats.bytes_scanned = bytes_scanned;
+  m_stats.elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now() - start_time).count();
+  return true;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "DNBDefs.h"
+#include "DNBError.h"
+#include "LinuxVMMemory.h"
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// What a scan looks for. Only addresses that are a multiple of `alignment` are considered; by default integers
+// and floats are naturally aligned and byte patterns may start anywhere.
+struct LinuxScanQuery {
+  enum Type : uint8_t {
+    eTypeInteger, // `size` (1, 2, 4 or 8) bytes equal to the low bytes of `integer`
+    eTypeFloat,   // 4 byte float within `tolerance` of `value`
+    eTypeDouble,  // 8 byte double within `tolerance` of `value`
+    eTypeBytes,   // `size` bytes where byte i matches when (data[i] & mask[i]) == (bytes[i] & mask[i])
+  };
+
+  Type type = eTypeInteger;
+  nub_size_t size = 4;
+  nub_size_t alignment = 4; // A power of two
+  uint64_t integer = 0;
+  double value = 0;
+  double tolerance = 0;
+  std::vector<uint8_t> bytes;
+  std::vector<uint8_t> mask;
+
+  static LinuxScanQuery Integer(uint64_t value, nub_size_t size);
+  static LinuxScanQuery Float(float value, float tolerance = 0);
+  static LinuxScanQuery Double(double value, double tolerance = 0);
+  // An empty `mask` matches every byte exactly.
+  static LinuxScanQuery Bytes(const std::vector<uint8_t> &bytes, const std::vector<uint8_t> &mask = {});
+
+  bool IsValid() const;
+  // Scalar check of the `size` bytes at `data`, what the vector kernels are measured against.
+  bool Matches(const uint8_t *data) const;
+};
+
+// Finds every address of a stopped process that holds a value. The readable regions are cut into blocks that a
+// pool of workers claims one at a time; each worker reads its block with one large transfer (skipping pages that
+// were never touched, which read as zero) and matches it 64 bytes per step with AVX2 or SSE2 kernels, or a scalar
+// loop off x86. Hits come back as one sorted array of addresses.
+class LinuxMemoryScanner {
+public:
+  struct Statistics {
+    uint64_t regions = 0;       // Regions scanned by the last Scan()
+    uint64_t bytes_scanned = 0; // Bytes actually read and matched by the last Scan()
+    uint64_t hits = 0;
+    uint64_t elapsed_ns = 0;
+  };
+
+  explicit LinuxMemoryScanner(LinuxVMMemory &vm_memory, unsigned thread_count = 0);
+
+  // Only regions that have all of `permissions` (DNBMemoryPermissions) and overlap [start, end) are scanned.
+  void SetPermissions(uint32_t permissions) { m_permissions = permissions; }
+  void SetRange(nub_addr_t start, nub_addr_t end) {
+    m_start = start;
+    m_end = end;
+  }
+
+  // Called from the worker threads, once per block with hits: the ordinal of the block (blocks are numbered in
+  // address order), its sorted hits, which the sink may take, and the bytes they were matched in, which start at
+  // `data_addr` and are only valid during the call.
+  typedef std::function<void(size_t block, std::vector<nub_addr_t> &hits, const uint8_t *data, nub_addr_t data_addr)>
+      HitSink;
+
+  bool Scan(nub_process_t pid, const LinuxScanQuery &query, std::vector<nub_addr_t> &hits);
+  // Streams the hits to `sink` instead of collecting them, for callers that keep them in another form.
+  bool Scan(nub_process_t pid, const LinuxScanQuery &query, const HitSink &sink);
+  // Called from the worker threads with each block as read: `data` holds the bytes from `data_addr`, which is the
+  // page the block starts in, up to the end of the block plus the requested overlap (capped at the region end), and
+  // `extents` tells which of them could be read. Only what starts in [start, end) belongs to the block.
+  typedef std::function<void(size_t block, const uint8_t *data, nub_addr_t data_addr,
+                             const std::vector<DNBMemoryExtent> &extents, nub_addr_t start, nub_addr_t end)>
+      BlockVisitor;
+  // The reading half of Scan(), for other passes over the same regions. Statistics are filled but for `hits`.
+  bool ReadBlocks(nub_process_t pid, nub_size_t overlap, const BlockVisitor &visitor);
+
+  // "avx2", "sse2" or "scalar": the kernel this machine uses.
+  static const char *KernelName();
+
+  const Statistics &GetStatistics() const { return m_stats; }
+  const DNBError &GetError() const { return m_err; }
+
+private:
+  static constexpr nub_size_t kBlockSize = 256 * 1024;
+
+  struct Block {
+    nub_addr_t start;
+    nub_addr_t end;      // Values must start before this
+    nub_addr_t read_end; // Values may extend up to this, the end of the region
+    bool file_backed;
+  };
+
+  LinuxVMMemory &m_vm_memory;
+  unsigned m_thread_count;
+  uint32_t m_permissions = eMemoryPermissionsReadable;
+  nub_addr_t m_start = 0;
+  nub_addr_t m_end = INVALID_NUB_ADDRESS;
+  Statistics m_stats;
+  DNBError m_err;
+};
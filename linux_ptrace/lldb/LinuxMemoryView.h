@@ -0,0 +1,86 @@
+#pragma once
+
+#include "DNBDefs.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// Read-only window on target memory returned by LinuxProcess::ReadMemoryView. The bytes live either in a page of
+// the page cache or in the process' view arena, both of which are recycled when the process runs again: a view is
+// valid until the next Resume/SingleStep/Detach of the process that produced it and must not outlive that process.
+class LinuxMemoryView {
+public:
+  LinuxMemoryView() = default;
+  LinuxMemoryView(nub_addr_t address, const uint8_t *data, nub_size_t size, const uint64_t *owner_epoch)
+      : m_address(address), m_data(data), m_size(size), m_owner_epoch(owner_epoch),
+        m_epoch(owner_epoch ? *owner_epoch : 0) {}
+
+  nub_addr_t address() const { return m_address; }
+  const uint8_t *data() const {
+    assert(IsValid() && "memory view used after the process resumed");
+    return m_data;
+  }
+  nub_size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+  const uint8_t *begin() const { return data(); }
+  const uint8_t *end() const { return data() + m_size; }
+  uint8_t operator[](nub_size_t index) const { return data()[index]; }
+  uint64_t StopEpoch() const { return m_epoch; }
+  bool IsValid() const { return m_owner_epoch != nullptr && *m_owner_epoch == m_epoch; }
+
+  // Unaligned load of a value at `offset`, the usual way of reading a variable out of the view. False, with `value`
+  // untouched, when the view ends before the value does: the read stopped at an unreadable page.
+  template <typename T> bool as(T *value, nub_size_t offset = 0) const {
+    if (offset > m_size || sizeof(T) > m_size - offset) return false;
+    std::memcpy(value, data() + offset, sizeof(T));
+    return true;
+  }
+
+private:
+  nub_addr_t m_address = INVALID_NUB_ADDRESS;
+  const uint8_t *m_data = nullptr;
+  nub_size_t m_size = 0;
+  const uint64_t *m_owner_epoch = nullptr;
+  uint64_t m_epoch = 0;
+};
+
+// Bump allocator backing the views that cannot alias a cache page. Blocks are kept across epochs, so steady state
+// polling allocates nothing.
+class LinuxViewArena {
+public:
+  uint8_t *Allocate(nub_size_t size) {
+    while (m_curr_block < m_blocks.size()) {
+      Block &block = m_blocks[m_curr_block];
+      if (block.size - m_curr_offset >= size) {
+        uint8_t *data = block.data.get() + m_curr_offset;
+        m_curr_offset = std::min(block.size, m_curr_offset + ((size + kAlignment - 1) & ~(kAlignment - 1)));
+        return data;
+      }
+      m_curr_block++;
+      m_curr_offset = 0;
+    }
+    nub_size_t block_size = std::max(kBlockSize, size);
+    m_blocks.push_back({std::unique_ptr<uint8_t[]>(new uint8_t[block_size]), block_size});
+    m_curr_offset = std::min(block_size, (size + kAlignment - 1) & ~(kAlignment - 1));
+    return m_blocks.back().data.get();
+  }
+  void Reset() {
+    m_curr_block = 0;
+    m_curr_offset = 0;
+  }
+
+private:
+  static constexpr nub_size_t kBlockSize = 64 * 1024;
+  static constexpr nub_size_t kAlignment = 16;
+
+  struct Block {
+    std::unique_ptr<uint8_t[]> data;
+    nub_size_t size;
+  };
+  std::vector<Block> m_blocks{};
+  size_t m_curr_block = 0;
+  nub_size_t m_curr_offset = 0;
+};
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <sys/mman.h>
+
+// Maps exactly at the hint or fails with EEXIST, where MAP_FIXED would replace what is there. Kernels before 4.17 do
+// not know the flag and take it for a plain hint: callers check the address they got.
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
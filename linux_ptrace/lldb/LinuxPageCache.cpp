@@ -0,0 +1,149 @@
+#include "LinuxPageCache.h"
+#include <algorithm>
+#include <cstring>
+
+LinuxPageCache::LinuxPageCache(LinuxVMMemory &vm_memory, nub_size_t max_pages)
+    : m_vm_memory(vm_memory), m_page_size(vm_memory.PageSize()), m_max_pages(max_pages) {}
+
+void LinuxPageCache::Invalidate() {
+  Flush();
+  m_pinned = false;
+  m_next_sequential_page = INVALID_NUB_ADDRESS;
+  m_prefetch_pages = 0;
+}
+
+void LinuxPageCache::Flush() {
+  if (!m_pages.empty()) m_stats.flushes++;
+  m_pages.clear();
+  m_next_slot = 0;
+}
+
+void LinuxPageCache::SyncEpoch(uint64_t stop_epoch) {
+  if (stop_epoch == m_epoch) return;
+  Invalidate();
+  m_epoch = stop_epoch;
+}
+
+uint32_t LinuxPageCache::AllocateSlot() {
+  uint32_t slot = m_next_slot++;
+  if (slot / kSlotsPerBlock >= m_blocks.size()) {
+    m_blocks.emplace_back(new uint8_t[kSlotsPerBlock * m_page_size]);
+  }
+  return slot;
+}
+
+void LinuxPageCache::Fetch(nub_process_t pid, nub_addr_t first_page, nub_size_t page_count, nub_addr_t ahead_of) {
+  std::vector<DNBMemoryRequest> requests;
+  std::vector<uint32_t> slots;
+  requests.reserve(page_count);
+  slots.reserve(page_count);
+  for (nub_size_t i = 0; i < page_count; i++) {
+    nub_addr_t page = first_page + i * m_page_size;
+    if (m_pages.count(page)) continue;
+    uint32_t slot = AllocateSlot();
+    requests.push_back({page, m_page_size, SlotData(slot), 0});
+    slots.push_back(slot);
+  }
+  if (requests.empty()) return;
+  m_vm_memory.ReadBatch(pid, requests.data(), requests.size());
+  m_stats.fetches++;
+  for (size_t i = 0; i < requests.size(); i++) {
+    const bool readable = requests[i].bytes_transferred == m_page_size;
+    m_pages[requests[i].addr] = readable ? slots[i] : kUnreadable;
+    if (readable && requests[i].addr >= ahead_of) m_stats.prefetched++;
+  }
+}
+
+bool LinuxPageCache::Populate(nub_process_t pid, nub_addr_t address, nub_size_t data_count) {
+  const nub_addr_t first_page = address - (address % m_page_size);
+  const nub_addr_t last_page = (address + data_count - 1) - ((address + data_count - 1) % m_page_size);
+  const nub_size_t page_count = (last_page - first_page) / m_page_size + 1;
+  if (page_count > m_max_pages) return false;
+
+  nub_addr_t first_missing = INVALID_NUB_ADDRESS;
+  nub_size_t missing_count = 0;
+  for (nub_addr_t page = first_page; page <= last_page; page += m_page_size) {
+    if (m_pages.count(page)) continue;
+    if (first_missing == INVALID_NUB_ADDRESS) first_missing = page;
+    missing_count = (page - first_missing) / m_page_size + 1;
+  }
+  m_stats.hits += page_count - missing_count;
+  if (missing_count == 0) return true;
+
+  m_stats.misses += missing_count;
+  // A miss that starts where the previous one ended is a sequential walk: fetch ahead with a window that doubles
+  // while the pattern holds, so scans and stack walks cost one batched read per window.
+  if (first_missing == m_next_sequential_page) {
+    m_prefetch_pages = std::min(std::max<nub_size_t>(m_prefetch_pages * 2, 1), kMaxPrefetchPages);
+  } else {
+    m_prefetch_pages = 0;
+  }
+  nub_size_t fetch_count = std::min(missing_count + m_prefetch_pages, m_max_pages);
+  if (m_pages.size() + fetch_count > m_max_pages) {
+    if (m_pinned) return false;
+    // Full: start over, refetching the pages of this request that were hits.
+    Flush();
+    fetch_count = std::min(page_count + m_prefetch_pages, m_max_pages);
+    first_missing = first_page;
+  }
+  Fetch(pid, first_missing, fetch_count, last_page + m_page_size);
+  m_next_sequential_page = first_missing + fetch_count * m_page_size;
+  return true;
+}
+
+nub_size_t LinuxPageCache::Read(nub_process_t pid, uint64_t stop_epoch, nub_addr_t address, void *data,
+                                nub_size_t data_count) {
+  if (data == NULL || data_count == 0 || m_page_size == 0) return 0;
+  SyncEpoch(stop_epoch);
+  if (!Populate(pid, address, data_count)) return m_vm_memory.Read(pid, address, data, data_count);
+
+  nub_size_t total_bytes_read = 0;
+  uint8_t *curr_data = static_cast<uint8_t *>(data);
+  nub_addr_t curr_addr = address;
+  while (total_bytes_read < data_count) {
+    nub_addr_t page = curr_addr - (curr_addr % m_page_size);
+    auto pos = m_pages.find(page);
+    if (pos == m_pages.end() || pos->second == kUnreadable) break;
+    nub_size_t page_offset = curr_addr - page;
+    nub_size_t curr_size = std::min(m_page_size - page_offset, data_count - total_bytes_read);
+    ::memcpy(curr_data, SlotData(pos->second) + page_offset, curr_size);
+    total_bytes_read += curr_size;
+    curr_addr += curr_size;
+    curr_data += curr_size;
+  }
+  return total_bytes_read;
+}
+
+const uint8_t *LinuxPageCache::ReadView(nub_process_t pid, uint64_t stop_epoch, nub_addr_t address,
+                                        nub_size_t data_count) {
+  if (data_count == 0 || m_page_size == 0) return NULL;
+  SyncEpoch(stop_epoch);
+  const nub_addr_t page = address - (address % m_page_size);
+  if (address + data_count - page > m_page_size) return NULL;
+  if (!Populate(pid, address, data_count)) return NULL;
+  auto pos = m_pages.find(page);
+  if (pos == m_pages.end() || pos->second == kUnreadable) return NULL;
+  m_pinned = true;
+  return SlotData(pos->second) + (address - page);
+}
+
+void LinuxPageCache::WriteThrough(uint64_t stop_epoch, nub_addr_t address, const void *data, nub_size_t data_count) {
+  if (data == NULL || data_count == 0 || m_page_size == 0) return;
+  SyncEpoch(stop_epoch);
+
+  const uint8_t *curr_data = static_cast<const uint8_t *>(data);
+  nub_addr_t curr_addr = address;
+  nub_size_t total_bytes = 0;
+  while (total_bytes < data_count) {
+    nub_addr_t page = curr_addr - (curr_addr % m_page_size);
+    nub_size_t page_offset = curr_addr - page;
+    nub_size_t curr_size = std::min(m_page_size - page_offset, data_count - total_bytes);
+    auto pos = m_pages.find(page);
+    if (pos != m_pages.end() && pos->second != kUnreadable) {
+      ::memcpy(SlotData(pos->second) + page_offset, curr_data, curr_size);
+    }
+    total_bytes += curr_size;
+    curr_addr += curr_size;
+    curr_data += curr_size;
+  }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "DNBDefs.h"
+#include "LinuxVMMemory.h"
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Page granular cache of target memory. The content is only valid while the target stays stopped, so every
+// lookup carries the stop epoch of the process and a new epoch drops everything cached before it.
+class LinuxPageCache {
+public:
+  struct Statistics {
+    uint64_t hits = 0;       // Pages served from the cache
+    uint64_t misses = 0;     // Pages the caller asked for that had to be fetched
+    uint64_t prefetched = 0; // Pages read ahead of a sequential access pattern
+    uint64_t fetches = 0;    // Batched reads issued to the target
+    uint64_t flushes = 0;    // Times the cache was dropped because of a new epoch or because it was full
+  };
+
+  explicit LinuxPageCache(LinuxVMMemory &vm_memory, nub_size_t max_pages = 16 * 1024);
+
+  nub_size_t Read(nub_process_t pid, uint64_t stop_epoch, nub_addr_t address, void *data, nub_size_t data_count);
+  // Returns a pointer straight into the cached page when the range lies within one readable page, NULL otherwise.
+  // The page is pinned: it is not recycled before the stop epoch ends, even when the cache runs full.
+  const uint8_t *ReadView(nub_process_t pid, uint64_t stop_epoch, nub_addr_t address, nub_size_t data_count);
+  // Keeps pages that are already cached coherent with a write that went to the target.
+  void WriteThrough(uint64_t stop_epoch, nub_addr_t address, const void *data, nub_size_t data_count);
+  void Invalidate();
+
+  const Statistics &GetStatistics() const { return m_stats; }
+  void ResetStatistics() { m_stats = Statistics{}; }
+  nub_size_t PageCount() const { return m_pages.size(); }
+
+private:
+  static constexpr uint32_t kUnreadable = UINT32_MAX;
+  static constexpr nub_size_t kSlotsPerBlock = 64;
+  static constexpr nub_size_t kMaxPrefetchPages = 64;
+
+  void SyncEpoch(uint64_t stop_epoch);
+  void Flush();
+  // Makes sure every page of the range is cached. Returns false when the cache is full but pinned, in which case
+  // the caller has to read around the cache.
+  bool Populate(nub_process_t pid, nub_addr_t address, nub_size_t data_count);
+  // Pages from `ahead_of` on were not asked for; those the read returned count as prefetched.
+  void Fetch(nub_process_t pid, nub_addr_t first_page, nub_size_t page_count, nub_addr_t ahead_of);
+  uint32_t AllocateSlot();
+  uint8_t *SlotData(uint32_t slot) {
+    return m_blocks[slot / kSlotsPerBlock].get() + (slot % kSlotsPerBlock) * m_page_size;
+  }
+
+  LinuxVMMemory &m_vm_memory;
+  nub_size_t m_page_size;
+  nub_size_t m_max_pages;
+  uint64_t m_epoch = 0;
+  std::unordered_map<nub_addr_t, uint32_t> m_pages; // page address -> storage slot or kUnreadable
+  std::vector<std::unique_ptr<uint8_t[]>> m_blocks; // page storage, reused across epochs
+  uint32_t m_next_slot = 0;
+  nub_addr_t m_next_sequential_page = INVALID_NUB_ADDRESS;
+  nub_size_t m_prefetch_pages = 0;
+  bool m_pinned = false; // A view aliases one of the pages of this epoch
+  Statistics m_stats;
+};
@@ -0,0 +1,134 @@
+#include "LinuxPageCodec.h"
+#include <algorithm>
+#include <cstring>
+
+static constexpr size_t kMinMatch = 4;
+static constexpr size_t kMaxOffset = 65535;
+// Like LZ4, matches stop short of the end so the last sequence always carries literals.
+static constexpr size_t kLastLiterals = 5;
+static constexpr size_t kMatchFindLimit = 12;
+static constexpr int kHashLog = 12;
+
+static inline uint32_t Read32(const uint8_t *p) {
+  uint32_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline uint32_t Hash4(uint32_t sequence) { return (sequence * 2654435761U) >> (32 - kHashLog); }
+
+static inline uint8_t *WriteLength(uint8_t *op, size_t length) {
+  for (; length >= 255; length -= 255) *op++ = 255;
+  *op++ = static_cast<uint8_t>(length);
+  return op;
+}
+
+static uint8_t *WriteSequence(uint8_t *op, const uint8_t *literals, size_t literal_length, size_t offset,
+                              size_t match_length) {
+  uint8_t *token = op++;
+  *token = static_cast<uint8_t>((literal_length >= 15 ? 15 : literal_length) << 4);
+  if (literal_length >= 15) op = WriteLength(op, literal_length - 15);
+  std::memcpy(op, literals, literal_length);
+  op += literal_length;
+  if (match_length == 0) return op;
+  *op++ = static_cast<uint8_t>(offset);
+  *op++ = static_cast<uint8_t>(offset >> 8);
+  match_length -= kMinMatch;
+  *token |= static_cast<uint8_t>(match_length >= 15 ? 15 : match_length);
+  if (match_length >= 15) op = WriteLength(op, match_length - 15);
+  return op;
+}
+
+size_t LinuxPageCodec::Compress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity) {
+  if (capacity < CompressBound(size)) return 0;
+  // Last occurrence of each hash as `base` + position + 1. The table outlives the call and every call starts above
+  // the entries of the previous one, so it is not cleared per page; clearing would cost more than hashing one.
+  thread_local uint32_t table[1 << kHashLog];
+  thread_local uint32_t base = 0;
+  if (static_cast<uint64_t>(base) + size + 1 > UINT32_MAX) {
+    std::memset(table, 0, sizeof(table));
+    base = 0;
+  }
+  const uint8_t *ip = src;
+  const uint8_t *anchor = src;
+  const uint8_t *const end = src + size;
+  const uint8_t *const match_limit = end - kLastLiterals;
+  uint8_t *op = dst;
+
+  if (size > kMatchFindLimit) {
+    const uint8_t *const search_limit = end - kMatchFindLimit;
+    while (ip < search_limit) {
+      const uint32_t sequence = Read32(ip);
+      const uint32_t hash = Hash4(sequence);
+      const uint32_t candidate = table[hash];
+      const size_t position = static_cast<size_t>(ip - src);
+      table[hash] = base + static_cast<uint32_t>(position) + 1;
+      if (candidate <= base || position - (candidate - base - 1) > kMaxOffset ||
+          Read32(src + (candidate - base - 1)) != sequence) {
+        // Skip faster through data that does not compress.
+        ip += 1 + ((ip - anchor) >> 6);
+        continue;
+      }
+      const uint8_t *match = src + (candidate - base - 1);
+      const uint8_t *match_end = ip + kMinMatch;
+      while (match_end < match_limit && *match_end == match[match_end - ip]) match_end++;
+      op = WriteSequence(op, anchor, ip - anchor, ip - match, match_end - ip);
+      ip = anchor = match_end;
+    }
+  }
+  op = WriteSequence(op, anchor, end - anchor, 0, 0);
+  base += static_cast<uint32_t>(size) + 1;
+  return op - dst;
+}
+
+size_t LinuxPageCodec::Decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity) {
+  const uint8_t *ip = src;
+  const uint8_t *const end = src + size;
+  uint8_t *op = dst;
+  uint8_t *const out_end = dst + capacity;
+  auto read_length = [&](size_t length, bool &ok) {
+    if (length != 15) return length;
+    uint8_t byte;
+    do {
+      if (ip >= end) {
+        ok = false;
+        return length;
+      }
+      byte = *ip++;
+      length += byte;
+    } while (byte == 255);
+    return length;
+  };
+
+  while (ip < end) {
+    const uint8_t token = *ip++;
+    bool ok = true;
+    size_t literal_length = read_length(token >> 4, ok);
+    if (!ok || literal_length > static_cast<size_t>(end - ip) || literal_length > static_cast<size_t>(out_end - op)) {
+      return 0;
+    }
+    std::memcpy(op, ip, literal_length);
+    ip += literal_length;
+    op += literal_length;
+    if (ip == end) break; // The last sequence has no match
+
+    if (end - ip < 2) return 0;
+    const size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    size_t match_length = read_length(token & 15, ok) + kMinMatch;
+    if (!ok || offset == 0 || offset > static_cast<size_t>(op - dst) ||
+        match_length > static_cast<size_t>(out_end - op)) {
+      return 0;
+    }
+    // A match may overlap its own output (offset < length, e.g. a run). The bytes from `match` repeat with period
+    // `offset`, so copy what is already there, doubling the chunk each step.
+    const uint8_t *match = op - offset;
+    while (match_length > 0) {
+      size_t count = std::min<size_t>(op - match, match_length);
+      std::memcpy(op, match, count);
+      op += count;
+      match_length -= count;
+    }
+  }
+  return static_cast<size_t>(op - dst) == capacity ? capacity : 0;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Small LZ77 codec for pages, laid out like an LZ4 block: a token (literal length nibble, match length nibble),
+// extended lengths as runs of 255, the literals, then a 16-bit match offset. It trades ratio for speed, which is
+// what storing whole address spaces needs: memory pages are mostly repetitive structure, not text.
+namespace LinuxPageCodec {
+
+// Worst case size of the compressed form of `size` bytes.
+constexpr size_t CompressBound(size_t size) { return size + size / 255 + 16; }
+
+// Returns the compressed size, 0 when the result would not fit in `capacity`.
+size_t Compress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity);
+
+// Returns `capacity`, or 0 when `src` is malformed or does not decode to exactly `capacity` bytes.
+size_t Decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity);
+
+} // namespace LinuxPageCodec
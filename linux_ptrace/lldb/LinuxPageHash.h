@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Four independent 64-bit lanes over the buffer, in the spirit of xxHash64. Fast enough to hash every page of a
+// process on each snapshot; it is not meant to resist adversarial input.
+inline uint64_t HashPage(const uint8_t *data, size_t size, uint64_t seed = 0) {
+  const uint64_t k1 = 0x9E3779B185EBCA87ULL;
+  const uint64_t k2 = 0xC2B2AE3D27D4EB4FULL;
+  auto rotate_left = [](uint64_t value, int bits) { return (value << bits) | (value >> (64 - bits)); };
+  uint64_t lanes[4] = {seed + k1 + k2, seed + k2, seed, seed - k1};
+  for (size_t offset = 0; offset + 32 <= size; offset += 32) {
+    for (int lane = 0; lane < 4; lane++) {
+      uint64_t word;
+      std::memcpy(&word, data + offset + lane * 8, sizeof(word));
+      lanes[lane] = rotate_left(lanes[lane] + word * k2, 31) * k1;
+    }
+  }
+  uint64_t hash = rotate_left(lanes[0], 1) + rotate_left(lanes[1], 7) + rotate_left(lanes[2], 12) +
+                  rotate_left(lanes[3], 18) + size;
+  hash ^= hash >> 33;
+  hash *= k2;
+  hash ^= hash >> 29;
+  hash *= k1;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+// 128-bit content key of a page: two differently seeded hashes. Wide enough that distinct pages of dozens of
+// multi-GB snapshots never share a key in practice.
+struct LinuxPageKey {
+  uint64_t low;
+  uint64_t high;
+
+  static LinuxPageKey Of(const uint8_t *data, size_t size) {
+    LinuxPageKey key{HashPage(data, size), HashPage(data, size, 0x5851F42D4C957F2DULL)};
+    // All zero is reserved for the zero page.
+    if (key.low == 0 && key.high == 0) key.low = 1;
+    return key;
+  }
+  static LinuxPageKey Zero() { return LinuxPageKey{0, 0}; }
+  bool IsZero() const { return low == 0 && high == 0; }
+  bool operator==(const LinuxPageKey &other) const { return low == other.low && high == other.high; }
+  bool operator!=(const LinuxPageKey &other) const { return !(*this == other); }
+};
+
+// Checks 64 bytes per step, so pages with content usually bail out on the first block.
+inline bool IsZeroPage(const uint8_t *data, size_t size) {
+  for (size_t offset = 0; offset + 64 <= size; offset += 64) {
+    uint64_t words[8];
+    std::memcpy(words, data + offset, sizeof(words));
+    if ((words[0] | words[1] | words[2] | words[3] | words[4] | words[5] | words[6] | words[7]) != 0) return false;
+  }
+  for (size_t offset = size - size % 64; offset < size; offset++) {
+    if (data[offset] != 0) return false;
+  }
+  return true;
+}
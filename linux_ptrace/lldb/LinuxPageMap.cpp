@@ -0,0 +1,119 @@
+#include "LinuxPageMap.h"
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Layout of a pagemap entry, see Documentation/admin-guide/mm/pagemap.rst.
+static constexpr uint64_t kPageMapSoftDirty = 1ULL << 55;
+static constexpr uint64_t kPageMapFile = 1ULL << 61;
+static constexpr uint64_t kPageMapSwapped = 1ULL << 62;
+static constexpr uint64_t kPageMapPresent = 1ULL << 63;
+
+LinuxPageMap::LinuxPageMap()
+    : m_pid(INVALID_NUB_PROCESS), m_fd(-1), m_page_size(static_cast<nub_size_t>(::sysconf(_SC_PAGESIZE))),
+      m_err(0) {}
+
+LinuxPageMap::~LinuxPageMap() {
+  if (m_fd >= 0) ::close(m_fd);
+}
+
+bool LinuxPageMap::Open(nub_process_t pid) {
+  if (m_pid == pid) return true;
+  if (m_fd >= 0) ::close(m_fd);
+  std::string path = "/proc/" + std::to_string(pid) + "/pagemap";
+  m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  m_pid = m_fd >= 0 ? pid : INVALID_NUB_PROCESS;
+  if (m_fd < 0) m_err.SetErrorToErrno();
+  return m_fd >= 0;
+}
+
+bool LinuxPageMap::Query(nub_process_t pid, nub_addr_t address, nub_size_t size, LinuxPageStates &states) {
+  m_err.Clear();
+  const nub_addr_t first_page = address / m_page_size;
+  const nub_addr_t end_page = size != 0 ? (address + size - 1) / m_page_size + 1 : first_page;
+  const nub_size_t word_count = (end_page - first_page + 63) / 64;
+  states.addr = first_page * m_page_size;
+  states.page_size = m_page_size;
+  states.page_count = end_page - first_page;
+  for (std::vector<uint64_t> *bitmap : {&states.present, &states.swapped, &states.file, &states.soft_dirty}) {
+    bitmap->assign(word_count, 0);
+  }
+  if (states.page_count == 0) return true;
+  if (!Open(pid)) return false;
+
+  m_entries.resize(std::min<nub_size_t>(states.page_count, kMaxEntriesPerRead));
+  nub_size_t page = 0;
+  while (page < states.page_count) {
+    nub_size_t count = std::min<nub_size_t>(states.page_count - page, m_entries.size());
+    ssize_t bytes = ::pread(m_fd, m_entries.data(), count * sizeof(uint64_t),
+                            static_cast<off_t>((first_page + page) * sizeof(uint64_t)));
+    if (bytes < 0 && errno == EINTR) continue;
+    if (bytes <= 0) {
+      if (bytes < 0) m_err.SetErrorToErrno();
+      return false;
+    }
+    count = bytes / sizeof(uint64_t);
+    for (nub_size_t i = 0; i < count; i++, page++) {
+      const uint64_t entry = m_entries[i];
+      const uint64_t bit = 1ULL << (page % 64);
+      const nub_size_t word = page / 64;
+      if (entry & kPageMapPresent) states.present[word] |= bit;
+      if (entry & kPageMapSwapped) states.swapped[word] |= bit;
+      if (entry & kPageMapFile) states.file[word] |= bit;
+      if (entry & kPageMapSoftDirty) states.soft_dirty[word] |= bit;
+    }
+  }
+  return true;
+}
+
+std::vector<nub_addr_t> LinuxPageMap::GetDirtyPages(nub_process_t pid, nub_addr_t address, nub_size_t size) {
+  std::vector<nub_addr_t> dirty_pages;
+  LinuxPageStates states;
+  if (!Query(pid, address, size, states)) return dirty_pages;
+  for (nub_size_t page = 0; page < states.page_count; page++) {
+    if (states.IsDirty(page)) dirty_pages.push_back(states.PageAddress(page));
+  }
+  return dirty_pages;
+}
+
+bool LinuxPageMap::SoftDirtySupported() {
+  static const bool supported = [] {
+    const long page_size = ::sysconf(_SC_PAGESIZE);
+    void *page = ::mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED) return false;
+    *static_cast<volatile uint8_t *>(page) = 1;
+    uint64_t entry = 0;
+    int fd = ::open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+      off_t offset = static_cast<off_t>(reinterpret_cast<uintptr_t>(page) / page_size * sizeof(entry));
+      if (::pread(fd, &entry, sizeof(entry), offset) != sizeof(entry)) entry = 0;
+      ::close(fd);
+    }
+    ::munmap(page, page_size);
+    return (entry & kPageMapSoftDirty) != 0;
+  }();
+  return supported;
+}
+
+bool LinuxPageMap::ClearSoftDirty(nub_process_t pid) {
+  m_err.Clear();
+  if (!SoftDirtySupported()) {
+    m_err.SetError(ENOTSUP, DNBError::POSIX);
+    return false;
+  }
+  std::string path = "/proc/" + std::to_string(pid) + "/clear_refs";
+  int fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    m_err.SetErrorToErrno();
+    return false;
+  }
+  // "4" clears the soft-dirty bits and write protects the pages again, so the next write sets them.
+  bool success = ::write(fd, "4", 1) == 1;
+  if (success) m_soft_dirty_epoch++;
+  if (!success) m_err.SetErrorToErrno();
+  ::close(fd);
+  return success;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "DNBDefs.h"
+#include "DNBError.h"
+#include <cstdint>
+#include <sys/types.h>
+#include <vector>
+
+// Page states of a range, one bit per page in each bitmap: page i of the range is bit (i % 64) of word (i / 64).
+struct LinuxPageStates {
+  nub_addr_t addr = 0;
+  nub_size_t page_size = 0;
+  nub_size_t page_count = 0;
+  std::vector<uint64_t> present;
+  std::vector<uint64_t> swapped;
+  std::vector<uint64_t> file;       // Page cache or shared anonymous page, clean copies exist outside the process
+  std::vector<uint64_t> soft_dirty; // Written since the last LinuxPageMap::ClearSoftDirty()
+
+  static bool Test(const std::vector<uint64_t> &bitmap, nub_size_t page) {
+    return (bitmap[page / 64] >> (page % 64)) & 1;
+  }
+  nub_addr_t PageAddress(nub_size_t page) const { return addr + page * page_size; }
+  // Present or swapped out: the page has content of its own and reading it does not fault in a fresh page.
+  bool IsResident(nub_size_t page) const { return Test(present, page) || Test(swapped, page); }
+  // Resident and either anonymous or written since the soft-dirty bits were last cleared.
+  bool IsDirty(nub_size_t page) const {
+    return IsResident(page) && (!Test(file, page) || Test(soft_dirty, page));
+  }
+};
+
+// Batched reader of /proc/pid/pagemap, the Linux counterpart of mach_vm_page_range_query. Entries are pread in
+// chunks straight into the bitmaps, so querying a range costs one read per kMaxEntriesPerRead pages.
+class LinuxPageMap {
+public:
+  LinuxPageMap();
+  ~LinuxPageMap();
+  LinuxPageMap(const LinuxPageMap &) = delete;
+  LinuxPageMap &operator=(const LinuxPageMap &) = delete;
+
+  // Fills `states` for the pages overlapping [address, address + size).
+  bool Query(nub_process_t pid, nub_addr_t address, nub_size_t size, LinuxPageStates &states);
+  // Addresses of the dirty pages of the range, in the form DNBRegionInfo::dirty_pages expects.
+  std::vector<nub_addr_t> GetDirtyPages(nub_process_t pid, nub_addr_t address, nub_size_t size);
+  // Resets the soft-dirty bits of the whole process (/proc/pid/clear_refs), the start of a new write tracking
+  // interval. Fails with ENOTSUP on kernels built without CONFIG_MEM_SOFT_DIRTY.
+  bool ClearSoftDirty(nub_process_t pid);
+  // Bumped by every ClearSoftDirty(). The bits are process wide, so each user of them records the epoch after its own
+  // clear and trusts them only while it is unchanged: a clear by another user hides the writes made before it.
+  uint64_t SoftDirtyEpoch() const { return m_soft_dirty_epoch; }
+  // Probed once on a page of our own: a freshly written page always carries the soft-dirty bit when the kernel
+  // tracks it.
+  static bool SoftDirtySupported();
+
+  const DNBError &GetError() const { return m_err; }
+
+private:
+  static constexpr nub_size_t kMaxEntriesPerRead = 64 * 1024;
+
+  bool Open(nub_process_t pid);
+
+  nub_process_t m_pid;
+  int m_fd;
+  nub_size_t m_page_size;
+  std::vector<uint64_t> m_entries;
+  uint64_t m_soft_dirty_epoch = 0;
+  DNBError m_err;
+};
@@ -0,0 +1,498 @@
+#include "LinuxPageStore.h"
+#include "LinuxPageCodec.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr char kIndexMagic[8] = {'D', 'N', 'B', 'P', 'I', 'D', 'X', '2'};
+static constexpr char kSnapshotMagic[8] = {'D', 'N', 'B', 'S', 'N', 'A', 'P', '1'};
+static constexpr uint64_t kInitialIndexCapacity = 64 * 1024;
+static constexpr uint32_t kEntryRaw = 1;
+static constexpr nub_size_t kChunkPages = 1024;
+
+struct LinuxPageStore::IndexHeader {
+  char magic[8];
+  uint64_t page_size;
+  uint64_t capacity; // Number of entries, a power of two
+  uint64_t count;
+  uint64_t data_size;   // Length of pages.dat covered by the index, anything past it is an unfinished append
+  uint64_t synced_size; // Length of pages.dat known to be on disk, entries past it may point at lost data
+  uint64_t reserved[2];
+};
+
+struct LinuxPageStore::IndexEntry {
+  LinuxPageKey key; // Zero when the slot is free
+  uint64_t offset;
+  uint32_t size;
+  uint32_t flags;
+};
+
+struct LinuxPageStore::SnapshotHeader {
+  char magic[8];
+  uint64_t page_size;
+  uint64_t range_count;
+  uint64_t entry_count;
+};
+
+static bool WriteAll(int fd, const void *data, size_t size, off_t offset) {
+  const uint8_t *curr = static_cast<const uint8_t *>(data);
+  while (size > 0) {
+    ssize_t bytes = ::pwrite(fd, curr, size, offset);
+    if (bytes < 0 && errno == EINTR) continue;
+    if (bytes <= 0) return false;
+    curr += bytes;
+    size -= bytes;
+    offset += bytes;
+  }
+  return true;
+}
+
+static bool ReadAll(int fd, void *data, size_t size, off_t offset) {
+  uint8_t *curr = static_cast<uint8_t *>(data);
+  while (size > 0) {
+    ssize_t bytes = ::pread(fd, curr, size, offset);
+    if (bytes < 0 && errno == EINTR) continue;
+    if (bytes <= 0) return false;
+    curr += bytes;
+    size -= bytes;
+    offset += bytes;
+  }
+  return true;
+}
+
+// A rename is only durable once the directory holding it is.
+static bool SyncDirectory(const std::string &directory) {
+  int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) return false;
+  const bool success = ::fsync(fd) == 0;
+  ::close(fd);
+  return success;
+}
+
+LinuxPageStore::LinuxPageStore()
+    : m_page_size(static_cast<nub_size_t>(::sysconf(_SC_PAGESIZE))), m_page(m_page_size),
+      m_zero_page(m_page_size, 0), m_compressed(LinuxPageCodec::CompressBound(m_page_size)), m_err(0) {}
+
+LinuxPageStore::~LinuxPageStore() { Close(); }
+
+std::string LinuxPageStore::SnapshotPath(uint32_t snapshot) const {
+  return m_directory + "/snapshot-" + std::to_string(snapshot) + ".dat";
+}
+
+bool LinuxPageStore::Open(const std::string &directory) {
+  Close();
+  m_err.Clear();
+  if (::mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+    m_err.SetErrorToErrno();
+    return false;
+  }
+  m_directory = directory;
+  m_data_fd = ::open((directory + "/pages.dat").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  m_index_fd = ::open((directory + "/index.dat").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  struct stat st;
+  if (m_data_fd < 0 || m_index_fd < 0 || ::fstat(m_index_fd, &st) != 0) {
+    m_err.SetErrorToErrno();
+    Close();
+    return false;
+  }
+  if (!MapIndex(st.st_size == 0 ? kInitialIndexCapacity : 0, st.st_size == 0)) {
+    Close();
+    return false;
+  }
+  // After a crash: drop the entries whose data may not have made it to the disk.
+  if ((m_index->data_size > m_index->synced_size || HasUnsyncedEntries()) &&
+      !RebuildIndex(m_index->capacity, m_index->synced_size)) {
+    Close();
+    return false;
+  }
+  // Drop a page append that was cut short before its index entry was written.
+  if (::ftruncate(m_data_fd, static_cast<off_t>(m_index->data_size)) != 0) {
+    m_err.SetErrorToErrno();
+    Close();
+    return false;
+  }
+  while (::access(SnapshotPath(m_snapshot_count).c_str(), F_OK) == 0) m_snapshot_count++;
+  m_opened = true;
+  return true;
+}
+
+void LinuxPageStore::Close() {
+  // Not while Open() fails half way, that would certify what it is about to drop.
+  if (m_opened) Sync();
+  for (SnapshotMapping &mapping : m_snapshots) {
+    if (mapping.base != nullptr) ::munmap(mapping.base, mapping.size);
+  }
+  m_snapshots.clear();
+  if (m_index != nullptr) ::munmap(m_index, m_index_size);
+  if (m_index_fd >= 0) ::close(m_index_fd);
+  if (m_data_fd >= 0) ::close(m_data_fd);
+  m_index = nullptr;
+  m_index_size = 0;
+  m_index_fd = -1;
+  m_data_fd = -1;
+  m_snapshot_count = 0;
+  m_opened = false;
+  m_loaded_key = LinuxPageKey::Zero();
+}
+
+bool LinuxPageStore::MapIndex(uint64_t capacity, bool create) {
+  size_t size;
+  if (create) {
+    size = sizeof(IndexHeader) + capacity * sizeof(IndexEntry);
+    if (::ftruncate(m_index_fd, static_cast<off_t>(size)) != 0) {
+      m_err.SetErrorToErrno();
+      return false;
+    }
+  } else {
+    struct stat st;
+    if (::fstat(m_index_fd, &st) != 0) {
+      m_err.SetErrorToErrno();
+      return false;
+    }
+    size = st.st_size;
+  }
+  void *base = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_index_fd, 0);
+  if (base == MAP_FAILED) {
+    m_err.SetErrorToErrno();
+    return false;
+  }
+  IndexHeader *header = static_cast<IndexHeader *>(base);
+  if (create) {
+    std::memcpy(header->magic, kIndexMagic, sizeof(kIndexMagic));
+    header->page_size = m_page_size;
+    header->capacity = capacity;
+  } else if (size < sizeof(IndexHeader) || std::memcmp(header->magic, kIndexMagic, sizeof(kIndexMagic)) != 0 ||
+             header->page_size != m_page_size ||
+             size != sizeof(IndexHeader) + header->capacity * sizeof(IndexEntry)) {
+    ::munmap(base, size);
+    m_err.SetErrorString("page store index is corrupt or was written with another page size");
+    return false;
+  }
+  m_index = header;
+  m_index_size = size;
+  return true;
+}
+
+LinuxPageStore::IndexEntry *LinuxPageStore::FindSlot(const LinuxPageKey &key) {
+  IndexEntry *entries = reinterpret_cast<IndexEntry *>(m_index + 1);
+  const uint64_t mask = m_index->capacity - 1;
+  for (uint64_t slot = key.low & mask;; slot = (slot + 1) & mask) {
+    if (entries[slot].key.IsZero() || entries[slot].key == key) return &entries[slot];
+  }
+}
+
+bool LinuxPageStore::Sync() {
+  if (m_index->synced_size == m_index->data_size) return true;
+  if (::fdatasync(m_data_fd) != 0) {
+    m_err.SetErrorToErrno();
+    return false;
+  }
+  m_index->synced_size = m_index->data_size;
+  if (::msync(m_index, m_index_size, MS_SYNC) != 0) {
+    m_err.SetErrorToErrno();
+    return false;
+  }
+  return true;
+}
+
+bool LinuxPageStore::HasUnsyncedEntries() const {
+  const IndexEntry *entries = reinterpret_cast<const IndexEntry *>(m_index + 1);
+  for (uint64_t i = 0; i < m_index->capacity; i++) {
+    if (!entries[i].key.IsZero() && entries[i].offset + entries[i].size > m_index->synced_size) return true;
+  }
+  return false;
+}
+
+bool LinuxPageStore::RebuildIndex(uint64_t capacity, uint64_t data_limit) {
+  // Rehash into a new file and rename it over the old one, so a crash leaves either index intact.
+  const std::string path = m_directory + "/index.dat";
+  const std::string new_path = path + ".new";
+  int new_fd = ::open(new_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (new_fd < 0) {
+    m_err.SetErrorToErrno();
+    return false;
+  }
+  IndexHeader *old_index = m_index;
+  const size_t old_size = m_index_size;
+  const int old_fd = m_index_fd;
+  m_index_fd = new_fd;
+  if (!MapIndex(capacity, true)) {
+    ::close(new_fd);
+    m_index_fd = old_fd;
+    m_index = old_index;
+    m_index_size = old_size;
+    return false;
+  }
+  const IndexEntry *old_entries = reinterpret_cast<const IndexEntry *>(old_index + 1);
+  for (uint64_t i = 0; i < old_index->capacity; i++) {
+    const IndexEntry &entry = old_entries[i];
+    if (entry.key.IsZero() || entry.offset + entry.size > data_limit) continue;
+    *FindSlot(entry.key) = entry;
+    m_index->count++;
+  }
+  m_index->data_size = std::min(old_index->data_size, data_limit);
+  m_index->synced_size = std::min(old_index->synced_size, m_index->data_size);
+  if (::msync(m_index, m_index_size, MS_SYNC) != 0 || ::rename(new_path.c_str(), path.c_str()) != 0) {
+    // The old index is still the one on disk: keep using it.
+    m_err.SetErrorToErrno();
+    ::munmap(m_index, m_index_size);
+    ::close(new_fd);
+    ::unlink(new_path.c_str());
+    m_index_fd = old_fd;
+    m_index = old_index;
+    m_index_size = old_size;
+    return false;
+  }
+  ::munmap(old_index, old_size);
+  ::close(old_fd);
+  if (!SyncDirectory(m_directory)) {
+    m_err.SetErrorToErrno();
+    return false;
+  }
+  return true;
+}
+
+bool LinuxPageStore::Put(const uint8_t *page, LinuxPageKey &key) {
+  m_stats.pages++;
+  if (IsZeroPage(page, m_page_size)) {
+    m_stats.zero_pages++;
+    key = LinuxPageKey::Zero();
+    return true;
+  }
+  key = LinuxPageKey::Of(page, m_page_size);
+  IndexEntry *slot = FindSlot(key);
+  if (!slot->key.IsZero()) {
+    m_stats.shared_pages++;
+    return true;
+  }
+  if ((m_index->count + 1) * 2 > m_index->capacity) {
+    if (!RebuildIndex(m_index->capacity * 2, m_index->data_size)) return false;
+    slot = FindSlot(key);
+  }
+
+  size_t size = LinuxPageCodec::Compress(page, m_page_size, m_compressed.data(), m_compressed.size());
+  uint32_t flags = 0;
+  const uint8_t *blob = m_compressed.data();
+  if (size == 0 || size >= m_page_size) {
+    size = m_page_size;
+    flags = kEntryRaw;
+    blob = page;
+  }
+  if (!WriteAll(m_data_fd, blob, size, static_cast<off_t>(m_index->data_size))) {
+    m_err.SetErrorToErrno();
+    return false;
+  }
+  // The key goes in last: a slot only becomes visible once the data it points at is complete.
+  slot->offset = m_index->data_size;
+  slot->size = static_cast<uint32_t>(size);
+  slot->flags = flags;
+  slot->key = key;
+  m_index->count++;
+  m_index->data_size += size;
+  m_stats.new_pages++;
+  m_stats.bytes_in += m_page_size;
+  m_stats.bytes_out += size;
+  return true;
+}
+
+bool LinuxPageStore::Get(const LinuxPageKey &key, uint8_t *page) {
+  if (key.IsZero()) {
+    std::memset(page, 0, m_page_size);
+    return true;
+  }
+  const IndexEntry *slot = FindSlot(key);
+  if (slot->key.IsZero()) {
+    m_err.SetErrorString("page not in store");
+    return false;
+  }
+  if (slot->flags & kEntryRaw) {
+    if (ReadAll(m_data_fd, page, m_page_size, static_cast<off_t>(slot->offset))) return true;
+  } else if (ReadAll(m_data_fd, m_compressed.data(), slot->size, static_cast<off_t>(slot->offset)) &&
+             LinuxPageCodec::Decompress(m_compressed.data(), slot->size, page, m_page_size) == m_page_size) {
+    return true;
+  }
+  m_err.SetErrorString("page store data is corrupt");
+  return false;
+}
+
+bool LinuxPageStore::Capture(nub_process_t pid, LinuxVMMemory &vm_memory, uint32_t &snapshot) {
+  m_err.Clear();
+  LinuxVMRegionIndex &index = vm_memory.RegionIndex();
+  if (index.IsStale(pid)) index.Refresh(pid);
+
+  std::vector<SnapshotRange> ranges;
+  std::vector<SnapshotEntry> entries;
+  std::vector<uint8_t> buffer(kChunkPages * m_page_size);
+  std::vector<DNBMemoryExtent> extents;
+  for (const LinuxVMRegion &region : index.Regions()) {
+    if ((region.permissions & eMemoryPermissionsWritable) == 0) continue;
+    ranges.push_back({region.start, region.end});
+    for (nub_addr_t chunk = region.start; chunk < region.end; chunk += kChunkPages * m_page_size) {
+      const nub_size_t size = std::min<nub_size_t>(region.end - chunk, kChunkPages * m_page_size);
+      // Untouched pages of a file mapping read as the file, only anonymous ones are known to be zero.
+      if (region.kind == LinuxVMRegion::eKindFile) {
+        vm_memory.ReadLarge(pid, chunk, buffer.data(), size, extents);
+      } else {
+        vm_memory.ReadResident(pid, chunk, buffer.data(), size, extents);
+      }
+      for (const DNBMemoryExtent &extent : extents) {
+        if (!extent.readable) continue;
+        for (nub_addr_t page_addr = extent.addr; page_addr < extent.addr + extent.size; page_addr += m_page_size) {
+          LinuxPageKey key;
+          if (!Put(&buffer[page_addr - chunk], key)) return false;
+          if (!key.IsZero()) entries.push_back({page_addr, key});
+        }
+      }
+    }
+  }
+
+  // The snapshot must not reach the disk before the pages it refers to.
+  if (!Sync()) return false;
+  SnapshotHeader header;
+  std::memcpy(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+  header.page_size = m_page_size;
+  header.range_count = ranges.size();
+  header.entry_count = entries.size();
+  const std::string path = SnapshotPath(m_snapshot_count);
+  const std::string new_path = path + ".new";
+  int fd = ::open(new_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  off_t offset = sizeof(header);
+  bool success = fd >= 0 && WriteAll(fd, &header, sizeof(header), 0) &&
+                 WriteAll(fd, ranges.data(), ranges.size() * sizeof(SnapshotRange), offset) &&
+                 WriteAll(fd, entries.data(), entries.size() * sizeof(SnapshotEntry),
+                          offset + ranges.size() * sizeof(SnapshotRange)) &&
+                 ::fdatasync(fd) == 0 && ::rename(new_path.c_str(), path.c_str()) == 0 && SyncDirectory(m_directory);
+  if (!success) m_err.SetErrorToErrno();
+  if (fd >= 0) ::close(fd);
+  if (!success) return false;
+  snapshot = m_snapshot_count++;
+  return true;
+}
+
+const LinuxPageStore::SnapshotMapping *LinuxPageStore::MapSnapshot(uint32_t snapshot) {
+  if (snapshot >= m_snapshot_count) {
+    m_err.SetErrorString("no such snapshot");
+    return NULL;
+  }
+  if (m_snapshots.size() <= snapshot) m_snapshots.resize(snapshot + 1);
+  SnapshotMapping &mapping = m_snapshots[snapshot];
+  if (mapping.base != nullptr) return &mapping;
+
+  int fd = ::open(SnapshotPath(snapshot).c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || ::fstat(fd, &st) != 0) {
+    m_err.SetErrorToErrno();
+    if (fd >= 0) ::close(fd);
+    return NULL;
+  }
+  void *base = st.st_size > 0 ? ::mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  ::close(fd);
+  if (base == MAP_FAILED) {
+    m_err.SetErrorToErrno();
+    return NULL;
+  }
+  const SnapshotHeader *header = static_cast<const SnapshotHeader *>(base);
+  const size_t size = st.st_size;
+  if (size < sizeof(SnapshotHeader) || std::memcmp(header->magic, kSnapshotMagic, sizeof(kSnapshotMagic)) != 0 ||
+      header->page_size != m_page_size ||
+      size != sizeof(SnapshotHeader) + header->range_count * sizeof(SnapshotRange) +
+                  header->entry_count * sizeof(SnapshotEntry)) {
+    ::munmap(base, size);
+    m_err.SetErrorString("snapshot file is corrupt");
+    return NULL;
+  }
+  mapping.base = base;
+  mapping.size = size;
+  mapping.ranges = reinterpret_cast<const SnapshotRange *>(header + 1);
+  mapping.range_count = header->range_count;
+  mapping.entries = reinterpret_cast<const SnapshotEntry *>(mapping.ranges + mapping.range_count);
+  mapping.entry_count = header->entry_count;
+  return &mapping;
+}
+
+const uint8_t *LinuxPageStore::LoadPage(const SnapshotMapping &mapping, nub_addr_t page_addr) {
+  const SnapshotEntry *entries_end = mapping.entries + mapping.entry_count;
+  const SnapshotEntry *entry = std::lower_bound(
+      mapping.entries, entries_end, page_addr,
+      [](const SnapshotEntry &entry, nub_addr_t addr) { return entry.addr < addr; });
+  if (entry == entries_end || entry->addr != page_addr) {
+    // No entry: either a zero page of a captured region or not captured at all.
+    const SnapshotRange *ranges_end = mapping.ranges + mapping.range_count;
+    const SnapshotRange *range = std::upper_bound(
+        mapping.ranges, ranges_end, page_addr,
+        [](nub_addr_t addr, const SnapshotRange &range) { return addr < range.end; });
+    return range != ranges_end && range->start <= page_addr ? m_zero_page.data() : NULL;
+  }
+  if (entry->key != m_loaded_key) {
+    if (!Get(entry->key, m_page.data())) return NULL;
+    m_loaded_key = entry->key;
+  }
+  return m_page.data();
+}
+
+nub_size_t LinuxPageStore::Read(uint32_t snapshot, nub_addr_t address, void *data, nub_size_t data_count) {
+  m_err.Clear();
+  const SnapshotMapping *mapping = MapSnapshot(snapshot);
+  if (mapping == NULL) return 0;
+  uint8_t *dest = static_cast<uint8_t *>(data);
+  nub_size_t total_bytes_read = 0;
+  while (data_count > 0) {
+    const nub_addr_t page_addr = address - (address % m_page_size);
+    const nub_size_t offset = address - page_addr;
+    const nub_size_t count = std::min(m_page_size - offset, data_count);
+    const uint8_t *page = LoadPage(*mapping, page_addr);
+    if (page != NULL) {
+      std::memcpy(dest, page + offset, count);
+      total_bytes_read += count;
+    } else {
+      std::memset(dest, 0, count);
+    }
+    dest += count;
+    address += count;
+    data_count -= count;
+  }
+  return total_bytes_read;
+}
+
+nub_size_t LinuxPageStore::Restore(uint32_t snapshot, nub_process_t pid, LinuxVMMemory &vm_memory) {
+  m_err.Clear();
+  const SnapshotMapping *mapping = MapSnapshot(snapshot);
+  if (mapping == NULL) return 0;
+
+  std::vector<uint8_t> buffer(kChunkPages * m_page_size);
+  std::vector<DNBMemoryRequest> requests;
+  nub_size_t total_bytes_written = 0;
+  auto flush = [&]() {
+    total_bytes_written += vm_memory.WriteBatch(pid, requests.data(), requests.size());
+    requests.clear();
+  };
+  LinuxPageStates states;
+  const SnapshotEntry *entry = mapping->entries;
+  const SnapshotEntry *entries_end = mapping->entries + mapping->entry_count;
+  for (uint64_t i = 0; i < mapping->range_count; i++) {
+    const SnapshotRange &range = mapping->ranges[i];
+    // Zero pages were not stored; only the ones that gained content since need writing.
+    if (!vm_memory.PageMap().Query(pid, range.start, range.end - range.start, states)) continue;
+    for (nub_size_t page = 0; page < states.page_count; page++) {
+      const nub_addr_t page_addr = states.PageAddress(page);
+      while (entry != entries_end && entry->addr < page_addr) entry++;
+      const bool stored = entry != entries_end && entry->addr == page_addr;
+      if (!stored && !states.IsResident(page)) continue;
+      if (requests.size() == kChunkPages) flush();
+      uint8_t *dest = &buffer[requests.size() * m_page_size];
+      if (!stored) {
+        std::memset(dest, 0, m_page_size);
+      } else if (!Get(entry->key, dest)) {
+        return total_bytes_written;
+      }
+      requests.push_back({page_addr, m_page_size, dest, 0});
+    }
+  }
+  flush();
+  return total_bytes_written;
+}
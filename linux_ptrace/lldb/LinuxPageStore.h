@@ -0,0 +1,110 @@
+#pragma once
+
+#include "DNBDefs.h"
+#include "DNBError.h"
+#include "LinuxPageHash.h"
+#include "LinuxVMMemory.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// On-disk store of memory snapshots, content addressed by page. A directory holds:
+//  - pages.dat: every distinct page once, compressed with LinuxPageCodec (or raw when that does not pay off),
+//  - index.dat: open addressing hash table from page key to its place in pages.dat, memory mapped and updated in
+//    place. The kernel may write it back ahead of pages.dat, so it also records how much of pages.dat was synced:
+//    at every capture and on close, pages.dat is synced first and the index after it. Entries past the synced
+//    length are dropped on open, so a crash cannot leave the index pointing at data that never reached the disk,
+//  - snapshot-N.dat: the captured regions and a sorted (page address, page key) array per snapshot, memory
+//    mapped on first use.
+// Zero pages are never stored and pages already in the store cost an index probe, so dozens of snapshots of a
+// large process cost about as much disk as the pages that actually differ between them.
+class LinuxPageStore {
+public:
+  struct Statistics {
+    uint64_t pages = 0;        // Pages captured
+    uint64_t zero_pages = 0;   // Captured pages that were all zero
+    uint64_t shared_pages = 0; // Captured pages already present in the store
+    uint64_t new_pages = 0;    // Pages added to the store
+    uint64_t bytes_in = 0;     // Uncompressed size of the new pages
+    uint64_t bytes_out = 0;    // Bytes appended to pages.dat for them
+  };
+
+  LinuxPageStore();
+  ~LinuxPageStore();
+  LinuxPageStore(const LinuxPageStore &) = delete;
+  LinuxPageStore &operator=(const LinuxPageStore &) = delete;
+
+  // Opens the store in `directory`, creating it when it does not exist yet.
+  bool Open(const std::string &directory);
+  void Close();
+  bool IsOpen() const { return m_data_fd >= 0; }
+  uint32_t SnapshotCount() const { return m_snapshot_count; }
+
+  // Stores one page and returns its key in `key`; zero pages are not stored and get LinuxPageKey::Zero().
+  bool Put(const uint8_t *page, LinuxPageKey &key);
+  bool Get(const LinuxPageKey &key, uint8_t *page);
+
+  // Captures the writable memory of the stopped process as a new snapshot. Pages of anonymous memory that are not
+  // resident are known to be zero and are not even read.
+  bool Capture(nub_process_t pid, LinuxVMMemory &vm_memory, uint32_t &snapshot);
+  // Reads memory as it was in `snapshot`. Bytes outside the captured regions are zero filled and not counted.
+  nub_size_t Read(uint32_t snapshot, nub_addr_t address, void *data, nub_size_t data_count);
+  // Writes `snapshot` back into the stopped process: every stored page, and zeros over pages that are resident
+  // now but were zero at capture time. Returns the number of bytes written.
+  nub_size_t Restore(uint32_t snapshot, nub_process_t pid, LinuxVMMemory &vm_memory);
+
+  const Statistics &GetStatistics() const { return m_stats; }
+  const DNBError &GetError() const { return m_err; }
+
+private:
+  struct IndexHeader;
+  struct IndexEntry;
+  struct SnapshotHeader;
+  struct SnapshotRange {
+    nub_addr_t start;
+    nub_addr_t end;
+  };
+  struct SnapshotEntry {
+    nub_addr_t addr;
+    LinuxPageKey key;
+  };
+  struct SnapshotMapping {
+    void *base = nullptr;
+    size_t size = 0;
+    const SnapshotRange *ranges = nullptr;
+    uint64_t range_count = 0;
+    const SnapshotEntry *entries = nullptr;
+    uint64_t entry_count = 0;
+  };
+
+  bool MapIndex(uint64_t capacity, bool create);
+  // Rehashes the entries that lie within the first `data_limit` bytes of pages.dat into a new index of `capacity`
+  // entries, written next to the old one and renamed over it.
+  bool RebuildIndex(uint64_t capacity, uint64_t data_limit);
+  // Whether an entry points past the synced data. Index pages are written back in no fixed order, so after a crash
+  // the entries can be newer than the header.
+  bool HasUnsyncedEntries() const;
+  // Makes everything appended so far durable: pages.dat, then the index that points into it.
+  bool Sync();
+  IndexEntry *FindSlot(const LinuxPageKey &key);
+  const SnapshotMapping *MapSnapshot(uint32_t snapshot);
+  // Page content for `page_addr` in `snapshot`, NULL when the page was not captured.
+  const uint8_t *LoadPage(const SnapshotMapping &mapping, nub_addr_t page_addr);
+  std::string SnapshotPath(uint32_t snapshot) const;
+
+  std::string m_directory;
+  nub_size_t m_page_size;
+  int m_data_fd = -1;
+  int m_index_fd = -1;
+  IndexHeader *m_index = nullptr;
+  size_t m_index_size = 0;
+  bool m_opened = false;
+  uint32_t m_snapshot_count = 0;
+  std::vector<SnapshotMapping> m_snapshots;
+  std::vector<uint8_t> m_page;       // Scratch page for decompression
+  std::vector<uint8_t> m_zero_page;
+  std::vector<uint8_t> m_compressed; // Scratch buffer for compression and pages.dat reads
+  LinuxPageKey m_loaded_key = LinuxPageKey::Zero(); // Key of the page currently decoded in m_page
+  Statistics m_stats;
+  DNBError m_err;
+};
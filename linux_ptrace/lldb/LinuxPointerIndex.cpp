@@ -0,0 +1,259 @@
+#include "LinuxPointerIndex.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Runs of the address space a value must fall in before it is looked up among the regions; unused entries have a
+// size of zero and match nothing.
+struct PointerClusters {
+  uint64_t start[4];
+  uint64_t size[4];
+};
+
+// Appends the index of every word of `words` whose value falls in one of the clusters.
+typedef void (*ClusterFilter)(const PointerClusters &clusters, const uint8_t *words, size_t count,
+                              std::vector<uint32_t> &hits);
+
+static void ClusterFilterScalar(const PointerClusters &clusters, const uint8_t *words, size_t count,
+                                std::vector<uint32_t> &hits) {
+  for (size_t i = 0; i < count; i++) {
+    uint64_t value;
+    ::memcpy(&value, words + i * 8, 8);
+    bool inside = false;
+    for (int k = 0; k < 4; k++) inside |= value - clusters.start[k] < clusters.size[k];
+    if (inside) hits.push_back(i);
+  }
+}
+
+#if defined(__x86_64__)
+// AVX2 only has a signed 64-bit compare: flipping the sign bit of both sides makes it an unsigned one.
+__attribute__((target("avx2"))) static void ClusterFilterAVX2(const PointerClusters &clusters, const uint8_t *words,
+                                                              size_t count, std::vector<uint32_t> &hits) {
+  const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+  __m256i starts[4];
+  __m256i limits[4];
+  for (int k = 0; k < 4; k++) {
+    starts[k] = _mm256_set1_epi64x(static_cast<long long>(clusters.start[k]));
+    limits[k] = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<long long>(clusters.size[k])), sign);
+  }
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(words + i * 8));
+    __m256i inside = _mm256_setzero_si256();
+    for (int k = 0; k < 4; k++) {
+      __m256i offset = _mm256_xor_si256(_mm256_sub_epi64(value, starts[k]), sign);
+      inside = _mm256_or_si256(inside, _mm256_cmpgt_epi64(limits[k], offset));
+    }
+    for (int mask = _mm256_movemask_pd(_mm256_castsi256_pd(inside)); mask != 0; mask &= mask - 1) {
+      hits.push_back(i + __builtin_ctz(mask));
+    }
+  }
+  const size_t tail = hits.size();
+  ClusterFilterScalar(clusters, words + i * 8, count - i, hits);
+  for (size_t j = tail; j < hits.size(); j++) hits[j] += i;
+}
+#endif
+
+static ClusterFilter SelectFilter() {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx2")) return ClusterFilterAVX2;
+#endif
+  return ClusterFilterScalar;
+}
+
+static constexpr int kRadixBits = 16;
+
+// Stable LSD radix sort of `references` by value - `base`, where every value - `base` is below 2^`key_bits`. Each
+// pass counts its digit per thread slice, so the slices can scatter in parallel without sharing a cursor.
+static void RadixSortByValue(std::vector<LinuxPointerIndex::Reference> &references, nub_addr_t base, int key_bits,
+                             size_t thread_count) {
+  typedef LinuxPointerIndex::Reference Reference;
+  const size_t kBuckets = 1 << kRadixBits;
+  const size_t count = references.size();
+  thread_count = std::max<size_t>(1, std::min(thread_count, count / 65536));
+  std::vector<Reference> scratch(count);
+  std::vector<size_t> offsets(thread_count * kBuckets);
+  auto slice = [count, thread_count](size_t t) { return count * t / thread_count; };
+  auto parallel = [thread_count](const std::function<void(size_t)> &work) {
+    if (thread_count == 1) return work(0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_count; t++) threads.emplace_back(work, t);
+    for (std::thread &thread : threads) thread.join();
+  };
+  for (int shift = 0; shift < key_bits; shift += kRadixBits) {
+    const Reference *in = references.data();
+    Reference *out = scratch.data();
+    auto digit = [base, shift](const Reference &reference) {
+      return ((reference.value - base) >> shift) & (kBuckets - 1);
+    };
+    parallel([&](size_t t) {
+      size_t *counts = offsets.data() + t * kBuckets;
+      std::fill(counts, counts + kBuckets, 0);
+      for (size_t i = slice(t); i < slice(t + 1); i++) counts[digit(in[i])]++;
+    });
+    // Bucket by bucket, thread by thread: slices of a bucket stay in their original order. A digit that is the
+    // same for every value leaves the order as it is.
+    bool uniform = false;
+    for (size_t bucket = 0, next = 0; bucket < kBuckets; bucket++) {
+      const size_t start = next;
+      for (size_t t = 0; t < thread_count; t++) {
+        const size_t bucket_count = offsets[t * kBuckets + bucket];
+        offsets[t * kBuckets + bucket] = next;
+        next += bucket_count;
+      }
+      uniform |= next - start == count;
+    }
+    if (uniform) continue;
+    parallel([&](size_t t) {
+      size_t *cursors = offsets.data() + t * kBuckets;
+      for (size_t i = slice(t); i < slice(t + 1); i++) out[cursors[digit(in[i])]++] = in[i];
+    });
+    references.swap(scratch);
+  }
+}
+
+LinuxPointerIndex::LinuxPointerIndex(LinuxVMMemory &vm_memory, unsigned thread_count)
+    : m_vm_memory(vm_memory), m_scanner(vm_memory, thread_count),
+      m_thread_count(thread_count != 0 ? thread_count : std::max(1u, std::thread::hardware_concurrency())) {
+  m_scanner.SetPermissions(eMemoryPermissionsReadable | eMemoryPermissionsWritable);
+}
+
+bool LinuxPointerIndex::Build(nub_process_t pid) {
+  auto start_time = std::chrono::steady_clock::now();
+  m_err.Clear();
+  m_built = false;
+  m_references.clear();
+  m_stats = Statistics{};
+  LinuxVMRegionIndex &index = m_vm_memory.RegionIndex();
+  if (index.IsStale(pid) && !index.Refresh(pid) && index.GetError().Fail()) {
+    m_err = index.GetError();
+    return false;
+  }
+  m_generation = index.Generation();
+  m_regions.clear();
+  for (const LinuxVMRegion &region : index.Regions()) {
+    // Nothing points into the kernel's pages, and the vsyscall page would stretch the value range to the top.
+    if (region.kind == LinuxVMRegion::eKindVVar || region.kind == LinuxVMRegion::eKindVSyscall) continue;
+    if (!m_regions.empty() && m_regions.back().end == region.start) {
+      m_regions.back().end = region.end;
+    } else {
+      m_regions.push_back({region.start, region.end});
+    }
+  }
+
+  // Cut the regions into clusters at the widest gaps, which separate e.g. the executable and heap from the
+  // libraries and stacks.
+  PointerClusters clusters = {};
+  if (!m_regions.empty()) {
+    std::vector<size_t> cuts(m_regions.size() - 1);
+    for (size_t i = 0; i < cuts.size(); i++) cuts[i] = i + 1;
+    const size_t cut_count = std::min(cuts.size(), kMaxClusters - 1);
+    std::partial_sort(cuts.begin(), cuts.begin() + cut_count, cuts.end(), [this](size_t a, size_t b) {
+      return m_regions[a].start - m_regions[a - 1].end > m_regions[b].start - m_regions[b - 1].end;
+    });
+    cuts.resize(cut_count);
+    std::sort(cuts.begin(), cuts.end());
+    cuts.push_back(m_regions.size());
+    for (size_t k = 0, first = 0; k < cuts.size(); first = cuts[k++]) {
+      clusters.start[k] = m_regions[first].start;
+      clusters.size[k] = m_regions[cuts[k] - 1].end - m_regions[first].start;
+    }
+  }
+
+  const ClusterFilter filter = SelectFilter();
+  std::mutex mutex;
+  std::vector<std::pair<size_t, std::vector<Reference>>> blocks;
+  auto visitor = [&](size_t block, const uint8_t *data, nub_addr_t data_addr,
+                     const std::vector<DNBMemoryExtent> &extents, nub_addr_t start, nub_addr_t end) {
+    std::vector<Reference> references;
+    std::vector<uint32_t> hits;
+    const Span *span = m_regions.data();
+    for (const DNBMemoryExtent &extent : extents) {
+      if (!extent.readable) continue;
+      const nub_addr_t first = (std::max(extent.addr, start) + 7) & ~static_cast<nub_addr_t>(7);
+      const nub_addr_t limit = std::min(end, extent.addr + extent.size);
+      if (first + 8 > limit) continue;
+      const uint8_t *words = data + (first - data_addr);
+      hits.clear();
+      filter(clusters, words, (limit - first) / 8, hits);
+      for (uint32_t hit : hits) {
+        nub_addr_t value;
+        ::memcpy(&value, words + hit * 8, 8);
+        // Neighbouring words often point into the same region, try the last one first.
+        if (value < span->start || value >= span->end) {
+          span = std::upper_bound(m_regions.data(), m_regions.data() + m_regions.size(), value,
+                                  [](nub_addr_t v, const Span &s) { return v < s.start; });
+          if (span == m_regions.data()) continue;
+          --span;
+        }
+        if (value < span->end) references.push_back({value, first + hit * 8});
+      }
+    }
+    if (references.empty()) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    blocks.emplace_back(block, std::move(references));
+  };
+  if (!m_regions.empty() && !m_scanner.ReadBlocks(pid, 0, visitor)) {
+    m_err = m_scanner.GetError();
+    return false;
+  }
+  auto sort_time = std::chrono::steady_clock::now();
+
+  // Blocks come out in address order; a stable sort by value then keeps equal values in address order.
+  std::sort(blocks.begin(), blocks.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+  size_t total = 0;
+  for (const auto &block : blocks) total += block.second.size();
+  m_references.reserve(total);
+  for (auto &block : blocks) {
+    m_references.insert(m_references.end(), block.second.begin(), block.second.end());
+    std::vector<Reference>().swap(block.second);
+  }
+  if (!m_regions.empty()) {
+    const nub_addr_t base = m_regions.front().start;
+    RadixSortByValue(m_references, base, 64 - __builtin_clzll(m_regions.back().end - base), m_thread_count);
+  }
+
+  const LinuxMemoryScanner::Statistics &scan_stats = m_scanner.GetStatistics();
+  m_stats.regions = scan_stats.regions;
+  m_stats.bytes_scanned = scan_stats.bytes_scanned;
+  m_stats.references = m_references.size();
+  m_stats.scan_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(sort_time - start_time).count();
+  m_stats.sort_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - sort_time).count();
+  m_built = true;
+  return true;
+}
+
+std::pair<const LinuxPointerIndex::Reference *, const LinuxPointerIndex::Reference *>
+LinuxPointerIndex::Range(nub_addr_t start, nub_addr_t end) const {
+  auto by_value = [](const Reference &reference, nub_addr_t value) { return reference.value < value; };
+  const Reference *first = std::lower_bound(m_references.data(), m_references.data() + m_references.size(),
+                                            start, by_value);
+  const Reference *last = std::lower_bound(first, m_references.data() + m_references.size(), end, by_value);
+  return {first, last};
+}
+
+void LinuxPointerIndex::FindReferences(nub_addr_t start, nub_addr_t end, std::vector<Reference> &references) const {
+  std::pair<const Reference *, const Reference *> range = Range(start, end);
+  references.assign(range.first, range.second);
+}
+
+size_t LinuxPointerIndex::CountReferences(nub_addr_t start, nub_addr_t end) const {
+  std::pair<const Reference *, const Reference *> range = Range(start, end);
+  return range.second - range.first;
+}
+
+void LinuxPointerIndex::FindReferencesToRegion(nub_addr_t addr, std::vector<Reference> &references) const {
+  const LinuxVMRegion *region = m_vm_memory.RegionIndex().FindRegion(addr);
+  if (region == NULL) {
+    references.clear();
+    return;
+  }
+  FindReferences(region->start, region->end, references);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "DNBDefs.h"
+#include "DNBError.h"
+#include "LinuxMemoryScanner.h"
+#include "LinuxVMMemory.h"
+#include <cstdint>
+#include <vector>
+
+// Reverse pointer index of a stopped process, to answer "who holds a pointer into [a, b)" without dumping memory.
+// Build() reads every writable region with the LinuxMemoryScanner worker pool and keeps each pointer aligned word
+// whose value lies inside a mapped region, as a (value, address) pair. Words are first range checked four at a time
+// against a handful of address clusters with AVX2, and only those inside a cluster are looked up among the regions
+// of the same index GetMemoryRegionInfo() reports. The pairs end up in one array sorted by value, so a query is a
+// binary search. The index is a snapshot: it is not updated as the process writes memory, rebuild it after a run.
+class LinuxPointerIndex {
+public:
+  struct Reference {
+    nub_addr_t value; // The pointer
+    nub_addr_t addr;  // Where it is stored
+    bool operator<(const Reference &other) const {
+      return value < other.value || (value == other.value && addr < other.addr);
+    }
+  };
+
+  struct Statistics {
+    uint64_t regions = 0;       // Writable regions read
+    uint64_t bytes_scanned = 0;
+    uint64_t references = 0;
+    uint64_t scan_ns = 0;
+    uint64_t sort_ns = 0;
+  };
+
+  explicit LinuxPointerIndex(LinuxVMMemory &vm_memory, unsigned thread_count = 0);
+
+  bool Build(nub_process_t pid);
+  bool IsBuilt() const { return m_built; }
+  // Region index generation the index was built at, a later generation means the layout has changed since.
+  uint64_t Generation() const { return m_generation; }
+
+  // The references whose value is in [start, end), ordered by value.
+  void FindReferences(nub_addr_t start, nub_addr_t end, std::vector<Reference> &references) const;
+  size_t CountReferences(nub_addr_t start, nub_addr_t end) const;
+  // The references into the region containing `addr`, e.g. every pointer into a heap mapping.
+  void FindReferencesToRegion(nub_addr_t addr, std::vector<Reference> &references) const;
+
+  const Statistics &GetStatistics() const { return m_stats; }
+  const DNBError &GetError() const { return m_err; }
+
+private:
+  // Values are coarsely checked against at most this many clusters of regions.
+  static constexpr size_t kMaxClusters = 4;
+
+  struct Span {
+    nub_addr_t start;
+    nub_addr_t end;
+  };
+
+  std::pair<const Reference *, const Reference *> Range(nub_addr_t start, nub_addr_t end) const;
+
+  LinuxVMMemory &m_vm_memory;
+  LinuxMemoryScanner m_scanner;
+  unsigned m_thread_count;
+  bool m_built = false;
+  uint64_t m_generation = 0;
+  std::vector<Span> m_regions; // Mapped ranges at the last build, adjacent regions merged
+  std::vector<Reference> m_references;
+  Statistics m_stats;
+  DNBError m_err;
+};
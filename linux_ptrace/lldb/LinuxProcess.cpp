@@ -0,0 +1,740 @@
+#include "LinuxProcess.h"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <iterator>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+// How long StepOverBreakpoint() waits for its step before it leaves the thread to finish it while the others run.
+static constexpr int kStepOverWaitMs = 50;
+
+static std::vector<pid_t> ListThreads(pid_t pid) {
+  std::vector<pid_t> tids;
+  std::string path = "/proc/" + std::to_string(pid) + "/task";
+  DIR *dir = ::opendir(path.c_str());
+  if (dir == NULL) return tids;
+  while (struct dirent *entry = ::readdir(dir)) {
+    if (entry->d_name[0] == '.') continue;
+    tids.push_back(std::atoi(entry->d_name));
+  }
+  ::closedir(dir);
+  return tids;
+}
+
+// Whether the SIGTRAP `tid` stopped with comes from single stepping, rather than from an INT3 or a watchpoint. A
+// step over a syscall instruction is reported at the syscall exit, as TRAP_BRKPT.
+static bool IsStepTrap(pid_t tid) {
+  siginfo_t info;
+  return 0 == ::ptrace(PTRACE_GETSIGINFO, tid, 0, &info) && (info.si_code == TRAP_TRACE || info.si_code == TRAP_BRKPT);
+}
+
+// Whether `signo` is queued for the thread itself, from the SigPnd line of its status.
+static bool HasPendingSignal(pid_t pid, pid_t tid, int signo) {
+  std::string path = "/proc/" + std::to_string(pid) + "/task/" + std::to_string(tid) + "/status";
+  FILE *file = ::fopen(path.c_str(), "r");
+  if (file == NULL) return false;
+  char line[256];
+  unsigned long long pending = 0;
+  while (::fgets(line, sizeof(line), file) != NULL) {
+    if (::sscanf(line, "SigPnd: %llx", &pending) == 1) break;
+  }
+  ::fclose(file);
+  return (pending >> (signo - 1)) & 1;
+}
+
+// Size of the stack mappings of the process (VmStk), in kB; 0 when it cannot be read.
+static uint64_t StackSize(pid_t pid) {
+  std::string path = "/proc/" + std::to_string(pid) + "/status";
+  FILE *file = ::fopen(path.c_str(), "r");
+  if (file == NULL) return 0;
+  char line[256];
+  unsigned long long size = 0;
+  while (::fgets(line, sizeof(line), file) != NULL) {
+    if (::sscanf(line, "VmStk: %llu", &size) == 1) break;
+  }
+  ::fclose(file);
+  return size;
+}
+
+void LinuxProcess::Attach(pid_t pid) {
+  assert(m_status == ProcessStatus::DETACH);
+  if (pid == 0) { throw std::runtime_error("pid == 0"); }
+  // Make sure the process exists, and have its stops wake us up from now on instead of sleeping until they are due.
+  if (!m_wait_events.Open(pid)) {
+    if (m_wait_events.GetError().Status() == ESRCH) { throw std::runtime_error("no such process"); }
+    throw std::runtime_error(m_wait_events.GetError().AsString());
+  }
+  m_pid = pid;
+  try {
+    SeizeThreads();
+    StopThreads(m_threads);
+  } catch (...) {
+    // Let go of what was seized. A thread can only be detached in a stop, so wait for the ones still on their way.
+    const LinuxWaitEvents::Deadline deadline = LinuxWaitEvents::After(m_stop_timeout_ms);
+    for (pid_t tid : m_threads) {
+      const int signal = m_pending_signals.count(tid) ? m_pending_signals[tid] : 0;
+      int status = 0;
+      if (0 != ::ptrace(PTRACE_DETACH, tid, 0, signal) && m_wait_events.Wait(tid, &status, deadline) > 0 &&
+          WIFSTOPPED(status)) {
+        ::ptrace(PTRACE_DETACH, tid, 0, signal);
+      }
+    }
+    m_threads.clear();
+    m_pending_signals.clear();
+    m_stop_infos.clear();
+    m_pid = INVALID_NUB_PROCESS;
+    m_wait_events.Close();
+    throw;
+  }
+  m_status = ProcessStatus::STOP;
+}
+
+void LinuxProcess::Detach() {
+  assert(m_status == ProcessStatus::RUNNING || m_status == ProcessStatus::STOP);
+  if (m_status == ProcessStatus::RUNNING) { Stop(); }
+  // A trap nobody waits for would kill the process.
+  if (!m_watchpoints.DisableAll(m_threads)) { throw std::runtime_error(m_watchpoints.GetError().AsString()); }
+  if (!m_breakpoints.RemoveAll(m_pid)) { throw std::runtime_error(m_breakpoints.GetError().AsString()); }
+  m_displaced_stepping.Clear(m_threads.empty() ? INVALID_NUB_PROCESS : m_threads.front());
+  for (pid_t tid : m_threads) {
+    int signal = m_pending_signals.count(tid) ? m_pending_signals[tid] : 0;
+    errno = 0;
+    if (0 != ::ptrace(PTRACE_DETACH, tid, 0, signal) && errno != ESRCH) { throw std::runtime_error(::strerror(errno)); }
+  }
+  m_threads.clear();
+  m_pending_signals.clear();
+  m_blocked_steps.clear();
+  m_syscall_entries.clear();
+  m_stop_infos.clear();
+  m_file_pages.Clear();
+  m_stop_epoch++;
+  m_wait_events.Close();
+  m_status = ProcessStatus::DETACH;
+}
+
+void LinuxProcess::Resume() {
+  assert(m_status == ProcessStatus::STOP);
+  m_stop_epoch++;
+  if (!m_track_address_space) { m_vm_memory.RegionIndex().MarkStale(); }
+  m_stop_infos.clear();
+  for (pid_t tid : std::vector<pid_t>(m_threads)) StepOverBreakpoint(tid);
+  for (pid_t tid : m_threads) {
+    if (m_blocked_steps.count(tid)) continue;
+    SyncWatchpoints(tid);
+    ContinueThread(tid, ResumeRequest());
+  }
+  // The process may write to any page it can, our own patches included.
+  m_file_pages.Invalidate();
+  m_status = ProcessStatus::RUNNING;
+}
+
+void LinuxProcess::SetAddressSpaceTracking(bool enabled) {
+  assert(m_status != ProcessStatus::RUNNING);
+  m_track_address_space = enabled;
+  m_syscall_entries.clear();
+  // Patches only make sense on top of an index that matches the process right now.
+  if (enabled && m_status == ProcessStatus::STOP) {
+    LinuxVMRegionIndex &index = m_vm_memory.RegionIndex();
+    index.MarkStale();
+    index.Refresh(m_pid);
+    m_stack_size = StackSize(m_pid);
+  }
+}
+
+void LinuxProcess::CheckStackGrowth() {
+  if (!m_track_address_space) return;
+  const uint64_t stack_size = StackSize(m_pid);
+  if (stack_size != m_stack_size) m_vm_memory.RegionIndex().MarkStale();
+  m_stack_size = stack_size;
+}
+
+int LinuxProcess::ResumeRequest() const { return m_track_address_space ? PTRACE_SYSCALL : PTRACE_CONT; }
+
+LinuxProcess::ProcessStatus LinuxProcess::ProcessEvents(int timeout_ms) {
+  assert(m_status == ProcessStatus::RUNNING);
+  const LinuxWaitEvents::Deadline deadline = LinuxWaitEvents::After(timeout_ms);
+  while (m_status == ProcessStatus::RUNNING) {
+    int status = 0;
+    pid_t tid = m_wait_events.Wait(-1, &status, deadline);
+    if (tid > 0) {
+      HandleRunningEvent(tid, status);
+      continue;
+    }
+    if (tid == 0) break;
+    if (errno != ECHILD) { throw std::runtime_error(::strerror(errno)); }
+    m_threads.clear();
+    m_status = ProcessStatus::DETACH;
+  }
+  if (m_status == ProcessStatus::DETACH) { m_wait_events.Close(); }
+  return m_status;
+}
+
+void LinuxProcess::HandleRunningEvent(pid_t tid, int status) {
+  if (WIFEXITED(status) || WIFSIGNALED(status)) {
+    ThreadExited(tid);
+    return;
+  }
+  if (!WIFSTOPPED(status)) return;
+  // A clone child reporting its initial stop before its parent reported the clone event.
+  if (std::find(m_threads.begin(), m_threads.end(), tid) == m_threads.end()) { m_threads.push_back(tid); }
+  int event = status >> 16;
+  int signal = WSTOPSIG(status);
+  if (m_blocked_steps.erase(tid) && event == 0 && signal == SIGTRAP && IsStepTrap(tid)) {
+    // A step over a breakpoint that blocked has completed.
+    SyncWatchpoints(tid);
+    ContinueThread(tid, ResumeRequest());
+  } else if (signal == (SIGTRAP | 0x80)) {
+    HandleSyscallStop(tid);
+    ContinueThread(tid, ResumeRequest());
+  } else if (event == PTRACE_EVENT_CLONE) {
+    unsigned long new_tid = 0;
+    ::ptrace(PTRACE_GETEVENTMSG, tid, 0, &new_tid);
+    if (std::find(m_threads.begin(), m_threads.end(), new_tid) == m_threads.end()) { m_threads.push_back(new_tid); }
+    ContinueThread(tid, ResumeRequest());
+  } else if (event == PTRACE_EVENT_STOP) {
+    // Initial stop of a new thread, or a group stop we do not model.
+    SyncWatchpoints(tid);
+    ContinueThread(tid, ResumeRequest());
+  } else if (event == 0 && signal == SIGTRAP) {
+    // A breakpoint or watchpoint: like the mach task, the whole process stops with it.
+    RecordTrap(tid);
+    std::vector<pid_t> others;
+    std::copy_if(m_threads.begin(), m_threads.end(), std::back_inserter(others),
+                 [tid](pid_t other) { return other != tid; });
+    StopThreads(others);
+    LeaveDisplacedCode();
+    CheckStackGrowth();
+    m_status = ProcessStatus::STOP;
+  } else {
+    m_pending_signals[tid] = event == 0 ? signal : 0;
+    ContinueThread(tid, ResumeRequest());
+  }
+}
+
+void LinuxProcess::HandleSyscallStop(pid_t tid) {
+  struct __ptrace_syscall_info info;
+  if (::ptrace(PTRACE_GET_SYSCALL_INFO, tid, sizeof(info), &info) <= 0) return;
+  if (info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+    if (!m_track_address_space || !LinuxVMRegionIndex::IsAddressSpaceSyscall(info.entry.nr)) {
+      m_syscall_entries.erase(tid);
+      return;
+    }
+    SyscallEntry &entry = m_syscall_entries[tid];
+    entry.nr = info.entry.nr;
+    std::copy(std::begin(info.entry.args), std::end(info.entry.args), entry.args);
+  } else if (info.op == PTRACE_SYSCALL_INFO_EXIT) {
+    auto pos = m_syscall_entries.find(tid);
+    if (pos == m_syscall_entries.end()) return;
+    SyscallEntry entry = pos->second;
+    m_syscall_entries.erase(pos);
+    if (info.exit.is_error) return;
+    LinuxVMRegionIndex &index = m_vm_memory.RegionIndex();
+    // Exit stops of different threads are not reported in the order the kernel changed the address space, so
+    // calls that overlapped in time cannot be replayed. That and anything else we cannot follow precisely falls
+    // back to a full resync on the next query.
+    if (!m_syscall_entries.empty() || !index.ApplySyscall(m_pid, entry.nr, entry.args, info.exit.rval)) {
+      index.MarkStale();
+    }
+  }
+}
+
+void LinuxProcess::Stop() {
+  assert(m_status == ProcessStatus::RUNNING);
+  StopThreads(m_threads);
+  LeaveDisplacedCode();
+  CheckStackGrowth();
+  m_status = ProcessStatus::STOP;
+}
+
+void LinuxProcess::SingleStep() {
+  assert(m_status == ProcessStatus::STOP);
+  m_stop_epoch++;
+  if (m_track_address_space) {
+    // A step over a syscall instruction completes the call without a syscall stop, so resync if one is ahead.
+    for (const user_regs_struct &gpr : ReadRegister()) {
+      uint8_t insn[2] = {};
+      if (m_vm_memory.Read(m_pid, gpr.rip, insn, sizeof(insn)) == sizeof(insn) && insn[0] == 0x0f && insn[1] == 0x05) {
+        m_vm_memory.RegionIndex().MarkStale();
+      }
+    }
+  } else {
+    m_vm_memory.RegionIndex().MarkStale();
+  }
+  m_stop_infos.clear();
+  // One instruction cannot reach another breakpoint, so the ones under the threads can be lifted for all of them.
+  const std::vector<nub_addr_t> lifted = BreakpointsUnderThreads();
+  for (nub_addr_t addr : lifted) {
+    if (!m_breakpoints.Lift(m_pid, addr)) { throw std::runtime_error(m_breakpoints.GetError().AsString()); }
+  }
+  for (pid_t tid : m_threads) {
+    SyncWatchpoints(tid);
+    ContinueThread(tid, PTRACE_SINGLESTEP);
+  }
+  // Like the mach task, the first thread that reports back ends the step and the others are stopped where they are.
+  // When none does in time, they all sit in blocking syscalls and are stopped there, with nothing stepped.
+  const LinuxWaitEvents::Deadline deadline = LinuxWaitEvents::After(m_stop_timeout_ms);
+  pid_t stepped_tid = INVALID_NUB_PROCESS;
+  while (stepped_tid == INVALID_NUB_PROCESS && !m_threads.empty()) {
+    int status = 0;
+    pid_t tid = m_wait_events.Wait(-1, &status, deadline);
+    if (tid == 0) break;
+    if (tid < 0) { throw std::runtime_error(::strerror(errno)); }
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      ThreadExited(tid);
+      continue;
+    }
+    if (!WIFSTOPPED(status)) continue;
+    if (std::find(m_threads.begin(), m_threads.end(), tid) == m_threads.end()) { m_threads.push_back(tid); }
+    int signal = WSTOPSIG(status);
+    if ((status >> 16) == 0 && signal != SIGTRAP) { m_pending_signals[tid] = signal; }
+    if ((status >> 16) == 0 && signal == SIGTRAP) { RecordTrap(tid); }
+    stepped_tid = tid;
+  }
+  std::vector<pid_t> others;
+  std::copy_if(m_threads.begin(), m_threads.end(), std::back_inserter(others),
+               [stepped_tid](pid_t tid) { return tid != stepped_tid; });
+  StopThreads(others);
+  // A thread can finish its step just as it is interrupted: the interrupt stop is reported first and the step trap
+  // stays queued, to stop the process for no reason on the next resume, or to kill it after a detach. Let those
+  // threads take their trap now.
+  std::vector<pid_t> trapped;
+  std::copy_if(others.begin(), others.end(), std::back_inserter(trapped),
+               [this](pid_t tid) { return HasPendingSignal(m_pid, tid, SIGTRAP); });
+  for (pid_t tid : trapped) ContinueThread(tid, PTRACE_CONT);
+  if (!trapped.empty()) StopThreads(trapped);
+  CheckStackGrowth();
+  m_file_pages.Invalidate();
+  m_status = ProcessStatus::STOP;
+  for (nub_addr_t addr : lifted) {
+    if (!m_breakpoints.Reinsert(m_pid, addr)) { throw std::runtime_error(m_breakpoints.GetError().AsString()); }
+  }
+}
+
+void LinuxProcess::SeizeThreads() {
+  // Threads may be spawned while we attach, keep scanning until a pass finds nothing new.
+  bool found_new_thread = true;
+  while (found_new_thread) {
+    found_new_thread = false;
+    for (pid_t tid : ListThreads(m_pid)) {
+      if (std::find(m_threads.begin(), m_threads.end(), tid) != m_threads.end()) continue;
+      errno = 0;
+      if (0 != ::ptrace(PTRACE_SEIZE, tid, 0, PTRACE_O_TRACECLONE | PTRACE_O_TRACESYSGOOD)) {
+        if (errno == ESRCH) continue;
+        // EPERM on a secondary thread means it was cloned by a thread we already seized and is traced by us.
+        if (errno != EPERM || tid == m_pid) { throw std::runtime_error(::strerror(errno)); }
+      }
+      m_threads.push_back(tid);
+      found_new_thread = true;
+    }
+  }
+  auto main_thread = std::find(m_threads.begin(), m_threads.end(), m_pid);
+  if (main_thread == m_threads.end()) { throw std::runtime_error("no such process"); }
+  std::iter_swap(m_threads.begin(), main_thread);
+}
+
+void LinuxProcess::StopThreads(const std::vector<pid_t> &threads) {
+  std::set<pid_t> waiting(threads.begin(), threads.end());
+  for (pid_t tid : threads) {
+    errno = 0;
+    if (0 != ::ptrace(PTRACE_INTERRUPT, tid, 0, 0) && errno != ESRCH) { throw std::runtime_error(::strerror(errno)); }
+  }
+  const LinuxWaitEvents::Deadline deadline = LinuxWaitEvents::After(m_stop_timeout_ms);
+  while (!waiting.empty()) {
+    int status = 0;
+    pid_t tid = m_wait_events.Wait(-1, &status, deadline);
+    if (tid == 0) { throw std::runtime_error("timed out waiting for the threads to stop"); }
+    if (tid < 0) {
+      if (errno == ECHILD) break;
+      throw std::runtime_error(::strerror(errno));
+    }
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      ThreadExited(tid);
+      waiting.erase(tid);
+      continue;
+    }
+    if (!WIFSTOPPED(status)) continue;
+    int event = status >> 16;
+    int signal = WSTOPSIG(status);
+    // Any stop ends a blocked step over a breakpoint; the interrupted instruction restarts on the breakpoint.
+    const bool step_trap = m_blocked_steps.erase(tid) && event == 0 && signal == SIGTRAP && IsStepTrap(tid);
+    if (std::find(m_threads.begin(), m_threads.end(), tid) == m_threads.end()) {
+      // A clone child reporting its initial stop before its parent reported the clone event.
+      m_threads.push_back(tid);
+      if (event != PTRACE_EVENT_STOP) { waiting.insert(tid); }
+    }
+    if (event == PTRACE_EVENT_STOP) {
+      SyncWatchpoints(tid);
+      waiting.erase(tid);
+      continue;
+    }
+    int request = PTRACE_CONT;
+    if (signal == (SIGTRAP | 0x80)) {
+      // Caught at a syscall entry or exit: let the exit be reported so the change is not missed.
+      HandleSyscallStop(tid);
+      request = ResumeRequest();
+    } else if (event == PTRACE_EVENT_CLONE) {
+      unsigned long new_tid = 0;
+      ::ptrace(PTRACE_GETEVENTMSG, tid, 0, &new_tid);
+      if (std::find(m_threads.begin(), m_threads.end(), new_tid) == m_threads.end()) {
+        m_threads.push_back(new_tid);
+        waiting.insert(new_tid);
+      }
+    } else if (event == 0 && signal != SIGTRAP) {
+      // Hold the signal back until the next resume, a stopped process must not run its handlers.
+      m_pending_signals[tid] = signal;
+    } else if (event == 0 && !step_trap) {
+      // Trapped on its own before the interrupt: keep the reason, a watchpoint does not fire twice.
+      RecordTrap(tid);
+    }
+    // Any trap consumes a pending interrupt, so ask again; the thread stops before it runs any user code.
+    ::ptrace(static_cast<__ptrace_request>(request), tid, 0, 0);
+    ::ptrace(PTRACE_INTERRUPT, tid, 0, 0);
+  }
+}
+
+void LinuxProcess::ContinueThread(pid_t tid, int request) {
+  int signal = 0;
+  auto pos = m_pending_signals.find(tid);
+  if (pos != m_pending_signals.end()) {
+    signal = pos->second;
+    m_pending_signals.erase(pos);
+  }
+  errno = 0;
+  if (0 != ::ptrace(static_cast<__ptrace_request>(request), tid, 0, signal) && errno != ESRCH) {
+    throw std::runtime_error(::strerror(errno));
+  }
+}
+
+void LinuxProcess::ThreadExited(pid_t tid) {
+  m_threads.erase(std::remove(m_threads.begin(), m_threads.end(), tid), m_threads.end());
+  m_pending_signals.erase(tid);
+  m_stop_infos.erase(tid);
+  m_blocked_steps.erase(tid);
+  m_watchpoints.ThreadExited(tid);
+  if (m_threads.empty()) { m_status = ProcessStatus::DETACH; }
+}
+
+void LinuxProcess::RecordTrap(pid_t tid) {
+  DNBThreadStopInfo &stop_info = m_stop_infos[tid];
+  if (m_watchpoints.GetStopInfo(tid, &stop_info)) return;
+  if (RecordBreakpointHit(tid, &stop_info)) return;
+  ::memset(&stop_info, 0, sizeof(stop_info));
+  stop_info.reason = eStopTypeSignal;
+  stop_info.details.signal.signo = SIGTRAP;
+  ::snprintf(stop_info.description, sizeof(stop_info.description), "signal SIGTRAP");
+}
+
+bool LinuxProcess::RecordBreakpointHit(pid_t tid, DNBThreadStopInfo *stop_info) {
+  siginfo_t info;
+  user_regs_struct gpr;
+  // INT3 reports SI_KERNEL; a single step that lands right behind a one byte instruction at a site does not.
+  if (m_breakpoints.Count() == 0 || 0 != ::ptrace(PTRACE_GETSIGINFO, tid, 0, &info) || info.si_code != SI_KERNEL ||
+      !ReadThreadRegisters(tid, &gpr, NULL)) {
+    return false;
+  }
+  const LinuxBreakpoints::Breakpoint *breakpoint = m_breakpoints.Hit(gpr.rip);
+  if (breakpoint == NULL) return false;
+  gpr.rip = breakpoint->addr;
+  if (!WriteThreadRegisters(tid, &gpr, NULL)) { throw std::runtime_error(::strerror(errno)); }
+  ::memset(stop_info, 0, sizeof(*stop_info));
+  stop_info->reason = eStopTypeException;
+  ::snprintf(stop_info->description, sizeof(stop_info->description), "breakpoint %u at 0x%llx", breakpoint->id,
+             static_cast<unsigned long long>(breakpoint->addr));
+  stop_info->details.exception.type = SIGTRAP;
+  stop_info->details.exception.data_count = 3;
+  stop_info->details.exception.data[0] = TRAP_BRKPT;
+  stop_info->details.exception.data[1] = breakpoint->addr;
+  stop_info->details.exception.data[2] = breakpoint->id;
+  return true;
+}
+
+std::vector<nub_addr_t> LinuxProcess::BreakpointsUnderThreads() {
+  std::vector<nub_addr_t> addrs;
+  if (m_breakpoints.Count() == 0) return addrs;
+  for (pid_t tid : m_threads) {
+    user_regs_struct gpr;
+    if (!ReadThreadRegisters(tid, &gpr, NULL)) continue;
+    const LinuxBreakpoints::Breakpoint *breakpoint = m_breakpoints.FindByAddress(gpr.rip);
+    if (breakpoint != NULL && breakpoint->inserted) addrs.push_back(gpr.rip);
+  }
+  std::sort(addrs.begin(), addrs.end());
+  addrs.erase(std::unique(addrs.begin(), addrs.end()), addrs.end());
+  return addrs;
+}
+
+void LinuxProcess::StepOverBreakpoint(pid_t tid) {
+  user_regs_struct gpr;
+  if (m_breakpoints.Count() == 0 || !ReadThreadRegisters(tid, &gpr, NULL)) return;
+  const LinuxBreakpoints::Breakpoint *breakpoint = m_breakpoints.FindByAddress(gpr.rip);
+  if (breakpoint == NULL || !breakpoint->inserted) return;
+  const nub_addr_t addr = breakpoint->addr;
+  if (m_displaced_stepping_enabled) {
+    uint8_t code[16];
+    const nub_size_t code_size = ReadMemory(addr, sizeof(code), code);
+    if (m_displaced_stepping.Prepare(tid, addr, code, code_size, gpr)) {
+      if (!WriteThreadRegisters(tid, &gpr, NULL)) { throw std::runtime_error(::strerror(errno)); }
+      return;
+    }
+  }
+  if (!m_breakpoints.Lift(m_pid, addr)) { throw std::runtime_error(m_breakpoints.GetError().AsString()); }
+  // The other threads stay stopped, none of them can pass the lifted site meanwhile.
+  SyncWatchpoints(tid);
+  // A step that does not complete at once blocks, in a syscall or on a page fault. Interrupting it would only restart
+  // the instruction on the breakpoint, so the thread is left to finish the step on its own with the breakpoint back
+  // in; the step trap is dropped when it arrives.
+  const LinuxWaitEvents::Deadline deadline = LinuxWaitEvents::After(kStepOverWaitMs);
+  bool ok = 0 == ::ptrace(PTRACE_SINGLESTEP, tid, 0, 0);
+  while (ok) {
+    int status = 0;
+    pid_t waited = m_wait_events.Wait(tid, &status, deadline);
+    if (waited == 0) {
+      m_blocked_steps.insert(tid);
+      break;
+    }
+    if (waited < 0) {
+      ok = false;
+      break;
+    }
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      ThreadExited(tid);
+      break;
+    }
+    if (!WIFSTOPPED(status)) continue;
+    const int signal = WSTOPSIG(status);
+    if ((status >> 16) == 0 && signal == SIGTRAP) break;
+    // A signal arrived before the step: keep it for the resume and step again.
+    if ((status >> 16) == 0 && signal != (SIGTRAP | 0x80)) { m_pending_signals[tid] = signal; }
+    ok = 0 == ::ptrace(PTRACE_SINGLESTEP, tid, 0, 0);
+  }
+  if (!m_breakpoints.Reinsert(m_pid, addr)) { throw std::runtime_error(m_breakpoints.GetError().AsString()); }
+  if (!ok && errno != ESRCH) { throw std::runtime_error(::strerror(errno)); }
+}
+
+void LinuxProcess::LeaveDisplacedCode() {
+  if (!m_displaced_stepping.IsActive()) return;
+  for (pid_t tid : m_threads) {
+    user_regs_struct gpr;
+    if (!ReadThreadRegisters(tid, &gpr, NULL)) continue;
+    nub_addr_t pc = gpr.rip;
+    if (!m_displaced_stepping.Relocate(pc)) continue;
+    gpr.rip = pc;
+    if (!WriteThreadRegisters(tid, &gpr, NULL)) { throw std::runtime_error(::strerror(errno)); }
+  }
+}
+
+nub_break_t LinuxProcess::SetBreakpoint(nub_addr_t addr) {
+  assert(m_status == ProcessStatus::STOP);
+  return m_breakpoints.Set(m_pid, addr);
+}
+
+bool LinuxProcess::SetBreakpoints(const std::vector<nub_addr_t> &addrs, std::vector<nub_break_t> &ids) {
+  assert(m_status == ProcessStatus::STOP);
+  return m_breakpoints.Set(m_pid, addrs, ids);
+}
+
+bool LinuxProcess::RemoveBreakpoints(const std::vector<nub_break_t> &ids) {
+  assert(m_status == ProcessStatus::STOP);
+  return m_breakpoints.Remove(m_pid, ids);
+}
+
+void LinuxProcess::SyncWatchpoints(pid_t tid) {
+  if (!m_watchpoints.Sync(tid)) { throw std::runtime_error(m_watchpoints.GetError().AsString()); }
+}
+
+nub_watch_t LinuxProcess::EnableWatchpoint(nub_addr_t addr, nub_size_t size, uint32_t watch_type) {
+  assert(m_status == ProcessStatus::STOP);
+  return m_watchpoints.Enable(m_threads, addr, size, watch_type);
+}
+
+bool LinuxProcess::DisableWatchpoint(nub_watch_t watch_id) {
+  assert(m_status == ProcessStatus::STOP);
+  return m_watchpoints.Disable(m_threads, watch_id);
+}
+
+bool LinuxProcess::GetThreadStopInfo(pid_t tid, DNBThreadStopInfo *stop_info) const {
+  auto pos = m_stop_infos.find(tid);
+  if (pos == m_stop_infos.end()) return false;
+  *stop_info = pos->second;
+  return true;
+}
+
+nub_size_t LinuxProcess::ReadMemory(nub_addr_t addr, nub_size_t size, void *buf) {
+  assert(m_status == ProcessStatus::STOP);
+  nub_size_t bytes_read = m_file_pages_enabled ? m_file_pages.Read(m_pid, addr, buf, size) : 0;
+  if (bytes_read < size) {
+    const nub_addr_t rest_addr = addr + bytes_read;
+    uint8_t *rest = static_cast<uint8_t *>(buf) + bytes_read;
+    const nub_size_t rest_size = size - bytes_read;
+    bytes_read += m_page_cache_enabled ? m_page_cache.Read(m_pid, m_stop_epoch, rest_addr, rest, rest_size)
+                                       : m_vm_memory.Read(m_pid, rest_addr, rest, rest_size);
+  }
+  m_breakpoints.MaskRead(addr, buf, bytes_read);
+  return bytes_read;
+}
+nub_size_t LinuxProcess::WriteMemory(nub_addr_t addr, nub_size_t size, const void *buf) {
+  assert(m_status == ProcessStatus::STOP);
+  if (size == 0) return 0;
+  // Breakpoints covered by the write stay in, over the new code.
+  std::vector<uint8_t> patched;
+  if (m_breakpoints.Overlaps(addr, size)) {
+    patched.assign(static_cast<const uint8_t *>(buf), static_cast<const uint8_t *>(buf) + size);
+    m_breakpoints.PatchWrite(addr, patched.data(), size);
+    buf = patched.data();
+  }
+  DNBMemoryRequest request{addr, size, const_cast<void *>(buf), 0};
+  return WriteBatch(&request, 1);
+}
+
+nub_size_t LinuxProcess::WriteBatch(DNBMemoryRequest *requests, nub_size_t request_count) {
+  // Even with file pages disabled the writes are recorded, so that enabling them later stays correct.
+  m_file_pages.WillWrite(m_pid, requests, request_count);
+  nub_size_t bytes_written = m_vm_memory.WriteBatch(m_pid, requests, request_count);
+  m_file_pages.DidWrite(requests, request_count);
+  for (nub_size_t i = 0; i < request_count && m_page_cache_enabled; i++) {
+    m_page_cache.WriteThrough(m_stop_epoch, requests[i].addr, requests[i].data, requests[i].bytes_transferred);
+  }
+  return bytes_written;
+}
+
+LinuxMemoryView LinuxProcess::ReadMemoryView(nub_addr_t addr, nub_size_t size) {
+  assert(m_status == ProcessStatus::STOP);
+  if (m_view_epoch != m_stop_epoch) {
+    m_view_arena.Reset();
+    m_view_epoch = m_stop_epoch;
+  }
+  // Aliasing the cache would show the INT3s, a masked copy goes to the arena.
+  if (m_page_cache_enabled && !m_breakpoints.Overlaps(addr, size)) {
+    const uint8_t *data = m_page_cache.ReadView(m_pid, m_stop_epoch, addr, size);
+    if (data != NULL) { return LinuxMemoryView(addr, data, size, &m_stop_epoch); }
+  }
+  uint8_t *data = m_view_arena.Allocate(size);
+  nub_size_t bytes_read = ReadMemory(addr, size, data);
+  return LinuxMemoryView(addr, data, bytes_read, &m_stop_epoch);
+}
+
+nub_bool_t LinuxProcess::GetMemoryRegionInfo(nub_addr_t addr, DNBRegionInfo *region_info) {
+  assert(m_status == ProcessStatus::STOP);
+  return m_vm_memory.GetMemoryRegionInfo(m_pid, addr, region_info);
+}
+
+std::vector<user_regs_struct> LinuxProcess::ReadRegister() {
+  std::vector<user_regs_struct> registers{};
+  for (pid_t tid : m_threads) {
+    user_regs_struct gpr;
+    errno = 0;
+    if (0 != ::ptrace(PTRACE_GETREGS, tid, 0, &gpr)) { throw std::runtime_error(::strerror(errno)); }
+    registers.emplace_back(gpr);
+  }
+  return registers;
+}
+
+bool LinuxProcess::ReadThreadRegisters(pid_t tid, user_regs_struct *gpr, user_fpregs_struct *fpr) {
+  if (gpr != NULL && 0 != ::ptrace(PTRACE_GETREGS, tid, 0, gpr)) return false;
+  if (fpr != NULL && 0 != ::ptrace(PTRACE_GETFPREGS, tid, 0, fpr)) return false;
+  return true;
+}
+
+bool LinuxProcess::WriteThreadRegisters(pid_t tid, const user_regs_struct *gpr, const user_fpregs_struct *fpr) {
+  if (gpr != NULL && 0 != ::ptrace(PTRACE_SETREGS, tid, 0, gpr)) return false;
+  if (fpr != NULL && 0 != ::ptrace(PTRACE_SETFPREGS, tid, 0, fpr)) return false;
+  return true;
+}
+
+bool LinuxProcess::InjectSyscall(pid_t tid, long nr, std::initializer_list<uint64_t> args, uint64_t *result) {
+  assert(m_status == ProcessStatus::STOP);
+  assert(args.size() <= 6);
+  static const uint8_t kSyscall[2] = {0x0f, 0x05};
+  user_regs_struct saved;
+  if (!ReadThreadRegisters(tid, &saved, NULL)) return false;
+  InvalidateStopState();
+  m_vm_memory.RegionIndex().MarkStale();
+
+  // A thread stopped in a syscall sits right behind a syscall instruction, borrow that one. Otherwise plant one at
+  // the current pc for the duration of the call.
+  user_regs_struct regs = saved;
+  uint8_t code[4] = {};
+  nub_addr_t syscall_addr = saved.rip;
+  bool planted = false;
+  if (m_vm_memory.Read(m_pid, saved.rip - 2, code, sizeof(code)) == sizeof(code) && code[0] == kSyscall[0] &&
+      code[1] == kSyscall[1]) {
+    syscall_addr = saved.rip - 2;
+  } else if (m_vm_memory.Read(m_pid, saved.rip, code + 2, 2) != 2 ||
+             m_vm_memory.Write(m_pid, saved.rip, kSyscall, sizeof(kSyscall)) != sizeof(kSyscall)) {
+    return false;
+  } else {
+    planted = true;
+  }
+  regs.rip = syscall_addr;
+  regs.rax = nr;
+  // Not in a syscall as far as the kernel is concerned, so it does not try to restart the interrupted one.
+  regs.orig_rax = static_cast<unsigned long long>(-1);
+  unsigned long long *arg_regs[6] = {&regs.rdi, &regs.rsi, &regs.rdx, &regs.r10, &regs.r8, &regs.r9};
+  size_t arg_index = 0;
+  for (uint64_t arg : args) *arg_regs[arg_index++] = arg;
+
+  LinuxWaitEvents::Deadline deadline = LinuxWaitEvents::After(m_stop_timeout_ms);
+  bool interrupted = false;
+  bool blocked = false;
+  bool exited = false;
+  bool ok = WriteThreadRegisters(tid, &regs, NULL) && 0 == ::ptrace(PTRACE_SINGLESTEP, tid, 0, 0);
+  while (ok) {
+    int status = 0;
+    pid_t waited = m_wait_events.Wait(tid, &status, deadline);
+    if (waited == 0 && !interrupted) {
+      // The call blocks: interrupt it, the registers put back below abandon it.
+      interrupted = true;
+      deadline = LinuxWaitEvents::After(m_stop_timeout_ms);
+      ok = 0 == ::ptrace(PTRACE_INTERRUPT, tid, 0, 0);
+      continue;
+    }
+    if (waited <= 0) {
+      if (waited == 0) { errno = ETIMEDOUT; }
+      ok = false;
+      break;
+    }
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      ThreadExited(tid);
+      exited = true;
+      break;
+    }
+    if (!WIFSTOPPED(status)) continue;
+    const int signal = WSTOPSIG(status);
+    if ((status >> 16) == 0 && signal == SIGTRAP) {
+      // Only a step that landed behind the syscall instruction ends the call. A thread fresh out of clone first
+      // passes its own syscall exit, which can report a step trap before our instruction ran.
+      ok = ReadThreadRegisters(tid, &regs, NULL);
+      if (!ok || regs.rip == syscall_addr + 2) break;
+    } else if ((status >> 16) == 0 && signal != (SIGTRAP | 0x80)) {
+      // A signal arrived before the step: keep it for the next resume.
+      m_pending_signals[tid] = signal;
+    }
+    if (interrupted) {
+      blocked = true;
+      break;
+    }
+    // Signal, syscall and event stops all come before the instruction ran, step again.
+    ok = 0 == ::ptrace(PTRACE_SINGLESTEP, tid, 0, 0);
+  }
+  if (ok && result != NULL) *result = exited ? 0 : regs.rax;
+  if (planted) m_vm_memory.Write(m_pid, saved.rip, code + 2, 2);
+  if (!exited && !WriteThreadRegisters(tid, &saved, NULL)) ok = false;
+  if (blocked) {
+    errno = ETIMEDOUT;
+    return false;
+  }
+  return ok;
+}
+
+void LinuxProcess::InvalidateStopState() {
+  m_stop_epoch++;
+  m_file_pages.Invalidate();
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "DNBDefs.h"
+#include "LinuxBreakpoints.h"
+#include "LinuxDisplacedStepping.h"
+#include "LinuxFilePages.h"
+#include "LinuxMemoryView.h"
+#include "LinuxPageCache.h"
+#include "LinuxVMMemory.h"
+#include "LinuxWaitEvents.h"
+#include "LinuxWatchpoints.h"
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <set>
+#include <sys/types.h>
+#include <sys/user.h>
+#include <unistd.h>
+#include <vector>
+
+class LinuxProcess {
+public:
+  enum ProcessStatus {
+    DETACH,
+    RUNNING,
+    STOP,
+  };
+  LinuxProcess()
+      : m_page_cache(m_vm_memory), m_file_pages(m_vm_memory),
+        m_breakpoints(m_vm_memory, [this](nub_process_t, DNBMemoryRequest *requests, nub_size_t request_count) {
+          return WriteBatch(requests, request_count);
+        }),
+        m_displaced_stepping(*this) {}
+  pid_t ProcessID() const { return m_pid; }
+  bool ProcessIDIsValid() const { return m_pid > 0; }
+  ProcessStatus Status() const { return m_status; }
+  // Bumped every time the process leaves the stopped state, or its state is changed behind the read path (see
+  // InvalidateStopState()). Anything read from the target is only valid for the epoch it was read in.
+  uint64_t StopEpoch() const { return m_stop_epoch; }
+  const std::vector<pid_t> &Threads() const { return m_threads; }
+  LinuxVMMemory &VMMemory() { return m_vm_memory; }
+  LinuxPageCache &PageCache() { return m_page_cache; }
+  void SetPageCacheEnabled(bool enabled) { m_page_cache_enabled = enabled; }
+  LinuxFilePages &FilePages() { return m_file_pages; }
+  // Serve reads of unmodified read-only file mappings from the file, see LinuxFilePages.
+  void SetFilePagesEnabled(bool enabled) { m_file_pages_enabled = enabled; }
+  // Follow mmap/munmap/mprotect/brk/mremap exits while the process runs and patch the region index in place instead
+  // of re-reading /proc/pid/maps after every stop. The process resumes with PTRACE_SYSCALL, so every syscall of every
+  // thread, not only those, costs a syscall-entry and a syscall-exit stop, two round trips through the debugger. A
+  // thread sits in those stops until ProcessEvents() services it: a process that is resumed but not pumped stalls at
+  // its next syscall. (A seccomp filter could narrow the stops to the address space calls, but it cannot be removed
+  // from the tracee again and fails its syscalls with ENOSYS once we detach.) Stack growth takes no syscall; it is
+  // noticed from the stack size at each stop, and the index is then re-read.
+  void SetAddressSpaceTracking(bool enabled);
+  // Generation of the region index, see LinuxVMRegionIndex::Generation().
+  uint64_t AddressSpaceGeneration() const { return m_vm_memory.RegionIndex().Generation(); }
+
+  // Seizes every thread of `pid` and waits for their stops. SIGCHLD stays blocked in the calling thread until
+  // Detach(), see LinuxWaitEvents; all calls below are expected from that thread.
+  void Attach(pid_t pid);
+  void Detach();
+  void Resume();
+  void Stop();
+  void SingleStep();
+  // Services the tracing events of a running process for up to `timeout_ms`. Returns early when the process stops
+  // on its own (a breakpoint trap) or goes away.
+  ProcessStatus ProcessEvents(int timeout_ms);
+  // Bound on the waits for threads that were interrupted or execute a single instruction, 5 s by default. Stops
+  // that do not arrive in time fail the call with std::runtime_error; SingleStep() and InjectSyscall() interrupt a
+  // step that blocks in a syscall instead.
+  void SetStopTimeout(int timeout_ms) { m_stop_timeout_ms = timeout_ms; }
+  LinuxWaitEvents &WaitEvents() { return m_wait_events; }
+
+  nub_size_t ReadMemory(nub_addr_t addr, nub_size_t size, void *buf);
+  nub_size_t WriteMemory(nub_addr_t addr, nub_size_t size, const void *buf);
+  // Zero-copy read: the view aliases a cache page when the range fits in one, otherwise it points into an arena
+  // that is reused every stop. The view is shorter than `size` when the read stops at an unreadable page.
+  LinuxMemoryView ReadMemoryView(nub_addr_t addr, nub_size_t size);
+  nub_bool_t GetMemoryRegionInfo(nub_addr_t addr, DNBRegionInfo *region_info);
+
+  // Software breakpoints, see LinuxBreakpoints; the process must be stopped. Memory reads show the original code.
+  // A hit stops the process with the thread's pc rewound to the breakpoint, GetThreadStopInfo() describes it, and
+  // the next resume or step executes the original instruction first.
+  bool SetBreakpoints(const std::vector<nub_addr_t> &addrs, std::vector<nub_break_t> &ids);
+  nub_break_t SetBreakpoint(nub_addr_t addr);
+  bool RemoveBreakpoints(const std::vector<nub_break_t> &ids);
+  LinuxBreakpoints &Breakpoints() { return m_breakpoints; }
+  // Resume threads sitting on a breakpoint by running the instruction out of line instead of lifting the breakpoint
+  // and stepping each of them alone, see LinuxDisplacedStepping. On by default.
+  void SetDisplacedSteppingEnabled(bool enabled) { m_displaced_stepping_enabled = enabled; }
+  LinuxDisplacedStepping &DisplacedStepping() { return m_displaced_stepping; }
+
+  // Hardware watchpoints in every thread, see LinuxWatchpoints; the process must be stopped. A hit stops the process
+  // like a breakpoint trap, GetThreadStopInfo() of the thread that trapped describes it.
+  nub_watch_t EnableWatchpoint(nub_addr_t addr, nub_size_t size, uint32_t watch_type);
+  bool DisableWatchpoint(nub_watch_t watch_id);
+  LinuxWatchpoints &Watchpoints() { return m_watchpoints; }
+  // Why `tid` stopped the process at the last stop. False for the threads that were only stopped along with it.
+  bool GetThreadStopInfo(pid_t tid, DNBThreadStopInfo *stop_info) const;
+
+  std::vector<user_regs_struct> ReadRegister();
+  // Register access for one stopped thread; a NULL set is skipped. Return false with errno set on failure.
+  bool ReadThreadRegisters(pid_t tid, user_regs_struct *gpr, user_fpregs_struct *fpr);
+  bool WriteThreadRegisters(pid_t tid, const user_regs_struct *gpr, const user_fpregs_struct *fpr);
+
+  // Makes the stopped thread `tid` execute syscall `nr` with up to six `args` and returns its raw result (a
+  // negative errno on failure) in `result`. The thread's registers and code are put back afterwards, except for
+  // SYS_exit, after which the thread is gone. The address space may have changed, so the stop state is invalidated.
+  // A call that blocks for longer than the stop timeout is interrupted and fails with ETIMEDOUT.
+  bool InjectSyscall(pid_t tid, long nr, std::initializer_list<uint64_t> args, uint64_t *result);
+  // Drops the signals held back while stopping, so the next resume delivers nothing the process did not have.
+  void DiscardPendingSignals() { m_pending_signals.clear(); }
+  // For callers that rewrote memory or registers directly: starts a new stop epoch, which drops the page cache and
+  // the views, and makes the file pages check every page again.
+  void InvalidateStopState();
+
+private:
+  void SeizeThreads();
+  // Interrupts `threads` and waits until every one of them reports its PTRACE_EVENT_STOP, at most the stop timeout.
+  void StopThreads(const std::vector<pid_t> &threads);
+  void ContinueThread(pid_t tid, int request);
+  void ThreadExited(pid_t tid);
+  int ResumeRequest() const;
+  void HandleSyscallStop(pid_t tid);
+  void HandleRunningEvent(pid_t tid, int status);
+  void RecordTrap(pid_t tid);
+  // Rewinds the thread that hit one of our INT3s and describes the hit; false when the trap was not an INT3 of ours.
+  bool RecordBreakpointHit(pid_t tid, DNBThreadStopInfo *stop_info);
+  // Runs the instruction under the breakpoint `tid` sits on, with the breakpoint lifted, before the thread resumes.
+  // A step that blocks is left running, see m_blocked_steps.
+  void StepOverBreakpoint(pid_t tid);
+  // Moves the threads that stopped inside a displaced instruction back to the matching place in the original code.
+  void LeaveDisplacedCode();
+  // With address space tracking, resyncs the region index on the next query when the stacks grew or shrank by a
+  // fault rather than a syscall.
+  void CheckStackGrowth();
+  // Addresses of the inserted breakpoints the stopped threads sit on.
+  std::vector<nub_addr_t> BreakpointsUnderThreads();
+  void SyncWatchpoints(pid_t tid);
+  // Writes through the caches, like WriteMemory() without breakpoint patching.
+  nub_size_t WriteBatch(DNBMemoryRequest *requests, nub_size_t request_count);
+
+private:
+  struct SyscallEntry {
+    uint64_t nr;
+    uint64_t args[6];
+  };
+
+  ProcessStatus m_status = ProcessStatus::DETACH;
+  pid_t m_pid = INVALID_NUB_PROCESS;        // Process ID of child process
+  std::vector<pid_t> m_threads{};           // Every traced thread, the main thread first
+  std::map<pid_t, int> m_pending_signals{}; // Signals caught while stopping, delivered on the next resume
+  std::set<pid_t> m_blocked_steps{};        // Left running in a step over a breakpoint that blocked
+  LinuxWaitEvents m_wait_events;
+  int m_stop_timeout_ms = 5000;
+  uint64_t m_stop_epoch = 0;
+  LinuxVMMemory m_vm_memory;
+  LinuxPageCache m_page_cache;
+  bool m_page_cache_enabled = true;
+  LinuxFilePages m_file_pages;
+  bool m_file_pages_enabled = true;
+  bool m_track_address_space = false;
+  std::map<pid_t, SyscallEntry> m_syscall_entries{}; // Address space syscalls in flight, applied at their exit
+  uint64_t m_stack_size = 0;                          // VmStk at the last stop, in kB
+  LinuxBreakpoints m_breakpoints;
+  LinuxDisplacedStepping m_displaced_stepping;
+  bool m_displaced_stepping_enabled = true;
+  LinuxWatchpoints m_watchpoints;
+  std::map<pid_t, DNBThreadStopInfo> m_stop_infos{}; // Threads that trapped since the last resume
+  LinuxViewArena m_view_arena;
+  uint64_t m_view_epoch = 0;
+};
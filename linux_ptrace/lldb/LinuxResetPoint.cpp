@@ -0,0 +1,325 @@
+#include "LinuxResetPoint.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int ToProtection(uint32_t permissions) {
+  int prot = PROT_NONE;
+  if (permissions & eMemoryPermissionsReadable) prot |= PROT_READ;
+  if (permissions & eMemoryPermissionsWritable) prot |= PROT_WRITE;
+  if (permissions & eMemoryPermissionsExecutable) prot |= PROT_EXEC;
+  return prot;
+}
+
+static bool SameLayout(const std::vector<LinuxResetPoint::Range> &a, const std::vector<LinuxResetPoint::Range> &b) {
+  return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const auto &left, const auto &right) {
+    return left.start == right.start && left.end == right.end && left.permissions == right.permissions;
+  });
+}
+
+// Pieces of the ranges of `from` that no range of `minus` covers. Each piece keeps the attributes of its range.
+static std::vector<LinuxResetPoint::Range> Subtract(const std::vector<LinuxResetPoint::Range> &from,
+                                                    const std::vector<LinuxResetPoint::Range> &minus) {
+  std::vector<LinuxResetPoint::Range> pieces;
+  size_t next = 0;
+  for (const LinuxResetPoint::Range &range : from) {
+    while (next < minus.size() && minus[next].end <= range.start) next++;
+    nub_addr_t curr = range.start;
+    for (size_t i = next; i < minus.size() && minus[i].start < range.end; i++) {
+      if (minus[i].start > curr) pieces.push_back({curr, minus[i].start, range.permissions, range.anonymous});
+      curr = std::max(curr, minus[i].end);
+    }
+    if (curr < range.end) pieces.push_back({curr, range.end, range.permissions, range.anonymous});
+  }
+  return pieces;
+}
+
+LinuxResetPoint::LinuxResetPoint(LinuxProcess &process)
+    : m_process(process), m_page_size(static_cast<nub_size_t>(::sysconf(_SC_PAGESIZE))),
+      m_zero_page(m_page_size, 0), m_err(0) {}
+
+std::vector<LinuxResetPoint::Range> LinuxResetPoint::CurrentRanges() {
+  LinuxVMRegionIndex &index = m_process.VMMemory().RegionIndex();
+  const nub_process_t pid = m_process.ProcessID();
+  if (index.IsStale(pid)) index.Refresh(pid);
+  std::vector<Range> ranges;
+  for (const LinuxVMRegion &region : index.Regions()) {
+    const bool anonymous = !region.shared && (region.kind == LinuxVMRegion::eKindAnonymous ||
+                                              region.kind == LinuxVMRegion::eKindHeap ||
+                                              region.kind == LinuxVMRegion::eKindStack);
+    if (!ranges.empty() && ranges.back().end == region.start && ranges.back().permissions == region.permissions) {
+      ranges.back().end = region.end;
+      ranges.back().anonymous = ranges.back().anonymous && anonymous;
+    } else {
+      ranges.push_back({region.start, region.end, region.permissions, anonymous});
+    }
+  }
+  return ranges;
+}
+
+bool LinuxResetPoint::Record() {
+  assert(m_process.Status() == LinuxProcess::STOP);
+  m_err.Clear();
+  m_recorded = false;
+  const nub_process_t pid = m_process.ProcessID();
+  LinuxVMMemory &vm_memory = m_process.VMMemory();
+
+  // brk(0) only reports the break; a run that grows the heap is undone by setting it back to this value.
+  uint64_t brk = 0;
+  if (!m_process.InjectSyscall(pid, SYS_brk, {0}, &brk)) {
+    m_err.SetErrorToErrno();
+    return false;
+  }
+  m_brk = brk;
+
+  m_threads.clear();
+  for (pid_t tid : m_process.Threads()) {
+    ThreadState state;
+    state.tid = tid;
+    if (!m_process.ReadThreadRegisters(tid, &state.gpr, &state.fpr)) {
+      m_err.SetErrorToErrno();
+      return false;
+    }
+    m_threads.push_back(state);
+  }
+
+  m_ranges = CurrentRanges();
+  m_generation = vm_memory.RegionIndex().Generation();
+
+  // Untouched pages of a private file mapping read as the file and are kept, untouched anonymous pages are zero.
+  m_pages.clear();
+  LinuxPageStates states;
+  for (const LinuxVMRegion &region : vm_memory.RegionIndex().Regions()) {
+    if ((region.permissions & eMemoryPermissionsWritable) == 0) continue;
+    if (!vm_memory.PageMap().Query(pid, region.start, region.GetByteSize(), states)) continue;
+    const bool file_backed = region.kind == LinuxVMRegion::eKindFile;
+    for (nub_size_t page = 0; page < states.page_count; page++) {
+      if (file_backed || states.IsResident(page)) m_pages.push_back(states.PageAddress(page));
+    }
+  }
+  m_data.assign(m_pages.size() * m_page_size, 0);
+  m_requests.clear();
+  for (size_t i = 0; i < m_pages.size(); i++) {
+    if (!m_requests.empty() && m_requests.back().addr + m_requests.back().size == m_pages[i]) {
+      m_requests.back().size += m_page_size;
+    } else {
+      m_requests.push_back({m_pages[i], m_page_size, &m_data[i * m_page_size], 0});
+    }
+  }
+  vm_memory.ReadBatch(pid, m_requests.data(), m_requests.size());
+
+  m_soft_dirty = LinuxPageMap::SoftDirtySupported() && vm_memory.PageMap().ClearSoftDirty(pid);
+  m_soft_dirty_epoch = vm_memory.PageMap().SoftDirtyEpoch();
+  m_recorded = true;
+  return true;
+}
+
+bool LinuxResetPoint::Reset() {
+  assert(m_recorded);
+  assert(m_process.Status() == LinuxProcess::STOP);
+  auto start_time = std::chrono::steady_clock::now();
+  m_err.Clear();
+  bool ok = RestoreThreads() && RestoreAddressSpace() && RestoreMemory() && RestoreRegisters();
+  m_process.DiscardPendingSignals();
+  m_process.InvalidateStopState();
+  if (!ok) return false;
+
+  const uint64_t elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                  std::chrono::steady_clock::now() - start_time).count();
+  m_stats.resets++;
+  m_stats.last_reset_ns = elapsed_ns;
+  m_stats.total_reset_ns += elapsed_ns;
+  return true;
+}
+
+bool LinuxResetPoint::RestoreThreads() {
+  const std::vector<pid_t> threads = m_process.Threads();
+  for (const ThreadState &state : m_threads) {
+    if (std::find(threads.begin(), threads.end(), state.tid) == threads.end()) {
+      m_err.SetErrorString(("baseline thread " + std::to_string(state.tid) + " exited").c_str());
+      return false;
+    }
+  }
+  for (pid_t tid : threads) {
+    auto is_baseline = [tid](const ThreadState &state) { return state.tid == tid; };
+    if (std::any_of(m_threads.begin(), m_threads.end(), is_baseline)) continue;
+    if (!m_process.InjectSyscall(tid, SYS_exit, {0}, NULL)) {
+      m_err.SetErrorToErrno();
+      return false;
+    }
+    m_stats.threads_exited++;
+  }
+  return true;
+}
+
+bool LinuxResetPoint::RestoreAddressSpace() {
+  LinuxVMRegionIndex &index = m_process.VMMemory().RegionIndex();
+  const nub_process_t pid = m_process.ProcessID();
+  if (!index.IsStale(pid) && index.Generation() == m_generation) return true;
+  std::vector<Range> ranges = CurrentRanges();
+  if (SameLayout(ranges, m_ranges)) {
+    m_generation = index.Generation();
+    return true;
+  }
+
+  m_stats.mappings_restored++;
+  auto inject = [this, pid](long nr, std::initializer_list<uint64_t> args) {
+    uint64_t result = 0;
+    if (!m_process.InjectSyscall(pid, nr, args, &result)) {
+      m_err.SetErrorToErrno();
+      return false;
+    }
+    if (nr != SYS_brk && static_cast<int64_t>(result) < 0 && static_cast<int64_t>(result) > -4096) {
+      m_err.SetError(static_cast<DNBError::ValueType>(-static_cast<int64_t>(result)), DNBError::POSIX);
+      return false;
+    }
+    return true;
+  };
+  // The break first: shrinking it drops the heap growth of the run, which is then not unmapped piecewise.
+  if (!inject(SYS_brk, {m_brk})) return false;
+  for (const Range &extra : Subtract(CurrentRanges(), m_ranges)) {
+    if (!inject(SYS_munmap, {extra.start, extra.end - extra.start})) return false;
+  }
+  for (const Range &missing : Subtract(m_ranges, CurrentRanges())) {
+    if (!missing.anonymous) {
+      m_err.SetErrorString("a file mapping of the baseline was unmapped");
+      return false;
+    }
+    // The pages of the new mapping are restored from the baseline with the rest of the memory.
+    if (!inject(SYS_mmap, {missing.start, missing.end - missing.start, static_cast<uint64_t>(ToProtection(
+                           missing.permissions)), MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, static_cast<uint64_t>(-1),
+                           0})) {
+      return false;
+    }
+  }
+  ranges = CurrentRanges();
+  size_t next = 0;
+  for (const Range &range : m_ranges) {
+    while (next < ranges.size() && ranges[next].end <= range.start) next++;
+    for (size_t i = next; i < ranges.size() && ranges[i].start < range.end; i++) {
+      if (ranges[i].permissions == range.permissions) continue;
+      const nub_addr_t start = std::max(range.start, ranges[i].start);
+      const nub_addr_t end = std::min(range.end, ranges[i].end);
+      if (!inject(SYS_mprotect, {start, end - start, static_cast<uint64_t>(ToProtection(range.permissions))})) {
+        return false;
+      }
+    }
+  }
+  if (!SameLayout(CurrentRanges(), m_ranges)) {
+    m_err.SetErrorString("the address space could not be restored");
+    return false;
+  }
+  m_generation = index.Generation();
+  return true;
+}
+
+bool LinuxResetPoint::RestoreMemory() {
+  const nub_process_t pid = m_process.ProcessID();
+  LinuxVMMemory &vm_memory = m_process.VMMemory();
+  LinuxPageStates states;
+  m_candidates.clear();
+  // Someone else cleared the bits since our last clear (a snapshot): they no longer cover the whole run.
+  const bool soft_dirty = m_soft_dirty && vm_memory.PageMap().SoftDirtyEpoch() == m_soft_dirty_epoch;
+  for (const Range &range : m_ranges) {
+    if ((range.permissions & eMemoryPermissionsWritable) == 0) continue;
+    if (!vm_memory.PageMap().Query(pid, range.start, range.end - range.start, states)) {
+      m_err = vm_memory.PageMap().GetError();
+      return false;
+    }
+    auto baseline = std::lower_bound(m_pages.begin(), m_pages.end(), range.start);
+    for (nub_size_t page = 0; page < states.page_count; page++) {
+      const nub_addr_t page_addr = states.PageAddress(page);
+      const bool in_baseline = baseline != m_pages.end() && *baseline == page_addr;
+      if (in_baseline) baseline++;
+      const bool resident = states.IsResident(page);
+      const bool written = !soft_dirty || LinuxPageStates::Test(states.soft_dirty, page);
+      // A baseline page that is no longer resident was discarded by the run (MADV_DONTNEED, a remap) and now
+      // reads as zero or as the file.
+      if (!(in_baseline ? !resident || written : resident && written)) continue;
+      m_candidates.push_back(page_addr);
+      if (m_candidates.size() == kChunkPages && !FlushCandidates()) return false;
+    }
+  }
+  if (!FlushCandidates()) return false;
+  if (m_soft_dirty && !vm_memory.PageMap().ClearSoftDirty(pid)) {
+    m_err = vm_memory.PageMap().GetError();
+    return false;
+  }
+  m_soft_dirty_epoch = vm_memory.PageMap().SoftDirtyEpoch();
+  return true;
+}
+
+bool LinuxResetPoint::FlushCandidates() {
+  if (m_candidates.empty()) return true;
+  const nub_process_t pid = m_process.ProcessID();
+  LinuxVMMemory &vm_memory = m_process.VMMemory();
+  m_staging.resize(m_candidates.size() * m_page_size);
+  // Candidates are sorted and the staging buffer is in the same order, so runs of adjacent pages are read with one
+  // request each.
+  m_requests.clear();
+  for (size_t i = 0; i < m_candidates.size(); i++) {
+    if (!m_requests.empty() && m_requests.back().addr + m_requests.back().size == m_candidates[i]) {
+      m_requests.back().size += m_page_size;
+    } else {
+      m_requests.push_back({m_candidates[i], m_page_size, &m_staging[i * m_page_size], 0});
+    }
+  }
+  vm_memory.ReadBatch(pid, m_requests.data(), m_requests.size());
+
+  // A page that could not be read is rewritten unconditionally.
+  m_readable.assign(m_candidates.size(), 0);
+  for (const DNBMemoryRequest &request : m_requests) {
+    const size_t first = (static_cast<uint8_t *>(request.data) - m_staging.data()) / m_page_size;
+    std::fill_n(m_readable.begin() + first, request.bytes_transferred / m_page_size, 1);
+  }
+  m_writes.clear();
+  for (size_t i = 0; i < m_candidates.size(); i++) {
+    const uint8_t *baseline = BaselinePage(m_candidates[i]);
+    if (baseline == NULL) baseline = m_zero_page.data();
+    if (m_readable[i] && std::memcmp(&m_staging[i * m_page_size], baseline, m_page_size) == 0) continue;
+    m_writes.push_back({m_candidates[i], m_page_size, const_cast<uint8_t *>(baseline), 0});
+  }
+  const size_t write_count = m_writes.size();
+  m_stats.pages_compared += m_candidates.size();
+  m_stats.pages_restored += write_count;
+  m_candidates.clear();
+  if (write_count == 0) return true;
+  if (vm_memory.WriteBatch(pid, m_writes.data(), write_count) != write_count * m_page_size) {
+    m_err = vm_memory.GetError();
+    if (m_err.Success()) m_err.SetErrorString("failed to restore a page");
+    return false;
+  }
+  return true;
+}
+
+const uint8_t *LinuxResetPoint::BaselinePage(nub_addr_t page_addr) const {
+  auto pos = std::lower_bound(m_pages.begin(), m_pages.end(), page_addr);
+  if (pos == m_pages.end() || *pos != page_addr) return NULL;
+  return &m_data[(pos - m_pages.begin()) * m_page_size];
+}
+
+bool LinuxResetPoint::RestoreRegisters() {
+  for (const ThreadState &state : m_threads) {
+    user_regs_struct gpr;
+    user_fpregs_struct fpr;
+    if (!m_process.ReadThreadRegisters(state.tid, &gpr, &fpr)) {
+      m_err.SetErrorToErrno();
+      return false;
+    }
+    const bool gpr_changed = std::memcmp(&gpr, &state.gpr, sizeof(gpr)) != 0;
+    const bool fpr_changed = std::memcmp(&fpr, &state.fpr, sizeof(fpr)) != 0;
+    if (!gpr_changed && !fpr_changed) continue;
+    if (!m_process.WriteThreadRegisters(state.tid, gpr_changed ? &state.gpr : NULL,
+                                        fpr_changed ? &state.fpr : NULL)) {
+      m_err.SetErrorToErrno();
+      return false;
+    }
+    m_stats.threads_restored++;
+  }
+  return true;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "DNBDefs.h"
+#include "DNBError.h"
+#include "LinuxProcess.h"
+#include <cstdint>
+#include <sys/user.h>
+#include <vector>
+
+// Baseline of a stopped process that it can be put back to after each run, for replaying inputs against a
+// long-lived target instead of restarting it. Record() keeps the registers of every thread, the layout of the
+// address space and a copy of the writable memory. Reset() then undoes only what the run changed:
+//  - threads created by the run exit, mappings it created, removed or reprotected are put back (by injecting
+//    exit/brk/munmap/mmap/mprotect calls into the target),
+//  - writable pages that differ from the baseline are rewritten; with soft-dirty tracking only pages written since
+//    the last reset are even compared, without it every page with content is. A LinuxSnapshotStore::Take() on the
+//    same process clears the bits too; the next reset then compares every page,
+//  - registers are rewritten for the threads whose registers changed.
+// What lives outside the address space (file offsets, sockets, other processes) is not restored.
+class LinuxResetPoint {
+public:
+  struct Statistics {
+    uint64_t resets = 0;
+    uint64_t pages_compared = 0;     // Pages read back and compared against the baseline
+    uint64_t pages_restored = 0;     // Pages rewritten
+    uint64_t threads_restored = 0;   // Threads whose registers were rewritten
+    uint64_t threads_exited = 0;     // Threads created by a run and made to exit
+    uint64_t mappings_restored = 0;  // Resets that had to repair the address space
+    uint64_t last_reset_ns = 0;
+    uint64_t total_reset_ns = 0;
+  };
+  // Run of the address space with uniform permissions. Adjacent regions are merged because the kernel may split
+  // or merge its VMAs differently once they are recreated.
+  struct Range {
+    nub_addr_t start;
+    nub_addr_t end;
+    uint32_t permissions;
+    bool anonymous; // Every region of the range is private anonymous memory, so it can be recreated
+  };
+
+  explicit LinuxResetPoint(LinuxProcess &process);
+
+  // Records the baseline; the process must be stopped.
+  bool Record();
+  bool IsRecorded() const { return m_recorded; }
+  // Puts the stopped process back to the baseline. Fails when that is not possible, e.g. a baseline thread exited
+  // or a file mapping went away, in which case the target should be restarted.
+  bool Reset();
+  bool UsesSoftDirty() const { return m_soft_dirty; }
+
+  const Statistics &GetStatistics() const { return m_stats; }
+  void ResetStatistics() { m_stats = Statistics{}; }
+  // Throughput of Reset() alone over the resets counted in the statistics.
+  double ResetsPerSecond() const {
+    return m_stats.total_reset_ns == 0 ? 0.0 : m_stats.resets * 1e9 / m_stats.total_reset_ns;
+  }
+  const DNBError &GetError() const { return m_err; }
+
+private:
+  // Small enough that the staged pages are still in cache when they are compared.
+  static constexpr nub_size_t kChunkPages = 64;
+
+  struct ThreadState {
+    pid_t tid;
+    user_regs_struct gpr;
+    user_fpregs_struct fpr;
+  };
+
+  std::vector<Range> CurrentRanges();
+  bool RestoreThreads();
+  bool RestoreAddressSpace();
+  bool RestoreMemory();
+  bool RestoreRegisters();
+  // Reads back the queued candidate pages and rewrites the ones that differ from the baseline.
+  bool FlushCandidates();
+  const uint8_t *BaselinePage(nub_addr_t page_addr) const;
+
+  LinuxProcess &m_process;
+  nub_size_t m_page_size;
+  bool m_recorded = false;
+  bool m_soft_dirty = false;
+  uint64_t m_soft_dirty_epoch = 0; // LinuxPageMap::SoftDirtyEpoch() after our last clear
+  nub_addr_t m_brk = 0;
+  uint64_t m_generation = 0; // Region index generation the address space was last seen matching the baseline in
+  std::vector<ThreadState> m_threads;
+  std::vector<Range> m_ranges;
+  std::vector<nub_addr_t> m_pages; // Sorted addresses of the baseline pages with content
+  std::vector<uint8_t> m_data;     // Their content, in the same order
+  std::vector<nub_addr_t> m_candidates; // Scratch of Reset(): pages to compare
+  std::vector<uint8_t> m_staging;       // Scratch of Reset(): their current content
+  std::vector<uint8_t> m_readable;       // Scratch of Reset(): whether each staged page could be read
+  std::vector<DNBMemoryRequest> m_requests;
+  std::vector<DNBMemoryRequest> m_writes;
+  std::vector<uint8_t> m_zero_page;
+  Statistics m_stats;
+  DNBError m_err;
+};
@@ -0,0 +1,335 @@
+#include "LinuxScanSession.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+// Whether every match of `query` has the same bytes, which then need not be kept per candidate.
+static bool IsExact(const LinuxScanQuery &query) {
+  switch (query.type) {
+  case LinuxScanQuery::eTypeInteger:
+    return true;
+  case LinuxScanQuery::eTypeBytes:
+    return std::all_of(query.mask.begin(), query.mask.end(), [](uint8_t mask) { return mask == 0xff; });
+  default:
+    return false;
+  }
+}
+
+static std::vector<uint8_t> ExactValue(const LinuxScanQuery &query) {
+  if (query.type == LinuxScanQuery::eTypeBytes) return query.bytes;
+  std::vector<uint8_t> value(query.size);
+  ::memcpy(value.data(), &query.integer, query.size);
+  return value;
+}
+
+template <typename T> static int Order(const uint8_t *a, const uint8_t *b) {
+  T x, y;
+  ::memcpy(&x, a, sizeof(T));
+  ::memcpy(&y, b, sizeof(T));
+  return x < y ? -1 : (y < x ? 1 : 0);
+}
+
+// -1, 0 or 1 as `a` is less than, equal to (or unordered with) or greater than `b`.
+static int OrderValues(const LinuxScanQuery &query, const uint8_t *a, const uint8_t *b) {
+  if (query.type == LinuxScanQuery::eTypeFloat) return Order<float>(a, b);
+  if (query.type == LinuxScanQuery::eTypeDouble) return Order<double>(a, b);
+  switch (query.size) {
+  case 1:
+    return Order<int8_t>(a, b);
+  case 2:
+    return Order<int16_t>(a, b);
+  case 4:
+    return Order<int32_t>(a, b);
+  default:
+    return Order<int64_t>(a, b);
+  }
+}
+
+static bool Satisfies(const LinuxScanQuery &query, LinuxScanSession::Compare compare, const uint8_t *current,
+                      const uint8_t *old, const LinuxScanQuery *value) {
+  switch (compare) {
+  case LinuxScanSession::eCompareEquals:
+    return value->Matches(current);
+  case LinuxScanSession::eCompareChanged:
+    return ::memcmp(current, old, query.size) != 0;
+  case LinuxScanSession::eCompareUnchanged:
+    return ::memcmp(current, old, query.size) == 0;
+  case LinuxScanSession::eCompareIncreased:
+    return OrderValues(query, current, old) > 0;
+  case LinuxScanSession::eCompareDecreased:
+    return OrderValues(query, current, old) < 0;
+  }
+  return false;
+}
+
+LinuxScanSession::LinuxScanSession(LinuxVMMemory &vm_memory, unsigned thread_count)
+    : m_scanner(vm_memory, thread_count),
+      m_thread_count(thread_count != 0 ? thread_count : std::max(1u, std::thread::hardware_concurrency())),
+      m_page_size(vm_memory.PageSize()) {}
+
+void LinuxScanSession::EncodePage(Chunk &chunk, nub_addr_t page_addr, const uint32_t *slots, size_t count,
+                                  uint64_t values) const {
+  CandidatePage page = {page_addr, static_cast<uint32_t>(count), 0, chunk.slots.size(), values};
+  // Each slot costs one byte per 7 bits of its distance from the previous one.
+  nub_size_t delta_size = 0;
+  for (size_t i = 0, next = 0; i < count; next = slots[i++] + 1) {
+    for (uint32_t gap = slots[i] - next; gap >= 0x80; gap >>= 7) delta_size++;
+    delta_size++;
+  }
+  if (delta_size < BitsetSize()) {
+    for (size_t i = 0, next = 0; i < count; next = slots[i++] + 1) {
+      uint32_t gap = slots[i] - next;
+      for (; gap >= 0x80; gap >>= 7) chunk.slots.push_back(static_cast<uint8_t>(gap | 0x80));
+      chunk.slots.push_back(static_cast<uint8_t>(gap));
+    }
+    page.slots_size = delta_size;
+  } else {
+    chunk.slots.resize(chunk.slots.size() + BitsetSize(), 0);
+    uint8_t *bitset = chunk.slots.data() + page.slots;
+    for (size_t i = 0; i < count; i++) bitset[slots[i] / 8] |= 1 << (slots[i] % 8);
+    page.slots_size = BitsetSize();
+  }
+  chunk.pages.push_back(page);
+  chunk.count += count;
+}
+
+template <typename Callback> void LinuxScanSession::ForEachSlot(const CandidatePage &page, Callback callback) const {
+  const uint8_t *slots = m_slots.data() + page.slots;
+  if (page.slots_size == BitsetSize()) {
+    for (nub_size_t byte = 0; byte < page.slots_size; byte++) {
+      for (unsigned bits = slots[byte]; bits != 0; bits &= bits - 1) callback(byte * 8 + __builtin_ctz(bits));
+    }
+    return;
+  }
+  uint32_t next = 0;
+  for (const uint8_t *p = slots, *end = slots + page.slots_size; p < end;) {
+    uint32_t gap = 0;
+    for (int shift = 0;; shift += 7) {
+      gap |= static_cast<uint32_t>(*p & 0x7f) << shift;
+      if ((*p++ & 0x80) == 0) break;
+    }
+    callback(next + gap);
+    next += gap + 1;
+  }
+}
+
+const uint8_t *LinuxScanSession::OldValue(const CandidatePage &page, size_t index) const {
+  return m_uniform ? m_uniform_value.data() : m_values.data() + page.values + index * m_query.size;
+}
+
+void LinuxScanSession::Clear() {
+  m_pages.clear();
+  m_slots.clear();
+  m_values.clear();
+  m_uniform = false;
+  m_uniform_value.clear();
+  m_stats.candidates = 0;
+}
+
+void LinuxScanSession::Append(Chunk &chunk) {
+  for (CandidatePage page : chunk.pages) {
+    page.slots += m_slots.size();
+    page.values += m_values.size();
+    m_pages.push_back(page);
+  }
+  m_slots.insert(m_slots.end(), chunk.slots.begin(), chunk.slots.end());
+  m_values.insert(m_values.end(), chunk.values.begin(), chunk.values.end());
+  m_stats.candidates += chunk.count;
+}
+
+void LinuxScanSession::UpdateStatistics() {
+  m_stats.pages = m_pages.size();
+  m_stats.memory_bytes = m_pages.capacity() * sizeof(CandidatePage) + m_slots.capacity() + m_values.capacity();
+}
+
+bool LinuxScanSession::Start(nub_process_t pid, const LinuxScanQuery &query) {
+  auto start_time = std::chrono::steady_clock::now();
+  m_err.Clear();
+  Clear();
+  m_query = query;
+  const bool uniform = IsExact(query);
+  std::mutex mutex;
+  std::vector<std::pair<size_t, Chunk>> chunks;
+  bool success = m_scanner.Scan(pid, query, [&](size_t block, std::vector<nub_addr_t> &hits, const uint8_t *data,
+                                                nub_addr_t data_addr) {
+    Chunk chunk;
+    std::vector<uint32_t> slots;
+    const nub_addr_t page_mask = ~static_cast<nub_addr_t>(m_page_size - 1);
+    for (size_t i = 0; i < hits.size();) {
+      const nub_addr_t page_addr = hits[i] & page_mask;
+      const uint64_t values = chunk.values.size();
+      slots.clear();
+      for (; i < hits.size() && (hits[i] & page_mask) == page_addr; i++) {
+        slots.push_back((hits[i] - page_addr) / query.alignment);
+        if (uniform) continue;
+        const uint8_t *value = data + (hits[i] - data_addr);
+        chunk.values.insert(chunk.values.end(), value, value + query.size);
+      }
+      EncodePage(chunk, page_addr, slots.data(), slots.size(), values);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    chunks.emplace_back(block, std::move(chunk));
+  });
+  if (!success) {
+    m_err = m_scanner.GetError();
+    return false;
+  }
+  // Scanner blocks are numbered in address order and never share a page.
+  std::sort(chunks.begin(), chunks.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+  for (auto &chunk : chunks) Append(chunk.second);
+  m_uniform = uniform;
+  if (uniform) m_uniform_value = ExactValue(query);
+
+  m_stats.passes = 1;
+  m_stats.bytes_read = m_scanner.GetStatistics().bytes_scanned;
+  UpdateStatistics();
+  m_stats.last_pass_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - start_time).count();
+  return true;
+}
+
+bool LinuxScanSession::RefineBatch(nub_process_t pid, LinuxVMMemory &reader, size_t first_page, size_t last_page,
+                                   Compare compare, const LinuxScanQuery *value, bool keep_values, Chunk &chunk,
+                                   std::vector<uint8_t> &buffer, uint64_t &bytes_read) const {
+  const nub_size_t alignment = m_query.alignment;
+  const nub_size_t size = m_query.size;
+  // Decode the slots once, they give both the bytes to read and the candidates to check.
+  std::vector<uint32_t> slots;
+  std::vector<size_t> page_slots(last_page - first_page + 1);
+  for (size_t i = first_page; i < last_page; i++) {
+    page_slots[i - first_page] = slots.size();
+    ForEachSlot(m_pages[i], [&slots](uint32_t slot) { slots.push_back(slot); });
+  }
+  page_slots.back() = slots.size();
+
+  // One range per page, from its first to the end of its last candidate. Adjacent pages are not merged: a transfer
+  // stops at the first fault of a range, which would lose the readable pages behind an unmapped one.
+  std::vector<DNBMemoryRequest> requests(last_page - first_page);
+  nub_size_t total_size = 0;
+  for (size_t i = first_page; i < last_page; i++) {
+    const size_t k = i - first_page;
+    const nub_addr_t start = m_pages[i].addr + slots[page_slots[k]] * alignment;
+    const nub_addr_t end = m_pages[i].addr + slots[page_slots[k + 1] - 1] * alignment + size;
+    requests[k] = {start, end - start, NULL, 0};
+    total_size += end - start;
+  }
+  if (buffer.size() < total_size) buffer.resize(total_size);
+  for (size_t r = 0, offset = 0; r < requests.size(); offset += requests[r++].size) {
+    requests[r].data = buffer.data() + offset;
+  }
+  bytes_read += reader.ReadBatch(pid, requests.data(), requests.size());
+  if (reader.GetError().Fail()) return false;
+
+  std::vector<uint32_t> survivors;
+  for (size_t i = first_page; i < last_page; i++) {
+    const size_t k = i - first_page;
+    const CandidatePage &page = m_pages[i];
+    const DNBMemoryRequest &request = requests[k];
+    const nub_addr_t readable_end = request.addr + request.bytes_transferred;
+    const uint8_t *data = static_cast<const uint8_t *>(request.data);
+    const uint64_t values = chunk.values.size();
+    survivors.clear();
+    for (size_t j = page_slots[k]; j < page_slots[k + 1]; j++) {
+      const nub_addr_t addr = page.addr + slots[j] * alignment;
+      if (addr + size > readable_end) break;
+      const uint8_t *current = data + (addr - request.addr);
+      if (!Satisfies(m_query, compare, current, OldValue(page, j - page_slots[k]), value)) continue;
+      survivors.push_back(slots[j]);
+      if (keep_values) chunk.values.insert(chunk.values.end(), current, current + size);
+    }
+    if (!survivors.empty()) EncodePage(chunk, page.addr, survivors.data(), survivors.size(), values);
+  }
+  return true;
+}
+
+bool LinuxScanSession::Refine(nub_process_t pid, Compare compare, const LinuxScanQuery *value) {
+  auto start_time = std::chrono::steady_clock::now();
+  m_err.Clear();
+  const bool ordered = compare == eCompareIncreased || compare == eCompareDecreased;
+  if ((compare == eCompareEquals &&
+       (value == NULL || !value->IsValid() || value->type != m_query.type || value->size != m_query.size)) ||
+      (ordered && m_query.type == LinuxScanQuery::eTypeBytes)) {
+    m_err.SetError(EINVAL, DNBError::POSIX);
+    return false;
+  }
+  // Survivors of these compares all hold one known value.
+  const bool uniform = (compare == eCompareUnchanged && m_uniform) || (compare == eCompareEquals && IsExact(*value));
+
+  const size_t batch_count = (m_pages.size() + kBatchPages - 1) / kBatchPages;
+  std::vector<Chunk> chunks(batch_count);
+  std::atomic<size_t> next_batch(0);
+  std::atomic<uint64_t> bytes_read(0);
+  std::mutex mutex;
+  DNBError error;
+  auto worker = [&]() {
+    // Transfers keep per instance state (error, cached fds), so every worker reads through its own instance.
+    LinuxVMMemory reader;
+    std::vector<uint8_t> buffer;
+    uint64_t worker_bytes_read = 0;
+    for (size_t i = next_batch++; i < batch_count; i = next_batch++) {
+      const size_t last_page = std::min(m_pages.size(), (i + 1) * kBatchPages);
+      if (!RefineBatch(pid, reader, i * kBatchPages, last_page, compare, value, !uniform, chunks[i], buffer,
+                       worker_bytes_read)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        error = reader.GetError();
+        next_batch = batch_count;
+        break;
+      }
+    }
+    bytes_read += worker_bytes_read;
+  };
+  const size_t thread_count = std::min<size_t>(m_thread_count, batch_count);
+  if (thread_count <= 1) {
+    worker();
+  } else {
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < thread_count; i++) workers.emplace_back(worker);
+    for (std::thread &thread : workers) thread.join();
+  }
+  if (error.Fail()) {
+    m_err = error;
+    return false;
+  }
+
+  std::vector<uint8_t> uniform_value = compare == eCompareEquals && uniform ? ExactValue(*value) : m_uniform_value;
+  Clear();
+  for (Chunk &chunk : chunks) Append(chunk);
+  // Drop what the first, largest passes reserved.
+  m_pages.shrink_to_fit();
+  m_slots.shrink_to_fit();
+  m_values.shrink_to_fit();
+  m_uniform = uniform;
+  if (uniform) m_uniform_value = uniform_value;
+
+  m_stats.passes++;
+  m_stats.bytes_read = bytes_read;
+  UpdateStatistics();
+  m_stats.last_pass_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - start_time).count();
+  return true;
+}
+
+bool LinuxScanSession::Contains(nub_addr_t addr) const {
+  const nub_addr_t page_addr = addr & ~static_cast<nub_addr_t>(m_page_size - 1);
+  auto page = std::lower_bound(m_pages.begin(), m_pages.end(), page_addr,
+                               [](const CandidatePage &candidate, nub_addr_t key) { return candidate.addr < key; });
+  if (page == m_pages.end() || page->addr != page_addr || (addr - page_addr) % m_query.alignment != 0) return false;
+  const uint32_t wanted = (addr - page_addr) / m_query.alignment;
+  bool found = false;
+  ForEachSlot(*page, [&found, wanted](uint32_t slot) { found |= slot == wanted; });
+  return found;
+}
+
+void LinuxScanSession::GetCandidates(std::vector<nub_addr_t> &addrs, size_t max_count) const {
+  addrs.clear();
+  for (const CandidatePage &page : m_pages) {
+    ForEachSlot(page, [&](uint32_t slot) {
+      if (addrs.size() < max_count) addrs.push_back(page.addr + slot * m_query.alignment);
+    });
+    if (addrs.size() >= max_count) break;
+  }
+}
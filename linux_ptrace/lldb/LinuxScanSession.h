@@ -0,0 +1,99 @@
+#pragma once
+
+#include "DNBDefs.h"
+#include "DNBError.h"
+#include "LinuxMemoryScanner.h"
+#include "LinuxVMMemory.h"
+#include <cstdint>
+#include <vector>
+
+// Narrows a value scan down over several stops of a running process, e.g. to find a counter: Start() with its
+// current value, then Refine() with eCompareIncreased after each run until few candidates are left.
+//
+// Candidates are kept per page, as a bitset of the page's aligned slots or as delta encoded slot numbers, whichever
+// is smaller, next to the value each candidate had at the last pass. A first pass that matched an exact value does
+// not even keep the values, they are all the same. Refine() re-reads only the candidate bytes of each page, a batch
+// of pages per vectored read, with the batches spread over a pool of workers.
+class LinuxScanSession {
+public:
+  enum Compare {
+    eCompareEquals,    // Matches the query given to Refine()
+    eCompareChanged,   // Differs from the value at the last pass
+    eCompareUnchanged, // Same as the value at the last pass
+    eCompareIncreased, // Greater than the value at the last pass, integers compare as signed
+    eCompareDecreased, // Less than the value at the last pass
+  };
+
+  struct Statistics {
+    uint64_t passes = 0;
+    uint64_t candidates = 0;
+    uint64_t pages = 0;         // Pages with candidates
+    uint64_t memory_bytes = 0;  // Held for the candidates and their values
+    uint64_t bytes_read = 0;    // By the last pass
+    uint64_t last_pass_ns = 0;
+  };
+
+  explicit LinuxScanSession(LinuxVMMemory &vm_memory, unsigned thread_count = 0);
+
+  // Restrict the first pass, see LinuxMemoryScanner.
+  void SetPermissions(uint32_t permissions) { m_scanner.SetPermissions(permissions); }
+  void SetRange(nub_addr_t start, nub_addr_t end) { m_scanner.SetRange(start, end); }
+
+  // First pass: the candidates are the matches of `query`, whose type, size and alignment later passes keep.
+  bool Start(nub_process_t pid, const LinuxScanQuery &query);
+  // Keeps the candidates whose current value satisfies `compare`. eCompareEquals needs a `value` of the same size
+  // as the first pass; byte patterns cannot be ordered. Candidates that can no longer be read are dropped.
+  bool Refine(nub_process_t pid, Compare compare, const LinuxScanQuery *value = NULL);
+
+  uint64_t CandidateCount() const { return m_stats.candidates; }
+  bool Contains(nub_addr_t addr) const;
+  // The first `max_count` candidates, in address order.
+  void GetCandidates(std::vector<nub_addr_t> &addrs, size_t max_count = SIZE_MAX) const;
+
+  const Statistics &GetStatistics() const { return m_stats; }
+  const DNBError &GetError() const { return m_err; }
+
+private:
+  // Pages per unit of work of Refine(), each read with one ReadBatch().
+  static constexpr size_t kBatchPages = 256;
+
+  struct CandidatePage {
+    nub_addr_t addr;
+    uint32_t count;
+    uint32_t slots_size; // Bytes of encoded slots; equal to BitsetSize() when they are a bitset
+    uint64_t slots;      // Offset of the encoded slots in m_slots
+    uint64_t values;     // Offset of the first value in m_values, unused when the values are uniform
+  };
+  // Candidates of a run of pages, with offsets relative to the chunk until Append() moves them into the session.
+  struct Chunk {
+    std::vector<CandidatePage> pages;
+    std::vector<uint8_t> slots;
+    std::vector<uint8_t> values;
+    uint64_t count = 0;
+  };
+
+  nub_size_t BitsetSize() const { return m_page_size / m_query.alignment / 8; }
+  // Appends a page with the given sorted slot numbers (offset in the page / alignment) whose values, if kept, start
+  // at `values` in the chunk.
+  void EncodePage(Chunk &chunk, nub_addr_t page_addr, const uint32_t *slots, size_t count, uint64_t values) const;
+  template <typename Callback> void ForEachSlot(const CandidatePage &page, Callback callback) const;
+  const uint8_t *OldValue(const CandidatePage &page, size_t index) const;
+  void Clear();
+  void Append(Chunk &chunk);
+  bool RefineBatch(nub_process_t pid, LinuxVMMemory &reader, size_t first_page, size_t last_page, Compare compare,
+                   const LinuxScanQuery *value, bool keep_values, Chunk &chunk, std::vector<uint8_t> &buffer,
+                   uint64_t &bytes_read) const;
+  void UpdateStatistics();
+
+  LinuxMemoryScanner m_scanner;
+  unsigned m_thread_count;
+  nub_size_t m_page_size;
+  LinuxScanQuery m_query;
+  std::vector<CandidatePage> m_pages; // In address order
+  std::vector<uint8_t> m_slots;
+  std::vector<uint8_t> m_values;
+  bool m_uniform = false;              // Every candidate holds m_uniform_value, m_values is empty
+  std::vector<uint8_t> m_uniform_value;
+  Statistics m_stats;
+  DNBError m_err;
+};
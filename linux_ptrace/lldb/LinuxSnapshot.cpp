@@ -0,0 +1,306 @@
+#include "LinuxSnapshot.h"
+#include "LinuxPageHash.h"
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static constexpr nub_size_t kMinPagesPerThread = 256;
+
+static void AppendChange(std::vector<LinuxMemoryChange> &changes, nub_addr_t addr, nub_size_t size) {
+  if (!changes.empty() && changes.back().addr + changes.back().size == addr) {
+    changes.back().size += size;
+  } else {
+    changes.push_back({addr, size});
+  }
+}
+
+// `mask` has bit i set when byte i of the 64 byte block at `addr` differs.
+static void AppendChangedRuns(std::vector<LinuxMemoryChange> &changes, nub_addr_t addr, uint64_t mask) {
+  while (mask != 0) {
+    int start = __builtin_ctzll(mask);
+    uint64_t rest = ~(mask >> start);
+    int length = rest == 0 ? 64 - start : __builtin_ctzll(rest);
+    AppendChange(changes, addr + start, length);
+    if (start + length == 64) break;
+    mask &= ~0ULL << (start + length);
+  }
+}
+
+#if defined(__x86_64__)
+static uint64_t DiffMaskSSE2(const uint8_t *a, const uint8_t *b) {
+  uint64_t equal = 0;
+  for (int i = 0; i < 4; i++) {
+    __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i * 16));
+    __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i * 16));
+    equal |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)))) << (i * 16);
+  }
+  return ~equal;
+}
+
+__attribute__((target("avx2"))) static uint64_t DiffMaskAVX2(const uint8_t *a, const uint8_t *b) {
+  __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a));
+  __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b));
+  __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + 32));
+  __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + 32));
+  uint64_t low = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a0, b0)));
+  uint64_t high = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a1, b1)));
+  return ~(low | (high << 32));
+}
+#else
+static uint64_t DiffMaskScalar(const uint8_t *a, const uint8_t *b) {
+  uint64_t mask = 0;
+  for (int i = 0; i < 64; i++) mask |= static_cast<uint64_t>(a[i] != b[i]) << i;
+  return mask;
+}
+#endif
+
+// Appends the runs of differing bytes of two buffers, 64 bytes per vector compare.
+static void DiffBytes(const uint8_t *a, const uint8_t *b, nub_size_t size, nub_addr_t addr,
+                      std::vector<LinuxMemoryChange> &changes) {
+#if defined(__x86_64__)
+  static const auto diff_mask = __builtin_cpu_supports("avx2") ? DiffMaskAVX2 : DiffMaskSSE2;
+#else
+  static const auto diff_mask = DiffMaskScalar;
+#endif
+  nub_size_t offset = 0;
+  for (; offset + 64 <= size; offset += 64) {
+    // Equal blocks are by far the common case, skip them before building a mask.
+    if (std::memcmp(a + offset, b + offset, 64) == 0) continue;
+    AppendChangedRuns(changes, addr + offset, diff_mask(a + offset, b + offset));
+  }
+  for (; offset < size; offset++) {
+    if (a[offset] != b[offset]) AppendChange(changes, addr + offset, 1);
+  }
+}
+
+LinuxSnapshotStore::LinuxSnapshotStore(LinuxVMMemory &vm_memory, unsigned thread_count)
+    : m_vm_memory(vm_memory), m_page_size(vm_memory.PageSize()),
+      m_thread_count(thread_count != 0 ? thread_count : std::max(1u, std::thread::hardware_concurrency())),
+      m_soft_dirty(LinuxPageMap::SoftDirtySupported()), m_zero_page(m_page_size, 0) {}
+
+LinuxSnapshotStore::~LinuxSnapshotStore() {
+  {
+    std::lock_guard<std::mutex> lock(m_pool_mutex);
+    m_stopping = true;
+  }
+  m_job_posted.notify_all();
+  for (std::thread &worker : m_workers) worker.join();
+}
+
+void LinuxSnapshotStore::Clear() {
+  m_pid = INVALID_NUB_PROCESS;
+  m_chain.clear();
+  m_known.clear();
+  m_known_hashes.clear();
+  m_stats = Statistics{};
+}
+
+void LinuxSnapshotStore::CollectLivePages(nub_process_t pid, bool use_soft_dirty) {
+  m_live.clear();
+  m_candidates.clear();
+  LinuxVMRegionIndex &index = m_vm_memory.RegionIndex();
+  if (index.IsStale(pid)) index.Refresh(pid);
+  LinuxPageStates states;
+  for (const LinuxVMRegion &region : index.Regions()) {
+    if ((region.permissions & eMemoryPermissionsWritable) == 0) continue;
+    if (!m_vm_memory.PageMap().Query(pid, region.start, region.GetByteSize(), states)) continue;
+    // Pages of a private file mapping that were never touched still have content: the file's.
+    const bool file_backed = region.kind == LinuxVMRegion::eKindFile;
+    for (nub_size_t page = 0; page < states.page_count; page++) {
+      if (!file_backed && !states.IsResident(page)) continue;
+      const nub_addr_t page_addr = states.PageAddress(page);
+      m_live.push_back(page_addr);
+      if (use_soft_dirty && LinuxPageStates::Test(states.soft_dirty, page) == 0 &&
+          std::binary_search(m_known.begin(), m_known.end(), page_addr)) {
+        continue;
+      }
+      m_candidates.push_back(page_addr);
+    }
+  }
+}
+
+void LinuxSnapshotStore::HashSlice(unsigned slice, unsigned slices, nub_size_t page_count) {
+  const nub_size_t pages_per_slice = (page_count + slices - 1) / slices;
+  const nub_size_t first = std::min(page_count, slice * pages_per_slice);
+  const nub_size_t last = std::min(page_count, first + pages_per_slice);
+  for (nub_size_t i = first; i < last; i++) m_hashes[i] = HashPage(&m_staging[i * m_page_size], m_page_size);
+}
+
+void LinuxSnapshotStore::WorkerLoop(unsigned slice) {
+  uint64_t last_job = 0;
+  std::unique_lock<std::mutex> lock(m_pool_mutex);
+  while (true) {
+    m_job_posted.wait(lock, [&] { return m_stopping || m_job != last_job; });
+    if (m_stopping) return;
+    last_job = m_job;
+    const unsigned slices = m_job_slices;
+    const nub_size_t page_count = m_job_pages;
+    lock.unlock();
+    if (slice < slices) HashSlice(slice, slices, page_count);
+    lock.lock();
+    if (--m_job_pending == 0) m_job_done.notify_one();
+  }
+}
+
+void LinuxSnapshotStore::HashPages(nub_size_t page_count) {
+  m_hashes.resize(page_count);
+  const unsigned slices = static_cast<unsigned>(std::min<nub_size_t>(m_thread_count, page_count / kMinPagesPerThread));
+  if (slices <= 1) {
+    HashSlice(0, 1, page_count);
+    return;
+  }
+  // Every worker takes part in every job, so none can miss one; those beyond `slices` only report back.
+  std::unique_lock<std::mutex> lock(m_pool_mutex);
+  while (m_workers.size() + 1 < m_thread_count) {
+    const unsigned slice = static_cast<unsigned>(m_workers.size()) + 1;
+    m_workers.emplace_back([this, slice] { WorkerLoop(slice); });
+  }
+  m_job++;
+  m_job_slices = slices;
+  m_job_pages = page_count;
+  m_job_pending = m_workers.size();
+  lock.unlock();
+  m_job_posted.notify_all();
+  HashSlice(0, slices, page_count);
+  lock.lock();
+  m_job_done.wait(lock, [this] { return m_job_pending == 0; });
+}
+
+nub_size_t LinuxSnapshotStore::LoadChunk(nub_process_t pid, nub_size_t first) {
+  // One batched transfer per chunk, pages that cannot be read count as zero.
+  const nub_size_t count = std::min(kChunkPages, m_candidates.size() - first);
+  m_staging.resize(count * m_page_size);
+  std::vector<DNBMemoryRequest> requests;
+  for (nub_size_t i = 0; i < count; i++) {
+    nub_addr_t page_addr = m_candidates[first + i];
+    if (!requests.empty() && requests.back().addr + requests.back().size == page_addr) {
+      requests.back().size += m_page_size;
+    } else {
+      requests.push_back({page_addr, m_page_size, &m_staging[i * m_page_size], 0});
+    }
+  }
+  m_vm_memory.ReadBatch(pid, requests.data(), requests.size());
+  for (const DNBMemoryRequest &request : requests) {
+    std::memset(static_cast<uint8_t *>(request.data) + request.bytes_transferred, 0,
+                request.size - request.bytes_transferred);
+  }
+  HashPages(count);
+  return count;
+}
+
+uint32_t LinuxSnapshotStore::StorePage(Delta &delta, const uint8_t *data) {
+  const uint32_t slot = delta.page_count++;
+  if (slot % kPagesPerBlock == 0) delta.blocks.emplace_back(new uint8_t[kPagesPerBlock * m_page_size]);
+  std::memcpy(delta.blocks.back().get() + (slot % kPagesPerBlock) * m_page_size, data, m_page_size);
+  return slot;
+}
+
+size_t LinuxSnapshotStore::Take(nub_process_t pid) {
+  if (pid != m_pid) Clear();
+  // The bits only cover the interval since our last clear if nobody else (a reset point) cleared them since.
+  const bool use_soft_dirty =
+      m_soft_dirty && !m_chain.empty() && m_vm_memory.PageMap().SoftDirtyEpoch() == m_soft_dirty_epoch;
+  CollectLivePages(pid, use_soft_dirty);
+
+  // Walk the live pages against what the previous snapshot knew: candidates whose hash moved are stored, known
+  // pages that are no longer live are recorded as dropped. Candidates are read and hashed a chunk at a time, so
+  // the staging buffer stays small and warm however large the process is.
+  Delta delta;
+  std::vector<nub_addr_t> known;
+  std::vector<uint64_t> known_hashes;
+  known.reserve(m_live.size());
+  known_hashes.reserve(m_live.size());
+  nub_size_t old_index = 0;
+  nub_size_t candidate_index = 0;
+  nub_size_t chunk_first = 0;
+  nub_size_t chunk_count = 0;
+  auto drop_until = [&](nub_addr_t page_addr) {
+    for (; old_index < m_known.size() && m_known[old_index] < page_addr; old_index++) {
+      delta.pages.push_back(m_known[old_index]);
+      delta.slots.push_back(kDroppedPage);
+    }
+  };
+  for (nub_addr_t page_addr : m_live) {
+    drop_until(page_addr);
+    const bool was_known = old_index < m_known.size() && m_known[old_index] == page_addr;
+    uint64_t hash = was_known ? m_known_hashes[old_index] : 0;
+    if (candidate_index < m_candidates.size() && m_candidates[candidate_index] == page_addr) {
+      if (candidate_index == chunk_first + chunk_count) {
+        chunk_first = candidate_index;
+        chunk_count = LoadChunk(pid, chunk_first);
+      }
+      const nub_size_t staged = candidate_index - chunk_first;
+      if (!was_known || m_hashes[staged] != hash) {
+        hash = m_hashes[staged];
+        delta.pages.push_back(page_addr);
+        delta.slots.push_back(StorePage(delta, &m_staging[staged * m_page_size]));
+      }
+      candidate_index++;
+    }
+    if (was_known) old_index++;
+    known.push_back(page_addr);
+    known_hashes.push_back(hash);
+  }
+  drop_until(INVALID_NUB_ADDRESS);
+  m_known.swap(known);
+  m_known_hashes.swap(known_hashes);
+
+  // Start the next write tracking interval only once everything dirty was read.
+  if (m_soft_dirty && !m_vm_memory.PageMap().ClearSoftDirty(pid)) m_soft_dirty = false;
+  m_soft_dirty_epoch = m_vm_memory.PageMap().SoftDirtyEpoch();
+
+  m_pid = pid;
+  m_stats.pages_live = m_live.size();
+  m_stats.pages_read = m_candidates.size();
+  m_stats.pages_stored = delta.page_count;
+  m_stats.pages_dropped = delta.pages.size() - delta.page_count;
+  m_stats.bytes_stored += delta.page_count * m_page_size;
+  m_chain.push_back(std::move(delta));
+  return m_chain.size() - 1;
+}
+
+const uint8_t *LinuxSnapshotStore::FindPage(size_t snapshot, nub_addr_t page) const {
+  for (size_t i = std::min(snapshot + 1, m_chain.size()); i-- > 0;) {
+    const Delta &delta = m_chain[i];
+    auto pos = std::lower_bound(delta.pages.begin(), delta.pages.end(), page);
+    if (pos == delta.pages.end() || *pos != page) continue;
+    uint32_t slot = delta.slots[pos - delta.pages.begin()];
+    if (slot == kDroppedPage) break;
+    return delta.blocks[slot / kPagesPerBlock].get() + (slot % kPagesPerBlock) * m_page_size;
+  }
+  return m_zero_page.data();
+}
+
+void LinuxSnapshotStore::Read(size_t snapshot, nub_addr_t address, void *data, nub_size_t data_count) const {
+  uint8_t *dest = static_cast<uint8_t *>(data);
+  while (data_count > 0) {
+    nub_addr_t page = address - (address % m_page_size);
+    nub_size_t offset = address - page;
+    nub_size_t count = std::min(m_page_size - offset, data_count);
+    std::memcpy(dest, FindPage(snapshot, page) + offset, count);
+    dest += count;
+    address += count;
+    data_count -= count;
+  }
+}
+
+std::vector<LinuxMemoryChange> LinuxSnapshotStore::Diff(size_t from, size_t to) const {
+  std::vector<LinuxMemoryChange> changes;
+  if (m_chain.empty()) return changes;
+  if (from > to) std::swap(from, to);
+  to = std::min(to, m_chain.size() - 1);
+  // Only pages some snapshot after `from` touched can differ.
+  std::vector<nub_addr_t> pages;
+  for (size_t i = from + 1; i <= to; i++) pages.insert(pages.end(), m_chain[i].pages.begin(), m_chain[i].pages.end());
+  std::sort(pages.begin(), pages.end());
+  pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+  for (nub_addr_t page : pages) {
+    const uint8_t *old_data = FindPage(from, page);
+    const uint8_t *new_data = FindPage(to, page);
+    if (old_data != new_data) DiffBytes(old_data, new_data, m_page_size, page, changes);
+  }
+  return changes;
+}
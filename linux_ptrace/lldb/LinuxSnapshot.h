@@ -0,0 +1,105 @@
+#pragma once
+
+#include "DNBDefs.h"
+#include "LinuxVMMemory.h"
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A run of bytes that differs between two snapshots.
+struct LinuxMemoryChange {
+  nub_addr_t addr;
+  nub_size_t size;
+};
+
+// Chain of snapshots of the writable memory of a stopped process. The first snapshot holds every page that has
+// content, each later one only the pages whose content changed since the previous snapshot (and the pages that
+// went away), so taking a snapshot costs in proportion to what the process wrote in between:
+//  - with soft-dirty tracking only the pages written since the last snapshot are read at all; after a
+//    LinuxResetPoint on the same process cleared the bits in between, every live page is read once more,
+//  - without it every live page is read, but pages are hashed in parallel, by workers started on first use and
+//    kept for the life of the store, and only changed ones are stored.
+// A page counts as changed when its 64-bit hash differs; the bytes are not compared, so a hash collision (about one
+// in 2^64 per written page) misses that change.
+class LinuxSnapshotStore {
+public:
+  struct Statistics {
+    uint64_t pages_live = 0;    // Pages with content in writable regions at the last Take()
+    uint64_t pages_read = 0;    // Pages read from the target by the last Take()
+    uint64_t pages_stored = 0;  // Changed pages stored by the last Take()
+    uint64_t pages_dropped = 0; // Pages that lost their content (unmapped, discarded) since the previous Take()
+    uint64_t bytes_stored = 0;  // Page data held by the whole chain
+  };
+
+  explicit LinuxSnapshotStore(LinuxVMMemory &vm_memory, unsigned thread_count = 0);
+  ~LinuxSnapshotStore();
+  LinuxSnapshotStore(const LinuxSnapshotStore &) = delete;
+  LinuxSnapshotStore &operator=(const LinuxSnapshotStore &) = delete;
+
+  // Snapshots the stopped process and returns the id of the new snapshot. Taking a snapshot of another process
+  // starts a new chain.
+  size_t Take(nub_process_t pid);
+  size_t Count() const { return m_chain.size(); }
+  void Clear();
+  bool UsesSoftDirty() const { return m_soft_dirty; }
+
+  // Reconstructs memory as it was in `snapshot`; bytes that had no content then read as zero.
+  void Read(size_t snapshot, nub_addr_t address, void *data, nub_size_t data_count) const;
+  // Byte ranges that differ between two snapshots, sorted and coalesced.
+  std::vector<LinuxMemoryChange> Diff(size_t from, size_t to) const;
+
+  const Statistics &GetStatistics() const { return m_stats; }
+
+private:
+  static constexpr uint32_t kDroppedPage = UINT32_MAX;
+  static constexpr nub_size_t kPagesPerBlock = 256;
+  static constexpr nub_size_t kChunkPages = 4096;
+
+  struct Delta {
+    std::vector<nub_addr_t> pages; // Sorted page addresses this snapshot changed
+    std::vector<uint32_t> slots;   // Storage slot of each page, or kDroppedPage
+    std::vector<std::unique_ptr<uint8_t[]>> blocks; // Page storage, kPagesPerBlock pages per block
+    uint32_t page_count = 0;
+  };
+
+  // Content of `page` as of `snapshot`: the newest copy at or before it in the chain.
+  const uint8_t *FindPage(size_t snapshot, nub_addr_t page) const;
+  void CollectLivePages(nub_process_t pid, bool use_soft_dirty);
+  // Reads and hashes the next chunk of candidates into the staging buffer, returns the number of pages loaded.
+  nub_size_t LoadChunk(nub_process_t pid, nub_size_t first);
+  void HashPages(nub_size_t page_count);
+  // Hashes slice `slice` of `slices` of the staged pages.
+  void HashSlice(unsigned slice, unsigned slices, nub_size_t page_count);
+  void WorkerLoop(unsigned slice);
+  uint32_t StorePage(Delta &delta, const uint8_t *data);
+
+  LinuxVMMemory &m_vm_memory;
+  nub_size_t m_page_size;
+  unsigned m_thread_count;
+  bool m_soft_dirty;
+  uint64_t m_soft_dirty_epoch = 0; // LinuxPageMap::SoftDirtyEpoch() after our last clear
+  nub_process_t m_pid = INVALID_NUB_PROCESS;
+  std::vector<Delta> m_chain;
+  std::vector<nub_addr_t> m_known;      // Sorted pages with content as of the newest snapshot
+  std::vector<uint64_t> m_known_hashes; // Hash of each page of m_known
+  std::vector<nub_addr_t> m_live;       // Scratch of Take(): pages with content now
+  std::vector<nub_addr_t> m_candidates; // Scratch of Take(): subset of m_live to read and compare
+  std::vector<uint8_t> m_staging;       // Scratch of Take(): data of the current chunk of m_candidates
+  std::vector<uint64_t> m_hashes;       // Scratch of Take(): hashes of the pages in m_staging
+  std::vector<uint8_t> m_zero_page;
+  Statistics m_stats;
+
+  // Hashing workers, slice 0 of every job is hashed by the calling thread.
+  std::vector<std::thread> m_workers;
+  std::mutex m_pool_mutex;
+  std::condition_variable m_job_posted;
+  std::condition_variable m_job_done;
+  uint64_t m_job = 0; // Bumped per job
+  unsigned m_job_slices = 0;
+  nub_size_t m_job_pages = 0;
+  size_t m_job_pending = 0; // Workers that did not finish the job yet
+  bool m_stopping = false;
+};
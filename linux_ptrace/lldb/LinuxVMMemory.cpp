@@ -0,0 +1,293 @@
+#include "LinuxVMMemory.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static const nub_size_t kInvalidPageSize = ~0;
+
+LinuxVMMemory::LinuxVMMemory()
+    : m_page_size(kInvalidPageSize), m_mem_pid(INVALID_NUB_PROCESS), m_mem_fd(-1), m_err(0) {}
+
+LinuxVMMemory::~LinuxVMMemory() {
+  if (m_mem_fd >= 0) ::close(m_mem_fd);
+}
+
+nub_size_t LinuxVMMemory::PageSize() {
+  if (m_page_size == kInvalidPageSize) {
+    long page_size = ::sysconf(_SC_PAGESIZE);
+    m_page_size = page_size > 0 ? static_cast<nub_size_t>(page_size) : 0;
+  }
+  return m_page_size;
+}
+
+nub_bool_t LinuxVMMemory::GetMemoryRegionInfo(nub_process_t pid, nub_addr_t address, DNBRegionInfo *region_info) {
+  if (m_region_index.IsStale(pid)) m_region_index.Refresh(pid);
+
+  const LinuxVMRegion *region = m_region_index.FindRegion(address);
+  if (region != NULL) {
+    region_info->addr = region->start;
+    region_info->size = region->GetByteSize();
+    region_info->permissions = region->permissions;
+    // PROT_NONE reservations can be huge and have nothing worth reporting, skip their pagemap walk.
+    if (region->permissions != 0) {
+      region_info->dirty_pages = m_page_map.GetDirtyPages(pid, region->start, region->GetByteSize());
+    } else {
+      region_info->dirty_pages.clear();
+    }
+    region_info->vm_types = m_region_index.GetMemoryTypes(*region);
+  } else {
+    // Not mapped: the hole runs up to the next region, or to the end of the address space past the last one.
+    const LinuxVMRegion *next_region = m_region_index.FindNextRegion(address);
+    region_info->addr = address;
+    region_info->size = next_region != NULL ? next_region->start - address : INVALID_NUB_ADDRESS - address;
+    region_info->dirty_pages.clear();
+    region_info->vm_types.clear();
+    // Not readable, writeable or executable
+    region_info->permissions = 0;
+  }
+  return true;
+}
+
+nub_size_t LinuxVMMemory::Read(nub_process_t pid, nub_addr_t address, void *data, nub_size_t data_count) {
+  if (data == NULL || data_count == 0) return 0;
+  DNBMemoryRequest request{address, data_count, data, 0};
+  return TransferBatch(pid, &request, 1, false);
+}
+
+nub_size_t LinuxVMMemory::Write(nub_process_t pid, nub_addr_t address, const void *data, nub_size_t data_count) {
+  if (data == NULL || data_count == 0) return 0;
+  DNBMemoryRequest request{address, data_count, const_cast<void *>(data), 0};
+  return WriteBatch(pid, &request, 1);
+}
+
+nub_size_t LinuxVMMemory::ReadBatch(nub_process_t pid, DNBMemoryRequest *requests, nub_size_t request_count) {
+  return TransferBatch(pid, requests, request_count, false);
+}
+
+nub_size_t LinuxVMMemory::WriteBatch(nub_process_t pid, DNBMemoryRequest *requests, nub_size_t request_count) {
+  nub_size_t total_bytes_written = TransferBatch(pid, requests, request_count, true);
+  if (m_err.Fail()) return total_bytes_written;
+  for (nub_size_t i = 0; i < request_count; i++) {
+    DNBMemoryRequest &request = requests[i];
+    if (request.bytes_transferred == request.size) continue;
+    nub_size_t bytes_written =
+        WriteProcMem(pid, request.addr + request.bytes_transferred,
+                     static_cast<const uint8_t *>(request.data) + request.bytes_transferred,
+                     request.size - request.bytes_transferred);
+    request.bytes_transferred += bytes_written;
+    total_bytes_written += bytes_written;
+  }
+  return total_bytes_written;
+}
+
+static void AppendExtent(std::vector<DNBMemoryExtent> &extents, nub_addr_t addr, nub_size_t size, bool readable) {
+  if (size == 0) return;
+  if (!extents.empty() && extents.back().readable == readable && extents.back().addr + extents.back().size == addr) {
+    extents.back().size += size;
+  } else {
+    extents.push_back({addr, size, readable});
+  }
+}
+
+nub_size_t LinuxVMMemory::ReadLarge(nub_process_t pid, nub_addr_t address, void *data, nub_size_t data_count,
+                                    std::vector<DNBMemoryExtent> &extents) {
+  extents.clear();
+  m_err.Clear();
+  if (data == NULL || data_count == 0) return 0;
+
+  const nub_addr_t end_address = address + data_count;
+  uint8_t *base = static_cast<uint8_t *>(data);
+  nub_size_t total_bytes_read = 0;
+  nub_addr_t curr_addr = address;
+  while (curr_addr < end_address) {
+    struct iovec local_iov = {base + (curr_addr - address), end_address - curr_addr};
+    struct iovec remote_iov = {reinterpret_cast<void *>(curr_addr), end_address - curr_addr};
+    errno = 0;
+    ssize_t bytes = ::process_vm_readv(pid, &local_iov, 1, &remote_iov, 1, 0);
+    if (bytes < 0 && errno != EFAULT) {
+      m_err.SetErrorToErrno();
+      break;
+    }
+    if (bytes > 0) {
+      AppendExtent(extents, curr_addr, bytes, true);
+      total_bytes_read += bytes;
+      curr_addr += bytes;
+      if (curr_addr == end_address) break;
+    }
+    // The transfer stopped at curr_addr, so the page holding it is unreadable.
+    const nub_size_t page_size = PageSize();
+    nub_addr_t bad_page = curr_addr - (curr_addr % page_size);
+    nub_addr_t next_addr = std::min(FindReadable(pid, bad_page, end_address), end_address);
+    ::memset(base + (curr_addr - address), 0, next_addr - curr_addr);
+    AppendExtent(extents, curr_addr, next_addr - curr_addr, false);
+    curr_addr = next_addr;
+  }
+  return total_bytes_read;
+}
+
+nub_size_t LinuxVMMemory::ReadResident(nub_process_t pid, nub_addr_t address, void *data, nub_size_t data_count,
+                                       std::vector<DNBMemoryExtent> &extents) {
+  extents.clear();
+  m_err.Clear();
+  if (data == NULL || data_count == 0) return 0;
+  LinuxPageStates states;
+  if (!m_page_map.Query(pid, address, data_count, states)) {
+    m_err = m_page_map.GetError();
+    return 0;
+  }
+
+  // One request per run of resident pages, clipped to the requested range.
+  const nub_addr_t end_address = address + data_count;
+  uint8_t *base = static_cast<uint8_t *>(data);
+  std::vector<DNBMemoryRequest> requests;
+  nub_size_t page = 0;
+  while (page < states.page_count) {
+    if (!states.IsResident(page)) {
+      page++;
+      continue;
+    }
+    nub_size_t first = page;
+    while (page < states.page_count && states.IsResident(page)) page++;
+    nub_addr_t run_start = std::max(states.PageAddress(first), address);
+    nub_addr_t run_end = std::min(states.PageAddress(page), end_address);
+    requests.push_back({run_start, run_end - run_start, base + (run_start - address), 0});
+  }
+  nub_size_t total_bytes_read = ReadBatch(pid, requests.data(), requests.size());
+
+  nub_addr_t curr_addr = address;
+  for (const DNBMemoryRequest &request : requests) {
+    ::memset(base + (curr_addr - address), 0, request.addr - curr_addr);
+    AppendExtent(extents, curr_addr, request.addr - curr_addr, false);
+    ::memset(static_cast<uint8_t *>(request.data) + request.bytes_transferred, 0,
+             request.size - request.bytes_transferred);
+    AppendExtent(extents, request.addr, request.bytes_transferred, true);
+    AppendExtent(extents, request.addr + request.bytes_transferred, request.size - request.bytes_transferred, false);
+    curr_addr = request.addr + request.size;
+  }
+  ::memset(base + (curr_addr - address), 0, end_address - curr_addr);
+  AppendExtent(extents, curr_addr, end_address - curr_addr, false);
+  return total_bytes_read;
+}
+
+bool LinuxVMMemory::IsReadable(nub_process_t pid, nub_addr_t address) {
+  uint8_t byte;
+  struct iovec local_iov = {&byte, 1};
+  struct iovec remote_iov = {reinterpret_cast<void *>(address), 1};
+  return ::process_vm_readv(pid, &local_iov, 1, &remote_iov, 1, 0) == 1;
+}
+
+nub_addr_t LinuxVMMemory::FindReadable(nub_process_t pid, nub_addr_t bad_page, nub_addr_t end_address) {
+  // Holes are usually whole unmapped or PROT_NONE ranges, and the maps tell where they end: skip straight to the next
+  // readable region. Unreadable pages inside a readable region (past the end of the file, mostly) do not follow any
+  // pattern, those are probed one by one. Without the maps every page is probed.
+  const nub_size_t page_size = PageSize();
+  const bool have_regions = !m_region_index.IsStale(pid) || m_region_index.Refresh(pid) ||
+                            m_region_index.GetError().Success();
+  nub_addr_t page = bad_page + page_size;
+  while (page < end_address) {
+    const LinuxVMRegion *region = have_regions ? m_region_index.FindRegion(page) : NULL;
+    if (have_regions && (region == NULL || (region->permissions & eMemoryPermissionsReadable) == 0)) {
+      region = m_region_index.FindNextRegion(page);
+      while (region != NULL && (region->permissions & eMemoryPermissionsReadable) == 0) {
+        region = m_region_index.FindNextRegion(region->start);
+      }
+      if (region == NULL) return end_address;
+      page = region->start;
+      continue;
+    }
+    if (IsReadable(pid, page)) return page;
+    page += page_size;
+  }
+  return end_address;
+}
+
+nub_size_t LinuxVMMemory::TransferBatch(nub_process_t pid, DNBMemoryRequest *requests, nub_size_t request_count,
+                                        bool write) {
+  m_err.Clear();
+  if (requests == NULL) return 0;
+  for (nub_size_t i = 0; i < request_count; i++) requests[i].bytes_transferred = 0;
+
+  struct iovec local_iov[IOV_MAX];
+  struct iovec remote_iov[IOV_MAX];
+  nub_size_t total_bytes_transferred = 0;
+  // The kernel stops at the first remote range it cannot access, so we resume right where it stopped and drop
+  // the faulting range when it is the very first one of a call.
+  nub_size_t curr_index = 0;
+  nub_size_t curr_offset = 0;
+  while (curr_index < request_count) {
+    if (curr_offset == requests[curr_index].size) {
+      curr_index++;
+      curr_offset = 0;
+      continue;
+    }
+    unsigned long iov_count = 0;
+    for (nub_size_t i = curr_index; i < request_count && iov_count < IOV_MAX; i++) {
+      nub_size_t skip = (i == curr_index) ? curr_offset : 0;
+      if (requests[i].size == skip) continue;
+      local_iov[iov_count].iov_base = static_cast<uint8_t *>(requests[i].data) + skip;
+      local_iov[iov_count].iov_len = requests[i].size - skip;
+      remote_iov[iov_count].iov_base = reinterpret_cast<void *>(requests[i].addr + skip);
+      remote_iov[iov_count].iov_len = requests[i].size - skip;
+      iov_count++;
+    }
+
+    errno = 0;
+    ssize_t bytes = write ? ::process_vm_writev(pid, local_iov, iov_count, remote_iov, iov_count, 0)
+                          : ::process_vm_readv(pid, local_iov, iov_count, remote_iov, iov_count, 0);
+    if (bytes < 0 && errno != EFAULT) {
+      m_err.SetErrorToErrno();
+      break;
+    }
+    if (bytes <= 0) {
+      curr_index++;
+      curr_offset = 0;
+      continue;
+    }
+
+    total_bytes_transferred += bytes;
+    nub_size_t bytes_left = static_cast<nub_size_t>(bytes);
+    while (bytes_left > 0) {
+      nub_size_t step = std::min(requests[curr_index].size - curr_offset, bytes_left);
+      requests[curr_index].bytes_transferred += step;
+      curr_offset += step;
+      bytes_left -= step;
+      if (curr_offset == requests[curr_index].size) {
+        curr_index++;
+        curr_offset = 0;
+      }
+    }
+  }
+  return total_bytes_transferred;
+}
+
+nub_size_t LinuxVMMemory::WriteProcMem(nub_process_t pid, nub_addr_t address, const void *data,
+                                       nub_size_t data_count) {
+  if (m_mem_pid != pid) {
+    if (m_mem_fd >= 0) ::close(m_mem_fd);
+    std::string path = "/proc/" + std::to_string(pid) + "/mem";
+    m_mem_fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    m_mem_pid = m_mem_fd >= 0 ? pid : INVALID_NUB_PROCESS;
+    if (m_mem_fd < 0) {
+      m_err.SetErrorToErrno();
+      return 0;
+    }
+  }
+
+  nub_size_t total_bytes_written = 0;
+  const uint8_t *curr_data = static_cast<const uint8_t *>(data);
+  while (total_bytes_written < data_count) {
+    ssize_t bytes = ::pwrite(m_mem_fd, curr_data + total_bytes_written, data_count - total_bytes_written,
+                             static_cast<off_t>(address + total_bytes_written));
+    if (bytes <= 0) {
+      if (bytes < 0 && errno == EINTR) continue;
+      if (bytes < 0 && errno != EIO && errno != EFAULT) m_err.SetErrorToErrno();
+      break;
+    }
+    total_bytes_written += bytes;
+  }
+  return total_bytes_written;
+}
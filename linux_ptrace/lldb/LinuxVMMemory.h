@@ -0,0 +1,70 @@
+#pragma once
+
+#include "DNBDefs.h"
+#include "DNBError.h"
+#include "LinuxPageMap.h"
+#include "LinuxVMRegion.h"
+#include <sys/types.h>
+#include <vector>
+
+// One disjoint range of a batch transfer. `data` is the local buffer the range is read into or written from,
+// `bytes_transferred` is filled in by the batch call.
+struct DNBMemoryRequest {
+  nub_addr_t addr;
+  nub_size_t size;
+  void *data;
+  nub_size_t bytes_transferred;
+};
+
+// A contiguous piece of a large read that was either fully readable or fully unreadable.
+struct DNBMemoryExtent {
+  nub_addr_t addr;
+  nub_size_t size;
+  bool readable;
+};
+
+class LinuxVMMemory {
+public:
+  LinuxVMMemory();
+  ~LinuxVMMemory();
+  nub_size_t Read(nub_process_t pid, nub_addr_t address, void *data, nub_size_t data_count);
+  nub_size_t Write(nub_process_t pid, nub_addr_t address, const void *data, nub_size_t data_count);
+  // Scatter-gather transfer of many disjoint ranges, packed IOV_MAX ranges per process_vm_readv/writev call.
+  // Returns the total number of bytes moved, per range results are in DNBMemoryRequest::bytes_transferred.
+  nub_size_t ReadBatch(nub_process_t pid, DNBMemoryRequest *requests, nub_size_t request_count);
+  nub_size_t WriteBatch(nub_process_t pid, DNBMemoryRequest *requests, nub_size_t request_count);
+  // Reads the whole range with a single transfer. Only when that transfer stops early are the unreadable pages
+  // located, from the region index and with one byte probes. Unreadable bytes are zero filled and the
+  // readable/unreadable layout of the range is returned in `extents`. Returns the number of readable bytes.
+  nub_size_t ReadLarge(nub_process_t pid, nub_addr_t address, void *data, nub_size_t data_count,
+                       std::vector<DNBMemoryExtent> &extents);
+  // Like ReadLarge, but only pages that are present or swapped out are copied; the others are zero filled without
+  // touching them, so a scan or dump of a sparse range does not fault in (or read from disk) pages it would find
+  // empty or unchanged. `extents` marks the copied ranges readable.
+  nub_size_t ReadResident(nub_process_t pid, nub_addr_t address, void *data, nub_size_t data_count,
+                          std::vector<DNBMemoryExtent> &extents);
+  nub_size_t PageSize();
+  // Answered from the region index, which is only re-read once the process ran since the last query.
+  nub_bool_t GetMemoryRegionInfo(nub_process_t pid, nub_addr_t address, DNBRegionInfo *region_info);
+  LinuxVMRegionIndex &RegionIndex() { return m_region_index; }
+  const LinuxVMRegionIndex &RegionIndex() const { return m_region_index; }
+  LinuxPageMap &PageMap() { return m_page_map; }
+
+  const DNBError &GetError() const { return m_err; }
+
+protected:
+  bool IsReadable(nub_process_t pid, nub_addr_t address);
+  // First readable page after `bad_page`, `end_address` when there is none before it.
+  nub_addr_t FindReadable(nub_process_t pid, nub_addr_t bad_page, nub_addr_t end_address);
+  nub_size_t TransferBatch(nub_process_t pid, DNBMemoryRequest *requests, nub_size_t request_count, bool write);
+  // Fallback for ranges process_vm_writev refuses (e.g. read-only text pages): /proc/pid/mem ignores the page
+  // protections for a ptrace attached tracer.
+  nub_size_t WriteProcMem(nub_process_t pid, nub_addr_t address, const void *data, nub_size_t data_count);
+
+  nub_size_t m_page_size;
+  nub_process_t m_mem_pid;
+  int m_mem_fd;
+  LinuxVMRegionIndex m_region_index;
+  LinuxPageMap m_page_map;
+  DNBError m_err;
+};
@@ -0,0 +1,311 @@
+#include "LinuxVMRegion.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+static bool ReadFile(const std::string &path, std::string &content) {
+  content.clear();
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  // /proc files report a size of 0, so grow the buffer until a read comes back short.
+  size_t capacity = std::max<size_t>(content.capacity(), 64 * 1024);
+  content.resize(capacity);
+  size_t length = 0;
+  while (true) {
+    if (length == content.size()) content.resize(content.size() * 2);
+    ssize_t bytes = ::read(fd, &content[length], content.size() - length);
+    if (bytes < 0 && errno == EINTR) continue;
+    if (bytes <= 0) {
+      content.resize(length);
+      ::close(fd);
+      return bytes == 0;
+    }
+    length += bytes;
+  }
+}
+
+static uint64_t ParseHex(const char *&pos, const char *end) {
+  uint64_t value = 0;
+  for (; pos < end; pos++) {
+    char c = *pos;
+    if (c >= '0' && c <= '9') {
+      value = (value << 4) | (c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      value = (value << 4) | (c - 'a' + 10);
+    } else {
+      break;
+    }
+  }
+  return value;
+}
+
+static uint64_t ParseDecimal(const char *&pos, const char *end) {
+  uint64_t value = 0;
+  for (; pos < end && *pos >= '0' && *pos <= '9'; pos++) value = value * 10 + (*pos - '0');
+  return value;
+}
+
+bool LinuxVMRegionIndex::Refresh(nub_process_t pid) {
+  m_err.Clear();
+  if (!ReadFile("/proc/" + std::to_string(pid) + "/maps", m_next_maps)) {
+    m_err.SetErrorToErrno();
+    return false;
+  }
+  m_stale = false;
+  if (pid == m_pid && m_next_maps == m_maps) return false;
+  m_pid = pid;
+  m_maps.swap(m_next_maps);
+  m_generation++;
+  return Parse();
+}
+
+bool LinuxVMRegionIndex::Parse() {
+  m_starts.clear();
+  m_regions.clear();
+  m_names.clear();
+
+  // Format: start-end perms offset major:minor inode [path]
+  const char *pos = m_maps.data();
+  const char *end = pos + m_maps.size();
+  while (pos < end) {
+    const char *line_end = static_cast<const char *>(::memchr(pos, '\n', end - pos));
+    if (line_end == NULL) line_end = end;
+
+    LinuxVMRegion region{};
+    region.start = ParseHex(pos, line_end);
+    pos++; // '-'
+    region.end = ParseHex(pos, line_end);
+    pos++; // ' '
+    if (line_end - pos >= 4) {
+      if (pos[0] == 'r') region.permissions |= eMemoryPermissionsReadable;
+      if (pos[1] == 'w') region.permissions |= eMemoryPermissionsWritable;
+      if (pos[2] == 'x') region.permissions |= eMemoryPermissionsExecutable;
+      region.shared = pos[3] == 's';
+      pos += 5;
+    }
+    region.offset = ParseHex(pos, line_end);
+    pos++; // ' '
+    uint32_t major = ParseHex(pos, line_end);
+    pos++; // ':'
+    uint32_t minor = ParseHex(pos, line_end);
+    region.dev = (major << 20) | minor;
+    pos++; // ' '
+    region.inode = ParseDecimal(pos, line_end);
+    while (pos < line_end && *pos == ' ') pos++;
+
+    region.name_offset = m_names.size();
+    region.name_length = line_end - pos;
+    m_names.insert(m_names.end(), pos, line_end);
+    if (region.name_length == 0 || ::strncmp(pos, "[anon:", 6) == 0) {
+      region.kind = LinuxVMRegion::eKindAnonymous;
+    } else if (::strncmp(pos, "[heap]", 6) == 0) {
+      region.kind = LinuxVMRegion::eKindHeap;
+    } else if (::strncmp(pos, "[stack", 6) == 0) {
+      region.kind = LinuxVMRegion::eKindStack;
+    } else if (::strncmp(pos, "[vdso]", 6) == 0) {
+      region.kind = LinuxVMRegion::eKindVDSO;
+    } else if (::strncmp(pos, "[vvar", 5) == 0) {
+      region.kind = LinuxVMRegion::eKindVVar;
+    } else if (::strncmp(pos, "[vsyscall]", 10) == 0) {
+      region.kind = LinuxVMRegion::eKindVSyscall;
+    } else {
+      region.kind = region.inode != 0 ? LinuxVMRegion::eKindFile : LinuxVMRegion::eKindAnonymous;
+    }
+
+    if (region.end > region.start) {
+      m_starts.push_back(region.start);
+      m_regions.push_back(region);
+    }
+    pos = line_end + 1;
+  }
+  return true;
+}
+
+void LinuxVMRegionIndex::SplitAt(nub_addr_t addr) {
+  auto pos = std::upper_bound(m_starts.begin(), m_starts.end(), addr);
+  if (pos == m_starts.begin()) return;
+  size_t index = pos - m_starts.begin() - 1;
+  LinuxVMRegion tail = m_regions[index];
+  if (addr <= tail.start || addr >= tail.end) return;
+  if (tail.kind == LinuxVMRegion::eKindFile) tail.offset += addr - tail.start;
+  tail.start = addr;
+  m_regions[index].end = addr;
+  m_starts.insert(m_starts.begin() + index + 1, addr);
+  m_regions.insert(m_regions.begin() + index + 1, tail);
+}
+
+std::pair<size_t, size_t> LinuxVMRegionIndex::Carve(nub_addr_t start, nub_addr_t end) {
+  SplitAt(start);
+  SplitAt(end);
+  size_t first = std::lower_bound(m_starts.begin(), m_starts.end(), start) - m_starts.begin();
+  size_t last = std::lower_bound(m_starts.begin(), m_starts.end(), end) - m_starts.begin();
+  return {first, last};
+}
+
+void LinuxVMRegionIndex::Map(const LinuxVMRegion &region, const std::string &name) {
+  Unmap(region.start, region.end);
+  LinuxVMRegion new_region = region;
+  new_region.name_offset = m_names.size();
+  new_region.name_length = name.size();
+  m_names.insert(m_names.end(), name.begin(), name.end());
+  size_t index = std::lower_bound(m_starts.begin(), m_starts.end(), region.start) - m_starts.begin();
+  m_starts.insert(m_starts.begin() + index, region.start);
+  m_regions.insert(m_regions.begin() + index, new_region);
+  m_generation++;
+}
+
+void LinuxVMRegionIndex::Unmap(nub_addr_t start, nub_addr_t end) {
+  std::pair<size_t, size_t> range = Carve(start, end);
+  m_starts.erase(m_starts.begin() + range.first, m_starts.begin() + range.second);
+  m_regions.erase(m_regions.begin() + range.first, m_regions.begin() + range.second);
+  // The regions no longer match the text they were parsed from, the next Refresh() must parse whatever it reads.
+  m_maps.clear();
+  m_generation++;
+}
+
+void LinuxVMRegionIndex::Protect(nub_addr_t start, nub_addr_t end, uint32_t permissions) {
+  std::pair<size_t, size_t> range = Carve(start, end);
+  for (size_t i = range.first; i < range.second; i++) m_regions[i].permissions = permissions;
+  m_maps.clear();
+  m_generation++;
+}
+
+static uint32_t PermissionsFromProt(uint64_t prot) {
+  uint32_t permissions = 0;
+  if (prot & PROT_READ) permissions |= eMemoryPermissionsReadable;
+  if (prot & PROT_WRITE) permissions |= eMemoryPermissionsWritable;
+  if (prot & PROT_EXEC) permissions |= eMemoryPermissionsExecutable;
+  return permissions;
+}
+
+bool LinuxVMRegionIndex::IsAddressSpaceSyscall(uint64_t nr) {
+  switch (nr) {
+  case SYS_mmap:
+  case SYS_munmap:
+  case SYS_mprotect:
+  case SYS_pkey_mprotect:
+  case SYS_brk:
+  case SYS_mremap:
+  case SYS_shmat:
+  case SYS_shmdt:
+  case SYS_remap_file_pages:
+  case SYS_execve:
+  case SYS_execveat: return true;
+  default: return false;
+  }
+}
+
+bool LinuxVMRegionIndex::ApplySyscall(nub_process_t pid, uint64_t nr, const uint64_t args[6], uint64_t ret) {
+  if (IsStale(pid)) return false;
+  const uint64_t page_size = ::sysconf(_SC_PAGESIZE);
+  auto page_align = [page_size](uint64_t value) { return (value + page_size - 1) & ~(page_size - 1); };
+
+  switch (nr) {
+  case SYS_mmap: {
+    LinuxVMRegion region{};
+    region.start = ret;
+    region.end = ret + page_align(args[1]);
+    region.permissions = PermissionsFromProt(args[2]);
+    region.shared = (args[3] & MAP_SHARED) != 0;
+    region.kind = LinuxVMRegion::eKindAnonymous;
+    std::string name;
+    if ((args[3] & MAP_ANONYMOUS) == 0) {
+      std::string fd_path = "/proc/" + std::to_string(pid) + "/fd/" + std::to_string(static_cast<int>(args[4]));
+      char path[PATH_MAX];
+      ssize_t length = ::readlink(fd_path.c_str(), path, sizeof(path));
+      struct stat st;
+      if (length <= 0 || ::stat(fd_path.c_str(), &st) != 0) return false;
+      name.assign(path, length);
+      region.kind = LinuxVMRegion::eKindFile;
+      region.offset = args[5];
+      region.inode = st.st_ino;
+      region.dev = (major(st.st_dev) << 20) | minor(st.st_dev);
+    }
+    Map(region, name);
+    return true;
+  }
+  case SYS_munmap: Unmap(args[0], args[0] + page_align(args[1])); return true;
+  case SYS_mprotect:
+  case SYS_pkey_mprotect: Protect(args[0], args[0] + page_align(args[1]), PermissionsFromProt(args[2])); return true;
+  case SYS_brk: {
+    auto heap = std::find_if(m_regions.begin(), m_regions.end(),
+                             [](const LinuxVMRegion &region) { return region.kind == LinuxVMRegion::eKindHeap; });
+    // Without a [heap] region we do not know where the break started.
+    if (heap == m_regions.end()) return false;
+    nub_addr_t new_end = std::max<nub_addr_t>(page_align(ret), heap->start);
+    if (new_end > heap->end) {
+      heap->end = new_end;
+      m_maps.clear();
+      m_generation++;
+    } else if (new_end < heap->end) {
+      Unmap(new_end, heap->end);
+    }
+    return true;
+  }
+  case SYS_mremap: {
+    const LinuxVMRegion *source = FindRegion(args[0]);
+    if (source == NULL) return false;
+    LinuxVMRegion region = *source;
+    std::string name = GetName(region);
+    if (region.kind == LinuxVMRegion::eKindFile) region.offset += args[0] - region.start;
+    const nub_addr_t old_end = args[0] + page_align(args[1]);
+    const nub_size_t new_size = page_align(args[2]);
+    if (ret == args[0]) {
+      if (args[0] + new_size < old_end) {
+        Unmap(args[0] + new_size, old_end);
+      } else if (args[0] + new_size > old_end) {
+        if (region.kind == LinuxVMRegion::eKindFile) region.offset += old_end - args[0];
+        region.start = old_end;
+        region.end = args[0] + new_size;
+        Map(region, name);
+      }
+      return true;
+    }
+    if ((args[3] & MREMAP_DONTUNMAP) == 0) Unmap(args[0], old_end);
+    region.start = ret;
+    region.end = ret + new_size;
+    Map(region, name);
+    return true;
+  }
+  default: return !IsAddressSpaceSyscall(nr);
+  }
+}
+
+const LinuxVMRegion *LinuxVMRegionIndex::FindRegion(nub_addr_t addr) const {
+  auto pos = std::upper_bound(m_starts.begin(), m_starts.end(), addr);
+  if (pos == m_starts.begin()) return NULL;
+  const LinuxVMRegion &region = m_regions[pos - m_starts.begin() - 1];
+  return region.ContainsAddress(addr) ? &region : NULL;
+}
+
+const LinuxVMRegion *LinuxVMRegionIndex::FindNextRegion(nub_addr_t addr) const {
+  auto pos = std::upper_bound(m_starts.begin(), m_starts.end(), addr);
+  if (pos == m_starts.end()) return NULL;
+  return &m_regions[pos - m_starts.begin()];
+}
+
+std::vector<std::string> LinuxVMRegionIndex::GetMemoryTypes(const LinuxVMRegion &region) const {
+  std::vector<std::string> types;
+  switch (region.kind) {
+  case LinuxVMRegion::eKindHeap: types.push_back("heap"); break;
+  case LinuxVMRegion::eKindStack:
+    if (region.permissions == 0) {
+      types.push_back("stack-guard");
+    } else {
+      types.push_back("stack");
+    }
+    break;
+  case LinuxVMRegion::eKindAnonymous: types.push_back("anon"); break;
+  case LinuxVMRegion::eKindFile: types.push_back("file"); break;
+  case LinuxVMRegion::eKindVDSO: types.push_back("vdso"); break;
+  case LinuxVMRegion::eKindVVar: types.push_back("vvar"); break;
+  case LinuxVMRegion::eKindVSyscall: types.push_back("vsyscall"); break;
+  }
+  if (region.shared) types.push_back("shared");
+  return types;
+}
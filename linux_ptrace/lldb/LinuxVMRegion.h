@@ -0,0 +1,80 @@
+#pragma once
+
+#include "DNBDefs.h"
+#include "DNBError.h"
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// One line of /proc/pid/maps. Kept trivially copyable so the index is a flat array; the path lives in the name
+// pool of the index.
+struct LinuxVMRegion {
+  enum Kind : uint8_t { eKindAnonymous, eKindHeap, eKindStack, eKindFile, eKindVDSO, eKindVVar, eKindVSyscall };
+
+  nub_addr_t start;
+  nub_addr_t end;
+  uint64_t offset;
+  uint64_t inode;
+  uint32_t dev;
+  uint32_t permissions; // DNBMemoryPermissions
+  uint32_t name_offset;
+  uint32_t name_length;
+  bool shared;
+  Kind kind;
+
+  nub_size_t GetByteSize() const { return end - start; }
+  bool ContainsAddress(nub_addr_t addr) const { return addr >= start && addr < end; }
+};
+
+// Sorted snapshot of the address space of a process, parsed from /proc/pid/maps. Lookups are a binary search over
+// a dense array of start addresses. The index is only re-read after MarkStale() (the process ran), and only rebuilt
+// when the maps content actually differs from the last parse. In between, ApplySyscall() patches it in place from
+// the address space syscalls the tracee made.
+class LinuxVMRegionIndex {
+public:
+  // Returns true when the index was rebuilt.
+  bool Refresh(nub_process_t pid);
+  void MarkStale() { m_stale = true; }
+  bool IsStale(nub_process_t pid) const { return m_stale || pid != m_pid; }
+  // Bumped whenever the regions change, by a rebuild or by a patch. Consumers that derive data from the address
+  // space (caches, scanners) compare it to know when to start over.
+  uint64_t Generation() const { return m_generation; }
+
+  // Patches the index for a successful mmap/munmap/mprotect/pkey_mprotect/brk/mremap. `args` are the syscall
+  // entry arguments and `ret` its return value. Returns false when the change cannot be modelled, in which case
+  // the caller must fall back to a full resync (MarkStale()).
+  bool ApplySyscall(nub_process_t pid, uint64_t nr, const uint64_t args[6], uint64_t ret);
+  static bool IsAddressSpaceSyscall(uint64_t nr);
+
+  void Map(const LinuxVMRegion &region, const std::string &name);
+  void Unmap(nub_addr_t start, nub_addr_t end);
+  void Protect(nub_addr_t start, nub_addr_t end, uint32_t permissions);
+
+  const LinuxVMRegion *FindRegion(nub_addr_t addr) const;
+  // First region that starts above `addr`, NULL when there is none.
+  const LinuxVMRegion *FindNextRegion(nub_addr_t addr) const;
+  const std::vector<LinuxVMRegion> &Regions() const { return m_regions; }
+  std::string GetName(const LinuxVMRegion &region) const {
+    return std::string(m_names.data() + region.name_offset, region.name_length);
+  }
+  std::vector<std::string> GetMemoryTypes(const LinuxVMRegion &region) const;
+
+  const DNBError &GetError() const { return m_err; }
+
+private:
+  bool Parse();
+  void SplitAt(nub_addr_t addr);
+  // Splits the regions straddling `start` and `end` and returns the index range of the regions inside.
+  std::pair<size_t, size_t> Carve(nub_addr_t start, nub_addr_t end);
+
+  nub_process_t m_pid = INVALID_NUB_PROCESS;
+  bool m_stale = true;
+  uint64_t m_generation = 0;
+  std::string m_maps;               // Text the regions were parsed from, to skip rebuilds; empty once patched
+  std::string m_next_maps;          // Buffer the next read goes into, swapped with m_maps
+  std::vector<nub_addr_t> m_starts; // Start addresses only, what the binary search walks
+  std::vector<LinuxVMRegion> m_regions;
+  std::vector<char> m_names;
+  DNBError m_err;
+};
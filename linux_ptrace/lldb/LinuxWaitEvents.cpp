@@ -0,0 +1,88 @@
+#include "LinuxWaitEvents.h"
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+bool LinuxWaitEvents::Open(pid_t pid) {
+  m_err.Clear();
+  Close();
+  m_pid_fd = static_cast<int>(::syscall(SYS_pidfd_open, pid, 0));
+  if (m_pid_fd < 0 && errno != ENOSYS) {
+    m_err.SetErrorToErrno();
+    return false;
+  }
+  sigset_t sigchld;
+  sigemptyset(&sigchld);
+  sigaddset(&sigchld, SIGCHLD);
+  ::pthread_sigmask(SIG_BLOCK, &sigchld, &m_old_mask);
+  m_signal_fd = ::signalfd(-1, &sigchld, SFD_NONBLOCK | SFD_CLOEXEC);
+  m_epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = m_signal_fd;
+  bool ok = m_signal_fd >= 0 && m_epoll_fd >= 0 && 0 == ::epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_signal_fd, &event);
+  if (ok && m_pid_fd >= 0) {
+    event.data.fd = m_pid_fd;
+    ok = 0 == ::epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_pid_fd, &event);
+  }
+  if (!ok) {
+    m_err.SetErrorToErrno();
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void LinuxWaitEvents::Close() {
+  if (m_epoll_fd >= 0) ::close(m_epoll_fd);
+  if (m_pid_fd >= 0) ::close(m_pid_fd);
+  if (m_signal_fd >= 0) {
+    ::close(m_signal_fd);
+    // What is still pending was for stops already reaped.
+    ::pthread_sigmask(SIG_SETMASK, &m_old_mask, NULL);
+  }
+  m_epoll_fd = m_signal_fd = m_pid_fd = -1;
+  m_exited = false;
+}
+
+pid_t LinuxWaitEvents::Wait(pid_t tid, int *status, Deadline deadline) {
+  m_stats.waits++;
+  for (;;) {
+    const pid_t waited = ::waitpid(tid, status, __WALL | WNOHANG);
+    if (waited > 0 || (waited < 0 && errno != EINTR)) return waited;
+    if (waited < 0) continue;
+    if (!IsOpen()) {
+      errno = EBADF;
+      return -1;
+    }
+    const auto remaining = deadline - std::chrono::steady_clock::now();
+    if (remaining <= std::chrono::steady_clock::duration::zero()) {
+      m_stats.timeouts++;
+      return 0;
+    }
+    // Rounded up: a timeout of 0 would turn the last millisecond into a busy loop.
+    const auto remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count() + 1;
+    struct epoll_event events[2];
+    m_stats.sleeps++;
+    const int count = ::epoll_wait(m_epoll_fd, events, 2, static_cast<int>(remaining_ms));
+    if (count < 0 && errno != EINTR) return -1;
+    for (int i = 0; i < count; i++) {
+      if (events[i].data.fd == m_signal_fd) {
+        // Read only to rearm the wakeup, waitpid() tells what happened.
+        struct signalfd_siginfo info;
+        while (::read(m_signal_fd, &info, sizeof(info)) == sizeof(info)) continue;
+      } else if (events[i].data.fd == m_pid_fd) {
+        // Stays readable from now on, the exit statuses are reaped by waitpid().
+        ::epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, m_pid_fd, NULL);
+        m_exited = true;
+      }
+    }
+  }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "DNBError.h"
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <sys/types.h>
+
+// The tracer's view of its tracee as file descriptors in one epoll set, so every wait for a ptrace stop has a deadline
+// and costs nothing while it blocks: a signalfd for the SIGCHLD that comes with every stop and exit of a traced thread,
+// and a pidfd of the process, readable once the whole process is gone. Wait() is waitpid() that gives up at a
+// deadline; it reaps what is there first and only then sleeps in epoll, so a stop reported in between is not missed
+// (the SIGCHLD stays pending and keeps the signalfd readable).
+//
+// SIGCHLD is blocked in the thread that calls Open() until Close(). Other threads of the debugger must block it too,
+// or the kernel may hand it to one of them and a wait only ends at its deadline. Without pidfd_open (Linux 5.3) the
+// signalfd alone does the job.
+class LinuxWaitEvents {
+public:
+  typedef std::chrono::steady_clock::time_point Deadline;
+
+  struct Statistics {
+    uint64_t waits = 0;    // Wait() calls
+    uint64_t sleeps = 0;   // epoll_wait() calls, one per wakeup
+    uint64_t timeouts = 0; // Waits that reached their deadline
+  };
+
+  LinuxWaitEvents() = default;
+  ~LinuxWaitEvents() { Close(); }
+  LinuxWaitEvents(const LinuxWaitEvents &) = delete;
+  LinuxWaitEvents &operator=(const LinuxWaitEvents &) = delete;
+
+  // Opens the descriptors for the process `pid`; false with the error set when it does not exist or a descriptor
+  // cannot be created.
+  bool Open(pid_t pid);
+  void Close();
+  bool IsOpen() const { return m_epoll_fd >= 0; }
+  // The pidfd of the process, -1 without pidfd support; signals sent through it cannot hit a recycled pid.
+  int PidFd() const { return m_pid_fd; }
+  // Whether the pidfd reported that the process is gone.
+  bool ProcessExited() const { return m_exited; }
+
+  // waitpid(`tid`, `status`, __WALL) for a traced thread, or any with -1, until `deadline`. Returns the thread, 0 when
+  // the deadline passed first, or -1 with errno set (ECHILD when nothing is traced any more).
+  pid_t Wait(pid_t tid, int *status, Deadline deadline);
+
+  static Deadline After(int timeout_ms) {
+    return std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  }
+
+  const Statistics &GetStatistics() const { return m_stats; }
+  const DNBError &GetError() const { return m_err; }
+
+private:
+  int m_epoll_fd = -1;
+  int m_signal_fd = -1;
+  int m_pid_fd = -1;
+  bool m_exited = false;
+  sigset_t m_old_mask;
+  Statistics m_stats;
+  DNBError m_err;
+};
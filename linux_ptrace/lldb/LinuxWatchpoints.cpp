@@ -0,0 +1,186 @@
+#include "LinuxWatchpoints.h"
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <sys/ptrace.h>
+#include <sys/user.h>
+
+static constexpr int kStatusRegister = 6;
+static constexpr int kControlRegister = 7;
+
+static bool PokeDebugRegister(pid_t tid, int index, uint64_t value) {
+  errno = 0;
+  return ::ptrace(PTRACE_POKEUSER, tid, offsetof(struct user, u_debugreg) + index * sizeof(long), value) == 0;
+}
+
+// DR7 LEN encoding of a slot length.
+static uint64_t LengthBits(uint8_t length) {
+  switch (length) {
+  case 1: return 0;
+  case 2: return 1;
+  case 8: return 2;
+  default: return 3;
+  }
+}
+
+uint64_t LinuxWatchpoints::ControlValue() const {
+  uint64_t control = 0;
+  for (uint32_t i = 0; i < kSlotCount; i++) {
+    const Slot &slot = m_slots[i];
+    if (slot.length == 0) continue;
+    control |= 1ull << (2 * i); // Local enable
+    control |= static_cast<uint64_t>(slot.rw) << (16 + 4 * i);
+    control |= LengthBits(slot.length) << (18 + 4 * i);
+  }
+  return control;
+}
+
+uint32_t LinuxWatchpoints::FreeSlots() const {
+  uint32_t free_slots = 0;
+  for (const Slot &slot : m_slots) free_slots += slot.length == 0;
+  return free_slots;
+}
+
+const LinuxWatchpoints::Watchpoint *LinuxWatchpoints::Find(nub_watch_t watch_id) const {
+  auto pos = m_watchpoints.find(watch_id);
+  return pos != m_watchpoints.end() ? &pos->second : NULL;
+}
+
+bool LinuxWatchpoints::Program(pid_t tid) {
+  const uint64_t control = ControlValue();
+  // The kernel validates each address against the control value in effect, so disable everything first.
+  bool ok = PokeDebugRegister(tid, kControlRegister, 0);
+  for (uint32_t i = 0; ok && i < kSlotCount; i++) {
+    if (m_slots[i].length != 0) ok = PokeDebugRegister(tid, i, m_slots[i].addr);
+  }
+  if (ok && control != 0) ok = PokeDebugRegister(tid, kControlRegister, control);
+  if (!ok) {
+    // A thread that exited meanwhile is reported by the process, it has nothing left to program.
+    if (errno == ESRCH) return true;
+    m_err.SetErrorToErrno();
+    return false;
+  }
+  m_thread_versions[tid] = m_version;
+  return true;
+}
+
+bool LinuxWatchpoints::ProgramAll(const std::vector<pid_t> &threads) {
+  for (pid_t tid : threads) {
+    if (!Program(tid)) return false;
+  }
+  return true;
+}
+
+bool LinuxWatchpoints::Sync(pid_t tid) {
+  auto pos = m_thread_versions.find(tid);
+  if (pos != m_thread_versions.end() && pos->second == m_version) return true;
+  // A new thread starts with clear debug registers, which is all it needs while nothing is watched.
+  if (pos == m_thread_versions.end() && ControlValue() == 0) {
+    m_thread_versions[tid] = m_version;
+    return true;
+  }
+  return Program(tid);
+}
+
+void LinuxWatchpoints::Release(nub_watch_t watch_id) {
+  for (Slot &slot : m_slots) {
+    if (slot.owner == watch_id) slot = Slot{};
+  }
+  m_watchpoints.erase(watch_id);
+  m_version++;
+}
+
+nub_watch_t LinuxWatchpoints::Enable(const std::vector<pid_t> &threads, nub_addr_t addr, nub_size_t size,
+                                     uint32_t watch_type) {
+  m_err.Clear();
+  if (size == 0 || addr + size < addr || (watch_type & (WATCH_TYPE_READ | WATCH_TYPE_WRITE)) == 0) {
+    m_err.SetError(EINVAL, DNBError::POSIX);
+    return INVALID_NUB_WATCH_ID;
+  }
+  // Each slot covers an aligned 1, 2, 4 or 8 bytes: take the largest one that starts here and fits.
+  std::vector<std::pair<nub_addr_t, uint8_t>> pieces;
+  for (nub_addr_t piece = addr; piece < addr + size && pieces.size() <= kSlotCount;) {
+    uint8_t length = 8;
+    while (length > 1 && (piece % length != 0 || length > addr + size - piece)) length /= 2;
+    pieces.emplace_back(piece, length);
+    piece += length;
+  }
+  if (pieces.size() > FreeSlots()) {
+    m_err.SetError(ENOSPC, DNBError::POSIX);
+    return INVALID_NUB_WATCH_ID;
+  }
+
+  const nub_watch_t watch_id = m_next_id++;
+  Watchpoint watchpoint = {addr, size, watch_type, 0};
+  const uint8_t rw = (watch_type & WATCH_TYPE_READ) ? 3 : 1;
+  uint32_t slot_index = 0;
+  for (const auto &piece : pieces) {
+    while (m_slots[slot_index].length != 0) slot_index++;
+    m_slots[slot_index] = {piece.first, piece.second, rw, watch_id};
+    watchpoint.slots |= 1u << slot_index;
+  }
+  m_watchpoints[watch_id] = watchpoint;
+  m_version++;
+  if (!ProgramAll(threads)) {
+    // Take the slots back out of the threads that did take them.
+    DNBError err = m_err;
+    Release(watch_id);
+    ProgramAll(threads);
+    m_err = err;
+    return INVALID_NUB_WATCH_ID;
+  }
+  return watch_id;
+}
+
+bool LinuxWatchpoints::Disable(const std::vector<pid_t> &threads, nub_watch_t watch_id) {
+  m_err.Clear();
+  if (m_watchpoints.count(watch_id) == 0) {
+    m_err.SetError(ENOENT, DNBError::POSIX);
+    return false;
+  }
+  Release(watch_id);
+  return ProgramAll(threads);
+}
+
+bool LinuxWatchpoints::DisableAll(const std::vector<pid_t> &threads) {
+  m_err.Clear();
+  if (m_watchpoints.empty()) return true;
+  for (Slot &slot : m_slots) slot = Slot{};
+  m_watchpoints.clear();
+  m_version++;
+  bool ok = ProgramAll(threads);
+  m_thread_versions.clear();
+  return ok;
+}
+
+bool LinuxWatchpoints::GetStopInfo(pid_t tid, DNBThreadStopInfo *stop_info) {
+  errno = 0;
+  const long status = ::ptrace(PTRACE_PEEKUSER, tid, offsetof(struct user, u_debugreg) + kStatusRegister * sizeof(long),
+                               0);
+  if (errno != 0 || (status & 0xf) == 0) return false;
+  // DR6 is sticky, clear it so the next trap is not taken for this one.
+  PokeDebugRegister(tid, kStatusRegister, 0);
+  uint32_t fired = 0;
+  for (uint32_t i = 0; i < kSlotCount; i++) {
+    if ((status & (1 << i)) && m_slots[i].length != 0) fired |= 1u << i;
+  }
+  if (fired == 0) return false;
+
+  const uint32_t slot_index = __builtin_ctz(fired);
+  const nub_watch_t watch_id = m_slots[slot_index].owner;
+  const Watchpoint &watchpoint = m_watchpoints[watch_id];
+  ::memset(stop_info, 0, sizeof(*stop_info));
+  stop_info->reason = eStopTypeException;
+  ::snprintf(stop_info->description, sizeof(stop_info->description), "watchpoint %u: %s 0x%llx, %zu bytes",
+             watch_id, (watchpoint.watch_type & WATCH_TYPE_READ) ? "read or write of" : "write to",
+             static_cast<unsigned long long>(watchpoint.addr), static_cast<size_t>(watchpoint.size));
+  stop_info->details.exception.type = SIGTRAP;
+  stop_info->details.exception.data_count = 4;
+  stop_info->details.exception.data[0] = TRAP_HWBKPT;
+  stop_info->details.exception.data[1] = watchpoint.addr;
+  stop_info->details.exception.data[2] = slot_index;
+  stop_info->details.exception.data[3] = watch_id;
+  return true;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "DNBDefs.h"
+#include "DNBError.h"
+#include <cstdint>
+#include <map>
+#include <sys/types.h>
+#include <vector>
+
+// Hardware watchpoints on the x86 debug registers, programmed into every traced thread with PTRACE_POKEUSER. The
+// four address registers DR0-DR3 each cover 1, 2, 4 or 8 naturally aligned bytes; a watched range is split into as
+// few such slots as its alignment allows and is refused when not enough of them are free. The thread traps right
+// after the access, so the process runs at full speed until then.
+//
+// Debug registers belong to a thread and are not inherited by clone children: Sync() programs a thread that has
+// not seen the current slots yet, the process calls it for every thread it picks up.
+class LinuxWatchpoints {
+public:
+  static constexpr uint32_t kSlotCount = 4;
+
+  struct Watchpoint {
+    nub_addr_t addr;
+    nub_size_t size;
+    uint32_t watch_type; // WATCH_TYPE_READ and/or WATCH_TYPE_WRITE
+    uint32_t slots;      // Bit i set when DRi covers part of the range
+  };
+
+  // Watches [addr, addr + size) in every thread of `threads`, which must be stopped. x86 cannot trap on reads only,
+  // WATCH_TYPE_READ watches reads and writes. Returns INVALID_NUB_WATCH_ID and sets the error when the range needs
+  // more slots than are free or a thread refuses it.
+  nub_watch_t Enable(const std::vector<pid_t> &threads, nub_addr_t addr, nub_size_t size, uint32_t watch_type);
+  bool Disable(const std::vector<pid_t> &threads, nub_watch_t watch_id);
+  // Clears the debug registers of every thread, which must happen before detaching: a trap nobody waits for kills
+  // the process.
+  bool DisableAll(const std::vector<pid_t> &threads);
+  const Watchpoint *Find(nub_watch_t watch_id) const;
+  uint32_t FreeSlots() const;
+
+  // Programs the current slots into the stopped thread `tid` unless it has them already.
+  bool Sync(pid_t tid);
+  void ThreadExited(pid_t tid) { m_thread_versions.erase(tid); }
+  // For a SIGTRAP of the stopped thread `tid`: reads and clears its DR6, and when one of our slots fired, describes
+  // the hit in `stop_info` and returns true. The exception type is SIGTRAP, its data are TRAP_HWBKPT, the start of
+  // the watched range, the slot that fired and the watchpoint ID.
+  bool GetStopInfo(pid_t tid, DNBThreadStopInfo *stop_info);
+
+  const DNBError &GetError() const { return m_err; }
+
+private:
+  struct Slot {
+    nub_addr_t addr;
+    uint8_t length;      // 0 when the slot is free
+    uint8_t rw;          // DR7 R/W field: 1 for writes, 3 for reads and writes
+    nub_watch_t owner;
+  };
+
+  uint64_t ControlValue() const;
+  bool Program(pid_t tid);
+  bool ProgramAll(const std::vector<pid_t> &threads);
+  void Release(nub_watch_t watch_id);
+
+  Slot m_slots[kSlotCount] = {};
+  std::map<nub_watch_t, Watchpoint> m_watchpoints;
+  nub_watch_t m_next_id = 1;
+  uint64_t m_version = 0;                      // Bumped whenever the slots change
+  std::map<pid_t, uint64_t> m_thread_versions; // The version each thread was last programmed with
+  DNBError m_err;
+};
@@ -0,0 +1,300 @@
+#include "lldb/DNBDefs.h"
+#include "lldb/LinuxProcess.h"
+#include "lldb/LinuxMemoryScanner.h"
+#include "lldb/LinuxPointerIndex.h"
+#include "lldb/LinuxResetPoint.h"
+#include "lldb/LinuxScanSession.h"
+#include "lldb/LinuxSnapshot.h"
+#include "logger.hpp"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+class DebuggerController {
+public:
+  explicit DebuggerController(pid_t pid) : m_pid(pid) {}
+
+  ~DebuggerController() {}
+
+  void attach() {
+    m_processSP = std::make_shared<LinuxProcess>();
+    auto start = std::chrono::steady_clock::now();
+    m_processSP->Attach(m_pid);
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    m_snapshots = std::make_unique<LinuxSnapshotStore>(m_processSP->VMMemory());
+    Logger::logInfo("attach process pid", m_pid, "stopped after us", elapsed.count());
+  }
+  void detach() {
+    m_processSP->Detach();
+    Logger::logInfo("detach process pid", m_pid);
+  }
+
+  void resume() {
+    m_processSP->Resume();
+    Logger::logInfo("resume process pid", m_pid);
+  }
+  void stop() {
+    m_processSP->Stop();
+    Logger::logInfo("stop process pid", m_pid);
+  }
+  // Lets the resumed process run for `timeout_ms`, servicing its tracing events.
+  void run_for(int timeout_ms) { m_processSP->ProcessEvents(timeout_ms); }
+  void single_step() {
+    m_processSP->SingleStep();
+    Logger::logInfo("single step pid", m_pid);
+  }
+
+  std::vector<uint8_t> read_memory(uint64_t addr, uint64_t size) {
+    std::vector<uint8_t> memory_data(size);
+    m_processSP->ReadMemory(addr, size, memory_data.data());
+    return memory_data;
+  }
+  // Valid until the next resume/single_step/detach, see LinuxMemoryView.
+  LinuxMemoryView read_memory_view(uint64_t addr, uint64_t size) { return m_processSP->ReadMemoryView(addr, size); }
+  bool read_int(uint64_t addr, int *value) { return read_memory_view(addr, sizeof(int)).as(value); }
+  void log_int(uint64_t addr) {
+    int value = 0;
+    if (read_int(addr, &value)) {
+      Logger::logDebug(value);
+    } else {
+      Logger::logError("cannot read int at", addr);
+    }
+  }
+  void write_memory(uint64_t addr, uint8_t const *data, uint64_t size) { m_processSP->WriteMemory(addr, size, data); }
+
+  std::vector<uint64_t> read_pc() {
+    std::vector<user_regs_struct> regs = m_processSP->ReadRegister();
+    std::vector<uint64_t> pcs(regs.size());
+    std::transform(regs.begin(), regs.end(), pcs.begin(), [](user_regs_struct const &it) { return it.rip; });
+    return pcs;
+  }
+
+  // Watches `addr` with a hardware watchpoint and lets the process run until it writes there.
+  void run_until_written(uint64_t addr, int timeout_ms) {
+    nub_watch_t watch_id = m_processSP->EnableWatchpoint(addr, sizeof(int), WATCH_TYPE_WRITE);
+    if (watch_id == INVALID_NUB_WATCH_ID) {
+      Logger::logError("watchpoint failed", m_processSP->Watchpoints().GetError().AsString());
+      return;
+    }
+    m_processSP->Resume();
+    if (m_processSP->ProcessEvents(timeout_ms) == LinuxProcess::RUNNING) {
+      Logger::logInfo("watchpoint not hit");
+      m_processSP->Stop();
+    }
+    for (pid_t tid : m_processSP->Threads()) {
+      DNBThreadStopInfo stop_info;
+      if (m_processSP->GetThreadStopInfo(tid, &stop_info)) { Logger::logInfo("thread", tid, stop_info.description); }
+    }
+    m_processSP->DisableWatchpoint(watch_id);
+  }
+
+  // Plants a breakpoint at `addr` and lets the process run until a thread hits it.
+  void run_until_breakpoint(uint64_t addr, int hits, int timeout_ms) {
+    nub_break_t break_id = m_processSP->SetBreakpoint(addr);
+    if (break_id == INVALID_NUB_BREAK_ID) {
+      Logger::logError("breakpoint failed", m_processSP->Breakpoints().GetError().AsString());
+      return;
+    }
+    for (int hit = 0; hit < hits; hit++) {
+      // The thread sitting on the breakpoint leaves it through a displaced copy of the instruction.
+      m_processSP->Resume();
+      if (m_processSP->ProcessEvents(timeout_ms) == LinuxProcess::RUNNING) {
+        Logger::logInfo("breakpoint not hit");
+        m_processSP->Stop();
+        break;
+      }
+      for (pid_t tid : m_processSP->Threads()) {
+        DNBThreadStopInfo stop_info;
+        if (m_processSP->GetThreadStopInfo(tid, &stop_info)) { Logger::logInfo("thread", tid, stop_info.description); }
+      }
+    }
+    // The trap is not visible to readers, the pc already points back at the breakpoint.
+    Logger::logInfo("pc register:", read_pc(), "code", read_memory(addr, 4));
+    LinuxDisplacedStepping::Statistics const &stats = m_processSP->DisplacedStepping().GetStatistics();
+    Logger::logInfo("displaced steps", stats.displaced, "emulated", stats.emulated, "refused", stats.refused,
+                    "slots", stats.slots);
+    m_processSP->RemoveBreakpoints({break_id});
+  }
+
+  void track_address_space(bool enabled) { m_processSP->SetAddressSpaceTracking(enabled); }
+  void log_address_space_generation() {
+    Logger::logInfo("address space generation", m_processSP->AddressSpaceGeneration());
+  }
+
+  void log_region_info(uint64_t addr) {
+    DNBRegionInfo region_info;
+    m_processSP->GetMemoryRegionInfo(addr, &region_info);
+    Logger::logInfo("region", region_info.addr, "size", region_info.size, "dirty pages",
+                    region_info.dirty_pages.size());
+  }
+
+  // Snapshots the stopped process and logs what changed since the previous snapshot.
+  void take_snapshot() {
+    size_t snapshot = m_snapshots->Take(m_pid);
+    LinuxSnapshotStore::Statistics const &stats = m_snapshots->GetStatistics();
+    Logger::logInfo("snapshot", snapshot, "live pages", stats.pages_live, "stored pages", stats.pages_stored);
+    if (snapshot > 0) { Logger::logInfo("changed ranges", m_snapshots->Diff(snapshot - 1, snapshot).size()); }
+  }
+
+  // Makes the current stop the point reset() returns the process to.
+  void record_reset_point() {
+    m_reset_point = std::make_unique<LinuxResetPoint>(*m_processSP);
+    if (!m_reset_point->Record()) {
+      Logger::logError("record reset point failed", m_reset_point->GetError().AsString());
+    }
+  }
+  bool reset() {
+    if (m_reset_point->Reset()) return true;
+    Logger::logError("reset failed", m_reset_point->GetError().AsString());
+    return false;
+  }
+  // Replays `runs` runs of `run_ms` each from the reset point and reports how fast the process is put back.
+  void benchmark_reset(int runs, int run_ms) {
+    m_reset_point->ResetStatistics();
+    for (int i = 0; i < runs; i++) {
+      m_processSP->Resume();
+      run_for(run_ms);
+      m_processSP->Stop();
+      if (!reset()) return;
+    }
+    LinuxResetPoint::Statistics const &stats = m_reset_point->GetStatistics();
+    Logger::logInfo("resets", stats.resets, "resets/sec", m_reset_point->ResetsPerSecond(), "pages compared",
+                    stats.pages_compared, "pages restored", stats.pages_restored, "soft dirty",
+                    m_reset_point->UsesSoftDirty());
+  }
+
+  // Scans the stopped process for the int currently stored at `addr` and logs how many addresses hold it.
+  void scan_for_value(uint64_t addr) {
+    LinuxMemoryScanner scanner(m_processSP->VMMemory());
+    std::vector<nub_addr_t> hits;
+    int value = 0;
+    if (!read_int(addr, &value)) {
+      Logger::logError("cannot read int at", addr);
+      return;
+    }
+    if (!scanner.Scan(m_pid, LinuxScanQuery::Integer(value, sizeof(int)), hits)) {
+      Logger::logError("scan failed", scanner.GetError().AsString());
+      return;
+    }
+    LinuxMemoryScanner::Statistics const &stats = scanner.GetStatistics();
+    Logger::logInfo("scan hits", stats.hits, "found addr", std::binary_search(hits.begin(), hits.end(), addr),
+                    "bytes scanned", stats.bytes_scanned, "GB/s", stats.bytes_scanned / double(stats.elapsed_ns),
+                    "kernel", LinuxMemoryScanner::KernelName());
+  }
+
+  // Pins down the counter at `addr` without knowing where it is: scans for its current value, then keeps the
+  // candidates that increased over each of `runs` runs of `run_ms`.
+  void narrow_to_counter(uint64_t addr, int runs, int run_ms) {
+    LinuxScanSession session(m_processSP->VMMemory());
+    session.SetPermissions(eMemoryPermissionsReadable | eMemoryPermissionsWritable);
+    int value = 0;
+    if (!read_int(addr, &value)) {
+      Logger::logError("cannot read int at", addr);
+      return;
+    }
+    if (!session.Start(m_pid, LinuxScanQuery::Integer(value, sizeof(int)))) {
+      Logger::logError("scan session failed", session.GetError().AsString());
+      return;
+    }
+    Logger::logInfo("candidates", session.CandidateCount());
+    for (int i = 0; i < runs && session.CandidateCount() > 1; i++) {
+      m_processSP->Resume();
+      run_for(run_ms);
+      m_processSP->Stop();
+      if (!session.Refine(m_pid, LinuxScanSession::eCompareIncreased)) {
+        Logger::logError("refine failed", session.GetError().AsString());
+        return;
+      }
+      LinuxScanSession::Statistics const &stats = session.GetStatistics();
+      Logger::logInfo("candidates", stats.candidates, "pages", stats.pages, "memory bytes", stats.memory_bytes,
+                      "pass ms", stats.last_pass_ns / 1e6);
+    }
+    Logger::logInfo("counter found", session.Contains(addr));
+  }
+
+  // Indexes every pointer of the stopped process and logs who points at `addr` and into its region.
+  void find_references(uint64_t addr) {
+    LinuxPointerIndex index(m_processSP->VMMemory());
+    if (!index.Build(m_pid)) {
+      Logger::logError("pointer index failed", index.GetError().AsString());
+      return;
+    }
+    LinuxPointerIndex::Statistics const &stats = index.GetStatistics();
+    std::vector<LinuxPointerIndex::Reference> references;
+    index.FindReferencesToRegion(addr, references);
+    Logger::logInfo("pointers", stats.references, "bytes scanned", stats.bytes_scanned, "build ms",
+                    (stats.scan_ns + stats.sort_ns) / 1e6, "to addr", index.CountReferences(addr, addr + sizeof(int)),
+                    "into its region", references.size());
+  }
+
+  void log_page_cache_statistics() {
+    LinuxPageCache::Statistics const &stats = m_processSP->PageCache().GetStatistics();
+    Logger::logInfo("page cache hits", stats.hits, "misses", stats.misses, "prefetched", stats.prefetched,
+                    "fetches", stats.fetches, "flushes", stats.flushes);
+  }
+
+  void log_file_pages_statistics() {
+    LinuxFilePages::Statistics const &stats = m_processSP->FilePages().GetStatistics();
+    Logger::logInfo("file pages bytes served", stats.bytes_served, "pages resolved", stats.pages_resolved,
+                    "refused", stats.pages_refused, "files mapped", stats.files_mapped);
+  }
+
+private:
+  pid_t m_pid;
+  std::shared_ptr<LinuxProcess> m_processSP = nullptr;
+  std::unique_ptr<LinuxSnapshotStore> m_snapshots = nullptr;
+  std::unique_ptr<LinuxResetPoint> m_reset_point = nullptr;
+};
+
+int main(int argc, const char *argv[]) {
+  assert((argc == 3) && "argument count error");
+  pid_t pid = std::atoi(argv[1]);
+  // address of `i` printed by target.cpp
+  uint64_t addr = std::strtoull(argv[2], nullptr, 0);
+  DebuggerController controller{pid};
+  controller.attach();
+  auto data = controller.read_memory(addr, sizeof(int));
+  Logger::logDebug(data);
+  std::fill(data.begin(), data.end(), 0);
+  controller.write_memory(addr, data.data(), data.size());
+  controller.run_until_written(addr, 3000);
+  Logger::logDebug(controller.read_memory(addr, sizeof(int)));
+  controller.track_address_space(true);
+  for (int i = 0; i < 3; i++) {
+    controller.resume();
+    controller.run_for(2000);
+    controller.stop();
+    controller.log_int(addr);
+    controller.log_address_space_generation();
+    controller.log_region_info(addr);
+    controller.take_snapshot();
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+  }
+  controller.record_reset_point();
+  controller.log_int(addr);
+  controller.benchmark_reset(5, 1100);
+  controller.log_int(addr);
+  controller.scan_for_value(addr);
+  controller.narrow_to_counter(addr, 3, 1100);
+  controller.find_references(addr);
+  for (int i = 0; i < 100; i++) {
+    controller.single_step();
+    auto pcs = controller.read_pc();
+    Logger::logInfo("pc register:", pcs);
+    // The instruction bytes at pc come from the mapped executable or library, not from the process.
+    controller.read_memory(pcs[0], 16);
+  }
+  // Whatever the main thread runs now it will likely run again on its next loop iteration.
+  controller.run_until_breakpoint(controller.read_pc()[0], 3, 3000);
+  controller.log_page_cache_statistics();
+  controller.log_file_pages_statistics();
+  controller.resume();
+  controller.detach();
+}
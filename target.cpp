@@ -1,4 +1,4 @@
-#include <_types/_uint64_t.h>
+#include <cstdint>
 #include <chrono>
 #include <iostream>
 #include <thread>